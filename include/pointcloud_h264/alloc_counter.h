@@ -0,0 +1,25 @@
+#ifndef ALLOC_COUNTER_H_
+#define ALLOC_COUNTER_H_
+
+#include <cstddef>
+
+/**
+ * Heap allocation counters, used to check that the steady-state encoding loop does not
+ * allocate (~alloc_check).
+ *
+ * alloc_counter.cpp replaces the global operator new / delete of the program it is linked
+ * into: only link it into executables (the node), never into a library. The nodelet library
+ * has the fallbacks of alloc_counter_fallback.cpp instead (nothing counted), overridden when
+ * the executable exports its symbols (ENABLE_EXPORTS).
+ */
+
+// Allocations made by the calling thread since it started
+std::size_t get_thread_allocations();
+
+// Allocations made by all threads
+std::size_t get_total_allocations();
+
+// false when the counters are the fallbacks
+bool allocations_counted();
+
+#endif
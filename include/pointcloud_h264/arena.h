@@ -0,0 +1,134 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <type_traits>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Bump allocator for the temporaries of one frame (predictors, CAVLC strings, Bitstream
+ * fragments), so that they do not go through malloc / free.
+ *
+ * Memory is taken from a chain of blocks that is kept across frames: deallocation does
+ * nothing and reset() only rewinds to the first block. After the first frames the chain
+ * reaches the high-water mark of a frame and no block is allocated anymore.
+ *
+ * Not thread-safe: one arena per encoding thread (pipeline stage).
+ */
+class FrameArena {
+public:
+  FrameArena(const std::size_t = 256 * 1024);
+  FrameArena(const FrameArena&) = delete;
+  FrameArena& operator=(const FrameArena&) = delete;
+
+  void* allocate(const std::size_t, const std::size_t);
+
+  // Everything allocated since the last reset becomes invalid
+  void reset() { current = 0; offset = 0; used = 0; }
+
+  std::size_t get_used() const { return used; }           // bytes allocated since the last reset
+  std::size_t get_capacity() const { return capacity; }   // bytes held by the chain
+  std::size_t get_high_water() const { return high_water; }
+
+  // Arena of the innermost ArenaScope of the calling thread, nullptr outside of any scope
+  static FrameArena* current_arena();
+
+private:
+  struct Block {
+    std::unique_ptr<std::uint8_t[]> data;
+    std::size_t size;
+  };
+
+  std::vector<Block> blocks;
+  std::size_t block_size;
+  std::size_t current;    // block being filled
+  std::size_t offset;     // first free byte in blocks[current]
+  std::size_t used;
+  std::size_t capacity;
+  std::size_t high_water;
+
+  friend class ArenaScope;
+  friend class HeapScope;
+  static thread_local FrameArena* thread_arena;
+};
+
+/**
+ * Makes 'arena' the allocator of the containers created by the calling thread (through
+ * ArenaAllocator) until the scope ends. Scopes nest, the previous arena is restored.
+ *
+ * Objects created inside a scope, and their copies, must not outlive the next reset() of its
+ * arena; objects created outside keep using the heap, even when they are assigned, appended
+ * to or copied inside.
+ */
+class ArenaScope {
+public:
+  ArenaScope(FrameArena& arena) : previous(FrameArena::thread_arena) { FrameArena::thread_arena = &arena; }
+  ~ArenaScope() { FrameArena::thread_arena = previous; }
+  ArenaScope(const ArenaScope&) = delete;
+  ArenaScope& operator=(const ArenaScope&) = delete;
+
+private:
+  FrameArena* previous;
+};
+
+/**
+ * Makes the heap the allocator of the containers created by the calling thread until the
+ * scope ends, inside an ArenaScope: for the objects that outlive the frame (a recycled Frame).
+ */
+class HeapScope {
+public:
+  HeapScope() : previous(FrameArena::thread_arena) { FrameArena::thread_arena = nullptr; }
+  ~HeapScope() { FrameArena::thread_arena = previous; }
+  HeapScope(const HeapScope&) = delete;
+  HeapScope& operator=(const HeapScope&) = delete;
+
+private:
+  FrameArena* previous;
+};
+
+/**
+ * Allocator drawing from the arena of the thread's current ArenaScope when the container is
+ * created, from the heap otherwise. A copy keeps the allocator of its source (a copy of a
+ * heap MB stays on the heap, whichever scope makes it), and the arena is never transferred
+ * by assignment, so a long-lived container never points into a frame arena.
+ */
+template <typename T>
+class ArenaAllocator {
+public:
+  typedef T value_type;
+  typedef std::false_type propagate_on_container_copy_assignment;
+  typedef std::false_type propagate_on_container_move_assignment;
+  typedef std::false_type propagate_on_container_swap;
+
+  ArenaAllocator() : arena(FrameArena::current_arena()) {}
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+  T* allocate(const std::size_t n) {
+    if (arena)
+      return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+    return std::allocator<T>().allocate(n);
+  }
+
+  void deallocate(T* p, const std::size_t n) {
+    if (!arena)
+      std::allocator<T>().deallocate(p, n);
+  }
+
+  ArenaAllocator select_on_container_copy_construction() const { return *this; }
+
+  FrameArena* arena;
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena == b.arena; }
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena != b.arena; }
+
+// String of the CAVLC code words being built
+typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>> ArenaString;
+
+#endif
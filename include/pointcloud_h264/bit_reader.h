@@ -0,0 +1,74 @@
+#ifndef BIT_READER_H_
+#define BIT_READER_H_
+
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Reads a Raw Byte Sequence Payload (emulation prevention bytes already removed)
+ * MSb first, as written by the Bitstream class.
+ *
+ * The next 64 bits of the payload are kept in a cache word, so peeking up to 32 bits
+ * never touches memory. Bits past the end of the payload read as zero.
+ */
+class BitReader {
+public:
+  BitReader(const std::uint8_t*, std::size_t);
+
+  // Returns the next n bits (1..32) without consuming them
+  inline std::uint32_t peek(const int n) const {
+    return static_cast<std::uint32_t>(cache >> (64 - n));
+  }
+
+  // Consumes n bits (0..32)
+  inline void skip(const int n) {
+    cache <<= n;
+    cache_bits -= n;
+    bit_pos += n;
+    if (cache_bits < 32)
+      refill();
+  }
+
+  inline std::uint32_t read(const int n) {
+    if (n == 0)
+      return 0;
+    std::uint32_t value = peek(n);
+    skip(n);
+    return value;
+  }
+
+  inline bool read_flag() {
+    bool flag = (cache >> 63) != 0;
+    skip(1);
+    return flag;
+  }
+
+  // Number of leading zero bits before the next one (up to 32)
+  inline int leading_zeros() const {
+    std::uint32_t word = peek(32);
+    return (word == 0) ? 32 : __builtin_clz(word);
+  }
+
+  std::uint32_t read_ue();
+  std::int32_t read_se();
+
+  bool byte_aligned() const { return (bit_pos & 7) == 0; }
+  void align();
+  std::size_t position() const { return bit_pos; }
+  std::size_t bits_left() const;
+  bool more_rbsp_data() const;
+  bool overrun() const { return bit_pos > size * 8; }
+
+private:
+  const std::uint8_t* data;
+  std::size_t size;         // payload size in bytes
+  std::size_t byte_pos;     // next byte to be loaded in the cache
+  std::size_t bit_pos;      // number of bits consumed
+  std::size_t last_one_pos; // position of the rbsp_stop_one_bit
+  std::uint64_t cache;      // next bits of the payload, MSb aligned
+  int cache_bits;           // number of valid bits in the cache
+
+  void refill();
+};
+
+#endif
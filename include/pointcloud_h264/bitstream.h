@@ -7,16 +7,22 @@
 #include <string>
 #include <bitset>
 
+#include "arena.h"
+
 class Bitstream {
 public:
+  // Drawn from the frame arena when the Bitstream is created inside an ArenaScope
+  typedef std::vector<std::uint8_t, ArenaAllocator<std::uint8_t>> Buffer;
+
   int nb_bits;    // total number of bits in the stream
-  std::vector<std::uint8_t> buffer;   // store bits as unsigned chars in a vector
+  Buffer buffer;  // store bits as unsigned chars in a vector
 
   Bitstream();
   Bitstream(const bool&);
   Bitstream(std::uint8_t[], int);
   Bitstream(const Bitstream&);
   Bitstream(const std::string&);
+  Bitstream(const ArenaString&);
   Bitstream(const std::uint8_t, int);
   Bitstream(const unsigned int, int);
 
@@ -26,9 +32,13 @@ public:
   bool byte_align();
   Bitstream rbsp_trailing_bits();
   Bitstream rbsp_to_ebsp();
+  void rbsp_to_ebsp(std::vector<std::uint8_t>&) const;
 
   // for testing
   std::string to_string();
+
+private:
+  void from_chars(const char*, const std::size_t);
 };
 
 #endif // BITSTREAM
@@ -2,38 +2,42 @@
 #define BLOCK_H_
 
 #include <array>
-#include <functional>
 
 #define PIXELS_PER_BLOCK 8*8
 
-// std::reference_wrapper is a class template that wraps a reference in a copyable, assignable object. 
-// It is frequently used as a mechanism to store references inside standard containers (like std::vector) which cannot normally hold references. 
-
-class Block2x2 {
-private:
-  std::array<std::reference_wrapper<int>, 4> data;
-
+/**
+ * View of a W x H block of samples or coefficients inside a MB component: pointer to the first
+ * element, distance between two rows (stride) and between two columns (STEP, e.g. 4 to pick
+ * the DC coefficients of the 4x4 blocks).
+ *
+ * The dimensions are compile-time constants so the loops over a view are unrolled, and the
+ * elements are accessed directly (no per-element reference as with std::reference_wrapper).
+ * A view is two words: pass it by value, it refers to the MB it was taken from.
+ */
+template <int W, int H, typename T = int, int STEP = 1>
+class BlockView {
 public:
-  Block2x2(int& e1, int& e2, int &e3, int &e4) : data{{e1, e2, e3, e4}} {}
+  static const int width = W;
+  static const int height = H;
+  static const int size = W * H;
 
-  int& operator[](int index) { return data[index].get(); }
-  decltype(std::begin(data)) begin() { return std::begin(data); }
-  decltype(std::end(data)) end() { return std::end(data); }
-};
+  BlockView(T* _data, const int _stride) : data(_data), stride(_stride) {}
 
-class Block4x4 {
-private:
-  std::array<std::reference_wrapper<int>, 16> data;
+  T& operator()(const int y, const int x) const { return data[y * stride + x * STEP]; }
+  // Raster order index (y * W + x)
+  T& operator[](const int index) const { return (*this)(index / W, index % W); }
 
-public:
-  Block4x4(int& e1, int& e2, int &e3, int &e4, int &e5, int &e6, int &e7, int &e8, int &e9, int &e10, int &e11, int &e12, int &e13, int &e14, int &e15, int &e16) 
-          : data{{e1, e2, e3, e4, e5, e6, e7, e8, e9, e10, e11, e12, e13, e14, e15, e16}} {};
+  T* row(const int y) const { return data + y * stride; }
 
-  int& operator[](int index) { return data[index].get(); }
-  decltype(std::begin(data)) begin() { return std::begin(data); }
-  decltype(std::end(data)) end() { return std::end(data); }
+private:
+  T* data;
+  int stride;
 };
 
+using Block4x4 = BlockView<4, 4>;
+using Block2x2 = BlockView<2, 2, int, 4>;     // chroma DC coefficients of an 8x8 block
+using DCBlock4x4 = BlockView<4, 4, int, 4>;   // luma DC coefficients of a 16x16 block
+
 using Block8x8 = std::array<int, 8*8>;
 using Block16x16 = std::array<int, 16*16>;
 
@@ -0,0 +1,208 @@
+#ifndef CABAC_H_
+#define CABAC_H_
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "bit_reader.h"
+
+// Entropy coding of the stream (entropy_coding_mode_flag of the PPS)
+enum class EntropyCoding {
+  CAVLC,    // Baseline profile
+  CABAC     // Main profile
+};
+
+/* ctxIdx of the syntax elements of I slices (frame MBs, no 8x8 transform), see 9.3.3.1.
+ * Blocks of contexts are indexed with the ctxIdxOffset + ctxBlockCatOffset + ctxIdxInc
+ */
+enum {
+  CTX_MB_TYPE_I = 3,                // mb_type (I slices): 3..10
+  CTX_MB_QP_DELTA = 60,             // 60..63
+  CTX_INTRA_CHROMA_PRED_MODE = 64,  // 64..67
+  CTX_PREV_INTRA4X4_PRED_MODE = 68,
+  CTX_REM_INTRA4X4_PRED_MODE = 69,
+  CTX_CBP_LUMA = 73,                // coded_block_pattern prefix: 73..76
+  CTX_CBP_CHROMA = 77,              // coded_block_pattern suffix: 77..84
+  CTX_CODED_BLOCK_FLAG = 85,        // 85..104
+  CTX_SIGNIFICANT_COEFF = 105,      // 105..165
+  CTX_LAST_SIGNIFICANT_COEFF = 166, // 166..226
+  CTX_COEFF_ABS_LEVEL = 227,        // 227..275
+  CABAC_NB_CONTEXTS = 276           // 276 is end_of_slice_flag (terminating bin, no context variable)
+};
+
+// ctxBlockCat of the residual blocks of 4:2:0 intra MBs (Table 9-42)
+enum class BlockCat {
+  LUMA_DC = 0,    // Intra16x16DCLevel
+  LUMA_AC = 1,    // Intra16x16ACLevel
+  LUMA_4x4 = 2,   // LumaLevel4x4
+  CHROMA_DC = 3,
+  CHROMA_AC = 4
+};
+
+// ctxBlockCatOffset of coded_block_flag, significant/last_significant_coeff_flag and coeff_abs_level_minus1
+const int cbf_cat_offset[5] = {0, 4, 8, 12, 16};
+const int significant_cat_offset[5] = {0, 15, 29, 44, 47};
+const int abs_level_cat_offset[5] = {0, 10, 20, 30, 39};
+
+// Arithmetic coding tables (9.3.3.2): range of the LPS by pStateIdx and qCodIRangeIdx, next state after a LPS
+extern const std::uint8_t cabac_range_lps[64][4];
+extern const std::uint8_t cabac_trans_lps[64];
+// Number of doublings that bring codIRange back to [256, 510], indexed by codIRange >> 3
+extern const std::uint8_t cabac_renorm_shift[64];
+
+// Probability model of one bin: pStateIdx and valMPS
+struct CabacContext {
+  std::uint8_t state;
+  std::uint8_t mps;
+
+  inline void update(const int bin) {
+    if (bin == mps) {
+      state += (state < 62);
+    } else {
+      if (state == 0)
+        mps = 1 - mps;
+      state = cabac_trans_lps[state];
+    }
+  }
+};
+
+// Initial context variables of an I slice at SliceQPY (9.3.1.1)
+void init_cabac_contexts(CabacContext[CABAC_NB_CONTEXTS], const int);
+
+/**
+ * Binary arithmetic encoder (9.3.4) writing whole bytes to a buffer.
+ *
+ * The bits that can still change with a carry are kept in 'low' above the 10 bit register,
+ * runs of 0xff bytes are held back until the carry is known. The renormalization is a single
+ * shift, its size comes from cabac_renorm_shift.
+ */
+class CabacEncoder {
+public:
+  CabacContext contexts[CABAC_NB_CONTEXTS];
+
+  CabacEncoder(std::vector<std::uint8_t>& _bytes) : bytes(_bytes) { start(); }
+
+  // First MB of a slice, or after the samples of an I_PCM MB (the contexts are kept)
+  void start() {
+    low = 0;
+    range = 510;
+    queue = -9;   // the first bit out of the register is not written
+    outstanding = 0;
+  }
+
+  inline void encode_decision(const int ctx_idx, const int bin) {
+    CabacContext& ctx = contexts[ctx_idx];
+    int range_lps = cabac_range_lps[ctx.state][(range >> 6) & 3];
+    range -= range_lps;
+    if (bin != ctx.mps) {
+      low += range;
+      range = range_lps;
+    }
+    ctx.update(bin);
+    renormalize();
+  }
+
+  inline void encode_bypass(const int bin) {
+    low = (low << 1) + (bin ? range : 0);
+    queue++;
+    if (queue >= 0)
+      put_byte();
+  }
+
+  // end_of_slice_flag and the I_PCM bin of mb_type, flush() must follow a bin of 1
+  inline void encode_terminate(const int bin) {
+    range -= 2;
+    if (bin)
+      low += range;
+    else
+      renormalize();
+  }
+
+  /* EncodeFlush: the last bits of the register, then a one bit (rbsp_stop_one_bit at the end
+   * of the slice) and zero bits up to the byte boundary (rbsp_alignment_zero_bit, pcm_alignment_zero_bit)
+   */
+  void flush();
+
+  // Size of the coded data so far (bits of the register that are already determined)
+  std::size_t bits_written() const { return 8 * (bytes.size() + outstanding) + (queue > -8 ? queue + 8 : 0); }
+
+private:
+  std::vector<std::uint8_t>& bytes;
+  std::uint32_t low;    // codILow, with the undetermined output bits above bit 9
+  std::uint32_t range;  // codIRange
+  int queue;            // number of bits above the register minus 8: a byte is ready when >= 0
+  int outstanding;      // 0xff bytes waiting for a possible carry
+
+  inline void renormalize() {
+    int shift = cabac_renorm_shift[range >> 3];
+    range <<= shift;
+    low <<= shift;
+    queue += shift;
+    if (queue >= 0)
+      put_byte();
+  }
+
+  void put_byte();
+};
+
+/**
+ * Binary arithmetic decoder (9.3.3.2), reads the slice data bit by bit from a BitReader.
+ * After the terminating bin of an I_PCM MB, the reader is right after the flushed bits:
+ * the samples are read from the aligned position and start() is called again.
+ */
+class CabacDecoder {
+public:
+  CabacContext contexts[CABAC_NB_CONTEXTS];
+
+  CabacDecoder(BitReader& _br) : br(_br), range(510), offset(0) {}
+
+  void start() {
+    range = 510;
+    offset = br.read(9);
+  }
+
+  inline int decode_decision(const int ctx_idx) {
+    CabacContext& ctx = contexts[ctx_idx];
+    std::uint32_t range_lps = cabac_range_lps[ctx.state][(range >> 6) & 3];
+    range -= range_lps;
+    int bin = ctx.mps;
+    if (offset >= range) {
+      bin = 1 - bin;
+      offset -= range;
+      range = range_lps;
+    }
+    ctx.update(bin);
+    renormalize();
+    return bin;
+  }
+
+  inline int decode_bypass() {
+    offset = (offset << 1) | br.read(1);
+    if (offset < range)
+      return 0;
+    offset -= range;
+    return 1;
+  }
+
+  inline int decode_terminate() {
+    range -= 2;
+    if (offset >= range)
+      return 1;
+    renormalize();
+    return 0;
+  }
+
+private:
+  BitReader& br;
+  std::uint32_t range;    // codIRange
+  std::uint32_t offset;   // codIOffset
+
+  inline void renormalize() {
+    int shift = cabac_renorm_shift[range >> 3];
+    range <<= shift;
+    offset = (offset << shift) | br.read(shift);
+  }
+};
+
+#endif
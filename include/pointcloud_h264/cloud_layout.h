@@ -0,0 +1,127 @@
+#ifndef CLOUD_LAYOUT_H_
+#define CLOUD_LAYOUT_H_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+// sensor_msgs::PointField datatypes
+enum class FieldType : std::uint8_t {
+  INT8 = 1, UINT8 = 2, INT16 = 3, UINT16 = 4, INT32 = 5, UINT32 = 6, FLOAT32 = 7, FLOAT64 = 8
+};
+
+/**
+ * Position of the fields of interest in the points of a sensor_msgs::PointCloud2, so the
+ * projection reads the message buffer directly (no pcl::fromROSMsg copy).
+ *
+ * The offsets only depend on the stream (driver), resolve() does nothing as long as the
+ * fields and point_step of the messages stay the same.
+ * x, y and z must be FLOAT32; intensity and ring are optional (offset -1 when absent).
+ */
+struct CloudLayout {
+  int x_offset = -1;
+  int y_offset = -1;
+  int z_offset = -1;
+  int intensity_offset = -1;
+  int ring_offset = -1;
+  FieldType intensity_type = FieldType::FLOAT32;
+  FieldType ring_type = FieldType::UINT16;
+  std::uint32_t point_step = 0;
+
+  bool valid() const { return x_offset >= 0 && y_offset >= 0 && z_offset >= 0 && point_step > 0; }
+
+  /**
+   * @brief Looks up the field offsets if the layout of 'msg' differs from the last one
+   *
+   * @param msg sensor_msgs::PointCloud2 (template, so that this header does not depend on ROS)
+   * @return false if the points cannot be read in place (no float x/y/z, other endianness)
+   */
+  template <typename Msg>
+  bool resolve(const Msg& msg) {
+    if (msg.point_step == point_step && same_fields(msg.fields))
+      return valid();
+
+    *this = CloudLayout();
+    point_step = msg.point_step;
+    for (const auto& field : msg.fields) {
+      fields.push_back(Field{field.name, field.offset, field.datatype});
+
+      if (field.datatype == static_cast<std::uint8_t>(FieldType::FLOAT32) && field.offset + 4 <= msg.point_step) {
+        if (field.name == "x") x_offset = field.offset;
+        if (field.name == "y") y_offset = field.offset;
+        if (field.name == "z") z_offset = field.offset;
+      }
+      if (field.name == "intensity" || field.name == "i") {
+        intensity_offset = field.offset;
+        intensity_type = static_cast<FieldType>(field.datatype);
+      }
+      if (field.name == "ring") {
+        ring_offset = field.offset;
+        ring_type = static_cast<FieldType>(field.datatype);
+      }
+    }
+
+    if (msg.is_bigendian != host_is_bigendian())
+      x_offset = -1;
+    return valid();
+  }
+
+  // Field values of the point at 'point' (start of the point in the message data)
+  float x(const std::uint8_t* point) const { return read_float(point + x_offset); }
+  float y(const std::uint8_t* point) const { return read_float(point + y_offset); }
+  float z(const std::uint8_t* point) const { return read_float(point + z_offset); }
+  float intensity(const std::uint8_t* point) const {
+    return (intensity_offset < 0) ? 0.0f : read_as_float(point + intensity_offset, intensity_type);
+  }
+  int ring(const std::uint8_t* point) const {
+    return (ring_offset < 0) ? -1 : static_cast<int>(read_as_float(point + ring_offset, ring_type));
+  }
+
+private:
+  struct Field {
+    std::string name;
+    std::uint32_t offset;
+    std::uint8_t datatype;
+  };
+  std::vector<Field> fields;   // layout of the last message, to detect changes
+
+  template <typename Fields>
+  bool same_fields(const Fields& other) const {
+    if (fields.size() != other.size())
+      return false;
+    for (std::size_t i = 0; i < fields.size(); i++)
+      if (fields[i].name != other[i].name || fields[i].offset != other[i].offset || fields[i].datatype != other[i].datatype)
+        return false;
+    return true;
+  }
+
+  static bool host_is_bigendian() {
+    const std::uint16_t one = 1;
+    return *reinterpret_cast<const std::uint8_t*>(&one) == 0;
+  }
+
+  // memcpy: the points are not necessarily aligned in the buffer
+  static float read_float(const std::uint8_t* data) {
+    float value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+  }
+
+  static float read_as_float(const std::uint8_t* data, const FieldType type) {
+    switch (type) {
+      case FieldType::INT8:    return *reinterpret_cast<const std::int8_t*>(data);
+      case FieldType::UINT8:   return *data;
+      case FieldType::INT16:   { std::int16_t v; std::memcpy(&v, data, sizeof(v)); return v; }
+      case FieldType::UINT16:  { std::uint16_t v; std::memcpy(&v, data, sizeof(v)); return v; }
+      case FieldType::INT32:   { std::int32_t v; std::memcpy(&v, data, sizeof(v)); return v; }
+      case FieldType::UINT32:  { std::uint32_t v; std::memcpy(&v, data, sizeof(v)); return v; }
+      case FieldType::FLOAT32: return read_float(data);
+      case FieldType::FLOAT64: { double v; std::memcpy(&v, data, sizeof(v)); return v; }
+    }
+    return 0.0f;
+  }
+};
+
+#endif
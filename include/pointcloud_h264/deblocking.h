@@ -0,0 +1,42 @@
+#ifndef DEBLOCKING_H_
+#define DEBLOCKING_H_
+
+#include <vector>
+#include <cstdint>
+
+// Loop filter fields of a slice header
+struct DeblockingParams {
+  unsigned int disable_idc = 1;   // disable_deblocking_filter_idc: 0 all edges, 1 no filter, 2 not across slice boundaries
+  int alpha_offset_div2 = 0;      // slice_alpha_c0_offset_div2, -6..6
+  int beta_offset_div2 = 0;       // slice_beta_offset_div2, -6..6
+};
+
+/**
+ * 4:2:0 picture to filter: planes with MB aligned dimensions (luma stride mb_cols * 16,
+ * chroma stride mb_cols * 8) and the MB data the filter depends on.
+ *
+ * The samples are in Y, Cb and Cr (8 bit), or in Y16, Cb16 and Cr16 when those are set
+ * (any bit depth up to 14, see bit_depth).
+ */
+struct DeblockingPicture {
+  std::uint8_t* Y;
+  std::uint8_t* Cb;
+  std::uint8_t* Cr;
+  std::uint16_t* Y16;
+  std::uint16_t* Cb16;
+  std::uint16_t* Cr16;
+  int bit_depth;          // of the samples, luma and chroma
+  int mb_cols;
+  int mb_rows;
+  const int* mb_qp;       // QPY of each MB (-QpBdOffsetY..51), -QpBdOffsetY for I_PCM (QP'Y 0)
+  const int* mb_slice;    // slice of each MB, nullptr for a single slice
+};
+
+/* Boundary strength of an edge between two intra MBs (the only MB type of I slices):
+ * 4 on the MB edges, 3 on the internal 4x4 edges
+ */
+inline int intra_boundary_strength(const bool mb_edge) { return mb_edge ? 4 : 3; }
+
+void deblock_picture(const DeblockingPicture&, const std::vector<DeblockingParams>&, const int);
+
+#endif
@@ -0,0 +1,195 @@
+#ifndef DECODER_H_
+#define DECODER_H_
+
+#include <array>
+#include <algorithm>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "bit_reader.h"
+#include "nal_unit.h"
+#include "macroblock.h"
+#include "intra.h"
+#include "tr_qt.h"
+#include "sei.h"
+#include "deblocking.h"
+#include "cabac.h"
+
+// Parsed Sequence Parameter Set (subset written by Packager::seq_parameter_set_rbsp)
+struct SeqParameterSet {
+  bool valid = false;
+  unsigned int profile_idc = 0;
+  unsigned int level_idc = 0;
+  unsigned int chroma_format_idc = 1;
+  unsigned int bit_depth_luma = 8;
+  unsigned int bit_depth_chroma = 8;
+  bool qpprime_y_zero_transform_bypass_flag = false;
+  unsigned int log2_max_frame_num = 4;
+  unsigned int pic_order_cnt_type = 0;
+  unsigned int log2_max_pic_order_cnt_lsb = 4;
+  unsigned int pic_width_in_mbs = 0;
+  unsigned int pic_height_in_mbs = 0;
+  unsigned int frame_crop_left_offset = 0;
+  unsigned int frame_crop_right_offset = 0;
+  unsigned int frame_crop_top_offset = 0;
+  unsigned int frame_crop_bottom_offset = 0;
+};
+
+// Parsed Picture Parameter Set (subset written by Packager::pic_parameter_set_rbsp)
+struct PicParameterSet {
+  bool valid = false;
+  bool entropy_coding_mode_flag = false;
+  bool pic_order_present_flag = false;
+  int pic_init_qp = 26;
+  int chroma_qp_index_offset = 0;
+  bool deblocking_filter_control_present_flag = false;
+  bool constrained_intra_pred_flag = false;
+  bool redundant_pic_cnt_present_flag = false;
+};
+
+struct SliceHeader {
+  unsigned int first_mb_in_slice = 0;
+  unsigned int slice_type = 0;
+  unsigned int frame_num = 0;
+  unsigned int idr_pic_id = 0;
+  unsigned int pic_order_cnt_lsb = 0;
+  int slice_qp = 26;
+  unsigned int disable_deblocking_filter_idc = 0;
+  int slice_alpha_c0_offset_div2 = 0;
+  int slice_beta_offset_div2 = 0;
+};
+
+/**
+ * Reconstructed picture, planar YUV 4:2:0 with MB aligned dimensions.
+ * width/height are the dimensions after applying the SPS cropping window.
+ * Above 8 bits the samples are in Y16, Cb16 and Cr16 (Y, Cb and Cr are then empty).
+ */
+struct DecodedPicture {
+  int frame_num = 0;      // idr_pic_id of the access unit
+  int mb_width = 0;       // width in pixels, multiple of 16
+  int mb_height = 0;      // height in pixels, multiple of 16
+  int width = 0;          // cropped width
+  int height = 0;         // cropped height
+  int bit_depth = 8;      // of the samples, luma and chroma
+  std::vector<std::uint8_t> Y;
+  std::vector<std::uint8_t> Cb;
+  std::vector<std::uint8_t> Cr;
+  std::vector<std::uint16_t> Y16;
+  std::vector<std::uint16_t> Cb16;
+  std::vector<std::uint16_t> Cr16;
+
+  bool has_metadata = false;    // a projection metadata SEI preceded the slices
+  ProjectionMetadata metadata;
+
+  // Single channel I420 image, same layout Frame::Frame expects (CV_16UC1 above 8 bits)
+  Mat to_I420() const;
+};
+
+/**
+ * I-slice decoder for the subset of H.264 written by Packager:
+ * Annex-B byte stream, SPS/PPS, IDR/non-IDR I slices with I_4x4, I_16x16 and I_PCM
+ * macroblocks, CAVLC (Baseline) or CABAC (Main) residuals, in-loop deblocking filter.
+ * High profiles are accepted for 4:2:0 without scaling matrices (lossless transform bypass), 8 to 14
+ * bits per sample, the same for luma and chroma.
+ */
+class Decoder {
+public:
+  Decoder();
+
+  // Decodes an Annex-B byte stream, returns every completed picture
+  std::vector<DecodedPicture> decode(const std::uint8_t*, std::size_t);
+
+  // Decodes one NAL unit (without start code), appends the pictures it completed. A picture with
+  // lost slices is completed (concealed) by the first slice of the next one, or by flush()
+  void decode_nal_unit(const std::uint8_t*, std::size_t, std::vector<DecodedPicture>&);
+
+  // End of the stream: completes the picture being decoded, if any (concealed)
+  void flush(std::vector<DecodedPicture>&);
+
+  // Last completed picture
+  const DecodedPicture& picture() const { return output; }
+
+private:
+  // Per MB state needed by the neighbouring MBs
+  struct MBInfo {
+    int slice_num = -1;
+    bool is_I_PCM = false;
+    bool is_intra16x16 = false;
+    int qp = 0;                             // QP_Y (-QpBdOffsetY..51), -QpBdOffsetY for I_PCM (loop filter)
+    std::array<int, 16> intra4x4_Y_mode;    // indexed by 4x4 block position (see MacroBlock)
+    std::array<int, 16> nc_Y;               // total_coeff per luma 4x4 block
+    std::array<int, 4> nc_Cb;
+    std::array<int, 4> nc_Cr;
+
+    // CABAC contexts (an I_PCM MB is fully coded, with chroma mode 0)
+    int chroma_mode = 0;
+    int cbp_luma = 0;
+    int cbp_chroma = 0;
+    std::array<bool, 3> cbf_DC;             // coded_block_flag of the Y (Intra16x16), Cb and Cr DC blocks
+  };
+
+  SeqParameterSet sps;
+  PicParameterSet pps;
+  SliceHeader slice;
+
+  // First slice of the picture being decoded (7.4.1.2.4: what tells the next picture apart)
+  bool picture_open;
+  SliceHeader picture_slice;
+  bool picture_idr;
+  bool picture_reference;
+
+  DecodedPicture current;
+  DecodedPicture output;
+  std::vector<MBInfo> mb_info;
+  int mbs_decoded;
+  int slice_num;
+  std::vector<DeblockingParams> slice_deblocking;   // loop filter of each slice of the picture
+  std::vector<int> mb_qp;                           // per MB input of the loop filter
+  std::vector<int> mb_slice;
+
+  std::vector<std::uint8_t> rbsp;   // scratch buffer for EBSP -> RBSP
+
+  bool has_pending_metadata;        // SEI received, applies to the next picture
+  ProjectionMetadata pending_metadata;
+
+  bool parse_SPS(BitReader&);
+  bool parse_PPS(BitReader&);
+  bool parse_slice_header(BitReader&, const NALType, const int);
+  bool is_new_picture(const NALType, const int) const;
+  bool start_slice(const NALType, const int, std::vector<DecodedPicture>&);
+  bool decode_slice_data(BitReader&);
+  bool decode_macroblock(BitReader&, const int, int&);
+  bool decode_macroblock_cabac(CabacDecoder&, BitReader&, const int, int&, int&);
+  void read_pcm_samples(BitReader&, const int);
+
+  void start_picture(const NALType, const int);
+  void finish_picture(std::vector<DecodedPicture>&);
+  void conceal_picture();
+  void filter_picture();
+
+  int get_neighbor_index(const int, const int) const;
+  int luma_nC(const int, const int) const;
+  int chroma_nC(const int, const int, const bool) const;
+  int predict_intra4x4_mode(const int, const int) const;
+
+  // QpBdOffsetY (= QpBdOffsetC): QP_Y ranges from -QpBdOffsetY to 51 above 8 bits
+  int qp_bd_offset() const { return 6 * (static_cast<int>(sps.bit_depth_luma) - 8); }
+
+  // Stores a reconstructed sample in the 8 or 16 bit plane, clipped to the bit depth
+  inline void put_sample(std::vector<std::uint8_t>& plane, std::vector<std::uint16_t>& plane16, const int index,
+                         const int value) {
+    if (current.bit_depth > 8)
+      plane16[index] = static_cast<std::uint16_t>(std::max(0, std::min(value, (1 << current.bit_depth) - 1)));
+    else
+      plane[index] = static_cast<std::uint8_t>(std::max(0, std::min(value, 255)));
+  }
+
+  // The last bool is TransformBypassModeFlag: residual coded without transform (lossless)
+  void reconstruct_macroblock(const int, MacroBlock&, const Intra16x16Mode, const IntraChromaMode, const int);
+  void reconstruct_intra16x16(const int, MacroBlock&, const Intra16x16Mode, const int, const bool);
+  void reconstruct_intra4x4(const int, const int, MacroBlock&, const Intra4x4Mode, const int, const bool);
+  void reconstruct_chroma(const int, MacroBlock&, const IntraChromaMode, const int, const bool);
+};
+
+#endif
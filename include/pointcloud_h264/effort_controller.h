@@ -0,0 +1,47 @@
+#ifndef EFFORT_CONTROLLER_H_
+#define EFFORT_CONTROLLER_H_
+
+#include <atomic>
+#include <cstddef>
+
+#include "prediction.h"
+
+/**
+ * Adapts the encoder preset frame by frame to hold a latency budget (reception of the cloud
+ * to output of the access unit).
+ *
+ * The level goes from 0 (ultrafast: 16x16 only, no plane mode) up to the configured preset:
+ *   - straight to 0 when the ingest queue holds the threshold number of clouds (at least 2),
+ *     a cloud was dropped or a frame took more than 1.5 budget, so the queue does not overflow,
+ *   - one level down when the smoothed latency goes over 90% of the budget, two over 100%,
+ *   - one level up after UP_FRAMES frames under 60% of the budget.
+ * A change is held HOLD_FRAMES frames, the frames already in the pipeline were encoded at the
+ * previous level.
+ *
+ * update() is called by the last stage, get_preset() by the prediction stage.
+ */
+class EffortController {
+public:
+  EffortController(const long, const int, const std::size_t);
+
+  void update(const long, const std::size_t, const std::size_t);
+
+  int get_level() const { return level.load(std::memory_order_relaxed); }
+  const EncoderPreset& get_preset() const { return get_encoder_preset(get_level()); }
+  long get_smoothed_latency() const { return smoothed_us; }
+
+  static const int HOLD_FRAMES = 4;
+  static const int UP_FRAMES = 20;
+
+private:
+  long budget_us;
+  int max_level;
+  std::atomic<int> level;
+  std::size_t queue_threshold;   // clouds waiting that force level 0
+  long smoothed_us;         // moving average of the latency, -1 before the first frame
+  int hold;                 // frames before the level can change again
+  int fast_frames;          // consecutive frames well under the budget
+  std::size_t dropped;      // clouds dropped by the ingest queue at the last update
+};
+
+#endif
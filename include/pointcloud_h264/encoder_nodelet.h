@@ -0,0 +1,34 @@
+#ifndef ENCODER_NODELET_H_
+#define ENCODER_NODELET_H_
+
+#include <thread>
+#include <vector>
+
+#include <nodelet/nodelet.h>
+#include <ros/ros.h>
+
+/**
+ * The point cloud encoder as a nodelet (pointcloud_h264/EncoderNodelet, see nodelet_plugins.xml).
+ *
+ * Loaded in the nodelet manager of the LiDAR driver and of the h264 topic subscribers, the clouds
+ * and the access units are handed over as shared pointers, without serialization or copy.
+ * pointcloud_h264_node runs it in a process of its own.
+ *
+ * onInit() reads the private parameters and starts the pipeline threads, the destructor drains
+ * and joins them. The encoder state is global: one instance per process.
+ */
+class EncoderNodelet : public nodelet::Nodelet {
+public:
+  ~EncoderNodelet();
+
+  // A frame allocated after the ~alloc_check warm-up frames
+  static bool allocation_check_failed();
+
+private:
+  void onInit() override;
+
+  ros::Subscriber sub;
+  std::vector<std::thread> stages;
+};
+
+#endif
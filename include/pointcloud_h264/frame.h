@@ -8,6 +8,8 @@
 #include <opencv2/imgproc.hpp>
 
 #include "macroblock.h"
+#include "deblocking.h"
+#include "tr_qt.h"
 
 using namespace cv;
 using namespace std;
@@ -20,6 +22,14 @@ enum {
   MB_NEIGHBOR_R
 };
 
+/* Neighbours of a MB: index of each MB_NEIGHBOR_* (-1 if outside of the picture or in another
+ * slice) and the same as AVAILABLE_* bits (see intra.h)
+ */
+struct MBNeighbors {
+  int index[MB_NEIGHBOR_R + 1];
+  std::uint8_t available;
+};
+
 enum {
   I_PICTURE,
   P_PICTURE
@@ -37,9 +47,38 @@ public:
   int nb_mb_cols;   // number of MB cols
 
   std::vector<MacroBlock> mbs;
+  std::vector<MacroBlock> decoded_mbs;  // reconstructed MBs, as seen by the decoder (filled by encode_I_frame)
+  std::vector<int> slice_map;           // slice number of each MB, empty for a single slice
+  std::vector<DeblockingParams> slice_deblocking;   // loop filter of each slice (slice header), at least one
+  std::vector<std::uint8_t> cabac_data;         // CABAC: slice_data() of the slices, one after the other (cabac_frame)
+  std::vector<std::size_t> cabac_slice_offsets; // CABAC: start of each slice in cabac_data, then its end
+  bool lossless = false;                // transform bypass at QP 0 (the stream must use Packager lossless too)
+  int bit_depth = 8;                    // of the samples, 8..14 (the stream must use the same Packager bit depth)
+  int qp = LUMA_QP;                     // QP_Y of the lossy MBs, -QpBdOffsetY..51 (51 - QpBdOffsetY: same step as 8 bits at 51)
 
   Frame(const Mat& yuv);
-  int get_neighbor_index(const int, const int);
+  void load(const Mat& yuv);
+  void set_slices(const std::vector<int>&);
+  void set_deblocking(const DeblockingParams&);
+  std::vector<std::uint16_t> get_decoded_Y() const;
+  int predict_intra4x4_mode(const int, const int) const;
+
+  const MBNeighbors& get_neighbors(const int index) const { return neighbors[index]; }
+  int get_neighbor_index(const int index, const int neighbor_type) const { return neighbors[index].index[neighbor_type]; }
+
+  int get_slice(const int index) const { return this->slice_map.empty() ? 0 : this->slice_map[index]; }
+  int get_nb_slices() const { return this->slice_first_mbs.empty() ? 1 : this->slice_first_mbs.size(); }
+  const DeblockingParams& get_deblocking(const int slice) const { return slice_deblocking[slice]; }
+  int get_qp() const { return this->lossless ? -get_qp_offset() : clip(this->qp, -get_qp_offset(), 51); }   // QP_Y of the non I_PCM MBs
+  int get_qp_offset() const { return 6 * (this->bit_depth - 8); }           // QpBdOffsetY (and QpBdOffsetC)
+  int get_luma_qp() const { return get_qp() + get_qp_offset(); }            // QP'Y, of the luma transform
+  int get_chroma_qp() const;                                                  // QP'C, of the chroma transform
+
+private:
+  std::vector<MBNeighbors> neighbors;   // per MB, only rebuilt when the geometry or the slices change
+  std::vector<int> slice_first_mbs;     // slices of the table, empty for a single slice
+
+  void build_neighbors();
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,214 @@
+#ifndef INGEST_QUEUE_H_
+#define INGEST_QUEUE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+#include <condition_variable>
+
+// What push() does when the queue is full
+enum class DropPolicy {
+  DROP_OLDEST,  // discard the oldest queued item (freshness first, teleoperation)
+  DROP_NEWEST,  // discard the item being pushed
+  BLOCK         // wait for the consumer (recording, nothing is lost)
+};
+
+/**
+ * Bounded queue between the ROS callback and the encoder thread, and between the encoder stages.
+ *
+ * The ring is lock-free (bounded MPMC queue with a sequence number per slot, so the
+ * producer can also pop to drop the oldest item); the mutex and condition variables are
+ * only used to put an idle consumer or a blocked producer to sleep.
+ *
+ * The capacity is rounded up to a power of two.
+ */
+template <typename T>
+class IngestQueue {
+public:
+  IngestQueue(const std::size_t, const DropPolicy);
+
+  // false if an item was dropped (the pushed one or the oldest one)
+  bool push(T&&);
+  // Waits at most 'timeout' for an item, false if none (or the queue was closed and is empty)
+  bool pop(T&, const std::chrono::milliseconds);
+  // Wakes up the waiting threads, push() then drops everything
+  void close();
+
+  // Approximate while other threads push or pop, always in [0, capacity()]
+  std::size_t size() const;
+  std::size_t capacity() const { return mask + 1; }
+  std::size_t get_dropped() const { return dropped.load(std::memory_order_relaxed); }
+  bool is_closed() const { return closed.load(std::memory_order_acquire); }
+
+private:
+  struct Slot {
+    std::atomic<std::size_t> sequence;
+    T value;
+  };
+
+  std::unique_ptr<Slot[]> slots;
+  std::size_t mask;
+  DropPolicy policy;
+  std::atomic<std::size_t> enqueue_pos;
+  std::atomic<std::size_t> dequeue_pos;
+  std::atomic<std::size_t> dropped;
+  std::atomic<bool> closed;
+
+  std::mutex mutex;
+  std::condition_variable not_empty;
+  std::condition_variable not_full;
+
+  bool try_push(T&);
+  bool try_pop(T&);
+};
+
+
+template <typename T>
+IngestQueue<T>::IngestQueue(const std::size_t _capacity, const DropPolicy _policy)
+: policy(_policy), enqueue_pos(0), dequeue_pos(0), dropped(0), closed(false)
+{
+  std::size_t size = 1;
+  while (size < _capacity)
+    size <<= 1;
+
+  slots.reset(new Slot[size]);
+  mask = size - 1;
+  for (std::size_t i = 0; i < size; i++)
+    slots[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Items in the queue
+ *
+ * dequeue_pos is loaded first: it never passes enqueue_pos, so the difference cannot wrap around.
+ * It can exceed the capacity when items were popped and pushed between the two loads.
+ */
+template <typename T>
+std::size_t IngestQueue<T>::size() const {
+  std::size_t dequeued = dequeue_pos.load(std::memory_order_acquire);
+  std::size_t enqueued = enqueue_pos.load(std::memory_order_acquire);
+  return std::min(enqueued - dequeued, capacity());
+}
+
+template <typename T>
+bool IngestQueue<T>::try_push(T& item) {
+  std::size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+  Slot* slot;
+
+  while (true) {
+    slot = &slots[pos & mask];
+    std::intptr_t diff = (std::intptr_t)slot->sequence.load(std::memory_order_acquire) - (std::intptr_t)pos;
+    if (diff == 0) {
+      if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      return false;   // full
+    } else {
+      pos = enqueue_pos.load(std::memory_order_relaxed);
+    }
+  }
+
+  slot->value = std::move(item);
+  slot->sequence.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+template <typename T>
+bool IngestQueue<T>::try_pop(T& item) {
+  std::size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+  Slot* slot;
+
+  while (true) {
+    slot = &slots[pos & mask];
+    std::intptr_t diff = (std::intptr_t)slot->sequence.load(std::memory_order_acquire) - (std::intptr_t)(pos + 1);
+    if (diff == 0) {
+      if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      return false;   // empty
+    } else {
+      pos = dequeue_pos.load(std::memory_order_relaxed);
+    }
+  }
+
+  item = std::move(slot->value);
+  slot->value = T();    // release what the slot holds (shared pointers)
+  slot->sequence.store(pos + mask + 1, std::memory_order_release);
+  return true;
+}
+
+/**
+ * @brief Queues an item, applying the drop policy when the queue is full
+ *
+ * @param item Moved into the queue (or destroyed if dropped)
+ * @return true if nothing was dropped
+ */
+template <typename T>
+bool IngestQueue<T>::push(T&& item) {
+  bool complete = true;
+
+  if (closed.load(std::memory_order_acquire)) {
+    dropped++;
+    return false;
+  }
+
+  while (!try_push(item)) {
+    if (policy == DropPolicy::DROP_NEWEST) {
+      dropped++;
+      return false;
+    }
+
+    if (policy == DropPolicy::DROP_OLDEST) {
+      T oldest;
+      if (try_pop(oldest)) {
+        dropped++;
+        complete = false;
+      }
+    } else {
+      std::unique_lock<std::mutex> lock(mutex);
+      not_full.wait(lock, [this] { return size() < capacity() || closed.load(); });
+      if (closed.load()) {
+        dropped++;
+        return false;
+      }
+    }
+  }
+
+  // Taking the lock orders the notification with the consumer's wait predicate
+  { std::lock_guard<std::mutex> lock(mutex); }
+  not_empty.notify_one();
+  return complete;
+}
+
+template <typename T>
+bool IngestQueue<T>::pop(T& item, const std::chrono::milliseconds timeout) {
+  if (!try_pop(item)) {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_empty.wait_for(lock, timeout, [this] { return size() > 0 || closed.load(); });
+    lock.unlock();
+    if (!try_pop(item))
+      return false;
+  }
+
+  if (policy == DropPolicy::BLOCK) {
+    { std::lock_guard<std::mutex> lock(mutex); }
+    not_full.notify_one();
+  }
+  return true;
+}
+
+template <typename T>
+void IngestQueue<T>::close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+  }
+  not_empty.notify_all();
+  not_full.notify_all();
+}
+
+#endif
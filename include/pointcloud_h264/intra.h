@@ -7,48 +7,99 @@
 #include <numeric>
 #include <algorithm>
 #include <functional>
-#include <experimental/optional>
 #include <iostream>
 #include <fstream>
 #include <iostream>
 #include <type_traits>
+#include <cstdint>
+#include <cstdlib>
 
 #include "block.h"
 
 using namespace std;
 
+/* Availability of the neighbours of a MB or of a 4x4 block, one bit per MB_NEIGHBOR_* (see frame.h):
+ * inside the picture, in the same slice and already decoded.
+ * The prediction functions only read the neighbours whose bit is set, any block can be passed for the others.
+ */
+enum : std::uint8_t {
+  AVAILABLE_UL = 1 << 0,
+  AVAILABLE_U  = 1 << 1,
+  AVAILABLE_UR = 1 << 2,
+  AVAILABLE_L  = 1 << 3,
+  AVAILABLE_R  = 1 << 4
+};
+
+/* Neighbouring samples of a N x N block (4x4 luma, 8x8 chroma, 16x16 luma):
+ *   [0]: up-left sample (Q)
+ *   [1..]: row above, N samples (+ 4 up-right ones E..H for a 4x4 block)
+ *   [LEFT..]: column at the left, N samples
+ * Sized at compile time (13, 17 or 33 samples), so it lives on the stack.
+ */
+template <int N>
 class Predictor {
 public:
-    std::vector<int> pred_pel;
-    bool up_available;
-    bool left_available;
-    bool up_right_available;
-    bool all_available;
-    
-    // Allocates space for the predictors relating the block size (e.g 4x4 block->13 predictors (A-Q))
-
-    Predictor(int size): up_available(false), left_available(false), up_right_available(false), all_available(false) {
-      switch (size) {
-        case 4:
-          this->pred_pel.reserve(13);
-          break;
-        case 8:
-          this->pred_pel.reserve(17);
-          break;
-        case 16:
-          this->pred_pel.reserve(33);
-          break;
-      }
+    static const int NB_UP = (N == 4) ? 2 * N : N;
+    static const int LEFT = 1 + NB_UP;
+    static const int SIZE = LEFT + N;
+    typedef std::array<int, SIZE> Pels;
+
+    Pels pred_pel;
+    bool up_available = false;
+    bool left_available = false;
+    bool up_right_available = false;
+    bool all_available = false;
+    int bit_depth = 8;    // of the samples: DC without neighbours is 1 << (bit_depth - 1), plane clips to (1 << bit_depth) - 1
+
+    /* Reads the samples around the block at (x0, y0) of a reconstructed plane (8 bit, or 16 bit
+     * above 8 bits), the neighbours are given by AVAILABLE_* bits. Missing samples are half the
+     * range, missing up-right ones repeat the last up sample; the up-left one is only used with
+     * both up and left.
+     */
+    template <typename Sample>
+    void load(const Sample* plane, const int stride, const int x0, const int y0, const std::uint8_t available,
+              const int _bit_depth = 8) {
+      const int half = 1 << (_bit_depth - 1);
+      bit_depth = _bit_depth;
+      up_available = available & AVAILABLE_U;
+      left_available = available & AVAILABLE_L;
+      up_right_available = (N == 4) && (available & AVAILABLE_UR);
+      all_available = up_available && left_available && (available & AVAILABLE_UL);
+
+      for (int i = 0; i < N; i++)
+        pred_pel[1+i] = up_available ? plane[(y0 - 1) * stride + x0 + i] : half;
+      for (int i = N; i < NB_UP; i++)
+        pred_pel[1+i] = up_right_available ? plane[(y0 - 1) * stride + x0 + i] : pred_pel[N];
+      for (int i = 0; i < N; i++)
+        pred_pel[LEFT+i] = left_available ? plane[(y0 + i) * stride + x0 - 1] : half;
+      pred_pel[0] = all_available ? plane[(y0 - 1) * stride + x0 - 1] : half;
     }
 };
 
+using Predictor4x4 = Predictor<4>;
+using Predictor8x8 = Predictor<8>;
+using Predictor16x16 = Predictor<16>;
+
+// Prediction of a N x N block, in raster order
+template <int N>
+using PredBlock = std::array<int, N*N>;
+
 // std::ostream& operator << (std::ostream& os, const Intra16x16Mode& obj)
 // {
 //    os << static_cast<std::underlying_type<Intra16x16Mode>::type>(obj);
 //    return os;
 // }
 
-using CopyBlock4x4 = std::array<int, 16>;
+using CopyBlock4x4 = PredBlock<4>;
+
+/* Clip function for plane prediction and reconstruction
+* Returns max value between lower and (min(n,upper))
+*/
+template <typename T>
+inline T clip(const T& n, const T& lower, const T& upper)
+{
+  return std::max(lower, std::min(n, upper));
+}
 
 // 9 predictions modes -> 4x4 Luma
 enum class Intra4x4Mode {
@@ -82,68 +133,120 @@ enum class IntraChromaMode {
 
 
 //A tuple is an object capable to hold a collection of elements. Each element can be of a different type.
-//The class template std::experimental::optional manages an optional contained value, i.e. a value that semantically may not be present.  
+
+
+// Cost ranking the candidate modes
+enum class IntraCost {
+  SAD,    // sum of absolute differences with the source
+  SATD,   // sum of the absolute 4x4 Hadamard coefficients of the residual (halved)
+  RD,     // SSD of the reconstruction + lambda * estimated coefficient bits (quantized at LUMA_QP / CHROMA_QP)
+  BYPASS  // lossless (transform bypass): SAD of the coded residual, after the DPCM of the vertical / horizontal modes
+};
+
+// Direction of the residual DPCM of a mode in transform bypass (see tr_qt.h), for IntraCost::BYPASS
+enum class BypassDPCM {
+  NONE,
+  VERTICAL,
+  HORIZONTAL
+};
+
+/* Effort of a mode decision (see EncoderPreset in prediction.h): which candidates are tried and how
+ * they are compared. The modes that are not tried are never chosen.
+ */
+struct IntraSearch {
+  IntraCost cost = IntraCost::SAD;
+  bool plane = true;              // plane mode of 16x16 luma and chroma
+  bool directional4x4 = true;     // the 6 directional 4x4 modes, besides vertical, horizontal and DC
+  int stop4x4 = 0;                // the directional modes are skipped when the best of V/H/DC costs less
+};
+
+// Outcome of a mode decision, the residual of 'mode' is left in the input block
+template <typename Mode>
+struct IntraChoice {
+  Mode mode;
+  int cost;   // under IntraSearch::cost, compares the 16x16 and 4x4 partitions of a MB
+  int sad;    // of the residual, for the I_PCM fallback
+};
 
 
 
+////////////////////// MODES COMMON TO ALL SIZES ////////////////////////
+
+// Instantiated for the sizes that use them in intra.cpp (DC: 8x8 is the chroma DC, per 4x4 quarter)
+template <int N> void intra_vertical(PredBlock<N>&, const Predictor<N>&);
+template <int N> void intra_horizontal(PredBlock<N>&, const Predictor<N>&);
+template <int N> void intra_dc(PredBlock<N>&, const Predictor<N>&);
+template <int N> void intra_plane(PredBlock<N>&, const Predictor<N>&);
+template <> void intra_dc<8>(PredBlock<8>&, const Predictor<8>&);
+
+// SAD of each mode of a 16x16 luma or 8x8 chroma block
+struct IntraCosts {
+  int vertical = 0;
+  int horizontal = 0;
+  int dc = 0;
+  int plane = 0;
+};
+
+template <int N> IntraCosts intra_costs(const PredBlock<N>&, const Predictor<N>&);
+
+// Cost of one prediction of a 4x4 / 16x16 luma or 8x8 chroma block
+template <int N> int intra_cost(const IntraCost, const PredBlock<N>&, const PredBlock<N>&, const BypassDPCM = BypassDPCM::NONE);
+
+
 ////////////////////// 4x4 MODES ////////////////////////
 
-std::tuple<int, Intra4x4Mode> intra4x4(Block4x4, std::experimental::optional<Block4x4>, 
-                                                 std::experimental::optional<Block4x4>,
-                                                 std::experimental::optional<Block4x4>, 
-                                                 std::experimental::optional<Block4x4>);
-
-void get_intra4x4(CopyBlock4x4&, const Predictor&, const Intra4x4Mode);
-void intra4x4_vertical(CopyBlock4x4&, const Predictor&);
-void intra4x4_horizontal(CopyBlock4x4&, const Predictor&);
-void intra4x4_dc(CopyBlock4x4&, const Predictor&);
-void intra4x4_downleft(CopyBlock4x4&, const Predictor&);
-void intra4x4_downright(CopyBlock4x4&, const Predictor&);
-void intra4x4_verticalright(CopyBlock4x4&, const Predictor&);
-void intra4x4_horizontaldown(CopyBlock4x4&, const Predictor&);
-void intra4x4_verticalleft(CopyBlock4x4&, const Predictor&);
-void intra4x4_horizontalup(CopyBlock4x4&, const Predictor&);
-
-Predictor get_intra4x4_predictor(std::experimental::optional<Block4x4>, std::experimental::optional<Block4x4>,
-                                 std::experimental::optional<Block4x4>, std::experimental::optional<Block4x4>);
+// Set of Intra4x4Mode, one bit per mode
+typedef std::uint16_t Intra4x4Modes;
+const Intra4x4Modes ALL_INTRA4X4_MODES = 0x1ff;
+
+inline Intra4x4Modes intra4x4_bit(const Intra4x4Mode mode) { return 1 << static_cast<int>(mode); }
+
+/* Pre-analysis of the source samples of a 16x16 luma MB: Sobel gradients, binned per 4x4 block
+ * by the direction of the edges (histogram weighted by |gx| + |gy|). Each bin is the 4x4 mode
+ * predicting along that direction.
+ */
+struct GradientAnalysis {
+  std::array<Intra4x4Modes, 16> modes;  // per 4x4 block, raster order: DC + the strongest directions
+  int energy;                           // sum of |gx| + |gy| over the MB, low on flat MBs
+};
+
+void analyze_gradients(const Block16x16&, const int, GradientAnalysis&);
+
+// The last parameter is the bit depth of the luma samples (see Predictor)
+IntraChoice<Intra4x4Mode> intra4x4(Block4x4, const IntraSearch&, const Intra4x4Modes, const std::uint8_t,
+                                   Block4x4, Block4x4, Block4x4, Block4x4, const int = 8);
+
+void get_intra4x4(CopyBlock4x4&, const Predictor4x4&, const Intra4x4Mode);
+void intra4x4_downleft(CopyBlock4x4&, const Predictor4x4&);
+void intra4x4_downright(CopyBlock4x4&, const Predictor4x4&);
+void intra4x4_verticalright(CopyBlock4x4&, const Predictor4x4&);
+void intra4x4_horizontaldown(CopyBlock4x4&, const Predictor4x4&);
+void intra4x4_verticalleft(CopyBlock4x4&, const Predictor4x4&);
+void intra4x4_horizontalup(CopyBlock4x4&, const Predictor4x4&);
+
+Predictor4x4 get_intra4x4_predictor(const std::uint8_t, Block4x4, Block4x4, Block4x4, Block4x4, const int = 8);
                                   
 
 ////////////////////// 16x16 MODES ////////////////////////
 
 
-std::tuple<int, Intra16x16Mode> intra16x16(Block16x16&, std::experimental::optional<std::reference_wrapper<Block16x16>>, 
-                                                        std::experimental::optional<std::reference_wrapper<Block16x16>>, 
-                                                        std::experimental::optional<std::reference_wrapper<Block16x16>>);
+IntraChoice<Intra16x16Mode> intra16x16(Block16x16&, const IntraSearch&, const std::uint8_t, const Block16x16&, const Block16x16&, const Block16x16&,
+                                       const int = 8);
 
-void get_intra16x16(Block16x16&, const Predictor&, const Intra16x16Mode);
-void intra16x16_vertical(Block16x16&, const Predictor&);
-void intra16x16_horizontal(Block16x16&, const Predictor&);
-void intra16x16_dc(Block16x16&, const Predictor&);
-void intra16x16_plane(Block16x16&, const Predictor&);
+void get_intra16x16(Block16x16&, const Predictor16x16&, const Intra16x16Mode);
 
-Predictor get_intra16x16_predictor(std::experimental::optional<std::reference_wrapper<Block16x16>>, std::experimental::optional<std::reference_wrapper<Block16x16>>, 
-                                   std::experimental::optional<std::reference_wrapper<Block16x16>>);
+Predictor16x16 get_intra16x16_predictor(const std::uint8_t, const Block16x16&, const Block16x16&, const Block16x16&, const int = 8);
 
 
 ////////////////////// 8x8 MODES ////////////////////////
 
-std::tuple<int, IntraChromaMode> intra8x8_chroma(Block8x8&, std::experimental::optional<std::reference_wrapper<Block8x8>>, 
-                                                            std::experimental::optional<std::reference_wrapper<Block8x8>>, 
-                                                            std::experimental::optional<std::reference_wrapper<Block8x8>>,
-                                                
-                                                 Block8x8&, std::experimental::optional<std::reference_wrapper<Block8x8>>, 
-                                                            std::experimental::optional<std::reference_wrapper<Block8x8>>, 
-                                                            std::experimental::optional<std::reference_wrapper<Block8x8>>);
+IntraChoice<IntraChromaMode> intra8x8_chroma(const IntraSearch&, const std::uint8_t,
+                                             Block8x8&, const Block8x8&, const Block8x8&, const Block8x8&,
+                                             Block8x8&, const Block8x8&, const Block8x8&, const Block8x8&, const int = 8);
 
-void get_intra8x8_chroma(Block8x8&, const Predictor&, const IntraChromaMode);
-void intra8x8_chroma_dc(Block8x8&, const Predictor&);
-void intra8x8_chroma_horizontal(Block8x8&, const Predictor&);
-void intra8x8_chroma_vertical(Block8x8&, const Predictor&);
-void intra8x8_chroma_plane(Block8x8&, const Predictor&);
+void get_intra8x8_chroma(Block8x8&, const Predictor8x8&, const IntraChromaMode);
 
-Predictor get_intra8x8_chroma_predictor(std::experimental::optional<std::reference_wrapper<Block8x8>>, 
-                                        std::experimental::optional<std::reference_wrapper<Block8x8>>, 
-                                        std::experimental::optional<std::reference_wrapper<Block8x8>>);
+Predictor8x8 get_intra8x8_chroma_predictor(const std::uint8_t, const Block8x8&, const Block8x8&, const Block8x8&, const int = 8);
 
 
-#endif
\ No newline at end of file
+#endif
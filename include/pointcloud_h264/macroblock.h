@@ -31,24 +31,27 @@ public:
   bool coded_block_pattern_chroma_DC = false;
   bool coded_block_pattern_chroma_AC = false;
 
-  Bitstream bitstream;
+  Bitstream bitstream;  // CAVLC residual, heap buffer of max_coded_bytes (Frame::load)
+  int cabac_bits = 0;   // CABAC: size of the MB in the slice data (see cabac_frame)
 
   static const std::array<int, 16> convert_table;
 
   MacroBlock(const int r, const int c): mb_row(r), mb_col(c) {}
 
+  // Bytes of an I_PCM MB (384 samples) plus the MB header: the bound of the coded MBs
+  static std::size_t max_coded_bytes(const int bit_depth) { return 384 * bit_depth / 8 + 16; }
+
+  // Back to the state of a new MB at (r, c), the bitstream keeps its capacity
+  void reset(const int r, const int c);
+
+  // Views into Y / Cr / Cb; the AC coefficients of a 4x4 block are its view without the DC
   Block4x4 get_Y_4x4_block(int pos);
   Block4x4 get_Cr_4x4_block(int pos);
   Block4x4 get_Cb_4x4_block(int pos);
 
-  Block4x4 get_Y_DC_block();
-  Block4x4 get_Y_AC_block(int pos);
-
+  DCBlock4x4 get_Y_DC_block();
   Block2x2 get_Cr_DC_block();
-  Block4x4 get_Cr_AC_block(int pos);
-
   Block2x2 get_Cb_DC_block();
-  Block4x4 get_Cb_AC_block(int pos);
 };
 
 #endif
\ No newline at end of file
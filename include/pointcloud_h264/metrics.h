@@ -0,0 +1,86 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <cstddef>
+#include <condition_variable>
+
+#include "projection.h"
+
+// Input of the metrics of one frame (copies, the encoder keeps going while they are computed)
+struct MetricsJob {
+  int frame_num = 0;
+  std::size_t bits = 0;               // size of the coded slice
+  int width = 0;                      // range image size (no padding)
+  int height = 0;
+  std::vector<float> source_ranges;   // width * height, metres
+  std::vector<std::uint16_t> source_Y; // width * height, quantized ranges fed to the encoder
+  std::vector<std::uint16_t> decoded_Y;// width * height, encoder reconstruction
+};
+
+/**
+ * @brief Copies the inputs of the metrics (planes are cropped to width x height)
+ *
+ * @param source Encoder input (see range_image_to_I420), 8 or 16 bit samples
+ * @param stride Distance between rows of the source and decoded planes (padded width)
+ */
+MetricsJob make_metrics_job(const int, const std::size_t, const float*, const int, const int,
+                            const cv::Mat&, const std::uint16_t*, const int);
+
+struct FrameMetrics {
+  int frame_num = 0;
+  std::size_t bits = 0;
+  double psnr_Y = 0.0;          // dB, quantized source vs reconstruction (peak 2^bit_depth - 1)
+  double range_rmse = 0.0;      // metres, on pixels valid in both
+  std::size_t lost_points = 0;  // valid in the source, 0 after decoding
+  std::size_t fake_points = 0;  // 0 in the source, valid after decoding
+  double p2p_rmse = 0.0;        // point-to-point (D1) RMSE, max of both directions, metres
+  double chamfer = 0.0;         // mean NN distance source->decoded + decoded->source, metres
+};
+
+/**
+ * @brief Computes the quality metrics of one frame
+ *
+ * @param job Source and decoded frame
+ * @param reprojector Direction tables of the projection
+ * @param radius Half size (pixels) of the window searched for nearest neighbours
+ */
+FrameMetrics compute_metrics(const MetricsJob&, const Reprojector&, const int = 2);
+
+/**
+ * Computes the metrics on a side thread and appends one line per frame to a text file:
+ *   frame bits psnr_Y range_rmse lost fake p2p_rmse chamfer
+ *
+ * submit() never blocks the encoder: when more than 'max_pending' jobs are waiting,
+ * the oldest one is dropped.
+ */
+class MetricsWorker {
+public:
+  MetricsWorker(const ProjectionConfig&, const std::string&, const std::size_t = 4);
+  ~MetricsWorker();
+
+  void submit(MetricsJob&&);
+  std::size_t get_dropped() const;
+
+private:
+  Reprojector reprojector;
+  std::ofstream file;
+  std::size_t max_pending;
+  std::size_t dropped;
+
+  std::deque<MetricsJob> jobs;
+  mutable std::mutex mutex;
+  std::condition_variable cv;
+  bool stop;
+  std::thread worker;
+
+  void run();
+};
+
+#endif
@@ -41,6 +41,11 @@ enum class NALRefIdc {
  DISPOSABLE  = 0
 };
 
+// NAL unit header byte: forbidden_zero_bit (0), nal_ref_idc, nal_unit_type
+inline std::uint8_t make_nal_header(const NALRefIdc ref_idc, const NALType type) {
+  return (static_cast<std::uint8_t>(ref_idc) << 5) | static_cast<std::uint8_t>(type);
+}
+
 /**
  * Coded or transmitted H.264 data is stored or transmitted as a series of packets
  * known as Network Abstraction Layer Units (NAL Units).
@@ -0,0 +1,78 @@
+#ifndef NAL_WRITER_H_
+#define NAL_WRITER_H_
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <condition_variable>
+#include <sys/uio.h>
+
+// When the writer thread forces the data to storage
+enum class FsyncPolicy {
+  NONE,       // leave it to the OS (data is flushed to the kernel after every batch)
+  PER_BATCH,  // fsync after every batch of NAL units
+  ON_CLOSE    // fsync once, when the writer is destroyed
+};
+
+/**
+ * Writes completed NAL units (start code included) to a file from a dedicated thread.
+ *
+ * The encoder pushes buffers into a bounded single producer / single consumer ring,
+ * the writer thread takes every buffer available and writes them with one writev.
+ * push() only blocks when the ring is full (storage slower than the encoder).
+ *
+ * Written buffers are not freed but handed back through a second ring: acquire_buffer()
+ * returns them (empty, capacity kept), so the steady state does not allocate. That ring
+ * starts full, with a buffer for each NAL unit that can be queued, plus the one being
+ * recycled and the one being built: acquire_buffer() never has to make a new buffer.
+ */
+class NalWriter {
+public:
+  NalWriter(const std::string&, const FsyncPolicy = FsyncPolicy::NONE, const std::size_t = 16);
+  ~NalWriter();
+
+  void push(std::vector<std::uint8_t>&&);
+  // Empty buffer to build the next NAL unit in (recycled when possible), same thread as push()
+  std::vector<std::uint8_t> acquire_buffer();
+  // Grows the buffers waiting in the second ring to 'bytes', same thread as push()
+  void reserve_buffers(const std::size_t);
+
+  std::size_t get_depth() const;                                 // NAL units waiting
+  std::size_t get_max_depth() const { return max_depth; }        // highest depth seen by push()
+  std::size_t get_full_count() const { return full_count; }      // push() calls that had to wait
+
+private:
+  int fd;
+  FsyncPolicy fsync_policy;
+
+  std::vector<std::vector<std::uint8_t>> ring;
+  std::atomic<std::size_t> head;   // next slot read by the writer
+  std::atomic<std::size_t> tail;   // next slot written by push()
+  std::atomic<bool> stop;
+
+  // Written buffers going back to the producer (single producer: the writer thread)
+  std::vector<std::vector<std::uint8_t>> free_ring;
+  std::atomic<std::size_t> free_head;
+  std::atomic<std::size_t> free_tail;
+  std::vector<struct iovec> iov;
+
+  std::size_t max_depth;
+  std::atomic<std::size_t> full_count;
+
+  // Only used to sleep / wake up, the ring itself is lock-free
+  std::mutex mutex;
+  std::condition_variable not_empty;
+  std::condition_variable not_full;
+
+  std::thread worker;
+
+  void run();
+  void write_batch(const std::size_t, const std::size_t);
+  void recycle(std::vector<std::uint8_t>&);
+};
+
+#endif
@@ -7,33 +7,68 @@
 #include <cstdint>
 #include <vector>
 #include <cmath>
+#include <mutex>
 
 #include "vlc.h"
 #include "nal_unit.h"
 #include "tr_qt.h"
 #include "frame.h"
 #include "bitstream.h"
+#include "nal_writer.h"
+#include "recording.h"
+#include "sei.h"
+#include "cabac.h"
 
 class Packager {
 public:
-  Packager(std::string);
+  Packager(std::string, const FsyncPolicy = FsyncPolicy::NONE, const std::size_t = 16,
+           const EntropyCoding = EntropyCoding::CAVLC, const bool = false, const int = 8);
 
   void write_SPS(const int, const int, const int);
   void write_PPS();
-  void write_slice(const int, Frame&);
+  void write_SEI(const ProjectionMetadata&, std::vector<std::uint8_t>* = nullptr);
+  size_t write_slice(const int, Frame&, std::vector<std::uint8_t>* = nullptr, const std::uint64_t = 0);
+
+  // Writes the index sidecar (see recording.h) next to the stream
+  bool enable_index();
+
+  // Appends the last SPS and PPS (start codes included) to an access unit
+  void append_parameter_sets(std::vector<std::uint8_t>&) const;
+
+  void plan_slices(const Frame&, const size_t, std::vector<int>&) const;
+
+  const NalWriter& get_writer() const { return writer; }
 
 private:
-  std::fstream file;
+  std::string filename;
+  NalWriter writer;   // file output, on its own thread
+  std::ofstream index_file;
+  std::uint64_t bytes_queued;     // stream size once the writer is done
+  std::size_t nal_reserve;        // largest NAL unit so far (worst case EBSP), reserved in every writer buffer
+  std::int64_t au_offset;         // start of the current access unit, -1 before its first NAL unit
+  std::uint16_t au_header_size;   // SPS + PPS bytes at the start of the current access unit
+  std::vector<std::uint8_t> parameter_sets;   // SPS + PPS, repeated in published access units
+  EntropyCoding entropy_coding;  // CABAC: the slice data comes from cabac_frame
+  bool lossless;                 // High 4:4:4 Predictive profile, transform bypass at QP 0 (Frame::lossless)
+  int bit_depth;                 // of the samples (Frame::bit_depth), High 10 up to 10 bits, High 4:4:4 Predictive above
+  std::vector<size_t> mb_bits;   // coded size of each MB of the last frame
+  std::vector<size_t> frame_mb_bits;   // same, frame being written (swapped with mb_bits)
+  mutable std::mutex mb_bits_mutex;   // plan_slices and write_slice may run on different threads
   static std::uint8_t start_code[4];
+
+  void queue(std::vector<std::uint8_t>&&, const bool);
+  size_t queue_nal(const NALRefIdc, const NALType, const Bitstream&, std::vector<std::uint8_t>*, const bool);
   unsigned int log2_max_frame_num;
   unsigned int log2_max_pic_order_cnt_lsb;
 
   Bitstream seq_parameter_set_rbsp(const int, const int, const int);
   Bitstream pic_parameter_set_rbsp();
-  Bitstream write_slice_data(Frame&, Bitstream&);
+  Bitstream write_slice_data(Frame&, Bitstream&, const int, const int, std::vector<size_t>&);
   Bitstream mb_pred(MacroBlock&, Frame&);
-  Bitstream slice_layer_without_partitioning_rbsp(const int, Frame&);
-  Bitstream slice_header(const int);
+  Bitstream slice_layer_without_partitioning_rbsp(const int, Frame&, const int, const int, std::vector<size_t>&);
+  Bitstream slice_header(const int, const int, const DeblockingParams&, const int);
+  // QP of the PPS: the default Frame::get_qp, the slices code the difference with theirs
+  int pic_init_qp() const { return lossless ? -6 * (bit_depth - 8) : LUMA_QP; }
 };
 
 #endif
\ No newline at end of file
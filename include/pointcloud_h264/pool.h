@@ -0,0 +1,54 @@
+#ifndef POOL_H_
+#define POOL_H_
+
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <cstddef>
+
+/**
+ * Recycles objects across frames (frame jobs: Frame, planes, range image), so that the
+ * steady-state encoding loop does not allocate.
+ *
+ * acquire() returns a released object when there is one (its buffers keep their capacity,
+ * the caller overwrites the content) and creates a new one otherwise.
+ * Thread-safe: objects are acquired by the first pipeline stage and released by the last.
+ */
+template <typename T>
+class ObjectPool {
+public:
+  // 'reserve': expected number of objects in flight, the free list never grows beyond it (the
+  // objects released past it are destroyed, so release() does not allocate)
+  ObjectPool(const std::size_t reserve = 8) : capacity(reserve), created(0) { free_objects.reserve(reserve); }
+
+  std::unique_ptr<T> acquire() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!free_objects.empty()) {
+        std::unique_ptr<T> object = std::move(free_objects.back());
+        free_objects.pop_back();
+        return object;
+      }
+      created++;
+    }
+    return std::unique_ptr<T>(new T());
+  }
+
+  void release(std::unique_ptr<T>&& object) {
+    if (!object)
+      return;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (free_objects.size() < capacity)
+      free_objects.push_back(std::move(object));
+  }
+
+  std::size_t get_created() const { return created; }   // objects ever allocated
+
+private:
+  std::mutex mutex;
+  std::vector<std::unique_ptr<T>> free_objects;
+  std::size_t capacity;
+  std::size_t created;
+};
+
+#endif
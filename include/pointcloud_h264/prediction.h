@@ -6,6 +6,7 @@
 #include <functional>
 #include <tuple>
 #include <algorithm>
+#include <string>
 
 #include <opencv2/opencv.hpp>
 #include <opencv2/core/core.hpp>
@@ -22,16 +23,47 @@ using namespace cv;
 using namespace std;
 
 
-int encode_Y_intra16x16_block(MacroBlock&, std::vector<MacroBlock>&, Frame&);
-int encode_Y_intra4x4_block(int, MacroBlock&, MacroBlock&, std::vector<MacroBlock>&, Frame&);
+/* Effort of the mode decision, named after the x264 presets:
+ *   ultrafast  16x16 and chroma V/H/DC only, SAD
+ *   superfast  + plane modes (previous default: 16x16 only)
+ *   veryfast   + 4x4 V/H/DC, skipped on flat MBs
+ *   faster     + the 6 directional 4x4 modes
+ *   fast       SATD
+ *   medium     SATD, 4x4 always tried
+ *   slow       RD cost, all the modes
+ * The 4x4 search of a MB is always abandoned once it costs more than the 16x16 prediction.
+ */
+struct EncoderPreset {
+  std::string name;
+  IntraSearch search;
+  bool intra4x4;      // evaluate the 4x4 partition of the luma MB
+  int skip4x4;        // 4x4 is not tried when the 16x16 prediction costs less
+  int directions4x4;  // directional 4x4 modes tried: the strongest edge directions of the block, 0: all
+  int flat16x16;      // MBs with less gradient energy are coded 16x16 without trying 4x4, 0: never
+};
 
-int encode_Y_block(MacroBlock&, std::vector<MacroBlock>&, Frame&);
+const std::string DEFAULT_ENCODER_PRESET = "superfast";
+const int NB_ENCODER_PRESETS = 7;
 
-int encode_CbCr_intra8x8_block(MacroBlock&, std::vector<MacroBlock>&, Frame&);
+// Presets by level, from the fastest (0, ultrafast) to the slowest
+const EncoderPreset& get_encoder_preset(const int);
+// Level of the preset called 'name', -1 if unknown
+int find_encoder_preset(const std::string&);
 
-int encode_CbCr_block(MacroBlock&, std::vector<MacroBlock>&, Frame&);
 
-void encode_I_frame(Frame&);
+IntraChoice<Intra16x16Mode> encode_Y_intra16x16_block(MacroBlock&, std::vector<MacroBlock>&, Frame&, const IntraSearch&);
+IntraChoice<Intra4x4Mode> encode_Y_intra4x4_block(int, MacroBlock&, MacroBlock&, std::vector<MacroBlock>&, Frame&, const IntraSearch&,
+                                                  const Intra4x4Modes);
+
+int encode_Y_block(MacroBlock&, std::vector<MacroBlock>&, Frame&, const EncoderPreset&, const GradientAnalysis*);
+
+int encode_CbCr_intra8x8_block(MacroBlock&, std::vector<MacroBlock>&, Frame&, const IntraSearch&);
+
+int encode_CbCr_block(MacroBlock&, std::vector<MacroBlock>&, Frame&, const IntraSearch&);
+
+void encode_I_frame(Frame&, const EncoderPreset&);
+
+void deblocking_filter(std::vector<MacroBlock>&, const Frame&);
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,175 @@
+#ifndef PROJECTION_H_
+#define PROJECTION_H_
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+#include <opencv2/core/core.hpp>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include "cloud_layout.h"
+
+/**
+ * Spherical projection used to build the range images (pcl::RangeImage, LASER_FRAME,
+ * identity sensor pose) and the quantization of ranges to bit_depth samples.
+ *
+ * Sample 0 means "no return", ranges in [min_range, max_range] are mapped linearly to
+ * 1..2^bit_depth - 1 (255 at 8 bits: 47 cm steps over 120 m, 7 mm at 14 bits).
+ */
+struct ProjectionConfig {
+  float angular_resolution_x = 0.2f * (M_PI / 180.0f);   // radians per column
+  float angular_resolution_y = 0.2f * (M_PI / 180.0f);   // radians per row
+  float max_angle_width = 360.0f * (M_PI / 180.0f);      // horizontal FOV in radians
+  float max_angle_height = 26.8f * (M_PI / 180.0f);      // vertical FOV in radians
+  float min_range = 0.0f;     // metres, range of sample 1
+  float max_range = 120.0f;   // metres, range of the largest sample
+  int bit_depth = 8;          // bits per sample, 8 to 14 (16 bit samples above 8 bits)
+
+  // Size of the (uncropped) range image
+  int width() const { return static_cast<int>(std::lrint(std::floor(max_angle_width / angular_resolution_x))); }
+  int height() const { return static_cast<int>(std::lrint(std::floor(max_angle_height / angular_resolution_y))); }
+  int max_sample() const { return (1 << bit_depth) - 1; }
+
+  bool operator==(const ProjectionConfig&) const;
+  bool operator!=(const ProjectionConfig& other) const { return !(*this == other); }
+};
+
+// Range (metres) to sample, non finite or negative ranges -> 0
+inline std::uint16_t range_to_sample(const float range, const ProjectionConfig& config) {
+  if (!(range >= config.min_range))   // also rejects NaN and -inf
+    return 0;
+  float step = (config.max_range - config.min_range) / float(config.max_sample() - 1);
+  float level = (std::min(range, config.max_range) - config.min_range) / step;
+  return static_cast<std::uint16_t>(1 + std::lrint(level));
+}
+
+// Sample to range (metres), 0 -> 0 (invalid)
+inline float sample_to_range(const int sample, const ProjectionConfig& config) {
+  if (sample == 0)
+    return 0.0f;
+  return config.min_range + (sample - 1) * (config.max_range - config.min_range) / float(config.max_sample() - 1);
+}
+
+/**
+ * @brief Builds the encoder input from a range image: quantized ranges in Y, chroma at 128,
+ *        padded (replicating the borders) to a multiple of 16
+ *
+ * @param ranges Range image (pcl::RangeImage::getRangesArray), row major
+ * @return Single channel I420 image (see Frame::Frame), CV_8U at 8 bits, CV_16U above
+ */
+cv::Mat range_image_to_I420(const float*, const int, const int, const ProjectionConfig&);
+
+/**
+ * @brief Range image straight from the point buffer of a sensor_msgs::PointCloud2, same geometry
+ *        as pcl::RangeImage::createFromPointCloud (LASER_FRAME, identity pose, no noise, no cropping)
+ *
+ * @param data, width, height, row_step Points of the message
+ * @param layout Field offsets (CloudLayout::resolve)
+ * @param ranges Output, config.width() * config.height(): nearest return of each pixel, -inf if none
+ *
+ * @return Number of points that fell in the image
+ */
+size_t project_points(const std::uint8_t*, const std::uint32_t, const std::uint32_t, const std::uint32_t,
+                      const CloudLayout&, const ProjectionConfig&, float*);
+
+/**
+ * Fast projection of rotating LiDAR scans, O(N) in the number of points.
+ *
+ * Same geometry as project_points (and pcl::RangeImage), but the binning constants are computed
+ * once per configuration, the angles come from a polynomial atan2 (no asin, cos(elevation) is
+ * the horizontal over the full range) and the z-buffer works on the quantized samples, written
+ * straight into the luma plane of the encoder input.
+ *
+ * The point buffers are kept between calls: no allocation once the scan size is stable.
+ */
+class SphericalProjector {
+public:
+  SphericalProjector(const ProjectionConfig& = ProjectionConfig());
+
+  void set_config(const ProjectionConfig&);
+  const ProjectionConfig& get_config() const { return config; }
+
+  /**
+   * @brief Projects the points of a sensor_msgs::PointCloud2 to the encoder input
+   *
+   * @param data, width, height, row_step Points of the message
+   * @param layout Field offsets (CloudLayout::resolve)
+   * @param yuv Output, single channel I420 image as built by range_image_to_I420 (reallocated if needed)
+   * @param ranges Optional output, float range image as built by project_points
+   *
+   * @return Number of points that fell in the image
+   */
+  size_t project(const std::uint8_t*, const std::uint32_t, const std::uint32_t, const std::uint32_t,
+                 const CloudLayout&, cv::Mat&, float* = nullptr);
+
+private:
+  ProjectionConfig config;
+  int image_width;
+  int image_height;
+  float scale_x, scale_y;     // pixels per radian
+  float centre_x, centre_y;   // column of azimuth 0, row of elevation 0 (+ 0.5 for rounding)
+
+  // One entry per point of the last scan
+  std::vector<float> x, y, z;
+  std::vector<float> range;
+  std::vector<std::int32_t> pixel;   // position in the luma plane, -1 outside the image or invalid
+  std::vector<std::uint16_t> sample;
+
+  void build_constants();
+};
+
+// Structure of arrays point buffer
+struct PointBuffer {
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<float> z;
+  std::size_t size = 0;   // number of valid points (the vectors may be larger)
+};
+
+/**
+ * Converts decoded range planes back to 3D points.
+ *
+ * The unit direction of every pixel of the range image is computed once per projection
+ * configuration, so reprojection is a table look-up and 3 multiplications per pixel.
+ */
+class Reprojector {
+public:
+  Reprojector(const ProjectionConfig& = ProjectionConfig());
+
+  // Rebuilds the direction tables only if the configuration changed
+  void set_config(const ProjectionConfig&);
+  const ProjectionConfig& get_config() const { return config; }
+
+  // Samples (plane, stride, width, height) of a window at (offset_x, offset_y) of the range image,
+  // 16 bit planes above 8 bits
+  size_t reproject(const std::uint8_t*, const int, const int, const int, PointBuffer&, const int = 0, const int = 0) const;
+  size_t reproject(const std::uint16_t*, const int, const int, const int, PointBuffer&, const int = 0, const int = 0) const;
+  size_t reproject(const std::uint8_t*, const int, const int, const int, pcl::PointCloud<pcl::PointXYZ>&, const int = 0, const int = 0) const;
+  size_t reproject(const std::uint16_t*, const int, const int, const int, pcl::PointCloud<pcl::PointXYZ>&, const int = 0, const int = 0) const;
+
+  // Float ranges to points, one per pixel (no compaction), invalid ranges give (0, 0, 0)
+  void reproject_grid(const float*, const int, const int, const int, PointBuffer&, const int = 0, const int = 0) const;
+
+private:
+  ProjectionConfig config;
+  int table_width;
+  int table_height;
+  std::vector<float> dir_x;   // unit directions, table_width * table_height
+  std::vector<float> dir_y;
+  std::vector<float> dir_z;
+  std::vector<float> range_lut;   // sample -> range, 2^bit_depth entries
+
+  void build_tables();
+
+  template <typename Sample>
+  size_t reproject_points(const Sample*, const int, const int, const int, PointBuffer&, const int, const int) const;
+  template <typename Sample>
+  size_t reproject_cloud(const Sample*, const int, const int, const int, pcl::PointCloud<pcl::PointXYZ>&, const int, const int) const;
+};
+
+#endif
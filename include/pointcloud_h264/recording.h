@@ -0,0 +1,71 @@
+#ifndef RECORDING_H_
+#define RECORDING_H_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Index sidecar of a recorded H.264 stream ("<stream>.idx"), one entry per access unit:
+ *
+ *   "H264IDX1" (8 bytes), then IndexEntry records (32 bytes, little endian), in stream order.
+ *
+ * An access unit starts with the SPS/PPS written just before it (if any), 'header_size'
+ * bytes, followed by the slices of the frame.
+ */
+enum IndexFlags : std::uint8_t {
+  INDEX_KEYFRAME = 0x01,        // IDR access unit
+  INDEX_PARAMETER_SETS = 0x02   // starts with SPS + PPS
+};
+
+struct IndexEntry {
+  std::uint64_t stamp;        // header.stamp of the source cloud, nanoseconds
+  std::uint64_t offset;       // byte offset of the access unit in the stream
+  std::uint32_t size;         // bytes
+  std::uint32_t frame_num;
+  std::uint8_t flags;         // IndexFlags
+  std::uint8_t reserved;
+  std::uint16_t header_size;  // bytes of SPS + PPS at the start of the access unit
+  std::uint32_t reserved2;
+};
+
+static_assert(sizeof(IndexEntry) == 32, "IndexEntry must be 32 bytes");
+
+extern const char INDEX_MAGIC[8];
+
+/**
+ * Random access to a recorded stream through its index.
+ *
+ * Every extracted range starts with the last parameter sets of the stream before it, so
+ * it can be decoded on its own (all frames are IDR).
+ */
+class RecordingReader {
+public:
+  RecordingReader();
+  ~RecordingReader();
+
+  // Opens '<stream>' and '<stream>.idx'
+  bool open(const std::string&);
+
+  std::size_t size() const { return entries.size(); }
+  const IndexEntry& entry(const std::size_t i) const { return entries[i]; }
+
+  // Binary searches, O(log n). -1 if not found
+  long find_frame(const std::uint32_t) const;
+  long find_stamp(const std::uint64_t) const;   // last access unit with stamp <= t
+
+  // Annex B stream of the access units [first, last), decodable on its own
+  std::vector<std::uint8_t> extract(const std::size_t, const std::size_t) const;
+  // Same split in one chunk per thread, read concurrently
+  std::vector<std::vector<std::uint8_t>> extract_parallel(const std::size_t, const std::size_t, const int) const;
+
+private:
+  int fd;
+  std::vector<IndexEntry> entries;
+  std::vector<long> parameter_sets;   // entry holding the parameter sets that apply to each entry
+
+  bool read_at(std::uint8_t*, const std::size_t, const std::uint64_t) const;
+};
+
+#endif
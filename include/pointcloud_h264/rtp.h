@@ -0,0 +1,74 @@
+#ifndef RTP_H_
+#define RTP_H_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include <netinet/in.h>
+
+/**
+ * RTP payload format for H.264 (RFC 6184, non-interleaved mode):
+ *   - NAL units that fit in a packet are sent as they are (single NAL unit packet)
+ *   - consecutive small NAL units (SPS + PPS) are aggregated in one STAP-A packet
+ *   - larger NAL units are fragmented in FU-A packets
+ * The marker bit is set on the last packet of each access unit.
+ */
+class RtpPacketizer {
+public:
+  RtpPacketizer(const std::uint32_t, const std::uint8_t = 96, const std::size_t = 1400);
+
+  // Annex B access unit -> RTP packets (header included)
+  std::vector<std::vector<std::uint8_t>> packetize(const std::uint8_t*, const std::size_t, const std::uint32_t);
+
+private:
+  std::uint32_t ssrc;
+  std::uint8_t payload_type;
+  std::size_t max_payload;    // RTP payload size limit (MTU - IP/UDP/RTP headers)
+  std::uint16_t sequence_number;
+
+  std::vector<std::uint8_t> new_packet(const std::uint32_t);
+};
+
+/**
+ * Rebuilds Annex B access units from RTP packets (single NAL, STAP-A and FU-A).
+ * A lost packet drops the NAL unit it belongs to.
+ */
+class RtpDepacketizer {
+public:
+  RtpDepacketizer();
+
+  // Returns true when the packet completed an access unit (marker bit)
+  bool push(const std::uint8_t*, const std::size_t);
+
+  // Last completed access unit, Annex B
+  const std::vector<std::uint8_t>& access_unit() const { return completed; }
+  std::size_t get_lost() const { return lost; }
+
+private:
+  std::vector<std::uint8_t> current;
+  std::vector<std::uint8_t> completed;
+  std::vector<std::uint8_t> fragment;   // FU-A being rebuilt
+  bool in_fragment;
+  bool has_sequence;
+  std::uint16_t next_sequence;
+  std::size_t lost;
+
+  void append_nal(const std::uint8_t*, const std::size_t);
+};
+
+// Sends RTP packets to a UDP destination
+class RtpSender {
+public:
+  RtpSender(const std::string&, const int);
+  ~RtpSender();
+
+  void send(const std::vector<std::vector<std::uint8_t>>&);
+
+private:
+  int fd;
+  struct sockaddr_in destination;
+};
+
+#endif
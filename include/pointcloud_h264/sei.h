@@ -0,0 +1,37 @@
+#ifndef SEI_H_
+#define SEI_H_
+
+#include <cstdint>
+#include <cstddef>
+
+#include "bitstream.h"
+#include "projection.h"
+
+/**
+ * Everything needed to turn a decoded frame back into points, carried in the stream as a
+ * user_data_unregistered SEI message (payloadType 5) in front of the slices of each frame.
+ *
+ * Payload (big endian): 16 bytes UUID, version (u8), bit depth (u8), quantization curve (u8,
+ * 0 = linear), 13 float32 (resolution x/y, FOV width/height, min/max range, sensor pose),
+ * stamp (u64, ns), frame number (u32).
+ */
+struct ProjectionMetadata {
+  ProjectionConfig config;      // bit depth included
+  float sensor_pose[7] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f};   // translation x, y, z (m), quaternion x, y, z, w
+  std::uint64_t stamp = 0;      // header.stamp of the source cloud, ns
+  std::uint32_t frame_num = 0;
+};
+
+extern const std::uint8_t PROJECTION_SEI_UUID[16];
+
+// SEI RBSP (without NAL header) holding one projection metadata message
+Bitstream projection_sei_rbsp(const ProjectionMetadata&);
+
+/**
+ * @brief Looks for a projection metadata message in a SEI RBSP
+ *
+ * @return true if found and well formed, 'metadata' is left unchanged otherwise
+ */
+bool parse_projection_sei(const std::uint8_t*, const std::size_t, ProjectionMetadata&);
+
+#endif
@@ -4,12 +4,17 @@
 #include <array>
 #include <vector>
 #include <tuple>
+#include <algorithm>
+#include <cstdlib>
 
 #include "frame.h"
 #include "macroblock.h"
 #include "vlc.h"
+#include "tr_qt.h"
+#include "cabac.h"
 
 void vlc_frame(Frame&);
+void cabac_frame(Frame&);
 Bitstream vlc_Y_DC(MacroBlock&, std::vector<std::array<int, 16>>&, Frame&);
 Bitstream vlc_Y(int, MacroBlock&, std::vector<std::array<int, 16>>&, Frame&);
 Bitstream vlc_Cb_DC(MacroBlock&);
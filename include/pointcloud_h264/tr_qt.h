@@ -2,6 +2,8 @@
 #define TR_QT_H_
 
 #include <cmath>
+#include <cstdint>
+#include <cstdlib>
 #include "block.h"
 
 // MAX QP for luma is 51, MAX QP for chroma is 39
@@ -9,6 +11,20 @@
 const int LUMA_QP = 51;
 const int CHROMA_QP = 39;
 
+/* QPc as a function of qPI (chroma_qp_index_offset already added)
+ */
+const int chroma_qp_table[52] = {
+  0 , 1 , 2 , 3 , 4 , 5 , 6 , 7 , 8 , 9 ,
+  10, 11, 12, 13, 14, 15, 16, 17, 18, 19,
+  20, 21, 22, 23, 24, 25, 26, 27, 28, 29,
+  29, 30, 31, 32, 32, 33, 34, 34, 35, 35,
+  36, 36, 37, 37, 37, 38, 38, 38, 39, 39,
+  39, 39
+};
+
+// chroma_qp_index_offset of the PPS: chroma_qp_table[LUMA_QP + CHROMA_QP_INDEX_OFFSET] is CHROMA_QP
+const int CHROMA_QP_INDEX_OFFSET = -3;
+
 const int mat_MF[6][3] = {
   {13107, 5243, 8066},
   {11916, 4660, 7490},
@@ -35,16 +51,58 @@ void forward_quantize4x4(const int[][4], int[][4], const int);
 void forward_DC_quantize4x4(const int [][4], int [][4], const int);
 void forward_quantize2x2(const int[][2], int[][2], const int);
 
+void inverse_dct4x4(const int[][4], int[][4]);
+void inverse_hadamard4x4(const int[][4], int[][4]);
+void inverse_hadamard2x2(const int[][2], int[][2]);
+
+void inverse_quantize4x4(const int[][4], int[][4], const int);
+void inverse_DC_quantize4x4(const int[][4], int[][4], const int);
+void inverse_quantize2x2(const int[][2], int[][2], const int);
+
 // Main QDCT function used as an expandable funciton
 template <typename T>
 inline void forward_qdct(T&, const int, const int);
 
 inline void forward_qdct4x4(Block4x4, const int);
 
-// Public interface
-void qdct_luma16x16_intra(Block16x16&);
-void qdct_chroma8x8_intra(Block8x8&);
-void qdct_luma4x4_intra(Block4x4);
+template <typename T>
+inline void inverse_qdct(T&, const int, const int);
+
+inline void inverse_qdct4x4(Block4x4, const int);
+
+// Public interface, the QPs are QP'Y and QP'C (QP_Y / QP_C + QpBdOffset above 8 bits)
+void qdct_luma16x16_intra(Block16x16&, const int = LUMA_QP);
+void qdct_chroma8x8_intra(Block8x8&, const int = CHROMA_QP);
+void qdct_luma4x4_intra(Block4x4, const int = LUMA_QP);
+
+// Coefficients (as left by the forward QDCT) to residual, in place
+void iqdct_luma16x16_intra(Block16x16&, const int);
+void iqdct_chroma8x8_intra(Block8x8&, const int);
+void iqdct_luma4x4_intra(Block4x4, const int);
+
+/* Transform bypass (lossless, QP'Y 0): the residual is coded as is. After a vertical or horizontal
+ * prediction, a sample is coded as the difference with the residual above it / on its left (8.5.15).
+ */
+template <int N>
+void forward_bypass_dpcm(BlockView<N, N> residual, const bool horizontal) {
+  for (int k = N - 1; k > 0; k--)
+    for (int l = 0; l < N; l++) {
+      if (horizontal)
+        residual(l, k) -= residual(l, k - 1);
+      else
+        residual(k, l) -= residual(k - 1, l);
+    }
+}
 
+template <int N>
+void inverse_bypass_dpcm(BlockView<N, N> residual, const bool horizontal) {
+  for (int k = 1; k < N; k++)
+    for (int l = 0; l < N; l++) {
+      if (horizontal)
+        residual(l, k) += residual(l, k - 1);
+      else
+        residual(k, l) += residual(k - 1, l);
+    }
+}
 
 #endif
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include <cstdint>
 
 #include "block.h"
+#include "arena.h"
 #include "bitstream.h"
 
 const int me[] = {
@@ -22,16 +23,32 @@ const int me[] = {
 	14, 15, 0
 };
 
-typedef std::string (*level_VLC_encoder)(int);
+/* Zig-zag scan
+ * scan index -> raster position in the 4x4 block (inverse of mat_zigzag4x4 in vlc.cpp)
+ */
+const int zigzag_scan4x4[16] = {
+  0, 1, 4, 8,
+  5, 2, 3, 6,
+  9, 12, 13, 10,
+  7, 11, 14, 15
+};
+
+// CAVLC code tables (see vlc.cpp), the decoder builds its look-up tables from them
+extern std::string num_vlc_table[6][17][4];
+extern std::string zero_vlc_table[16][17];
+extern std::string zero_vlc_table2x2[4][4];
+extern std::string run_vlc_table[15][8];
+
+typedef ArenaString (*level_VLC_encoder)(int);
 
 // Level VLC tables
-std::string level_VLC_0(int level_code);
-std::string level_VLC_1(int level_code);
-std::string level_VLC_2(int level_code);
-std::string level_VLC_3(int level_code);
-std::string level_VLC_4(int level_code);
-std::string level_VLC_5(int level_code);
-std::string level_VLC_6(int level_code);
+ArenaString level_VLC_0(int level_code);
+ArenaString level_VLC_1(int level_code);
+ArenaString level_VLC_2(int level_code);
+ArenaString level_VLC_3(int level_code);
+ArenaString level_VLC_4(int level_code);
+ArenaString level_VLC_5(int level_code);
+ArenaString level_VLC_6(int level_code);
 
 /**
  * @brief Unsigned Exponential Golomb Coding
@@ -45,17 +62,6 @@ Bitstream uegc(const unsigned int);
  */
 Bitstream segc(const int);
 
-/**
- * @brief       Performs 4x4 CAVLC encoding
- * 
- * @param block Transform coefficients 4x4 input block
- * @param nC    Number of non-zero coefficients in neighbouring blocks
- * @param maxNumCoeff 15 or 16?
- * 
- * @return  Bitstream object initialized with the final string
- */
-std::pair<Bitstream, int> cavlc_block2x2(Block2x2, const int, const int);
-
 /**
  * @brief       Performs 2x2 CAVLC encoding
  * 
@@ -68,6 +74,21 @@ std::pair<Bitstream, int> cavlc_block2x2(Block2x2, const int, const int);
  * @note  The procedure is the same as in the 4x4 CAVLC, except for the indexes.
  *        Comments in 4x4 CAVLC also apply here
  */
-std::pair<Bitstream, int> cavlc_block4x4(Block4x4, const int, const int);
+std::pair<Bitstream, int> cavlc_block2x2(Block2x2, const int, const int);
+
+/**
+ * @brief       Performs 4x4 CAVLC encoding
+ * 
+ * @param block Transform coefficients 4x4 input block
+ * @param nC    Number of non-zero coefficients in neighbouring blocks
+ * @param maxNumCoeff 15 (AC block) or 16
+ * @param skip_dc The DC coefficient of the block is coded apart (AC block), it is read as 0
+ * 
+ * @return  Bitstream object initialized with the final string
+ */
+std::pair<Bitstream, int> cavlc_block4x4(Block4x4, const int, const int, const bool = false);
+
+// Intra16x16 luma DC coefficients (16 coefficients, one per 4x4 block)
+std::pair<Bitstream, int> cavlc_block4x4(DCBlock4x4, const int, const int);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,142 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cmath>
+#include <limits>
+#include <cstdlib>
+
+#include "packager.h"
+#include "prediction.h"
+#include "top_encoding.h"
+#include "projection.h"
+#include "alloc_counter.h"
+#include "arena.h"
+
+using namespace std;
+
+/*
+*   Steady-state allocation check of the encoder without ROS: encodes synthetic range images
+*   through the stages of pointcloud_h264_node (Frame::load, encode_I_frame, vlc_frame or
+*   cabac_frame, write_slice, each stage after the first in its own frame arena) and fails if
+*   a frame allocates once the warm-up frames are encoded.
+*
+*   The range images cycle through NB_SCENES scenes, so the buffers reach their high-water
+*   mark during the warm-up. Allocations of each stage go to stdout.
+*
+*   usage: pointcloud_h264_alloc_check [<cavlc|cabac> [<max_slice_bytes> [<bit_depth> [<frames> [<warm-up>]]]]]
+*/
+
+const int NB_SCENES = 4;
+
+// Stage 0 to 3, as in the node
+enum { STAGE_LOAD, STAGE_PREDICTION, STAGE_ENTROPY, STAGE_PACKING, NB_STAGES };
+
+// Ground plane, walls and objects at varying distances, no return above the horizon and in gaps
+void synthetic_ranges(const int scene, const int width, const int height, vector<float>& ranges)
+{
+    for (int v = 0; v < height; v++)
+        for (int u = 0; u < width; u++) {
+            float range;
+            if (v < height / 4 && (u / 64 + scene) % 3 == 0)
+                range = -numeric_limits<float>::infinity();   // sky
+            else if (v > height * 2 / 3)
+                range = 3.0f + 40.0f / (v - height * 2 / 3 + 1);   // ground
+            else
+                range = 8.0f + 30.0f * (0.5f + 0.5f * sin(u * 0.013f + scene)) + ((u * 7 + v * 13 + scene) % 5) * 0.05f;
+            if ((u / 40 + v / 8 + scene) % 11 == 0)
+                range = -numeric_limits<float>::infinity();   // gaps
+            ranges[v * width + u] = range;
+        }
+}
+
+int main(int argc, char** argv)
+{
+    string entropy_name = (argc > 1) ? argv[1] : "cavlc";
+    size_t max_slice_bytes = (argc > 2) ? atoi(argv[2]) : 0;
+    int bit_depth = (argc > 3) ? atoi(argv[3]) : 8;
+    int nb_frames = (argc > 4) ? atoi(argv[4]) : 40;
+    int warm_up = (argc > 5) ? atoi(argv[5]) : 2 * NB_SCENES;
+    if ((entropy_name != "cavlc" && entropy_name != "cabac") || bit_depth < 8 || bit_depth > 14) {
+        cerr << "usage: " << argv[0]
+             << " [<cavlc|cabac> [<max_slice_bytes> [<bit_depth> [<frames> [<warm-up>]]]]]" << endl;
+        return 1;
+    }
+    EntropyCoding entropy_coding = (entropy_name == "cabac") ? EntropyCoding::CABAC : EntropyCoding::CAVLC;
+
+    ProjectionConfig projection;
+    projection.bit_depth = bit_depth;
+    const int width = projection.width(), height = projection.height();
+
+    // Encoder inputs built up front: only the encoding is checked
+    vector<cv::Mat> scenes;
+    vector<float> ranges(width * height);
+    for (int scene = 0; scene < NB_SCENES; scene++) {
+        synthetic_ranges(scene, width, height, ranges);
+        scenes.push_back(range_image_to_I420(ranges.data(), width, height, projection));
+    }
+
+    Packager packager("/dev/null", FsyncPolicy::NONE, 16, entropy_coding, false, bit_depth);
+    unique_ptr<Frame> frame;
+    vector<int> first_mbs;
+    FrameArena arenas[NB_STAGES];
+    int failed = 0;
+
+    for (int n = 0; n < nb_frames; n++) {
+        size_t allocations[NB_STAGES];
+
+        size_t start = get_thread_allocations();
+        if (frame)
+            frame->load(scenes[n % NB_SCENES]);
+        else
+            frame.reset(new Frame(scenes[n % NB_SCENES]));
+        if (max_slice_bytes > 0) {
+            packager.plan_slices(*frame, max_slice_bytes, first_mbs);
+            frame->set_slices(first_mbs);
+        }
+        frame->bit_depth = bit_depth;
+        if (n == 0) {
+            packager.write_SPS(frame->width, frame->height, 76);
+            packager.write_PPS();
+        }
+        allocations[STAGE_LOAD] = get_thread_allocations() - start;
+
+        for (int stage = STAGE_PREDICTION; stage < NB_STAGES; stage++) {
+            start = get_thread_allocations();
+            {
+                ArenaScope scope(arenas[stage]);
+                if (stage == STAGE_PREDICTION)
+                    encode_I_frame(*frame, get_encoder_preset(find_encoder_preset(DEFAULT_ENCODER_PRESET)));
+                else if (stage == STAGE_ENTROPY && entropy_coding == EntropyCoding::CABAC)
+                    cabac_frame(*frame);
+                else if (stage == STAGE_ENTROPY)
+                    vlc_frame(*frame);
+                else
+                    packager.write_slice(n, *frame);
+            }
+            arenas[stage].reset();
+            allocations[stage] = get_thread_allocations() - start;
+        }
+
+        // frame, allocations of each stage
+        size_t total = 0;
+        cout << n;
+        for (int stage = 0; stage < NB_STAGES; stage++) {
+            cout << " " << allocations[stage];
+            total += allocations[stage];
+        }
+        cout << endl;
+
+        if (n >= warm_up && total > 0) {
+            cerr << "Frame " << n << ": " << total << " heap allocations in the steady-state encoding loop" << endl;
+            failed++;
+        }
+    }
+
+    if (failed > 0) {
+        cerr << failed << " of " << nb_frames - warm_up << " frames allocated after the warm-up" << endl;
+        return 1;
+    }
+    cout << "No allocation after " << warm_up << " warm-up frames" << endl;
+    return 0;
+}
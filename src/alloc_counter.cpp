@@ -0,0 +1,53 @@
+#include "alloc_counter.h"
+
+#include <new>
+#include <atomic>
+#include <cstdlib>
+
+namespace {
+
+thread_local std::size_t thread_allocations = 0;
+std::atomic<std::size_t> total_allocations(0);
+
+void* allocate(std::size_t size) {
+  thread_allocations++;
+  total_allocations.fetch_add(1, std::memory_order_relaxed);
+  void* p = std::malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+}   // namespace
+
+std::size_t get_thread_allocations() {
+  return thread_allocations;
+}
+
+std::size_t get_total_allocations() {
+  return total_allocations.load(std::memory_order_relaxed);
+}
+
+bool allocations_counted() {
+  return true;
+}
+
+// Replacements of the global allocation functions
+void* operator new(std::size_t size) { return allocate(size); }
+void* operator new[](std::size_t size) { return allocate(size); }
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  try {
+    return allocate(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+void* operator new[](std::size_t size, const std::nothrow_t& tag) noexcept { return operator new(size, tag); }
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, std::size_t) noexcept { operator delete[](p); }
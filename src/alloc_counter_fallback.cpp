@@ -0,0 +1,11 @@
+#include "alloc_counter.h"
+
+/*
+    Counters of the encoder nodelet library, which cannot replace operator new: weak
+    definitions, interposed by alloc_counter.cpp when the executable that loads the library
+    links it and exports its symbols (pointcloud_h264_node). In any other nodelet manager
+    nothing is counted.
+*/
+__attribute__((weak)) std::size_t get_thread_allocations() { return 0; }
+__attribute__((weak)) std::size_t get_total_allocations() { return 0; }
+__attribute__((weak)) bool allocations_counted() { return false; }
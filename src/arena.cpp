@@ -0,0 +1,45 @@
+#include "arena.h"
+
+#include <algorithm>
+
+thread_local FrameArena* FrameArena::thread_arena = nullptr;
+
+FrameArena::FrameArena(const std::size_t _block_size)
+: block_size(_block_size), current(0), offset(0), used(0), capacity(0), high_water(0) {}
+
+FrameArena* FrameArena::current_arena() {
+  return thread_arena;
+}
+
+/**
+ * @brief Bumps the offset in the current block, moves to the next block of the chain (or
+ *        appends a new one) when it is full
+ *
+ * @param size  Bytes
+ * @param align Power of two
+ */
+void* FrameArena::allocate(const std::size_t size, const std::size_t align) {
+  while (current < blocks.size()) {
+    Block& block = blocks[current];
+    std::uintptr_t base = reinterpret_cast<std::uintptr_t>(block.data.get());
+    std::size_t start = ((base + offset + align - 1) & ~(std::uintptr_t)(align - 1)) - base;
+    if (start + size <= block.size) {
+      offset = start + size;
+      used += size;
+      high_water = std::max(high_water, used);
+      return block.data.get() + start;
+    }
+    current++;
+    offset = 0;
+  }
+
+  // Chain exhausted (first frames): requests larger than a block get a block of their own
+  Block block;
+  block.size = std::max(block_size, size + align);
+  block.data.reset(new std::uint8_t[block.size]);
+  capacity += block.size;
+  blocks.push_back(std::move(block));
+  current = blocks.size() - 1;
+  offset = 0;
+  return allocate(size, align);
+}
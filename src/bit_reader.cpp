@@ -0,0 +1,74 @@
+#include "bit_reader.h"
+
+BitReader::BitReader(const std::uint8_t* payload, std::size_t payload_size)
+: data(payload), size(payload_size), byte_pos(0), bit_pos(0), cache(0), cache_bits(0)
+{
+  // Locate the rbsp_stop_one_bit (last bit set in the payload)
+  last_one_pos = 0;
+  for (std::size_t i = size; i > 0; i--) {
+    if (data[i-1] != 0) {
+      last_one_pos = (i-1) * 8 + (7 - __builtin_ctz(data[i-1]));
+      break;
+    }
+  }
+
+  refill();
+}
+
+/**
+ * @brief Loads bytes into the cache until it holds at least 57 bits.
+ *        Past the end of the payload, zero bytes are loaded.
+ */
+void BitReader::refill() {
+  while (cache_bits <= 56) {
+    std::uint64_t byte = (byte_pos < size) ? data[byte_pos] : 0;
+    cache |= byte << (56 - cache_bits);
+    cache_bits += 8;
+    byte_pos++;
+  }
+}
+
+/**
+ * @brief Unsigned Exponential Golomb decoding, ue(v)
+ *
+ * @return codeNum
+ */
+std::uint32_t BitReader::read_ue() {
+  int leading_zero_bits = leading_zeros();
+  if (leading_zero_bits > 31) {   // malformed stream, consume the zeros
+    skip(32);
+    return 0;
+  }
+
+  skip(leading_zero_bits + 1);
+  return ((1u << leading_zero_bits) - 1) + read(leading_zero_bits);
+}
+
+/**
+ * @brief Signed Exponential Golomb decoding, se(v)
+ *
+ * @return Mapped signed value (1 -> 1, 2 -> -1, 3 -> 2, ...)
+ */
+std::int32_t BitReader::read_se() {
+  std::uint32_t codenum = read_ue();
+  if (codenum & 1)
+    return static_cast<std::int32_t>((codenum + 1) >> 1);
+  return -static_cast<std::int32_t>(codenum >> 1);
+}
+
+// Skips bits up to the next byte boundary
+void BitReader::align() {
+  if (bit_pos & 7)
+    skip(8 - (bit_pos & 7));
+}
+
+std::size_t BitReader::bits_left() const {
+  return (bit_pos < size * 8) ? size * 8 - bit_pos : 0;
+}
+
+/**
+ * @return true if there is more data in the RBSP before the rbsp_trailing_bits
+ */
+bool BitReader::more_rbsp_data() const {
+  return bit_pos < last_one_pos;
+}
@@ -39,12 +39,9 @@ Bitstream::Bitstream(std::uint8_t bits[], int digit) {
 /**
  * @brief Construct a new Bitstream from other Bitstream
  * 
- * @param a The bitstream to be copied
+ * @param a The bitstream to be copied, its allocator (heap or arena) is kept
  */
-Bitstream::Bitstream(const Bitstream& a) {
-  nb_bits = a.nb_bits;
-  buffer.insert(buffer.end(), a.buffer.begin(), a.buffer.end());
-}
+Bitstream::Bitstream(const Bitstream& a) : nb_bits(a.nb_bits), buffer(a.buffer) {}
 
 /**
  * @brief Construct a variable sized bitstream from a string bitset
@@ -52,17 +49,34 @@ Bitstream::Bitstream(const Bitstream& a) {
  * @param s The string to be converted to a Bitstream object
  */
 Bitstream::Bitstream(const std::string& s) {
-  nb_bits = s.size();
-  int nb_int = nb_bits % 8 == 0 ? nb_bits/8: nb_bits/8 + 1;
-  int trail_bits = nb_bits % 8;
-  
-  for (int i = 0; i < nb_int - 1; i++)
-    buffer.push_back( (std::bitset<8>(s.substr(i*8, 8)).to_ulong()) );
+  from_chars(s.data(), s.size());
+}
 
-  if (trail_bits != 0)
-    buffer.push_back( (std::bitset<8>(s.substr((nb_int-1)*8, trail_bits)).to_ulong() << (8-trail_bits)) );
-  else
-    buffer.push_back( (std::bitset<8>(s.substr((nb_int-1)*8, 8)).to_ulong()) );
+/**
+ * @brief Same as above, from a string built in the frame arena (CAVLC)
+ */
+Bitstream::Bitstream(const ArenaString& s) {
+  from_chars(s.data(), s.size());
+}
+
+/**
+ * @brief Packs a string of '0' and '1' into bytes, MSb first (the last byte is padded with zeros)
+ */
+void Bitstream::from_chars(const char* s, const std::size_t size) {
+  nb_bits = size;
+  buffer.reserve((size + 7) / 8);
+
+  std::uint8_t byte = 0;
+  for (std::size_t i = 0; i < size; i++) {
+    byte = (byte << 1) | (s[i] == '1');
+    if (i % 8 == 7) {
+      buffer.push_back(byte);
+      byte = 0;
+    }
+  }
+
+  if (size % 8 != 0)
+    buffer.push_back(byte << (8 - size % 8));
 }
 
 /**
@@ -87,11 +101,11 @@ Bitstream::Bitstream(const unsigned int cui, int digit) {
   unsigned int ui = cui << (32 - digit);
   if (digit >= 0)
     buffer.push_back((std::uint8_t)(ui >> 24));
-  if (digit >= 8)
+  if (digit > 8)
     buffer.push_back((std::uint8_t)(ui >> 16));
-  if (digit >= 16)
+  if (digit > 16)
     buffer.push_back((std::uint8_t)(ui >> 8));
-  if (digit >= 24)
+  if (digit > 24)
     buffer.push_back((std::uint8_t)(ui));
 }
 
@@ -196,30 +210,22 @@ Bitstream Bitstream::rbsp_trailing_bits() {
   return rbsp;
 }
 
-/* This function add emulation_prevention_three_byte for all occurrences
- * of the following byte sequences in the stream
- *  0x000000  -> 0x00000300
- *  0x000001  -> 0x00000301
- *  0x000002  -> 0x00000302
- *  0x000003  -> 0x00000303
- */
-Bitstream Bitstream::rbsp_to_ebsp() {
-  
+namespace {
+
+template <typename Output>
+void append_ebsp(const Bitstream::Buffer& rbsp, const int nb_bits, Output& output) {
+
   assert(nb_bits % 8 == 0);
 
-  // output: ebsp
-  Bitstream ebsp;
   int count = 0;
 
-  for (const auto& byte : buffer) {
+  for (const auto& byte : rbsp) {
     // Detect 0x00 twice
     if (count == 2 && !(byte & 0xfc)) {
-      ebsp.buffer.push_back(0x03);
-      ebsp.nb_bits += 8;
+      output.push_back(0x03);
       count = 0;
     }
-    ebsp.buffer.push_back(byte);
-    ebsp.nb_bits += 8;
+    output.push_back(byte);
     if (byte == 0x00) {
       count++;
     }
@@ -227,10 +233,31 @@ Bitstream Bitstream::rbsp_to_ebsp() {
       count = 0;
     }
   }
+}
 
+}   // namespace
+
+/* This function add emulation_prevention_three_byte for all occurrences
+ * of the following byte sequences in the stream
+ *  0x000000  -> 0x00000300
+ *  0x000001  -> 0x00000301
+ *  0x000002  -> 0x00000302
+ *  0x000003  -> 0x00000303
+ */
+Bitstream Bitstream::rbsp_to_ebsp() {
+  Bitstream ebsp;
+  append_ebsp(buffer, nb_bits, ebsp.buffer);
+  ebsp.nb_bits = ebsp.buffer.size() * 8;
   return ebsp;
 }
 
+/**
+ * @brief Same as rbsp_to_ebsp(), appending the EBSP to 'output' (e.g. a recycled NAL buffer)
+ */
+void Bitstream::rbsp_to_ebsp(std::vector<std::uint8_t>& output) const {
+  append_ebsp(buffer, nb_bits, output);
+}
+
 /**
  * @brief Converts the bitstream to string
  * 
@@ -0,0 +1,298 @@
+#include "deblocking.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+
+#include "intra.h"
+#include "tr_qt.h"
+
+/**
+ * In-loop deblocking filter (H.264 8.7)
+ *
+ * The MBs are filtered in raster order; inside a MB the vertical edges go first (left to
+ * right), then the horizontal edges (top to bottom), luma and both chroma planes.
+ * An edge is filtered in one go: the samples across it (p3..q3) of its 16 (luma) or 8
+ * (chroma) lines are copied to a small array, filtered with branchless loops over the
+ * lines (vectorized by the compiler) and copied back. The arrays are 16 bits, whatever the
+ * planes (8 lines per SSE register): 14 bit samples still fit, the sums are computed in int.
+ *
+ * Above 8 bits alpha, beta and tC0 are scaled by 2^(BitDepth - 8) (8-461, 8-462, 8-465) and
+ * the samples clipped to 2^BitDepth - 1.
+ */
+
+namespace {
+
+// alpha' (Table 8-16), indexed by indexA
+const int alpha_table[52] = {
+  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+  4,   4,   5,   6,   7,   8,   9,  10,  12,  13,  15,  17,  20,  22,  25,  28,
+  32,  36,  40,  45,  50,  56,  63,  71,  80,  90, 101, 113, 127, 144, 162, 182,
+  203, 226, 255, 255
+};
+
+// beta' (Table 8-16), indexed by indexB
+const int beta_table[52] = {
+  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+  2,  2,  2,  3,  3,  3,  3,  4,  4,  4,  6,  6,  7,  7,  8,  8,
+  9,  9, 10, 10, 11, 11, 12, 12, 13, 13, 14, 14, 15, 15, 16, 16,
+  17, 17, 18, 18
+};
+
+// tC0 (Table 8-17), indexed by indexA and bS - 1
+const int tc0_table[52][3] = {
+  {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0},
+  {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0},
+  {0, 0, 0}, {0, 0, 1}, {0, 0, 1}, {0, 0, 1}, {0, 0, 1}, {0, 1, 1}, {0, 1, 1}, {1, 1, 1},
+  {1, 1, 1}, {1, 1, 1}, {1, 1, 1}, {1, 1, 2}, {1, 1, 2}, {1, 1, 2}, {1, 1, 2}, {1, 2, 3},
+  {1, 2, 3}, {2, 2, 3}, {2, 2, 4}, {2, 3, 4}, {2, 3, 4}, {3, 3, 5}, {3, 4, 6}, {3, 4, 6},
+  {4, 5, 7}, {4, 5, 8}, {4, 6, 9}, {5, 7, 10}, {6, 8, 11}, {6, 8, 13}, {7, 10, 14}, {8, 11, 16},
+  {9, 12, 18}, {10, 13, 20}, {11, 15, 23}, {13, 17, 25}
+};
+
+// Thresholds of an edge, from the average QP of its two sides
+struct EdgeFilter {
+  int bS;
+  int alpha;
+  int beta;
+  int tc0;
+  int max_sample;
+
+  EdgeFilter(const int _bS, const int qp_av, const DeblockingParams& params, const int bit_depth)
+  : bS(_bS), max_sample((1 << bit_depth) - 1) {
+    int index_a = clip(qp_av + 2 * params.alpha_offset_div2, 0, 51);
+    int index_b = clip(qp_av + 2 * params.beta_offset_div2, 0, 51);
+    alpha = alpha_table[index_a] << (bit_depth - 8);
+    beta = beta_table[index_b] << (bit_depth - 8);
+    tc0 = (bS < 4) ? tc0_table[index_a][bS - 1] << (bit_depth - 8) : 0;
+  }
+
+  // alpha or beta 0: no sample can pass the thresholds
+  bool active() const { return bS > 0 && alpha > 0 && beta > 0; }
+};
+
+/* Samples across an edge: s[k][i] is sample k of line i, k = 0 .. 2K-1 going from p(K-1) to
+ * q(K-1) (p0 = K-1, q0 = K). 'across' is the distance between two samples of a line (1 for a
+ * vertical edge, the stride for a horizontal one), 'along' between two lines.
+ */
+template <int K, int N, typename T>
+inline void load_edge(const T* q0, const int across, const int along, std::int16_t (&s)[2 * K][N]) {
+  for (int k = 0; k < 2 * K; k++)
+    for (int i = 0; i < N; i++)
+      s[k][i] = q0[(k - K) * across + i * along];
+}
+
+// Stores samples first .. 2K-1-first of each line (the ones the filter can change)
+template <int K, int N, typename T>
+inline void store_edge(T* q0, const int across, const int along, const std::int16_t (&s)[2 * K][N], const int first) {
+  for (int k = first; k < 2 * K - first; k++)
+    for (int i = 0; i < N; i++)
+      q0[(k - K) * across + i * along] = static_cast<T>(s[k][i]);
+}
+
+// Clip3 of the standard, by value: clip() goes through references that keep the loops from vectorizing
+inline int clip3(const int lower, const int upper, const int x) {
+  return (x < lower) ? lower : (x > upper) ? upper : x;
+}
+
+/* Lines of an edge that pass the thresholds (8-460): the samples on each side are close,
+ * the step across the edge is not a real one (under alpha)
+ */
+inline int filter_line(const int p1, const int p0, const int q0, const int q1, const int alpha, const int beta) {
+  return (std::abs(p0 - q0) < alpha) & (std::abs(p1 - p0) < beta) & (std::abs(q1 - q0) < beta);
+}
+
+/**
+ * @brief Luma edge with bS 4 (MB edge), 16 lines of p3..q3 (8.7.2.4)
+ *
+ * Every output is computed from the unfiltered samples and blended in with a per line mask:
+ * no branch and few selects in the loop, so it is vectorized.
+ */
+void filter_luma_edge_strong(std::int16_t (&s)[8][16], const EdgeFilter& f) {
+  const int alpha = f.alpha, beta = f.beta;
+  const int strong_limit = (alpha >> 2) + 2;
+
+  for (int i = 0; i < 16; i++) {
+    const int p3 = s[0][i], p2 = s[1][i], p1 = s[2][i], p0 = s[3][i];
+    const int q0 = s[4][i], q1 = s[5][i], q2 = s[6][i], q3 = s[7][i];
+
+    const int filter = filter_line(p1, p0, q0, q1, alpha, beta);
+    const int strong = std::abs(p0 - q0) < strong_limit;
+    const int sp = filter & strong & (std::abs(p2 - p0) < beta);
+    const int sq = filter & strong & (std::abs(q2 - q0) < beta);
+    const int mf = -filter, mp = -sp, mq = -sq;   // all ones on the lines where the filter applies
+
+    // p0 / q0: 3-tap filter, 5-tap on the smooth sides
+    const int wp0 = (2 * p1 + p0 + q1 + 2) >> 2, wq0 = (2 * q1 + q0 + p1 + 2) >> 2;
+    const int np0 = wp0 + ((((p2 + 2 * p1 + 2 * p0 + 2 * q0 + q1 + 4) >> 3) - wp0) & mp);
+    const int nq0 = wq0 + ((((p1 + 2 * p0 + 2 * q0 + 2 * q1 + q2 + 4) >> 3) - wq0) & mq);
+
+    s[1][i] = p2 + ((((2 * p3 + 3 * p2 + p1 + p0 + q0 + 4) >> 3) - p2) & mp);
+    s[2][i] = p1 + ((((p2 + p1 + p0 + q0 + 2) >> 2) - p1) & mp);
+    s[3][i] = p0 + ((np0 - p0) & mf);
+    s[4][i] = q0 + ((nq0 - q0) & mf);
+    s[5][i] = q1 + ((((p0 + q0 + q1 + q2 + 2) >> 2) - q1) & mq);
+    s[6][i] = q2 + ((((2 * q3 + 3 * q2 + q1 + q0 + p0 + 4) >> 3) - q2) & mq);
+  }
+}
+
+/**
+ * @brief Luma edge with bS < 4, 16 lines of p2..q2 (8.7.2.3)
+ *
+ * The lines that are not filtered get a clipping range of 0, which leaves their samples as is.
+ */
+void filter_luma_edge_normal(std::int16_t (&s)[8][16], const EdgeFilter& f) {
+  const int alpha = f.alpha, beta = f.beta, tc0 = f.tc0, max_sample = f.max_sample;
+
+  for (int i = 0; i < 16; i++) {
+    const int p2 = s[1][i], p1 = s[2][i], p0 = s[3][i];
+    const int q0 = s[4][i], q1 = s[5][i], q2 = s[6][i];
+
+    const int filter = filter_line(p1, p0, q0, q1, alpha, beta);
+    const int ap = std::abs(p2 - p0) < beta;
+    const int aq = std::abs(q2 - q0) < beta;
+
+    const int tc = filter * (tc0 + ap + aq);
+    const int tc_p1 = filter * ap * tc0;
+    const int tc_q1 = filter * aq * tc0;
+    const int delta = clip3(-tc, tc, (((q0 - p0) << 2) + (p1 - q1) + 4) >> 3);
+    const int average = (p0 + q0 + 1) >> 1;
+
+    s[2][i] = p1 + clip3(-tc_p1, tc_p1, (p2 + average - (p1 << 1)) >> 1);
+    s[3][i] = clip3(0, max_sample, p0 + delta);
+    s[4][i] = clip3(0, max_sample, q0 - delta);
+    s[5][i] = q1 + clip3(-tc_q1, tc_q1, (q2 + average - (q1 << 1)) >> 1);
+  }
+}
+
+/**
+ * @brief Chroma edge, 8 lines of p1..q1: only p0 and q0 change (chromaStyleFilteringFlag)
+ */
+void filter_chroma_edge(std::int16_t (&s)[4][8], const EdgeFilter& f) {
+  const int alpha = f.alpha, beta = f.beta, tc = f.tc0 + 1, max_sample = f.max_sample;
+  const bool strong = (f.bS == 4);
+
+  for (int i = 0; i < 8; i++) {
+    const int p1 = s[0][i], p0 = s[1][i], q0 = s[2][i], q1 = s[3][i];
+
+    const int filter = filter_line(p1, p0, q0, q1, alpha, beta);
+    const int delta = clip3(-tc, tc, (((q0 - p0) << 2) + (p1 - q1) + 4) >> 3);
+    const int np0 = strong ? (2 * p1 + p0 + q1 + 2) >> 2 : clip3(0, max_sample, p0 + delta);
+    const int nq0 = strong ? (2 * q1 + q0 + p1 + 2) >> 2 : clip3(0, max_sample, q0 - delta);
+
+    s[1][i] = filter ? np0 : p0;
+    s[2][i] = filter ? nq0 : q0;
+  }
+}
+
+template <typename T>
+void luma_edge(T* q0, const int across, const int along, const EdgeFilter& f) {
+  if (!f.active())
+    return;
+  std::int16_t s[8][16];
+  load_edge<4, 16>(q0, across, along, s);
+  if (f.bS == 4)
+    filter_luma_edge_strong(s, f);
+  else
+    filter_luma_edge_normal(s, f);
+  store_edge<4, 16>(q0, across, along, s, 1);
+}
+
+template <typename T>
+void chroma_edge(T* q0, const int across, const int along, const EdgeFilter& f) {
+  if (!f.active())
+    return;
+  std::int16_t s[4][8];
+  load_edge<2, 8>(q0, across, along, s);
+  filter_chroma_edge(s, f);
+  store_edge<2, 8>(q0, across, along, s, 1);
+}
+
+/**
+ * @brief Filters the MB edges of planes of 8 bit (uint8_t) or wider (uint16_t) samples, in place
+ */
+template <typename T>
+void deblock_planes(T* const Y, T* const Cb, T* const Cr, const DeblockingPicture& picture,
+                    const std::vector<DeblockingParams>& slices, const int chroma_qp_index_offset) {
+  const int luma_stride = picture.mb_cols * 16;
+  const int chroma_stride = picture.mb_cols * 8;
+  const int nb_mbs = picture.mb_cols * picture.mb_rows;
+  const int bit_depth = picture.bit_depth;
+  const int qp_bd_offset = 6 * (bit_depth - 8);
+
+  auto slice_of = [&](const int mb) { return picture.mb_slice ? picture.mb_slice[mb] : 0; };
+  // QPC of the MB (8.7.2.2): the negative qPI of the high bit depths are their own QPC
+  auto chroma_qp = [&](const int mb) {
+    int qpi = clip(picture.mb_qp[mb] + chroma_qp_index_offset, -qp_bd_offset, 51);
+    return (qpi < 0) ? qpi : chroma_qp_table[qpi];
+  };
+
+  for (int mb = 0; mb < nb_mbs; mb++) {
+    const int slice = slice_of(mb);
+    const DeblockingParams& params = slices[slice];
+    if (params.disable_idc == 1)
+      continue;
+
+    const int row = mb / picture.mb_cols;
+    const int col = mb % picture.mb_cols;
+    const int left = mb - 1;
+    const int up = mb - picture.mb_cols;
+
+    // MB edges: inside the picture, and in the same slice with disable_idc 2
+    const bool filter_left = col > 0 && (params.disable_idc != 2 || slice_of(left) == slice);
+    const bool filter_up = row > 0 && (params.disable_idc != 2 || slice_of(up) == slice);
+
+    const int qp = picture.mb_qp[mb];
+    const int qpc = chroma_qp(mb);
+    const EdgeFilter luma_inner(intra_boundary_strength(false), qp, params, bit_depth);
+    const EdgeFilter chroma_inner(intra_boundary_strength(false), qpc, params, bit_depth);
+
+    T* y_mb = Y + row * 16 * luma_stride + col * 16;
+    const int chroma_offset = row * 8 * chroma_stride + col * 8;
+    T* C[2] = {Cb + chroma_offset, Cr + chroma_offset};
+
+    // Vertical edges
+    if (filter_left)
+      luma_edge(y_mb, 1, luma_stride,
+                EdgeFilter(intra_boundary_strength(true), (qp + picture.mb_qp[left] + 1) >> 1, params, bit_depth));
+    for (int x = 4; x < 16; x += 4)
+      luma_edge(y_mb + x, 1, luma_stride, luma_inner);
+
+    // Horizontal edges
+    if (filter_up)
+      luma_edge(y_mb, luma_stride, 1,
+                EdgeFilter(intra_boundary_strength(true), (qp + picture.mb_qp[up] + 1) >> 1, params, bit_depth));
+    for (int y = 4; y < 16; y += 4)
+      luma_edge(y_mb + y * luma_stride, luma_stride, 1, luma_inner);
+
+    // Chroma: edges 0 and 4, the bS of luma edges 0 and 8
+    for (T* plane : C) {
+      if (filter_left)
+        chroma_edge(plane, 1, chroma_stride,
+                    EdgeFilter(intra_boundary_strength(true), (qpc + chroma_qp(left) + 1) >> 1, params, bit_depth));
+      chroma_edge(plane + 4, 1, chroma_stride, chroma_inner);
+
+      if (filter_up)
+        chroma_edge(plane, chroma_stride, 1,
+                    EdgeFilter(intra_boundary_strength(true), (qpc + chroma_qp(up) + 1) >> 1, params, bit_depth));
+      chroma_edge(plane + 4 * chroma_stride, chroma_stride, 1, chroma_inner);
+    }
+  }
+}
+
+} // namespace
+
+/**
+ * @brief Filters the MB edges of a reconstructed picture, in place
+ *
+ * @param picture                 Planes, QP and slice of each MB
+ * @param slices                  Loop filter fields of each slice header (indexed by slice number)
+ * @param chroma_qp_index_offset  Of the PPS, for the QP of the chroma edges
+ */
+void deblock_picture(const DeblockingPicture& picture, const std::vector<DeblockingParams>& slices,
+                     const int chroma_qp_index_offset) {
+  if (picture.Y16)
+    deblock_planes(picture.Y16, picture.Cb16, picture.Cr16, picture, slices, chroma_qp_index_offset);
+  else
+    deblock_planes(picture.Y, picture.Cb, picture.Cr, picture, slices, chroma_qp_index_offset);
+}
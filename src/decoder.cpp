@@ -0,0 +1,1350 @@
+#include "decoder.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+namespace {
+
+/**
+ * Look-up table indexed by the next 'bits' bits of the stream.
+ * Each entry holds (code length << 8) | symbol, 0xffff for invalid codes.
+ */
+struct VLCTable {
+  int bits = 0;
+  std::vector<std::uint16_t> lut;
+
+  void init(const int nb_bits) {
+    bits = nb_bits;
+    lut.assign(1 << nb_bits, 0xffff);
+  }
+
+  // Every code starting with 'code' maps to the symbol
+  void add(const std::string& code, const int symbol) {
+    if (code.empty())
+      return;
+    int len = code.size();
+    unsigned int value = std::stoul(code, nullptr, 2);
+    unsigned int first = value << (bits - len);
+    unsigned int last = (value + 1) << (bits - len);
+    for (unsigned int i = first; i < last; i++)
+      lut[i] = static_cast<std::uint16_t>((len << 8) | symbol);
+  }
+
+  // Returns the decoded symbol, -1 for an invalid code
+  inline int decode(BitReader& br) const {
+    std::uint16_t entry = lut[br.peek(bits)];
+    if (entry == 0xffff)
+      return -1;
+    br.skip(entry >> 8);
+    return entry & 0xff;
+  }
+};
+
+/**
+ * CAVLC decoding tables, built once from the encoder tables (see vlc.cpp)
+ */
+struct CAVLCTables {
+  VLCTable coeff_token[5];          // nC 0-1, 2-3, 4-7, 8+, -1 ; symbol = TotalCoeff * 4 + TrailingOnes
+  VLCTable total_zeros[16];         // indexed by TotalCoeff (1..15)
+  VLCTable total_zeros2x2[4];       // indexed by TotalCoeff (1..3)
+  VLCTable run_before[8];           // indexed by min(zerosLeft, 7) (1..7)
+
+  CAVLCTables() {
+    for (int t = 0; t < 5; t++) {
+      coeff_token[t].init(t == 4 ? 8 : 16);
+      for (int total_coeff = 0; total_coeff < 17; total_coeff++)
+        for (int trail_ones = 0; trail_ones < 4; trail_ones++)
+          coeff_token[t].add(num_vlc_table[t][total_coeff][trail_ones], total_coeff * 4 + trail_ones);
+    }
+
+    for (int total_coeff = 1; total_coeff < 16; total_coeff++) {
+      total_zeros[total_coeff].init(9);
+      for (int zeros = 0; zeros < 16; zeros++)
+        total_zeros[total_coeff].add(zero_vlc_table[zeros][total_coeff], zeros);
+    }
+
+    for (int total_coeff = 1; total_coeff < 4; total_coeff++) {
+      total_zeros2x2[total_coeff].init(3);
+      for (int zeros = 0; zeros < 4; zeros++)
+        total_zeros2x2[total_coeff].add(zero_vlc_table2x2[zeros][total_coeff], zeros);
+    }
+
+    for (int zeros_left = 1; zeros_left < 8; zeros_left++) {
+      run_before[zeros_left].init(11);
+      for (int run = 0; run < 15; run++)
+        run_before[zeros_left].add(run_vlc_table[run][zeros_left], run);
+    }
+  }
+};
+
+const CAVLCTables& cavlc_tables() {
+  static const CAVLCTables tables;
+  return tables;
+}
+
+/**
+ * @brief Decodes a CAVLC coded block of coefficients (residual_block_cavlc)
+ *
+ * @param br Bit reader positioned at the coeff_token
+ * @param coeff_level Output coefficients in scan order (maxNumCoeff entries)
+ * @param nC Number of non-zero coefficients in neighbouring blocks (-1 for chroma DC)
+ * @param maxNumCoeff 4, 15 or 16
+ *
+ * @return TotalCoeff, -1 on a malformed block
+ */
+int cavlc_decode_block(BitReader& br, int coeff_level[], const int nC, const int maxNumCoeff) {
+  const CAVLCTables& tables = cavlc_tables();
+
+  int table_idx;
+  if (nC == -1)
+    table_idx = 4;
+  else if (nC < 2)
+    table_idx = 0;
+  else if (nC < 4)
+    table_idx = 1;
+  else if (nC < 8)
+    table_idx = 2;
+  else
+    table_idx = 3;
+
+  std::fill_n(coeff_level, maxNumCoeff, 0);
+
+  int token = tables.coeff_token[table_idx].decode(br);
+  if (token < 0)
+    return -1;
+  int total_coeff = token >> 2;
+  int trail_ones = token & 3;
+  if (total_coeff == 0)
+    return 0;
+  if (total_coeff > maxNumCoeff)
+    return -1;
+
+  // Levels, highest frequency first
+  int level[16];
+  int i = 0;
+  for (; i < trail_ones; i++)
+    level[i] = br.read_flag() ? -1 : 1;
+
+  int suffix_len = (total_coeff > 10 && trail_ones < 3) ? 1 : 0;
+  for (; i < total_coeff; i++) {
+    int level_prefix = br.leading_zeros();
+    if (level_prefix > 20)
+      return -1;
+    br.skip(level_prefix + 1);
+
+    int level_suffix_len = suffix_len;
+    if (level_prefix == 14 && suffix_len == 0)
+      level_suffix_len = 4;
+    else if (level_prefix >= 15)
+      level_suffix_len = level_prefix - 3;
+
+    int level_code = (std::min(15, level_prefix) << suffix_len);
+    if (level_suffix_len > 0)
+      level_code += br.read(level_suffix_len);
+    if (level_prefix >= 15 && suffix_len == 0)
+      level_code += 15;
+    if (level_prefix >= 16)
+      level_code += (1 << (level_prefix - 3)) - 4096;
+    if (i == trail_ones && trail_ones < 3)
+      level_code += 2;
+
+    if (level_code % 2 == 0)
+      level[i] = (level_code + 2) >> 1;
+    else
+      level[i] = (-level_code - 1) >> 1;
+
+    if (suffix_len == 0)
+      suffix_len = 1;
+    if (std::abs(level[i]) > (3 << (suffix_len - 1)) && suffix_len < 6)
+      suffix_len++;
+  }
+
+  // Zeros before the highest frequency coefficient
+  int zeros_left = 0;
+  if (total_coeff < maxNumCoeff) {
+    if (maxNumCoeff == 4)
+      zeros_left = tables.total_zeros2x2[total_coeff].decode(br);
+    else
+      zeros_left = tables.total_zeros[total_coeff].decode(br);
+    if (zeros_left < 0 || zeros_left + total_coeff > maxNumCoeff)
+      return -1;
+  }
+
+  // Runs and coefficient placement, from the highest frequency down
+  int coeff_num = total_coeff + zeros_left - 1;
+  for (i = 0; i < total_coeff - 1; i++) {
+    int run = 0;
+    if (zeros_left > 0) {
+      run = tables.run_before[std::min(zeros_left, 7)].decode(br);
+      if (run < 0 || run > zeros_left)
+        return -1;
+    }
+    coeff_level[coeff_num] = level[i];
+    coeff_num -= run + 1;
+    zeros_left -= run;
+  }
+  coeff_level[coeff_num] = level[i];
+
+  return total_coeff;
+}
+
+/**
+ * @brief Decodes a residual block coded with CABAC (residual_block_cabac)
+ *
+ * @param coeff_level Output, the coefficients in scan order
+ * @param cbf_inc ctxIdxInc of coded_block_flag
+ * @return Number of non-zero coefficients, -1 on error
+ */
+int cabac_decode_block(CabacDecoder& cabac, int coeff_level[], const int max_num_coeff, const BlockCat cat, const int cbf_inc) {
+  const int c = static_cast<int>(cat);
+  std::fill(coeff_level, coeff_level + max_num_coeff, 0);
+  if (!cabac.decode_decision(CTX_CODED_BLOCK_FLAG + cbf_cat_offset[c] + cbf_inc))
+    return 0;
+
+  // Significance map, the last coefficient is significant when no last_significant_coeff_flag was set
+  const int significant = CTX_SIGNIFICANT_COEFF + significant_cat_offset[c];
+  const int last_significant = CTX_LAST_SIGNIFICANT_COEFF + significant_cat_offset[c];
+  int positions[16];
+  int total_coeff = 0;
+  int i = 0;
+  for (; i < max_num_coeff - 1; i++) {
+    if (cabac.decode_decision(significant + i)) {
+      positions[total_coeff++] = i;
+      if (cabac.decode_decision(last_significant + i))
+        break;
+    }
+  }
+  if (i == max_num_coeff - 1)
+    positions[total_coeff++] = i;
+
+  // Levels in reverse scan order
+  const int abs_level = CTX_COEFF_ABS_LEVEL + abs_level_cat_offset[c];
+  const int max_gt1_inc = (cat == BlockCat::CHROMA_DC) ? 3 : 4;
+  int nb_eq1 = 0, nb_gt1 = 0;
+  for (int k = total_coeff - 1; k >= 0; k--) {
+    int level = 1;
+    if (cabac.decode_decision(abs_level + (nb_gt1 ? 0 : std::min(4, 1 + nb_eq1)))) {
+      int ctx = abs_level + 5 + std::min(max_gt1_inc, nb_gt1);
+      int prefix = 1;
+      while (prefix < 14 && cabac.decode_decision(ctx))
+        prefix++;
+      level += prefix;
+
+      if (prefix == 14) {   // UEG0 suffix
+        int exp = 0;
+        while (cabac.decode_bypass()) {
+          level += 1 << exp;
+          if (++exp > 16)
+            return -1;
+        }
+        while (exp--)
+          level += cabac.decode_bypass() << exp;
+      }
+      nb_gt1++;
+    } else {
+      nb_eq1++;
+    }
+    coeff_level[positions[k]] = cabac.decode_bypass() ? -level : level;
+  }
+
+  return total_coeff;
+}
+
+// condTermFlagN of coded_block_flag for the current (intra) MB: an unavailable neighbour counts as coded
+inline int cbf_cond(const int index, const bool cbf) {
+  return (index == -1) ? 1 : cbf;
+}
+
+}   // namespace
+
+
+Mat DecodedPicture::to_I420() const {
+  if (bit_depth > 8) {
+    Mat yuv(mb_height * 3 / 2, mb_width, CV_16UC1);
+    std::uint16_t* data = reinterpret_cast<std::uint16_t*>(yuv.data);
+    std::copy(Y16.begin(), Y16.end(), data);
+    std::copy(Cb16.begin(), Cb16.end(), data + Y16.size());
+    std::copy(Cr16.begin(), Cr16.end(), data + Y16.size() + Cb16.size());
+    return yuv;
+  }
+
+  Mat yuv(mb_height * 3 / 2, mb_width, CV_8UC1);
+  std::memcpy(yuv.data, Y.data(), Y.size());
+  std::memcpy(yuv.data + Y.size(), Cb.data(), Cb.size());
+  std::memcpy(yuv.data + Y.size() + Cb.size(), Cr.data(), Cr.size());
+  return yuv;
+}
+
+
+Decoder::Decoder(): picture_open(false), picture_idr(false), picture_reference(false), mbs_decoded(0), slice_num(0),
+  has_pending_metadata(false) {
+  cavlc_tables();   // build the look-up tables up front
+}
+
+/**
+ * @brief Splits an Annex-B byte stream at the start codes and decodes each NAL unit
+ *
+ * @param data Byte stream (as written by Packager)
+ * @param size Size in bytes
+ *
+ * @return Every picture completed in the stream, in decoding order
+ */
+std::vector<DecodedPicture> Decoder::decode(const std::uint8_t* data, std::size_t size) {
+  std::vector<DecodedPicture> pictures;
+
+  // Find the first start code
+  std::size_t pos = 0;
+  while (pos + 3 <= size && !(data[pos] == 0 && data[pos+1] == 0 && data[pos+2] == 1))
+    pos++;
+
+  while (pos + 3 <= size) {
+    std::size_t begin = pos + 3;
+    std::size_t end = begin;
+    while (end + 3 <= size && !(data[end] == 0 && data[end+1] == 0 && data[end+2] == 1))
+      end++;
+    if (end + 3 > size)
+      end = size;
+    pos = end;
+
+    // Drop trailing_zero_8bits (and the leading zero of a 4 byte start code)
+    while (end > begin && data[end-1] == 0)
+      end--;
+
+    if (end > begin)
+      decode_nal_unit(data + begin, end - begin, pictures);
+  }
+
+  return pictures;
+}
+
+/**
+ * @brief Decodes one NAL unit
+ *
+ * @param nal NAL unit bytes, header included, start code excluded
+ * @param size Size in bytes
+ * @param pictures The pictures the NAL unit completed are appended to it (also available through picture()):
+ *        its own, once all its MBs are decoded, and the previous one if the NAL unit starts a new picture
+ *        before the previous was complete (lost slices, concealed)
+ */
+void Decoder::decode_nal_unit(const std::uint8_t* nal, std::size_t size, std::vector<DecodedPicture>& pictures) {
+  if (size < 1)
+    return;
+
+  int nal_ref_idc = (nal[0] >> 5) & 0x03;
+  NALType nal_unit_type = static_cast<NALType>(nal[0] & 0x1f);
+
+  // EBSP -> RBSP: remove the emulation_prevention_three_byte
+  rbsp.resize(size);
+  std::size_t rbsp_size = 0;
+  int zeros = 0;
+  for (std::size_t i = 1; i < size; i++) {
+    if (zeros >= 2 && nal[i] == 0x03) {
+      zeros = 0;
+      continue;
+    }
+    rbsp[rbsp_size++] = nal[i];
+    zeros = (nal[i] == 0x00) ? zeros + 1 : 0;
+  }
+
+  BitReader br(rbsp.data(), rbsp_size);
+
+  switch (nal_unit_type) {
+    case NALType::SPS:
+      parse_SPS(br);
+      return;
+
+    case NALType::PPS:
+      parse_PPS(br);
+      return;
+
+    case NALType::SLICE:
+    case NALType::IDR:
+      if (!sps.valid || !pps.valid) {
+        cerr << "Slice before SPS/PPS" << endl;
+        return;
+      }
+      if (!parse_slice_header(br, nal_unit_type, nal_ref_idc) || !start_slice(nal_unit_type, nal_ref_idc, pictures))
+        return;
+      if (!decode_slice_data(br))
+        return;
+
+      if (mbs_decoded == static_cast<int>(mb_info.size()))
+        finish_picture(pictures);
+      return;
+
+    case NALType::SEI:
+      if (parse_projection_sei(rbsp.data(), rbsp_size, pending_metadata))
+        has_pending_metadata = true;
+      return;
+
+    default:    // AUD, end of sequence/stream, filler
+      return;
+  }
+}
+
+void Decoder::flush(std::vector<DecodedPicture>& pictures) {
+  if (picture_open)
+    finish_picture(pictures);
+}
+
+bool Decoder::parse_SPS(BitReader& br) {
+  SeqParameterSet s;
+
+  s.profile_idc = br.read(8);
+  br.read(8);   // constraint_set flags and reserved_zero bits
+  s.level_idc = br.read(8);
+  br.read_ue(); // seq_parameter_set_id
+
+  switch (s.profile_idc) {
+    case 66: case 77: case 88:
+      break;
+    case 100: case 110: case 122: case 244: case 44: case 83: case 86: case 118: case 128:
+      s.chroma_format_idc = br.read_ue();
+      if (s.chroma_format_idc == 3)
+        br.read_flag();   // separate_colour_plane_flag
+      s.bit_depth_luma = br.read_ue() + 8;
+      s.bit_depth_chroma = br.read_ue() + 8;
+      s.qpprime_y_zero_transform_bypass_flag = br.read_flag();
+      if (br.read_flag()) {   // seq_scaling_matrix_present_flag
+        cerr << "Scaling matrices are not supported" << endl;
+        return false;
+      }
+      if (s.chroma_format_idc != 1 || s.bit_depth_luma > 14 || s.bit_depth_chroma != s.bit_depth_luma) {
+        cerr << "Only 4:2:0 streams with 8 to 14 bits per sample (luma and chroma) are supported" << endl;
+        return false;
+      }
+      break;
+    default:
+      cerr << "Unsupported profile_idc " << s.profile_idc << endl;
+      return false;
+  }
+
+  s.log2_max_frame_num = br.read_ue() + 4;
+  s.pic_order_cnt_type = br.read_ue();
+  if (s.pic_order_cnt_type == 0) {
+    s.log2_max_pic_order_cnt_lsb = br.read_ue() + 4;
+  }
+  else if (s.pic_order_cnt_type == 1) {
+    cerr << "Unsupported pic_order_cnt_type 1" << endl;
+    return false;
+  }
+
+  br.read_ue();     // num_ref_frames
+  br.read_flag();   // gaps_in_frame_num_value_allowed_flag
+  s.pic_width_in_mbs = br.read_ue() + 1;
+  s.pic_height_in_mbs = br.read_ue() + 1;
+
+  if (!br.read_flag()) {  // frame_mbs_only_flag
+    cerr << "Interlaced streams are not supported" << endl;
+    return false;
+  }
+
+  br.read_flag();   // direct_8x8_inference_flag
+  if (br.read_flag()) {   // frame_cropping_flag
+    s.frame_crop_left_offset = br.read_ue();
+    s.frame_crop_right_offset = br.read_ue();
+    s.frame_crop_top_offset = br.read_ue();
+    s.frame_crop_bottom_offset = br.read_ue();
+  }
+  // vui_parameters_present_flag and VUI are not needed for decoding
+
+  s.valid = !br.overrun();
+  sps = s;
+  return sps.valid;
+}
+
+bool Decoder::parse_PPS(BitReader& br) {
+  PicParameterSet p;
+
+  br.read_ue();   // pic_parameter_set_id
+  br.read_ue();   // seq_parameter_set_id
+  p.entropy_coding_mode_flag = br.read_flag();
+  p.pic_order_present_flag = br.read_flag();
+  if (br.read_ue() != 0) {  // num_slice_groups_minus1
+    cerr << "Slice groups are not supported" << endl;
+    return false;
+  }
+  br.read_ue();   // num_ref_idx_l0_active_minus1
+  br.read_ue();   // num_ref_idx_l1_active_minus1
+  br.read_flag(); // weighted_pred_flag
+  br.read(2);     // weighted_bipred_idc
+  p.pic_init_qp = 26 + br.read_se();
+  br.read_se();   // pic_init_qs_minus26
+  p.chroma_qp_index_offset = br.read_se();
+  p.deblocking_filter_control_present_flag = br.read_flag();
+  p.constrained_intra_pred_flag = br.read_flag();
+  p.redundant_pic_cnt_present_flag = br.read_flag();
+
+  p.valid = !br.overrun();
+  pps = p;
+  return pps.valid;
+}
+
+bool Decoder::parse_slice_header(BitReader& br, const NALType nal_unit_type, const int nal_ref_idc) {
+  slice = SliceHeader();
+
+  slice.first_mb_in_slice = br.read_ue();
+  slice.slice_type = br.read_ue();
+  br.read_ue();   // pic_parameter_set_id
+
+  if (slice.slice_type % 5 != 2) {
+    cerr << "Only I slices are supported" << endl;
+    return false;
+  }
+
+  slice.frame_num = br.read(sps.log2_max_frame_num);
+  if (nal_unit_type == NALType::IDR)
+    slice.idr_pic_id = br.read_ue();
+
+  if (sps.pic_order_cnt_type == 0) {
+    slice.pic_order_cnt_lsb = br.read(sps.log2_max_pic_order_cnt_lsb);
+    if (pps.pic_order_present_flag)
+      br.read_se();   // delta_pic_order_cnt_bottom
+  }
+
+  if (pps.redundant_pic_cnt_present_flag)
+    br.read_ue();     // redundant_pic_cnt
+
+  // dec_ref_pic_marking()
+  if (nal_ref_idc != 0) {
+    if (nal_unit_type == NALType::IDR) {
+      br.read_flag();   // no_output_of_prior_pics_flag
+      br.read_flag();   // long_term_reference_flag
+    }
+    else if (br.read_flag()) {  // adaptive_ref_pic_marking_mode_flag
+      unsigned int operation;
+      while ((operation = br.read_ue()) != 0 && !br.overrun()) {
+        if (operation == 1 || operation == 3)
+          br.read_ue();   // difference_of_pic_nums_minus1
+        if (operation == 2)
+          br.read_ue();   // long_term_pic_num
+        if (operation == 3 || operation == 6)
+          br.read_ue();   // long_term_frame_idx
+        if (operation == 4)
+          br.read_ue();   // max_long_term_frame_idx_plus1
+      }
+    }
+  }
+
+  slice.slice_qp = pps.pic_init_qp + br.read_se();
+
+  if (pps.deblocking_filter_control_present_flag) {
+    slice.disable_deblocking_filter_idc = br.read_ue();
+    if (slice.disable_deblocking_filter_idc != 1) {
+      slice.slice_alpha_c0_offset_div2 = br.read_se();
+      slice.slice_beta_offset_div2 = br.read_se();
+    }
+  }
+
+  int nb_mbs = sps.pic_width_in_mbs * sps.pic_height_in_mbs;
+  if (br.overrun() || slice.slice_qp < -qp_bd_offset() || slice.slice_qp > 51 || (int)slice.first_mb_in_slice >= nb_mbs ||
+      std::abs(slice.slice_alpha_c0_offset_div2) > 6 || std::abs(slice.slice_beta_offset_div2) > 6) {
+    cerr << "Malformed slice header" << endl;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Whether the slice just parsed belongs to another picture than the one being decoded: the fields
+ *        of 7.4.1.2.4 the encoder changes from one picture to the next, or an MB that is already decoded.
+ *        A picture whose first slices were lost still starts on its first slice received.
+ */
+bool Decoder::is_new_picture(const NALType nal_unit_type, const int nal_ref_idc) const {
+  const bool idr = (nal_unit_type == NALType::IDR);
+  int nb_mbs = sps.pic_width_in_mbs * sps.pic_height_in_mbs;
+  if (!picture_open || (int)mb_info.size() != nb_mbs)
+    return true;
+  if (slice.frame_num != picture_slice.frame_num || slice.pic_order_cnt_lsb != picture_slice.pic_order_cnt_lsb ||
+      idr != picture_idr || (idr && slice.idr_pic_id != picture_slice.idr_pic_id) || (nal_ref_idc != 0) != picture_reference)
+    return true;
+  return mb_info[slice.first_mb_in_slice].slice_num != -1;
+}
+
+// Completes the previous picture if the slice starts a new one, then sets up the slice in the current picture
+bool Decoder::start_slice(const NALType nal_unit_type, const int nal_ref_idc, std::vector<DecodedPicture>& pictures) {
+  if (is_new_picture(nal_unit_type, nal_ref_idc)) {
+    if (picture_open)
+      finish_picture(pictures);
+    start_picture(nal_unit_type, nal_ref_idc);
+  } else {
+    slice_num++;
+  }
+
+  if (slice_num >= static_cast<int>(slice_deblocking.size())) {
+    cerr << "More slices than MBs in the picture" << endl;
+    return false;
+  }
+
+  // Loop filter of the slice, applied once the picture is complete
+  DeblockingParams& deblocking = slice_deblocking[slice_num];
+  deblocking.disable_idc = slice.disable_deblocking_filter_idc;
+  deblocking.alpha_offset_div2 = slice.slice_alpha_c0_offset_div2;
+  deblocking.beta_offset_div2 = slice.slice_beta_offset_div2;
+
+  current.frame_num = (nal_unit_type == NALType::IDR) ? slice.idr_pic_id : slice.frame_num;
+  return true;
+}
+
+// Allocates the planes and resets the MB state for a new picture, starting with the slice just parsed
+void Decoder::start_picture(const NALType nal_unit_type, const int nal_ref_idc) {
+  picture_open = true;
+  picture_slice = slice;
+  picture_idr = (nal_unit_type == NALType::IDR);
+  picture_reference = (nal_ref_idc != 0);
+
+  current.mb_width = sps.pic_width_in_mbs * 16;
+  current.mb_height = sps.pic_height_in_mbs * 16;
+  current.width = current.mb_width - 2 * (sps.frame_crop_left_offset + sps.frame_crop_right_offset);
+  current.height = current.mb_height - 2 * (sps.frame_crop_top_offset + sps.frame_crop_bottom_offset);
+  current.bit_depth = sps.bit_depth_luma;
+  const bool wide = current.bit_depth > 8;
+  std::size_t nb_samples = current.mb_width * current.mb_height;
+  current.Y.resize(wide ? 0 : nb_samples);
+  current.Cb.resize(wide ? 0 : nb_samples / 4);
+  current.Cr.resize(wide ? 0 : nb_samples / 4);
+  current.Y16.resize(wide ? nb_samples : 0);
+  current.Cb16.resize(wide ? nb_samples / 4 : 0);
+  current.Cr16.resize(wide ? nb_samples / 4 : 0);
+
+  mb_info.assign(sps.pic_width_in_mbs * sps.pic_height_in_mbs, MBInfo());
+  slice_deblocking.assign(mb_info.size(), DeblockingParams());
+  mbs_decoded = 0;
+  slice_num = 0;
+
+  current.has_metadata = has_pending_metadata;
+  if (has_pending_metadata)
+    current.metadata = pending_metadata;
+  has_pending_metadata = false;
+}
+
+// Conceals the MBs no slice reached, filters the picture and outputs it
+void Decoder::finish_picture(std::vector<DecodedPicture>& pictures) {
+  if (mbs_decoded < static_cast<int>(mb_info.size())) {
+    cerr << "Picture " << current.frame_num << ": " << mb_info.size() - mbs_decoded << " MBs lost, concealed" << endl;
+    conceal_picture();
+  }
+  filter_picture();
+  std::swap(output, current);
+  pictures.push_back(output);
+  mbs_decoded = 0;
+  picture_open = false;
+}
+
+/**
+ * @brief Fills the MBs of the lost slices with no range (0) and the neutral chroma, so that the reprojection
+ *        skips them. They form a slice of their own for the loop filter, unfiltered, and count as I_PCM.
+ */
+void Decoder::conceal_picture() {
+  const int mb_cols = current.mb_width / 16;
+  const int concealed_slice = slice_num + 1;
+  if (concealed_slice >= static_cast<int>(slice_deblocking.size()))
+    slice_deblocking.resize(concealed_slice + 1);
+  slice_deblocking[concealed_slice] = DeblockingParams();   // filter off
+
+  for (int mb_addr = 0; mb_addr < static_cast<int>(mb_info.size()); mb_addr++) {
+    MBInfo& info = mb_info[mb_addr];
+    if (info.slice_num != -1)
+      continue;
+    info = MBInfo();
+    info.slice_num = concealed_slice;
+    info.is_I_PCM = true;
+    info.qp = -qp_bd_offset();
+
+    int x0 = (mb_addr % mb_cols) * 16;
+    int y0 = (mb_addr / mb_cols) * 16;
+    for (int i = 0; i < 16; i++)
+      for (int j = 0; j < 16; j++)
+        put_sample(current.Y, current.Y16, (y0 + i) * current.mb_width + x0 + j, 0);
+    for (int i = 0; i < 8; i++)
+      for (int j = 0; j < 8; j++) {
+        int index = ((y0 >> 1) + i) * (current.mb_width >> 1) + (x0 >> 1) + j;
+        put_sample(current.Cb, current.Cb16, index, 1 << (current.bit_depth - 1));
+        put_sample(current.Cr, current.Cr16, index, 1 << (current.bit_depth - 1));
+      }
+  }
+}
+
+// In-loop deblocking of the completed picture, with the filter parameters of each slice
+void Decoder::filter_picture() {
+  mb_qp.resize(mb_info.size());
+  mb_slice.resize(mb_info.size());
+  for (std::size_t i = 0; i < mb_info.size(); i++) {
+    mb_qp[i] = mb_info[i].qp;
+    mb_slice[i] = std::max(mb_info[i].slice_num, 0);
+  }
+
+  const bool wide = (current.bit_depth > 8);
+  DeblockingPicture picture = {wide ? nullptr : current.Y.data(), wide ? nullptr : current.Cb.data(),
+                               wide ? nullptr : current.Cr.data(), wide ? current.Y16.data() : nullptr,
+                               wide ? current.Cb16.data() : nullptr, wide ? current.Cr16.data() : nullptr, current.bit_depth,
+                               current.mb_width / 16, current.mb_height / 16,
+                               mb_qp.data(), mb_slice.data()};
+  deblock_picture(picture, slice_deblocking, pps.chroma_qp_index_offset);
+}
+
+bool Decoder::decode_slice_data(BitReader& br) {
+  int qp = slice.slice_qp;
+  int nb_mbs = mb_info.size();
+
+  if (pps.entropy_coding_mode_flag) {
+    while (!br.byte_aligned())    // cabac_alignment_one_bit
+      br.read_flag();
+
+    CabacDecoder cabac(br);
+    init_cabac_contexts(cabac.contexts, slice.slice_qp);
+    cabac.start();
+
+    int qp_delta = 0;
+    for (int mb_addr = slice.first_mb_in_slice; mb_addr < nb_mbs; mb_addr++) {
+      if (!decode_macroblock_cabac(cabac, br, mb_addr, qp, qp_delta) || br.overrun()) {
+        cerr << "Error decoding MB " << mb_addr << endl;
+        mb_info[mb_addr].slice_num = -1;   // concealed with the lost MBs
+        return false;
+      }
+      mbs_decoded++;
+
+      if (cabac.decode_terminate())   // end_of_slice_flag
+        break;
+    }
+    return true;
+  }
+
+  for (int mb_addr = slice.first_mb_in_slice; mb_addr < nb_mbs; mb_addr++) {
+    if (!decode_macroblock(br, mb_addr, qp) || br.overrun()) {
+      cerr << "Error decoding MB " << mb_addr << endl;
+      mb_info[mb_addr].slice_num = -1;   // concealed with the lost MBs
+      return false;
+    }
+    mbs_decoded++;
+
+    if (!br.more_rbsp_data())
+      break;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Returns the index of a neighbour MB, -1 if it is outside the picture or in another slice
+ */
+int Decoder::get_neighbor_index(const int curr_index, const int neighbor_type) const {
+  int nb_mb_cols = sps.pic_width_in_mbs;
+  int col = curr_index % nb_mb_cols;
+  int neighbor_index;
+
+  switch (neighbor_type) {
+    case MB_NEIGHBOR_UL:
+      neighbor_index = (col == 0) ? -1 : curr_index - nb_mb_cols - 1;
+      break;
+    case MB_NEIGHBOR_U:
+      neighbor_index = curr_index - nb_mb_cols;
+      break;
+    case MB_NEIGHBOR_UR:
+      neighbor_index = (col == nb_mb_cols - 1) ? -1 : curr_index - nb_mb_cols + 1;
+      break;
+    case MB_NEIGHBOR_L:
+      neighbor_index = (col == 0) ? -1 : curr_index - 1;
+      break;
+    default:
+      neighbor_index = -1;
+      break;
+  }
+
+  if (neighbor_index < 0 || mb_info[neighbor_index].slice_num != mb_info[curr_index].slice_num)
+    return -1;
+  return neighbor_index;
+}
+
+/**
+ * @brief Predicted Intra4x4PredMode of a 4x4 block: min(mode of left, mode of upper)
+ *
+ * @param mb_addr Current MB
+ * @param blk 4x4 block position (see MacroBlock::convert_table)
+ */
+int Decoder::predict_intra4x4_mode(const int mb_addr, const int blk) const {
+  int real_pos = MacroBlock::convert_table[blk];
+
+  int a_index, a_pos, b_index, b_pos;
+  if (real_pos % 4 == 0) {
+    a_index = get_neighbor_index(mb_addr, MB_NEIGHBOR_L);
+    a_pos = real_pos + 3;
+  } else {
+    a_index = mb_addr;
+    a_pos = real_pos - 1;
+  }
+
+  if (real_pos < 4) {
+    b_index = get_neighbor_index(mb_addr, MB_NEIGHBOR_U);
+    b_pos = real_pos + 12;
+  } else {
+    b_index = mb_addr;
+    b_pos = real_pos - 4;
+  }
+
+  if (a_index == -1 || b_index == -1)
+    return static_cast<int>(Intra4x4Mode::DC);
+
+  const MBInfo& a = mb_info[a_index];
+  const MBInfo& b = mb_info[b_index];
+  int mode_a = (a.is_intra16x16 || a.is_I_PCM) ? 2 : a.intra4x4_Y_mode[MacroBlock::convert_table[a_pos]];
+  int mode_b = (b.is_intra16x16 || b.is_I_PCM) ? 2 : b.intra4x4_Y_mode[MacroBlock::convert_table[b_pos]];
+
+  return std::min(mode_a, mode_b);
+}
+
+/**
+ * @brief nC of a luma 4x4 block from the total_coeff of the left and upper blocks
+ */
+int Decoder::luma_nC(const int mb_addr, const int blk) const {
+  int real_pos = MacroBlock::convert_table[blk];
+
+  int a_index, a_pos, b_index, b_pos;
+  if (real_pos % 4 == 0) {
+    a_index = get_neighbor_index(mb_addr, MB_NEIGHBOR_L);
+    a_pos = real_pos + 3;
+  } else {
+    a_index = mb_addr;
+    a_pos = real_pos - 1;
+  }
+
+  if (real_pos < 4) {
+    b_index = get_neighbor_index(mb_addr, MB_NEIGHBOR_U);
+    b_pos = real_pos + 12;
+  } else {
+    b_index = mb_addr;
+    b_pos = real_pos - 4;
+  }
+
+  int nA = (a_index == -1) ? 0 : mb_info[a_index].nc_Y[MacroBlock::convert_table[a_pos]];
+  int nB = (b_index == -1) ? 0 : mb_info[b_index].nc_Y[MacroBlock::convert_table[b_pos]];
+
+  if (a_index != -1 && b_index != -1)
+    return (nA + nB + 1) >> 1;
+  return nA + nB;
+}
+
+/**
+ * @brief nC of a chroma AC 4x4 block (2x2 arrangement within the 8x8 component)
+ */
+int Decoder::chroma_nC(const int mb_addr, const int blk, const bool is_cb) const {
+  int a_index, a_pos, b_index, b_pos;
+  if (blk % 2 == 0) {
+    a_index = get_neighbor_index(mb_addr, MB_NEIGHBOR_L);
+    a_pos = blk + 1;
+  } else {
+    a_index = mb_addr;
+    a_pos = blk - 1;
+  }
+
+  if (blk < 2) {
+    b_index = get_neighbor_index(mb_addr, MB_NEIGHBOR_U);
+    b_pos = blk + 2;
+  } else {
+    b_index = mb_addr;
+    b_pos = blk - 2;
+  }
+
+  int nA = 0, nB = 0;
+  if (a_index != -1)
+    nA = is_cb ? mb_info[a_index].nc_Cb[a_pos] : mb_info[a_index].nc_Cr[a_pos];
+  if (b_index != -1)
+    nB = is_cb ? mb_info[b_index].nc_Cb[b_pos] : mb_info[b_index].nc_Cr[b_pos];
+
+  if (a_index != -1 && b_index != -1)
+    return (nA + nB + 1) >> 1;
+  return nA + nB;
+}
+
+/**
+ * @brief Parses and reconstructs one macroblock (macroblock_layer)
+ *
+ * @param br Bit reader positioned at mb_type
+ * @param mb_addr MB address in raster order
+ * @param qp Current QP_Y, updated with mb_qp_delta
+ */
+bool Decoder::decode_macroblock(BitReader& br, const int mb_addr, int& qp) {
+  MBInfo& info = mb_info[mb_addr];
+  info.slice_num = slice_num;
+  info.nc_Y.fill(0);
+  info.nc_Cb.fill(0);
+  info.nc_Cr.fill(0);
+  info.intra4x4_Y_mode.fill(static_cast<int>(Intra4x4Mode::DC));
+
+  int nb_mb_cols = sps.pic_width_in_mbs;
+  int x0 = (mb_addr % nb_mb_cols) * 16;
+  int y0 = (mb_addr / nb_mb_cols) * 16;
+
+  unsigned int mb_type = br.read_ue();
+  if (mb_type > 25)
+    return false;
+
+  // I_PCM: samples are sent raw
+  if (mb_type == 25) {
+    info.is_I_PCM = true;
+    info.qp = -qp_bd_offset();    // for the loop filter (QP'Y 0, as the reference decoder), QP_Y itself is unchanged
+    info.nc_Y.fill(16);
+    info.nc_Cb.fill(16);
+    info.nc_Cr.fill(16);
+    read_pcm_samples(br, mb_addr);
+    return true;
+  }
+
+  bool is_intra16x16 = (mb_type != 0);
+  info.is_intra16x16 = is_intra16x16;
+
+  Intra16x16Mode intra16x16_mode = Intra16x16Mode::DC;
+  int cbp_luma, cbp_chroma;
+
+  if (is_intra16x16) {
+    intra16x16_mode = static_cast<Intra16x16Mode>((mb_type - 1) % 4);
+    cbp_chroma = ((mb_type - 1) / 4) % 3;
+    cbp_luma = (mb_type >= 13) ? 15 : 0;
+  }
+  else {
+    for (int blk = 0; blk < 16; blk++) {
+      int pred_mode = predict_intra4x4_mode(mb_addr, blk);
+      if (br.read_flag()) {   // prev_intra4x4_pred_mode_flag
+        info.intra4x4_Y_mode[blk] = pred_mode;
+      }
+      else {
+        int rem_mode = br.read(3);
+        info.intra4x4_Y_mode[blk] = (rem_mode < pred_mode) ? rem_mode : rem_mode + 1;
+      }
+    }
+  }
+
+  unsigned int chroma_mode = br.read_ue();
+  if (chroma_mode > 3)
+    return false;
+
+  if (!is_intra16x16) {
+    unsigned int code_num = br.read_ue();
+    if (code_num > 47)
+      return false;
+    int cbp = std::find(me, me + 48, static_cast<int>(code_num)) - me;   // me[cbp] = codeNum
+    cbp_luma = cbp & 0x0f;
+    cbp_chroma = cbp >> 4;
+  }
+
+  if (cbp_luma > 0 || cbp_chroma > 0 || is_intra16x16) {
+    int mb_qp_delta = br.read_se();
+    qp = (qp + mb_qp_delta + 52 + 2 * qp_bd_offset()) % (52 + qp_bd_offset()) - qp_bd_offset();
+  }
+  info.qp = qp;
+
+  // Residual, coefficients placed as left by the forward QDCT (see tr_qt.cpp)
+  MacroBlock mb(y0 >> 4, x0 >> 4);
+  mb.mb_index = mb_addr;
+  mb.Y.fill(0);
+  mb.Cb.fill(0);
+  mb.Cr.fill(0);
+
+  int coeff_level[16];
+
+  if (is_intra16x16) {
+    if (cavlc_decode_block(br, coeff_level, luma_nC(mb_addr, 0), 16) < 0)
+      return false;
+    for (int k = 0; k < 16; k++) {
+      int pos = zigzag_scan4x4[k];
+      mb.Y[(pos / 4) * 64 + (pos % 4) * 4] = coeff_level[k];
+    }
+  }
+
+  for (int blk = 0; blk < 16; blk++) {
+    if (!(cbp_luma & (1 << (blk / 4))))
+      continue;
+
+    int max_num_coeff = is_intra16x16 ? 15 : 16;
+    int total_coeff = cavlc_decode_block(br, coeff_level, luma_nC(mb_addr, blk), max_num_coeff);
+    if (total_coeff < 0)
+      return false;
+    info.nc_Y[blk] = total_coeff;
+
+    Block4x4 block = mb.get_Y_4x4_block(blk);
+    for (int k = 0; k < max_num_coeff; k++)
+      block[zigzag_scan4x4[k + 16 - max_num_coeff]] = coeff_level[k];
+  }
+
+  if (cbp_chroma & 3) {
+    if (cavlc_decode_block(br, coeff_level, -1, 4) < 0)
+      return false;
+    mb.Cb[0] = coeff_level[0]; mb.Cb[4] = coeff_level[1]; mb.Cb[32] = coeff_level[2]; mb.Cb[36] = coeff_level[3];
+
+    if (cavlc_decode_block(br, coeff_level, -1, 4) < 0)
+      return false;
+    mb.Cr[0] = coeff_level[0]; mb.Cr[4] = coeff_level[1]; mb.Cr[32] = coeff_level[2]; mb.Cr[36] = coeff_level[3];
+  }
+
+  if (cbp_chroma & 2) {
+    for (int blk = 0; blk < 4; blk++) {
+      int total_coeff = cavlc_decode_block(br, coeff_level, chroma_nC(mb_addr, blk, true), 15);
+      if (total_coeff < 0)
+        return false;
+      info.nc_Cb[blk] = total_coeff;
+
+      Block4x4 block = mb.get_Cb_4x4_block(blk);
+      for (int k = 0; k < 15; k++)
+        block[zigzag_scan4x4[k + 1]] = coeff_level[k];
+    }
+
+    for (int blk = 0; blk < 4; blk++) {
+      int total_coeff = cavlc_decode_block(br, coeff_level, chroma_nC(mb_addr, blk, false), 15);
+      if (total_coeff < 0)
+        return false;
+      info.nc_Cr[blk] = total_coeff;
+
+      Block4x4 block = mb.get_Cr_4x4_block(blk);
+      for (int k = 0; k < 15; k++)
+        block[zigzag_scan4x4[k + 1]] = coeff_level[k];
+    }
+  }
+
+  reconstruct_macroblock(mb_addr, mb, intra16x16_mode, static_cast<IntraChromaMode>(chroma_mode), qp);
+  return true;
+}
+
+/**
+ * @brief CABAC counterpart of decode_macroblock (syntax and contexts as written by cabac_frame)
+ *
+ * @param cabac Arithmetic decoder positioned at mb_type
+ * @param br Bit reader under the decoder, for the I_PCM samples
+ * @param qp_delta mb_qp_delta of the previous MB of the slice, updated
+ */
+bool Decoder::decode_macroblock_cabac(CabacDecoder& cabac, BitReader& br, const int mb_addr, int& qp, int& qp_delta) {
+  MBInfo& info = mb_info[mb_addr];
+  info.slice_num = slice_num;
+  info.nc_Y.fill(0);
+  info.nc_Cb.fill(0);
+  info.nc_Cr.fill(0);
+  info.cbf_DC.fill(false);
+  info.intra4x4_Y_mode.fill(static_cast<int>(Intra4x4Mode::DC));
+
+  const int index_A = get_neighbor_index(mb_addr, MB_NEIGHBOR_L);
+  const int index_B = get_neighbor_index(mb_addr, MB_NEIGHBOR_U);
+
+  // mb_type
+  int inc = (index_A != -1 && (mb_info[index_A].is_I_PCM || mb_info[index_A].is_intra16x16)) +
+            (index_B != -1 && (mb_info[index_B].is_I_PCM || mb_info[index_B].is_intra16x16));
+  bool is_intra16x16 = cabac.decode_decision(CTX_MB_TYPE_I + inc);
+
+  if (is_intra16x16 && cabac.decode_terminate()) {    // I_PCM, the arithmetic decoder restarts after the samples
+    info.is_I_PCM = true;
+    info.qp = -qp_bd_offset();    // for the loop filter, see decode_macroblock
+    info.nc_Y.fill(16);
+    info.nc_Cb.fill(16);
+    info.nc_Cr.fill(16);
+    info.cbf_DC.fill(true);
+    info.chroma_mode = 0;
+    info.cbp_luma = 15;
+    info.cbp_chroma = 2;
+    read_pcm_samples(br, mb_addr);
+    cabac.start();
+    qp_delta = 0;
+    return true;
+  }
+  info.is_intra16x16 = is_intra16x16;
+
+  Intra16x16Mode intra16x16_mode = Intra16x16Mode::DC;
+  int cbp_luma = 0, cbp_chroma = 0;
+
+  if (is_intra16x16) {
+    cbp_luma = cabac.decode_decision(CTX_MB_TYPE_I + 3) ? 15 : 0;
+    if (cabac.decode_decision(CTX_MB_TYPE_I + 4))
+      cbp_chroma = 1 + cabac.decode_decision(CTX_MB_TYPE_I + 5);
+    int mode = cabac.decode_decision(CTX_MB_TYPE_I + 6) << 1;
+    mode |= cabac.decode_decision(CTX_MB_TYPE_I + 7);
+    intra16x16_mode = static_cast<Intra16x16Mode>(mode);
+  }
+  else {
+    for (int blk = 0; blk < 16; blk++) {
+      int pred_mode = predict_intra4x4_mode(mb_addr, blk);
+      if (cabac.decode_decision(CTX_PREV_INTRA4X4_PRED_MODE)) {
+        info.intra4x4_Y_mode[blk] = pred_mode;
+      }
+      else {
+        int rem_mode = 0;
+        for (int k = 0; k < 3; k++)
+          rem_mode |= cabac.decode_decision(CTX_REM_INTRA4X4_PRED_MODE) << k;
+        info.intra4x4_Y_mode[blk] = (rem_mode < pred_mode) ? rem_mode : rem_mode + 1;
+      }
+    }
+  }
+
+  // intra_chroma_pred_mode
+  inc = (index_A != -1 && mb_info[index_A].chroma_mode != 0) + (index_B != -1 && mb_info[index_B].chroma_mode != 0);
+  int chroma_mode = 0;
+  if (cabac.decode_decision(CTX_INTRA_CHROMA_PRED_MODE + inc)) {
+    chroma_mode = 1;
+    while (chroma_mode < 3 && cabac.decode_decision(CTX_INTRA_CHROMA_PRED_MODE + 3))
+      chroma_mode++;
+  }
+  info.chroma_mode = chroma_mode;
+
+  // coded_block_pattern
+  if (!is_intra16x16) {
+    for (int b8 = 0; b8 < 4; b8++) {
+      int cond_A = (b8 % 2 == 0) ? (index_A != -1 && !((mb_info[index_A].cbp_luma >> (b8 + 1)) & 1))
+                                 : !((cbp_luma >> (b8 - 1)) & 1);
+      int cond_B = (b8 < 2) ? (index_B != -1 && !((mb_info[index_B].cbp_luma >> (b8 + 2)) & 1))
+                            : !((cbp_luma >> (b8 - 2)) & 1);
+      cbp_luma |= cabac.decode_decision(CTX_CBP_LUMA + cond_A + 2 * cond_B) << b8;
+    }
+
+    inc = (index_A != -1 && mb_info[index_A].cbp_chroma != 0) + 2 * (index_B != -1 && mb_info[index_B].cbp_chroma != 0);
+    if (cabac.decode_decision(CTX_CBP_CHROMA + inc)) {
+      inc = (index_A != -1 && mb_info[index_A].cbp_chroma == 2) + 2 * (index_B != -1 && mb_info[index_B].cbp_chroma == 2);
+      cbp_chroma = 1 + cabac.decode_decision(CTX_CBP_CHROMA + 4 + inc);
+    }
+  }
+  info.cbp_luma = cbp_luma;
+  info.cbp_chroma = cbp_chroma;
+
+  // mb_qp_delta: unary, mapped as se(v)
+  int mb_qp_delta = 0;
+  if (cbp_luma > 0 || cbp_chroma > 0 || is_intra16x16) {
+    if (cabac.decode_decision(CTX_MB_QP_DELTA + (qp_delta != 0))) {
+      int k = 1;
+      while (cabac.decode_decision(CTX_MB_QP_DELTA + ((k == 1) ? 2 : 3))) {
+        if (++k > 102)
+          return false;
+      }
+      mb_qp_delta = (k & 1) ? (k + 1) / 2 : -(k / 2);
+    }
+    qp = (qp + mb_qp_delta + 52 + 2 * qp_bd_offset()) % (52 + qp_bd_offset()) - qp_bd_offset();
+  }
+  qp_delta = mb_qp_delta;
+  info.qp = qp;
+
+  // Residual
+  MacroBlock mb(mb_addr / sps.pic_width_in_mbs, mb_addr % sps.pic_width_in_mbs);
+  mb.mb_index = mb_addr;
+  mb.Y.fill(0);
+  mb.Cb.fill(0);
+  mb.Cr.fill(0);
+
+  int coeff_level[16];
+
+  if (is_intra16x16) {
+    inc = cbf_cond(index_A, index_A != -1 && mb_info[index_A].cbf_DC[0]) +
+          2 * cbf_cond(index_B, index_B != -1 && mb_info[index_B].cbf_DC[0]);
+    int total_coeff = cabac_decode_block(cabac, coeff_level, 16, BlockCat::LUMA_DC, inc);
+    if (total_coeff < 0)
+      return false;
+    info.cbf_DC[0] = total_coeff > 0;
+    for (int k = 0; k < 16; k++) {
+      int pos = zigzag_scan4x4[k];
+      mb.Y[(pos / 4) * 64 + (pos % 4) * 4] = coeff_level[k];
+    }
+  }
+
+  for (int blk = 0; blk < 16; blk++) {
+    if (!(cbp_luma & (1 << (blk / 4))))
+      continue;
+
+    int real_pos = MacroBlock::convert_table[blk];
+    int a_index = (real_pos % 4 == 0) ? index_A : mb_addr;
+    int a_pos = MacroBlock::convert_table[(real_pos % 4 == 0) ? real_pos + 3 : real_pos - 1];
+    int b_index = (real_pos < 4) ? index_B : mb_addr;
+    int b_pos = MacroBlock::convert_table[(real_pos < 4) ? real_pos + 12 : real_pos - 4];
+    inc = cbf_cond(a_index, a_index != -1 && mb_info[a_index].nc_Y[a_pos] != 0) +
+          2 * cbf_cond(b_index, b_index != -1 && mb_info[b_index].nc_Y[b_pos] != 0);
+
+    int max_num_coeff = is_intra16x16 ? 15 : 16;
+    int total_coeff = cabac_decode_block(cabac, coeff_level, max_num_coeff,
+                                         is_intra16x16 ? BlockCat::LUMA_AC : BlockCat::LUMA_4x4, inc);
+    if (total_coeff < 0)
+      return false;
+    info.nc_Y[blk] = total_coeff;
+
+    Block4x4 block = mb.get_Y_4x4_block(blk);
+    for (int k = 0; k < max_num_coeff; k++)
+      block[zigzag_scan4x4[k + 16 - max_num_coeff]] = coeff_level[k];
+  }
+
+  if (cbp_chroma & 3) {
+    for (int c = 0; c < 2; c++) {
+      inc = cbf_cond(index_A, index_A != -1 && mb_info[index_A].cbf_DC[1 + c]) +
+            2 * cbf_cond(index_B, index_B != -1 && mb_info[index_B].cbf_DC[1 + c]);
+      int total_coeff = cabac_decode_block(cabac, coeff_level, 4, BlockCat::CHROMA_DC, inc);
+      if (total_coeff < 0)
+        return false;
+      info.cbf_DC[1 + c] = total_coeff > 0;
+
+      Block2x2 dc = (c == 0) ? mb.get_Cb_DC_block() : mb.get_Cr_DC_block();
+      for (int k = 0; k < 4; k++)
+        dc[k] = coeff_level[k];
+    }
+  }
+
+  if (cbp_chroma & 2) {
+    for (int c = 0; c < 2; c++) {
+      for (int blk = 0; blk < 4; blk++) {
+        int a_index = (blk % 2 == 0) ? index_A : mb_addr;
+        int a_pos = (blk % 2 == 0) ? blk + 1 : blk - 1;
+        int b_index = (blk < 2) ? index_B : mb_addr;
+        int b_pos = (blk < 2) ? blk + 2 : blk - 2;
+        bool cbf_a = a_index != -1 && ((c == 0) ? mb_info[a_index].nc_Cb[a_pos] : mb_info[a_index].nc_Cr[a_pos]) != 0;
+        bool cbf_b = b_index != -1 && ((c == 0) ? mb_info[b_index].nc_Cb[b_pos] : mb_info[b_index].nc_Cr[b_pos]) != 0;
+        inc = cbf_cond(a_index, cbf_a) + 2 * cbf_cond(b_index, cbf_b);
+
+        int total_coeff = cabac_decode_block(cabac, coeff_level, 15, BlockCat::CHROMA_AC, inc);
+        if (total_coeff < 0)
+          return false;
+        ((c == 0) ? info.nc_Cb : info.nc_Cr)[blk] = total_coeff;
+
+        Block4x4 block = (c == 0) ? mb.get_Cb_4x4_block(blk) : mb.get_Cr_4x4_block(blk);
+        for (int k = 0; k < 15; k++)
+          block[zigzag_scan4x4[k + 1]] = coeff_level[k];
+      }
+    }
+  }
+
+  reconstruct_macroblock(mb_addr, mb, intra16x16_mode, static_cast<IntraChromaMode>(chroma_mode), qp);
+  return true;
+}
+
+// pcm_alignment_zero_bit and the raw samples of an I_PCM MB
+void Decoder::read_pcm_samples(BitReader& br, const int mb_addr) {
+  int x0 = (mb_addr % sps.pic_width_in_mbs) * 16;
+  int y0 = (mb_addr / sps.pic_width_in_mbs) * 16;
+
+  br.align();
+  for (int i = 0; i < 16; i++)
+    for (int j = 0; j < 16; j++)
+      put_sample(current.Y, current.Y16, (y0 + i) * current.mb_width + x0 + j, br.read(current.bit_depth));
+  for (int i = 0; i < 8; i++)
+    for (int j = 0; j < 8; j++)
+      put_sample(current.Cb, current.Cb16, ((y0 >> 1) + i) * (current.mb_width >> 1) + (x0 >> 1) + j, br.read(current.bit_depth));
+  for (int i = 0; i < 8; i++)
+    for (int j = 0; j < 8; j++)
+      put_sample(current.Cr, current.Cr16, ((y0 >> 1) + i) * (current.mb_width >> 1) + (x0 >> 1) + j, br.read(current.bit_depth));
+}
+
+// Prediction + inverse transform of a parsed MB (coefficients in 'mb', modes in mb_info)
+void Decoder::reconstruct_macroblock(const int mb_addr, MacroBlock& mb, const Intra16x16Mode intra16x16_mode,
+                                     const IntraChromaMode chroma_mode, const int qp) {
+  const MBInfo& info = mb_info[mb_addr];
+  const int qp_luma = qp + qp_bd_offset();   // QP'Y, the dequantization QP of the luma residual
+  const bool bypass = sps.qpprime_y_zero_transform_bypass_flag && qp_luma == 0;
+  if (info.is_intra16x16) {
+    reconstruct_intra16x16(mb_addr, mb, intra16x16_mode, qp_luma, bypass);
+  }
+  else {
+    for (int blk = 0; blk < 16; blk++)
+      reconstruct_intra4x4(mb_addr, blk, mb, static_cast<Intra4x4Mode>(info.intra4x4_Y_mode[blk]), qp_luma, bypass);
+  }
+
+  // QP'C: QP_C (identity below 30, where the negative qPI are) + QpBdOffsetC
+  int qpi = std::max(-qp_bd_offset(), std::min(qp + pps.chroma_qp_index_offset, 51));
+  int qp_chroma = ((qpi < 0) ? qpi : chroma_qp_table[qpi]) + qp_bd_offset();
+  reconstruct_chroma(mb_addr, mb, chroma_mode, qp_chroma, bypass);
+}
+
+void Decoder::reconstruct_intra16x16(const int mb_addr, MacroBlock& mb, const Intra16x16Mode mode, const int qp,
+                                     const bool bypass) {
+  int stride = current.mb_width;
+  int x0 = (mb_addr % sps.pic_width_in_mbs) * 16;
+  int y0 = (mb_addr / sps.pic_width_in_mbs) * 16;
+
+  // [0]: UL, [1..16]: U, [17..32]: L (see get_intra16x16_predictor)
+  bool up = get_neighbor_index(mb_addr, MB_NEIGHBOR_U) != -1;
+  bool left = get_neighbor_index(mb_addr, MB_NEIGHBOR_L) != -1;
+  int available = (up ? AVAILABLE_U : 0) | (left ? AVAILABLE_L : 0) | AVAILABLE_UL;
+  Predictor16x16 predictor;
+  if (current.bit_depth > 8)
+    predictor.load(current.Y16.data(), stride, x0, y0, available, current.bit_depth);
+  else
+    predictor.load(current.Y.data(), stride, x0, y0, available);
+
+  Block16x16 pred;
+  get_intra16x16(pred, predictor, mode);
+  if (!bypass)
+    iqdct_luma16x16_intra(mb.Y, qp);
+  else if (mode == Intra16x16Mode::VERTICAL || mode == Intra16x16Mode::HORIZONTAL)
+    inverse_bypass_dpcm(BlockView<16, 16>(mb.Y.data(), 16), mode == Intra16x16Mode::HORIZONTAL);
+
+  for (int i = 0; i < 16; i++)
+    for (int j = 0; j < 16; j++)
+      put_sample(current.Y, current.Y16, (y0 + i) * stride + x0 + j, pred[i*16+j] + mb.Y[i*16+j]);
+}
+
+void Decoder::reconstruct_intra4x4(const int mb_addr, const int blk, MacroBlock& mb, const Intra4x4Mode mode, const int qp,
+                                   const bool bypass) {
+  int stride = current.mb_width;
+  int real_pos = MacroBlock::convert_table[blk];
+  int x0 = (mb_addr % sps.pic_width_in_mbs) * 16 + (real_pos % 4) * 4;
+  int y0 = (mb_addr / sps.pic_width_in_mbs) * 16 + (real_pos / 4) * 4;
+
+  bool up = (real_pos >= 4) || get_neighbor_index(mb_addr, MB_NEIGHBOR_U) != -1;
+  bool left = (real_pos % 4 != 0) || get_neighbor_index(mb_addr, MB_NEIGHBOR_L) != -1;
+
+  // Upper right samples: not yet decoded for the right column and for blocks 3 and 11
+  bool up_right;
+  if (real_pos == 3)
+    up_right = get_neighbor_index(mb_addr, MB_NEIGHBOR_UR) != -1;
+  else if (real_pos < 3)
+    up_right = up;
+  else if (real_pos % 4 == 3)
+    up_right = false;
+  else
+    up_right = MacroBlock::convert_table[real_pos - 3] < blk;
+
+  // [0]: Q, [1..4]: A-D, [5..8]: E-H, [9..12]: I-L (see get_intra4x4_predictor)
+  int available = (up ? AVAILABLE_U : 0) | (left ? AVAILABLE_L : 0) | (up_right ? AVAILABLE_UR : 0) | AVAILABLE_UL;
+  Predictor4x4 predictor;
+  if (current.bit_depth > 8)
+    predictor.load(current.Y16.data(), stride, x0, y0, available, current.bit_depth);
+  else
+    predictor.load(current.Y.data(), stride, x0, y0, available);
+
+  CopyBlock4x4 pred;
+  get_intra4x4(pred, predictor, mode);
+
+  Block4x4 residual = mb.get_Y_4x4_block(blk);
+  if (!bypass)
+    iqdct_luma4x4_intra(residual, qp);
+  else if (mode == Intra4x4Mode::VERTICAL || mode == Intra4x4Mode::HORIZONTAL)
+    inverse_bypass_dpcm(residual, mode == Intra4x4Mode::HORIZONTAL);
+
+  for (int i = 0; i < 4; i++)
+    for (int j = 0; j < 4; j++)
+      put_sample(current.Y, current.Y16, (y0 + i) * stride + x0 + j, pred[i*4+j] + residual(i, j));
+}
+
+void Decoder::reconstruct_chroma(const int mb_addr, MacroBlock& mb, const IntraChromaMode mode, const int qp,
+                                 const bool bypass) {
+  int stride = current.mb_width >> 1;
+  int x0 = (mb_addr % sps.pic_width_in_mbs) * 8;
+  int y0 = (mb_addr / sps.pic_width_in_mbs) * 8;
+  bool up = get_neighbor_index(mb_addr, MB_NEIGHBOR_U) != -1;
+  bool left = get_neighbor_index(mb_addr, MB_NEIGHBOR_L) != -1;
+
+  int available = (up ? AVAILABLE_U : 0) | (left ? AVAILABLE_L : 0) | AVAILABLE_UL;
+
+  for (int c = 0; c < 2; c++) {
+    std::vector<std::uint8_t>& plane = (c == 0) ? current.Cb : current.Cr;
+    std::vector<std::uint16_t>& plane16 = (c == 0) ? current.Cb16 : current.Cr16;
+    Block8x8& block = (c == 0) ? mb.Cb : mb.Cr;
+
+    // [0]: UL, [1..8]: U, [9..16]: L (see get_intra8x8_chroma_predictor)
+    Predictor8x8 predictor;
+    if (current.bit_depth > 8)
+      predictor.load(plane16.data(), stride, x0, y0, available, current.bit_depth);
+    else
+      predictor.load(plane.data(), stride, x0, y0, available);
+
+    Block8x8 pred;
+    get_intra8x8_chroma(pred, predictor, mode);
+    if (!bypass)
+      iqdct_chroma8x8_intra(block, qp);
+    else if (mode == IntraChromaMode::VERTICAL || mode == IntraChromaMode::HORIZONTAL)
+      inverse_bypass_dpcm(BlockView<8, 8>(block.data(), 8), mode == IntraChromaMode::HORIZONTAL);
+
+    for (int i = 0; i < 8; i++)
+      for (int j = 0; j < 8; j++)
+        put_sample(plane, plane16, (y0 + i) * stride + x0 + j, pred[i*8+j] + block[i*8+j]);
+  }
+}
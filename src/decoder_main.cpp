@@ -0,0 +1,106 @@
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+#include <chrono>
+
+#include "decoder.h"
+#include "projection.h"
+
+using namespace std;
+using namespace std::chrono;
+
+/*
+*   Decodes an H.264 stream written by pointcloud_h264_node to planar YUV 4:2:0
+*   (16 bit little endian samples when the stream has more than 8 bits)
+*   and optionally reprojects every frame to 3D points (float x, y, z per point, one
+*   uint32 point count before each frame), using the projection metadata SEI of the stream
+*
+*   usage: pointcloud_h264_decoder <input.h264> <output.yuv> [<points.bin>]
+*/
+int main(int argc, char** argv)
+{
+    if (argc < 3) {
+        cerr << "usage: " << argv[0] << " <input.h264> <output.yuv> [<points.bin>]" << endl;
+        return 1;
+    }
+
+    ifstream input(argv[1], ios::in | ios::binary);
+    if (!input.is_open()) {
+        cerr << "Cannot open " << argv[1] << endl;
+        return 1;
+    }
+    vector<uint8_t> stream((istreambuf_iterator<char>(input)), istreambuf_iterator<char>());
+
+    ofstream output(argv[2], ios::out | ios::binary);
+    if (!output.is_open()) {
+        cerr << "Cannot open " << argv[2] << endl;
+        return 1;
+    }
+
+    auto start = high_resolution_clock::now();
+    Decoder decoder;
+    vector<DecodedPicture> pictures = decoder.decode(stream.data(), stream.size());
+    decoder.flush(pictures);   // a last picture with lost slices
+    auto stop = high_resolution_clock::now();
+    auto duration = duration_cast<microseconds>(stop - start);
+
+    for (auto& picture : pictures) {
+        // Cropped window, 4:2:0, 16 bit little endian samples above 8 bits
+        if (picture.bit_depth > 8) {
+            for (int i = 0; i < picture.height; i++)
+                output.write((char*)&picture.Y16[i * picture.mb_width], picture.width * sizeof(uint16_t));
+            for (int i = 0; i < picture.height / 2; i++)
+                output.write((char*)&picture.Cb16[i * picture.mb_width / 2], picture.width / 2 * sizeof(uint16_t));
+            for (int i = 0; i < picture.height / 2; i++)
+                output.write((char*)&picture.Cr16[i * picture.mb_width / 2], picture.width / 2 * sizeof(uint16_t));
+            continue;
+        }
+        for (int i = 0; i < picture.height; i++)
+            output.write((char*)&picture.Y[i * picture.mb_width], picture.width);
+        for (int i = 0; i < picture.height / 2; i++)
+            output.write((char*)&picture.Cb[i * picture.mb_width / 2], picture.width / 2);
+        for (int i = 0; i < picture.height / 2; i++)
+            output.write((char*)&picture.Cr[i * picture.mb_width / 2], picture.width / 2);
+    }
+
+    cout << pictures.size() << " frames decoded in " << duration.count() << " us";
+    if (!pictures.empty())
+        cout << " (" << duration.count() / pictures.size() << " us/frame, "
+             << pictures.front().width << "x" << pictures.front().height << ")";
+    cout << endl;
+
+    if (argc > 3) {
+        ofstream points_file(argv[3], ios::out | ios::binary);
+        if (!points_file.is_open()) {
+            cerr << "Cannot open " << argv[3] << endl;
+            return 1;
+        }
+
+        Reprojector reprojector;
+        PointBuffer points;
+        long reprojection_time = 0;
+
+        for (auto& picture : pictures) {
+            auto start_r = high_resolution_clock::now();
+            if (picture.has_metadata)
+                reprojector.set_config(picture.metadata.config);    // tables rebuilt only if the projection changed
+            uint32_t nb_points = (picture.bit_depth > 8)
+                ? reprojector.reproject(picture.Y16.data(), picture.mb_width, picture.width, picture.height, points)
+                : reprojector.reproject(picture.Y.data(), picture.mb_width, picture.width, picture.height, points);
+            auto stop_r = high_resolution_clock::now();
+            reprojection_time += duration_cast<microseconds>(stop_r - start_r).count();
+
+            points_file.write((char*)&nb_points, sizeof(nb_points));
+            for (uint32_t i = 0; i < nb_points; i++) {
+                float xyz[3] = {points.x[i], points.y[i], points.z[i]};
+                points_file.write((char*)xyz, sizeof(xyz));
+            }
+        }
+
+        if (!pictures.empty())
+            cout << "Reprojection: " << reprojection_time / (long)pictures.size() << " us/frame" << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include "effort_controller.h"
+
+#include <algorithm>
+
+/**
+ * @param _budget_us Latency budget of a frame
+ * @param _max_level Level of the configured preset, the controller starts there
+ * @param _queue_threshold Clouds waiting in the ingest queue that force the cheapest search (at least 2:
+ *        one cloud waiting while a frame is encoded is the normal state of a loaded pipeline)
+ */
+EffortController::EffortController(const long _budget_us, const int _max_level, const std::size_t _queue_threshold)
+: budget_us(_budget_us), max_level(clip(_max_level, 0, NB_ENCODER_PRESETS - 1)), level(max_level),
+  queue_threshold(std::max<std::size_t>(_queue_threshold, 2)), smoothed_us(-1), hold(0), fast_frames(0), dropped(0) {}
+
+/**
+ * @brief Takes the measures of the last frame out of the pipeline, sets the level of the next frames
+ *
+ * @param latency_us     Reception to output of the frame
+ * @param queued         Clouds waiting in the ingest queue
+ * @param total_dropped  Clouds dropped by the ingest queue so far
+ */
+void EffortController::update(const long latency_us, const std::size_t queued, const std::size_t total_dropped) {
+  smoothed_us = (smoothed_us < 0) ? latency_us : smoothed_us + (latency_us - smoothed_us) / 4;
+
+  const bool dropping = total_dropped > dropped;
+  dropped = total_dropped;
+  const int current = level.load(std::memory_order_relaxed);
+
+  // Falling behind: cheapest search at once, before the ingest queue overflows
+  if (dropping || queued >= queue_threshold || 2 * latency_us > 3 * budget_us) {
+    if (current > 0) {
+      level.store(0, std::memory_order_relaxed);
+      hold = HOLD_FRAMES;
+    }
+    fast_frames = 0;
+    return;
+  }
+
+  if (hold > 0) {
+    hold--;
+    return;
+  }
+
+  // Over the budget: two levels down, close to it: one
+  if (10 * smoothed_us > 9 * budget_us) {
+    if (current > 0) {
+      level.store(std::max(current - ((smoothed_us > budget_us) ? 2 : 1), 0), std::memory_order_relaxed);
+      hold = HOLD_FRAMES;
+    }
+    fast_frames = 0;
+  } else if (10 * smoothed_us < 6 * budget_us) {
+    if (++fast_frames >= UP_FRAMES && current < max_level) {
+      level.store(current + 1, std::memory_order_relaxed);
+      hold = HOLD_FRAMES;
+      fast_frames = 0;
+    }
+  } else {
+    fast_frames = 0;
+  }
+}
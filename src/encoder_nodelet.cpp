@@ -0,0 +1,669 @@
+#include <ros/ros.h>
+#include <pluginlib/class_list_macros.h>
+#include <pcl_conversions/pcl_conversions.h>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/CompressedImage.h>
+#include <pcl/io/auto_io.h>
+#include <pcl/compression/octree_pointcloud_compression.h>
+#include <fstream>
+#include <iostream>
+#include <pcl/visualization/pcl_visualizer.h>
+#include <pcl/io/png_io.h>
+#include <pcl/range_image/range_image.h>
+#include <pcl/range_image/range_image_spherical.h>
+#include <boost/thread/thread.hpp>
+#include <pcl/visualization/common/float_image_utils.h>
+#include <pcl/compression/libpng_wrapper.h>
+#include <pcl/compression/organized_pointcloud_compression.h>
+#include <opencv2/opencv.hpp>
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc.hpp>
+#include <iostream>
+#include <stdio.h>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <unistd.h>
+
+
+#include "prediction.h"
+#include "packager.h"
+#include "top_encoding.h"
+#include "projection.h"
+#include "metrics.h"
+#include "rtp.h"
+#include "ingest_queue.h"
+#include "pool.h"
+#include "alloc_counter.h"
+#include "arena.h"
+#include "effort_controller.h"
+#include "encoder_nodelet.h"
+
+using namespace cv;
+using namespace std;
+using namespace std::chrono;
+
+std::unique_ptr<Packager> packager;
+
+// Entropy coding of the slices (~entropy_coding): "cavlc" (Baseline profile) or "cabac" (Main profile, smaller)
+EntropyCoding entropy_coding = EntropyCoding::CAVLC;
+
+// Mathematically lossless ranges (~lossless): transform bypass at QP 0 (High 4:4:4 Predictive profile),
+// the MBs that cost more than their samples stay I_PCM. The loop filter has no effect at QP 0.
+bool lossless = false;
+
+// Bits per range sample (~bit_depth, 8 to 14), the constant chroma uses the same depth. Above 8 bits the
+// stream is High 10 (up to 10 bits) or High 4:4:4 Predictive.
+int bit_depth = 8;
+
+// QP_Y of the lossy MBs (~qp, -6 * (bit_depth - 8) to 51). By default 51 - 6 * (bit_depth - 8): the
+// quantizer step of 8 bits at QP 51 (QP'Y 51), so the extra bits of the samples are kept.
+int qp = LUMA_QP;
+
+// Encoded access units (format "h264", Annex B), SPS/PPS repeated every keyframe_interval frames
+ros::Publisher h264_pub;
+int keyframe_interval = 30;
+
+// Live RTP/UDP stream (enabled with ~rtp_host), slices capped to ~max_slice_bytes
+std::unique_ptr<RtpPacketizer> rtp_packetizer;
+std::unique_ptr<RtpSender> rtp_sender;
+int max_slice_bytes = 0;
+
+// Projection metadata SEI in front of every frame (~sei)
+bool write_sei = true;
+
+// In-loop deblocking filter of every slice (~deblocking: off, on, or slice to stop at the slice
+// boundaries; ~deblocking_alpha and ~deblocking_beta: slice_alpha_c0_offset_div2 and slice_beta_offset_div2).
+// Off by default: at QP 51 it also smooths the real range steps and the I_PCM MBs.
+DeblockingParams deblocking_params;
+
+ProjectionConfig projection_config;
+
+// Range image construction (~projector): "fast" (SphericalProjector), "exact" (project_points) or "pcl"
+// (pcl::RangeImage, reference). Every ~projection_check frames the PCL reference is also run and compared.
+std::string projector_name = "fast";
+int projection_check = 0;
+ofstream check_file("txt/projection_check.txt", ios::out);
+
+// Mode decision effort (~preset): ultrafast, superfast, veryfast, faster, fast, medium or slow (see prediction.h)
+int preset_level = 0;
+
+// With ~latency_budget_ms > 0, the preset is lowered (down to ultrafast) when the frames take longer
+// than the budget and raised back up to ~preset when there is room. Latencies go to txt/effort.txt.
+// ~effort_queue clouds waiting in the ingest queue also force ultrafast (0: the queue is full with a
+// drop policy, as the next cloud would be dropped, half full when blocking; at least 2).
+std::unique_ptr<EffortController> effort_controller;
+ofstream effort_file("txt/effort.txt", ios::out);
+
+// Quality metrics computed on a side thread (enabled with the ~metrics parameter)
+std::unique_ptr<MetricsWorker> metrics;
+
+ofstream rimage_file("txt/rimage_time.txt", ios::out);
+ofstream mb_file("txt/mb_time.txt", ios::out);
+ofstream pred_file("txt/pred_time.txt", ios::out);
+ofstream transf_file("txt/trf_time.txt", ios::app);
+ofstream code_file("txt/code_time.txt", ios::out);
+ofstream pack_file("txt/pack_time.txt", ios::out);
+ofstream queue_file("txt/writer_queue.txt", ios::out);
+ofstream ingest_file("txt/ingest.txt", ios::out);
+
+// Clouds waiting for the encoder (~ingest_queue, ~drop_policy)
+struct IngestItem {
+    sensor_msgs::PointCloud2ConstPtr cloud;
+    steady_clock::time_point received;
+};
+std::unique_ptr<IngestQueue<IngestItem>> ingest_queue;
+
+/*
+    Encoding pipeline, one thread per stage, frames handed over through blocking queues:
+
+      projection -> prediction/transform -> entropy coding -> packing/output
+      (frame N+2)   (frame N+1)             (frame N)         (frame N-1)
+
+    Throughput is set by the slowest stage. Stage occupancy goes to txt/pipeline.txt.
+*/
+enum { STAGE_PROJECTION, STAGE_PREDICTION, STAGE_ENTROPY, STAGE_PACKING, NB_STAGES };
+
+// Recycled through job_pool: the buffers below keep their capacity from one frame to the next
+struct FrameJob {
+    sensor_msgs::PointCloud2ConstPtr input;
+    int frame_num;
+    std::unique_ptr<Frame> frame;
+    Mat yuv;                              // encoder input (metrics)
+    std::unique_ptr<float[]> ranges;      // range image (metrics)
+    int width, height;                    // range image size
+    float sensor_pose[7];                 // translation, quaternion
+    std::vector<int> first_mbs;           // slices
+    std::size_t allocations[NB_STAGES];   // heap allocations of each stage (~alloc_check)
+    steady_clock::time_point received;    // by the ROS callback
+    long stage_us[NB_STAGES];             // processing time of each stage
+    int preset_level;                     // preset of the prediction stage
+};
+
+// Jobs in flight: one per stage and queue slot, plus the one being recycled
+ObjectPool<FrameJob> job_pool(2 * NB_STAGES);
+
+/*
+    Allocation check (~alloc_check >= 0): allocations of every stage are written to
+    txt/allocations.txt, and the node stops with an error if a frame allocates once
+    ~alloc_check warm-up frames have been encoded.
+*/
+int alloc_check = -1;
+bool alloc_failed = false;
+ofstream alloc_file;
+
+// Last stage: latency (effort control), allocation check, then the job goes back to the pool
+void retire_job(std::unique_ptr<FrameJob>&& job)
+{
+    // frame, latency (us), time in each stage (us), preset level of the frame
+    long latency = duration_cast<microseconds>(steady_clock::now() - job->received).count();
+    effort_file << job->frame_num << " " << latency;
+    for (int i = 0; i < NB_STAGES; i++)
+        effort_file << " " << job->stage_us[i];
+    effort_file << " " << job->preset_level << endl;
+
+    if (effort_controller)
+        effort_controller->update(latency, ingest_queue->size(), ingest_queue->get_dropped());
+
+    if (alloc_check >= 0) {
+        std::size_t total = 0;
+        alloc_file << job->frame_num;
+        for (int i = 0; i < NB_STAGES; i++) {
+            alloc_file << " " << job->allocations[i];
+            total += job->allocations[i];
+        }
+        alloc_file << endl;
+
+        if (job->frame_num >= alloc_check && total > 0 && !alloc_failed) {
+            ROS_ERROR("Frame %d: %zu heap allocations in the steady-state encoding loop (see txt/allocations.txt)",
+                      job->frame_num, total);
+            alloc_failed = true;
+            ros::shutdown();
+        }
+    }
+
+    job->input.reset();   // the message goes back to ROS now
+    job_pool.release(std::move(job));
+}
+
+typedef IngestQueue<std::unique_ptr<FrameJob>> StageQueue;
+std::unique_ptr<StageQueue> stage_queues[NB_STAGES - 1];   // input of stages 1..3
+
+std::atomic<long> stage_busy_us[NB_STAGES];
+steady_clock::time_point pipeline_start;
+ofstream pipeline_file("txt/pipeline.txt", ios::out);
+
+// Runs 'work' on every job of 'input' until it is closed and empty, then closes 'output'.
+// The temporaries of 'work' are taken from a frame arena, rewound after every job.
+template <typename Work>
+void run_stage(const int stage, StageQueue& input, StageQueue* output, Work work)
+{
+    std::unique_ptr<FrameJob> job;
+    FrameArena arena;
+    while (true) {
+        if (!input.pop(job, milliseconds(100))) {
+            if (input.is_closed() && input.size() == 0)
+                break;
+            continue;
+        }
+
+        auto start = steady_clock::now();
+        std::size_t allocations = get_thread_allocations();
+        {
+            ArenaScope scope(arena);
+            work(*job);
+        }
+        arena.reset();
+        job->allocations[stage] = get_thread_allocations() - allocations;
+        job->stage_us[stage] = duration_cast<microseconds>(steady_clock::now() - start).count();
+        stage_busy_us[stage] += job->stage_us[stage];
+
+        if (output)
+            output->push(std::move(job));
+        else
+            retire_job(std::move(job));
+    }
+    if (output)
+        output->close();
+}
+
+// Reference range image: PCL conversion and pcl::RangeImage::createFromPointCloud
+void pcl_range_image(const sensor_msgs::PointCloud2ConstPtr& input, const ProjectionConfig& projection, float* ranges)
+{
+    pcl::PointCloud<pcl::PointXYZ>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZ>);
+    pcl::fromROSMsg(*input, *cloud);
+
+    Eigen::Affine3f sensorPose = (Eigen::Affine3f)Eigen::Translation3f(0.0f, 0.0f, 0.0f);
+    pcl::RangeImage::CoordinateFrame coordinate_frame = pcl::RangeImage::LASER_FRAME;
+    float noiseLevel=0.00;
+    float minRange = projection.min_range;
+    int borderSize = std::numeric_limits<int>::min();  // no cropping, the image size and angles are fixed by the projection
+
+    pcl::RangeImage rangeImage;
+    rangeImage.createFromPointCloud(*cloud, projection.angular_resolution_x, projection.angular_resolution_y, 
+                                     projection.max_angle_width, projection.max_angle_height,
+                                     sensorPose, coordinate_frame, noiseLevel, minRange, borderSize);
+
+    int width = projection.width(), height = projection.height();
+    std::fill(ranges, ranges + width * height, -std::numeric_limits<float>::infinity());
+    for (int v = 0; v < std::min<int>(height, rangeImage.height); v++)
+        for (int u = 0; u < std::min<int>(width, rangeImage.width); u++)
+            ranges[v * width + u] = rangeImage.getPoint(u, v).range;
+}
+
+// Stage 0: range image, I420 image and Frame (MB split, slices)
+std::unique_ptr<FrameJob> project_cloud(const sensor_msgs::PointCloud2ConstPtr& input)
+{
+    static int counter=0;
+    static CloudLayout layout;            // field offsets, resolved again only when the message layout changes
+    static SphericalProjector projector;
+
+    // Projection shared with the decoder side (see projection.h)
+    const ProjectionConfig& projection = projection_config;
+    projector.set_config(projection);
+
+    if (projector_name != "pcl" && !layout.resolve(*input)) {
+        ROS_ERROR_THROTTLE(10, "PointCloud2 without float32 x/y/z in host byte order, cloud dropped");
+        return nullptr;
+    }
+
+    /*
+        The ranges are read from the message buffer (no PCL cloud) and binned as
+        pcl::RangeImage::createFromPointCloud would do (LASER_FRAME, identity sensor pose).
+        The fast projector writes the encoder input directly, the float ranges are only
+        built for the metrics.
+    */
+    std::unique_ptr<FrameJob> job = job_pool.acquire();
+    job->input = input;
+    if (!job->ranges || job->width != projection.width() || job->height != projection.height())
+        job->ranges.reset(new float[projection.width() * projection.height()]);
+    job->width = projection.width();
+    job->height = projection.height();
+
+    auto start_0 = high_resolution_clock::now();
+    if (projector_name == "fast") {
+        projector.project(input->data.data(), input->width, input->height, input->row_step, layout, job->yuv,
+                          metrics ? job->ranges.get() : nullptr);
+    } else {
+        if (projector_name == "pcl")
+            pcl_range_image(input, projection, job->ranges.get());
+        else
+            project_points(input->data.data(), input->width, input->height, input->row_step, layout, projection, job->ranges.get());
+
+        /*
+            The ranges are quantized to the luma samples (0 = no return), chroma is constant.
+            The output YUV image has ONE channel and 3/2 * padded rows (I420), with width and height
+            padded to multiple of 16 (see range_image_to_I420).
+        */
+        job->yuv = range_image_to_I420(job->ranges.get(), job->width, job->height, projection);
+    }
+    auto stop_0 = high_resolution_clock::now();
+    auto duration_0 = duration_cast<microseconds>(stop_0 - start_0);
+    rimage_file << duration_0.count() << endl;                           
+
+    job->frame_num = counter++;
+    float pose[7] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f};   // identity: translation, quaternion
+    std::copy(pose, pose + 7, job->sensor_pose);
+
+    // Validation against PCL: frame, pixels whose sample differs, pixels with a return in either image
+    if (projection_check > 0 && job->frame_num % projection_check == 0 && projector_name != "pcl") {
+        std::unique_ptr<float[]> reference(new float[job->width * job->height]);
+        pcl_range_image(input, projection, reference.get());
+        cv::Mat expected = range_image_to_I420(reference.get(), job->width, job->height, projection);
+
+        long different = 0, valid = 0;
+        const bool wide = (expected.depth() == CV_16U);
+        auto sample = [wide](const cv::Mat& yuv, int v, int u) -> int {
+            return wide ? yuv.ptr<uint16_t>(v)[u] : yuv.ptr<uint8_t>(v)[u];
+        };
+        for (int v = 0; v < job->height; v++)
+            for (int u = 0; u < job->width; u++) {
+                int a = sample(expected, v, u), b = sample(job->yuv, v, u);
+                different += (a != b);
+                valid += (a != 0 || b != 0);
+            }
+        check_file << job->frame_num << " " << different << " " << valid << endl;
+    }
+
+    auto start_2 = high_resolution_clock::now(); 
+    if (job->frame)
+        job->frame->load(job->yuv);
+    else
+        job->frame.reset(new Frame(job->yuv));
+    if (max_slice_bytes > 0) {
+        packager->plan_slices(*job->frame, max_slice_bytes, job->first_mbs);
+        job->frame->set_slices(job->first_mbs);
+    }
+    job->frame->set_deblocking(deblocking_params);
+    job->frame->lossless = lossless;
+    job->frame->bit_depth = bit_depth;
+    job->frame->qp = qp;
+    auto stop_2 = high_resolution_clock::now();
+    auto duration_2 = duration_cast<microseconds>(stop_2 - start_2);
+    mb_file << duration_2.count() << endl;
+
+    return job;
+}
+
+// Stage 1: intra prediction, transform and quantization
+void predict_frame(FrameJob& job)
+{
+    transf_file << "Start frame " << job.frame_num << endl;
+    auto start_3 = high_resolution_clock::now(); 
+    job.preset_level = effort_controller ? effort_controller->get_level() : preset_level;
+    encode_I_frame(*job.frame, get_encoder_preset(job.preset_level));
+    auto stop_3 = high_resolution_clock::now();
+    auto duration_3 = duration_cast<microseconds>(stop_3 - start_3);
+    pred_file << duration_3.count() << endl;
+    transf_file << "End frame " << job.frame_num << endl;
+
+    printf("Prediction and Transform %d\n", job.frame_num);
+}
+
+// Stage 2: CAVLC residuals, or the whole slice data with CABAC
+void entropy_code_frame(FrameJob& job)
+{
+    auto start_4 = high_resolution_clock::now(); 
+    if (entropy_coding == EntropyCoding::CABAC)
+        cabac_frame(*job.frame);
+    else
+        vlc_frame(*job.frame);
+    auto stop_4 = high_resolution_clock::now();
+    auto duration_4 = duration_cast<microseconds>(stop_4 - start_4);
+    code_file << duration_4.count() << endl;
+
+    printf("Entropy coding %d\n", job.frame_num);
+}
+
+// Stage 3: NAL units to the file, topic and RTP stream, metrics
+void pack_frame(FrameJob& job)
+{
+    static int encode_flag=0;
+    const int counter = job.frame_num;
+    const sensor_msgs::PointCloud2ConstPtr& input = job.input;
+    Frame& yuvFrame = *job.frame;
+
+    if(!encode_flag)
+    {
+        packager->write_SPS(yuvFrame.width, yuvFrame.height, 76);  // 1 frame for testing
+        packager->write_PPS();   // 1 PPS for the whole slice
+        encode_flag=1;
+        printf("SPS and PPS done\n");
+    }
+
+    auto start_5 = high_resolution_clock::now(); 
+    // Published as a shared pointer: subscribers in the same process (nodelets) get it without serialization
+    sensor_msgs::CompressedImagePtr access_unit;
+    if (h264_pub.getNumSubscribers() > 0 || rtp_sender) {
+        access_unit.reset(new sensor_msgs::CompressedImage);
+        access_unit->header = input->header;
+        access_unit->format = "h264";
+        if (counter % keyframe_interval == 0)
+            packager->append_parameter_sets(access_unit->data);
+    }
+
+    if (write_sei) {
+        ProjectionMetadata metadata;
+        metadata.config = projection_config;
+        metadata.stamp = input->header.stamp.toNSec();
+        metadata.frame_num = counter;
+        std::copy(job.sensor_pose, job.sensor_pose + 7, metadata.sensor_pose);
+        packager->write_SEI(metadata, access_unit ? &access_unit->data : nullptr);
+    }
+
+    size_t slice_bytes = packager->write_slice(counter, yuvFrame, access_unit ? &access_unit->data : nullptr,
+                                               input->header.stamp.toNSec());
+    if (access_unit && rtp_sender) {
+        // 90 kHz clock, wrapping modulo 2^32 (RFC 3550): stamp.toNSec() * 9 overflows 64 bits
+        const ros::Time& stamp = input->header.stamp;
+        uint32_t timestamp = uint32_t(stamp.sec * 90000ULL + stamp.nsec / 100000 * 9);
+        rtp_sender->send(rtp_packetizer->packetize(access_unit->data.data(), access_unit->data.size(), timestamp));
+    }
+    if (access_unit && h264_pub.getNumSubscribers() > 0)
+        h264_pub.publish(access_unit);
+    auto stop_5 = high_resolution_clock::now();
+    auto duration_5 = duration_cast<microseconds>(stop_5 - start_5);
+    pack_file << duration_5.count() << endl;    
+
+    printf("Packing %d\n",counter);
+    queue_file << packager->get_writer().get_depth() << " " << packager->get_writer().get_max_depth() << " "
+               << packager->get_writer().get_full_count() << endl;
+
+    if (metrics) {
+        std::vector<uint16_t> decoded_Y = yuvFrame.get_decoded_Y();
+        metrics->submit(make_metrics_job(counter, slice_bytes * 8, job.ranges.get(), job.width, job.height,
+                                         job.yuv, decoded_Y.data(), yuvFrame.width));
+    }
+
+    // frame, occupancy (%) of each stage since the start, frames waiting in front of stages 1..3
+    double elapsed = std::max<long>(1, duration_cast<microseconds>(steady_clock::now() - pipeline_start).count());
+    pipeline_file << counter;
+    for (int i = 0; i < NB_STAGES; i++)
+        pipeline_file << " " << 100.0 * stage_busy_us[i] / elapsed;
+    for (int i = 0; i < NB_STAGES - 1; i++)
+        pipeline_file << " " << stage_queues[i]->size();
+    pipeline_file << endl;
+}
+
+// Only queues the message: the ROS spinner never waits for the encoder
+void receiver_cb(const sensor_msgs::PointCloud2ConstPtr& input)
+{
+    ingest_queue->push(IngestItem{input, steady_clock::now()});
+}
+
+// Stage 0, fed by the ingest queue
+void projection_thread()
+{
+    IngestItem item;
+    while (true) {
+        if (!ingest_queue->pop(item, milliseconds(100))) {
+            if (ingest_queue->is_closed() && ingest_queue->size() == 0)
+                break;
+            continue;
+        }
+
+        // queue latency (us), frames still queued, frames dropped so far
+        auto latency = duration_cast<microseconds>(steady_clock::now() - item.received);
+        ingest_file << latency.count() << " " << ingest_queue->size() << " " << ingest_queue->get_dropped() << endl;
+
+        auto start = steady_clock::now();
+        std::size_t allocations = get_thread_allocations();
+        std::unique_ptr<FrameJob> job = project_cloud(item.cloud);
+        long busy = duration_cast<microseconds>(steady_clock::now() - start).count();
+        stage_busy_us[STAGE_PROJECTION] += busy;
+
+        if (job) {
+            job->allocations[STAGE_PROJECTION] = get_thread_allocations() - allocations;
+            job->received = item.received;
+            job->stage_us[STAGE_PROJECTION] = busy;
+            stage_queues[0]->push(std::move(job));
+        }
+        item.cloud.reset();
+    }
+    stage_queues[0]->close();
+}
+
+// A single encoder per process: its state above is global
+std::atomic<bool> encoder_loaded(false);
+
+bool EncoderNodelet::allocation_check_failed()
+{
+  return alloc_failed;
+}
+
+void EncoderNodelet::onInit()
+{
+  if (encoder_loaded.exchange(true)) {
+    NODELET_ERROR("Only one encoder nodelet per process");
+    return;
+  }
+
+//   remove("txt/16x16_Y_predictors.txt");
+//   remove("txt/4x4_Y_predictors.txt");
+//   remove("txt/16x16_Y_pred_mode.txt");
+//   remove("txt/4x4_Y_pred_mode.txt"); 
+//   remove("txt/8x8_Cb_predictors.txt");
+//   remove("txt/8x8_Cr_predictors.txt");
+//   remove("txt/8x8_CbCr_pred_mode.txt");
+//   remove("txt/4x4_Y_residual.txt");
+//   remove("txt/16x16_Y_residual.txt");
+//   remove("txt/8x8_CbCr_residual.txt");
+
+  ros::NodeHandle& nh = getNodeHandle();
+  ros::NodeHandle& private_nh = getPrivateNodeHandle();
+
+  // Output stream, written from its own thread (~fsync: none, batch or close)
+  std::string fsync_mode;
+  int writer_queue;
+  private_nh.param<std::string>("fsync", fsync_mode, "none");
+  private_nh.param("writer_queue", writer_queue, 16);
+
+  FsyncPolicy fsync_policy = FsyncPolicy::NONE;
+  if (fsync_mode == "batch")
+    fsync_policy = FsyncPolicy::PER_BATCH;
+  else if (fsync_mode == "close")
+    fsync_policy = FsyncPolicy::ON_CLOSE;
+
+  std::string entropy_coding_name;
+  private_nh.param<std::string>("entropy_coding", entropy_coding_name, "cavlc");
+  if (entropy_coding_name != "cavlc" && entropy_coding_name != "cabac") {
+    ROS_WARN("Unknown entropy coding %s, using cavlc", entropy_coding_name.c_str());
+    entropy_coding_name = "cavlc";
+  }
+  entropy_coding = (entropy_coding_name == "cabac") ? EntropyCoding::CABAC : EntropyCoding::CAVLC;
+  private_nh.param("lossless", lossless, false);
+  private_nh.param("bit_depth", bit_depth, 8);
+  if (bit_depth < 8 || bit_depth > 14) {
+    ROS_WARN("Unsupported bit depth %d, using %d", bit_depth, clip(bit_depth, 8, 14));
+    bit_depth = clip(bit_depth, 8, 14);
+  }
+  projection_config.bit_depth = bit_depth;
+  private_nh.param("qp", qp, LUMA_QP - 6 * (bit_depth - 8));
+  if (qp < -6 * (bit_depth - 8) || qp > 51) {
+    ROS_WARN("QP %d out of range at %d bits, using %d", qp, bit_depth, clip(qp, -6 * (bit_depth - 8), 51));
+    qp = clip(qp, -6 * (bit_depth - 8), 51);
+  }
+  packager.reset(new Packager("/home/portilha/catkin_ws/src/h264/output_bitstream/out.h264", fsync_policy, writer_queue,
+                              entropy_coding, lossless, bit_depth));
+
+  // Seek index (out.h264.idx, see recording.h)
+  bool write_index;
+  private_nh.param("index", write_index, true);
+  if (write_index)
+    packager->enable_index();
+
+  std::string h264_topic;
+  private_nh.param<std::string>("h264_topic", h264_topic, "pointcloud_h264");
+  private_nh.param("keyframe_interval", keyframe_interval, 30);
+  keyframe_interval = std::max(keyframe_interval, 1);
+  h264_pub = nh.advertise<sensor_msgs::CompressedImage>(h264_topic, 10);
+
+  std::string rtp_host;
+  int rtp_port, rtp_payload;
+  private_nh.param<std::string>("rtp_host", rtp_host, "");
+  private_nh.param("rtp_port", rtp_port, 5004);
+  private_nh.param("rtp_payload", rtp_payload, 1400);   // bytes, 1500 MTU - IP/UDP/RTP headers
+  private_nh.param("max_slice_bytes", max_slice_bytes, rtp_host.empty() ? 0 : rtp_payload);
+  if (!rtp_host.empty()) {
+    rtp_packetizer.reset(new RtpPacketizer(getpid(), 96, rtp_payload));
+    rtp_sender.reset(new RtpSender(rtp_host, rtp_port));
+  }
+
+  private_nh.param("sei", write_sei, true);
+
+  std::string deblocking_mode;
+  private_nh.param<std::string>("deblocking", deblocking_mode, "off");
+  private_nh.param("deblocking_alpha", deblocking_params.alpha_offset_div2, 0);
+  private_nh.param("deblocking_beta", deblocking_params.beta_offset_div2, 0);
+  if (deblocking_mode != "on" && deblocking_mode != "off" && deblocking_mode != "slice") {
+    ROS_WARN("Unknown deblocking mode %s, using off", deblocking_mode.c_str());
+    deblocking_mode = "off";
+  }
+  deblocking_params.disable_idc = (deblocking_mode == "off") ? 1 : (deblocking_mode == "slice") ? 2 : 0;
+  deblocking_params.alpha_offset_div2 = clip(deblocking_params.alpha_offset_div2, -6, 6);
+  deblocking_params.beta_offset_div2 = clip(deblocking_params.beta_offset_div2, -6, 6);
+
+  private_nh.param("alloc_check", alloc_check, -1);
+  if (alloc_check >= 0 && !allocations_counted()) {
+    ROS_WARN("~alloc_check needs the heap counters of pointcloud_h264_node, off");
+    alloc_check = -1;
+  }
+  if (alloc_check >= 0)
+    alloc_file.open("txt/allocations.txt", ios::out);
+
+  private_nh.param<std::string>("projector", projector_name, "fast");
+  private_nh.param("projection_check", projection_check, 0);
+  if (projector_name != "fast" && projector_name != "exact" && projector_name != "pcl") {
+    ROS_WARN("Unknown projector %s, using fast", projector_name.c_str());
+    projector_name = "fast";
+  }
+
+  std::string preset_name;
+  int latency_budget, effort_queue;
+  private_nh.param<std::string>("preset", preset_name, DEFAULT_ENCODER_PRESET);
+  private_nh.param("latency_budget_ms", latency_budget, 0);
+  private_nh.param("effort_queue", effort_queue, 0);
+  preset_level = find_encoder_preset(preset_name);
+  if (preset_level < 0) {
+    ROS_WARN("Unknown preset %s, using %s", preset_name.c_str(), DEFAULT_ENCODER_PRESET.c_str());
+    preset_level = find_encoder_preset(DEFAULT_ENCODER_PRESET);
+  }
+  bool enable_metrics;
+  private_nh.param("metrics", enable_metrics, false);
+  if (enable_metrics)
+    metrics.reset(new MetricsWorker(projection_config, "txt/metrics.txt"));
+
+  // Encoder thread fed by a bounded queue: freshness first by default (drop the oldest cloud)
+  int ingest_size;
+  std::string drop_policy;
+  private_nh.param("ingest_queue", ingest_size, 2);
+  private_nh.param<std::string>("drop_policy", drop_policy, "oldest");
+
+  DropPolicy policy = DropPolicy::DROP_OLDEST;
+  if (drop_policy == "newest")
+    policy = DropPolicy::DROP_NEWEST;
+  else if (drop_policy == "block")
+    policy = DropPolicy::BLOCK;
+  ingest_queue.reset(new IngestQueue<IngestItem>(std::max(ingest_size, 1), policy));
+
+  if (latency_budget > 0) {
+    std::size_t capacity = ingest_queue->capacity();
+    if (effort_queue <= 0)
+      effort_queue = (policy == DropPolicy::BLOCK) ? capacity / 2 : capacity;
+    effort_controller.reset(new EffortController(latency_budget * 1000L, preset_level, effort_queue));
+  }
+
+  // Encoding pipeline, one frame in flight between two stages
+  for (int i = 0; i < NB_STAGES - 1; i++)
+    stage_queues[i].reset(new StageQueue(1, DropPolicy::BLOCK));
+  pipeline_start = steady_clock::now();
+
+  stages.emplace_back(projection_thread);
+  stages.emplace_back(run_stage<void (*)(FrameJob&)>, STAGE_PREDICTION, std::ref(*stage_queues[0]), stage_queues[1].get(),
+                      predict_frame);
+  stages.emplace_back(run_stage<void (*)(FrameJob&)>, STAGE_ENTROPY, std::ref(*stage_queues[1]), stage_queues[2].get(),
+                      entropy_code_frame);
+  stages.emplace_back(run_stage<void (*)(FrameJob&)>, STAGE_PACKING, std::ref(*stage_queues[2]), nullptr, pack_frame);
+
+  // Create a ROS subscriber for the input point cloud (the ingest queue does the buffering, except when blocking)
+  sub = nh.subscribe ("/kitti/velo/pointcloud", (policy == DropPolicy::BLOCK) ? 100 : 1, receiver_cb);
+  //sub = nh.subscribe ("/autonomoose/velo/pointcloud", 1, receiver_cb);
+}
+
+// Unloaded (or the node is shutting down): each stage drains its input and closes the next queue
+EncoderNodelet::~EncoderNodelet()
+{
+  if (stages.empty())
+    return;
+  sub.shutdown();
+  ingest_queue->close();
+  for (auto& stage : stages)
+    stage.join();
+}
+
+PLUGINLIB_EXPORT_CLASS(EncoderNodelet, nodelet::Nodelet)
@@ -1,5 +1,7 @@
 #include "frame.h"
 
+#include <algorithm>
+
 /* Initialize Frame(I-Picture)
  *
  * Only I-Picture can be initialized with a padded frame, since there is no dependency
@@ -8,6 +10,21 @@
 Frame::Frame(const Mat& yuv)
 : type(I_PICTURE)
 {
+  load(yuv);
+}
+
+/* (Re)fills the frame with a new padded I420 image, 8 bit (CV_8U) or 16 bit samples (CV_16U, more than
+ * 8 bits, see bit_depth)
+ *
+ * When the geometry does not change, the MBs are overwritten in place: a recycled Frame
+ * (see ObjectPool) keeps the capacity of all its buffers and nothing is allocated. The
+ * coded MBs and CABAC slices are reserved for their worst case (MacroBlock::max_coded_bytes).
+ * The slices (set_slices) are kept too, a new geometry goes back to a single slice.
+ */
+void Frame::load(const Mat& yuv)
+{
+  this->type = I_PICTURE;
+
   // data structure (raw image) dimensions
   this->raw_height = yuv.rows;
   this->raw_width = yuv.cols;
@@ -33,10 +50,34 @@ Frame::Frame(const Mat& yuv)
   uint16_t nb_mbs = this->nb_mb_cols * this->nb_mb_rows;
   uint16_t cnt_mbs = 0;
 
-  // Reserve the capacity of vector
-  this->mbs.reserve(nb_mbs);
+  // New geometry: rebuild the vector of macroblocks (capacity reserved once) and the neighbour table.
+  // The MBs outlive the frame arena of the calling stage, their bitstreams are on the heap
+  if (this->mbs.size() != nb_mbs || (!this->mbs.empty() && this->mbs.back().mb_col != this->nb_mb_cols - 1)) {
+    HeapScope heap;
+    this->mbs.clear();
+    this->mbs.reserve(nb_mbs);
+    for (int y = 0; y < this->nb_mb_rows; y++)
+      for (int x = 0; x < this->nb_mb_cols; x++)
+        this->mbs.push_back(MacroBlock(y, x));
+
+    this->slice_map.clear();
+    this->slice_first_mbs.clear();
+    this->slice_first_mbs.reserve(nb_mbs);   // at most one slice per MB, set_slices does not allocate
+    this->slice_deblocking.resize(1);
+    this->cabac_slice_offsets.reserve(nb_mbs + 1);
+    build_neighbors();
+  }
+  this->decoded_mbs.clear();
+
+  const uint8_t* pixelPtr = yuv.data;                          // pointer to pixel data
+  const uint16_t* pixelPtr16 = (const uint16_t*)yuv.data;       // same, 16 bit samples
+  const bool wide = (yuv.depth() == CV_16U);
+
+  // Worst case of the entropy coding (no-op once reserved), so that vlc_frame and cabac_frame do not
+  // allocate: bit_depth is only set after load, 16 bit samples hold up to 14 bits
+  const std::size_t max_mb_bytes = MacroBlock::max_coded_bytes(wide ? 14 : 8);
+  this->cabac_data.reserve(nb_mbs * max_mb_bytes);
 
-  uint8_t* pixelPtr = (uint8_t*)yuv.data;                     // pointer to pixel data
   // 179968 pixels for luma
   // 269952 total pixels
   uint32_t u_offset = this->height * this->width;              // offset to U component
@@ -48,7 +89,9 @@ Frame::Frame(const Mat& yuv)
     for (x = 0; x < this->nb_mb_cols; x++) {
 
       // Initialize macroblock with row (y) and column (x) address
-      MacroBlock mb(y, x);
+      MacroBlock& mb = this->mbs[cnt_mbs];
+      mb.reset(y, x);
+      mb.bitstream.buffer.reserve(max_mb_bytes);
 
       // cout << x << " , " << y << endl;
 
@@ -57,7 +100,7 @@ Frame::Frame(const Mat& yuv)
         for (int j = 0; j < 16; j++)
         {
           uint32_t index = i*this->width + j + (x<<4) + (y<<4)*this->width;
-          mb.Y[(i<<4) + j] = pixelPtr[index];
+          mb.Y[(i<<4) + j] = wide ? pixelPtr16[index] : pixelPtr[index];
           //cout << index << endl;
         }
 
@@ -67,7 +110,7 @@ Frame::Frame(const Mat& yuv)
         {
           uint32_t index = u_offset + j + (i>>1)*this->width + (i & 0x01)*(this->width>>1) 
                                       + (x<<3)  + (y<<2)*this->width;
-          mb.Cb[(i<<3) + j] = pixelPtr[index];
+          mb.Cb[(i<<3) + j] = wide ? pixelPtr16[index] : pixelPtr[index];
         }
 
       // Chroma V component (Red projection) (8x8 pixels)
@@ -76,65 +119,149 @@ Frame::Frame(const Mat& yuv)
         {
           uint32_t index = v_offset + j + (i>>1)*this->width + (i & 0x01)*(this->width>>1) 
                                       + (x<<3)  + (y<<2)*this->width;
-          mb.Cr[(i<<3) + j] = pixelPtr[index];
+          mb.Cr[(i<<3) + j] = wide ? pixelPtr16[index] : pixelPtr[index];
           // cout << index << endl;
         }
 
       // MB index
       mb.mb_index = cnt_mbs++;
-      // Push into the vector of macroblocks
-      this->mbs.push_back(mb);
     }
   }
 
 }
 
-int Frame::get_neighbor_index(const int curr_index, const int neighbor_type) {
-  int neighbor_index = 0;
-
-  switch(neighbor_type) {
-    case MB_NEIGHBOR_UL: // Upper left neighbor
-      if ((curr_index % this->nb_mb_cols == 0) || (curr_index < this->nb_mb_cols))
-        neighbor_index = -1;
-      else
-        neighbor_index = curr_index - this->nb_mb_cols - 1;
-      break;
-
-    case MB_NEIGHBOR_U: // Upper neighbor
-      if(curr_index < this->nb_mb_cols)
-        neighbor_index = -1;
-      else
-        neighbor_index = curr_index - this->nb_mb_cols;
-      break;
-
-    case MB_NEIGHBOR_UR: // Upper right neighbor
-      if (((curr_index + 1) % this->nb_mb_cols == 0) || (curr_index < this->nb_mb_cols))
-        neighbor_index = -1;
-      else
-        neighbor_index = curr_index - this->nb_mb_cols + 1;
-      break;
-
-    case MB_NEIGHBOR_L: // Left neighbor
-      if (curr_index % this->nb_mb_cols == 0)
-        neighbor_index = -1;
-      else
-        neighbor_index = curr_index - 1;
-      break;
-
-    case MB_NEIGHBOR_R: // Right neighbor
-      if ((curr_index + 1) % this->nb_mb_cols == 0)
-        neighbor_index = -1;
-      else
-        neighbor_index = curr_index + 1;
-      break;
-
-    default:
-      neighbor_index = -1;
-      break;
+/* Fills the neighbour table for the current geometry and slices
+ *
+ * A neighbour is available when it is inside the picture and in the same slice as the MB
+ */
+void Frame::build_neighbors() {
+  const int nb_mbs = this->mbs.size();
+  this->neighbors.resize(nb_mbs);
+
+  for (int i = 0; i < nb_mbs; i++) {
+    int row = i / this->nb_mb_cols;
+    int col = i % this->nb_mb_cols;
+    bool up = (row > 0);
+    bool left = (col > 0);
+    bool right = (col + 1 < this->nb_mb_cols);
+
+    MBNeighbors& neighbor = this->neighbors[i];
+    neighbor.index[MB_NEIGHBOR_UL] = (up && left) ? i - this->nb_mb_cols - 1 : -1;
+    neighbor.index[MB_NEIGHBOR_U] = up ? i - this->nb_mb_cols : -1;
+    neighbor.index[MB_NEIGHBOR_UR] = (up && right) ? i - this->nb_mb_cols + 1 : -1;
+    neighbor.index[MB_NEIGHBOR_L] = left ? i - 1 : -1;
+    neighbor.index[MB_NEIGHBOR_R] = right ? i + 1 : -1;
+
+    neighbor.available = 0;
+    for (int type = MB_NEIGHBOR_UL; type <= MB_NEIGHBOR_R; type++) {
+      int& index = neighbor.index[type];
+      if (index != -1 && !this->slice_map.empty() && this->slice_map[index] != this->slice_map[i])
+        index = -1;
+      if (index != -1)
+        neighbor.available |= 1 << type;
+    }
+  }
+}
+
+/* Splits the frame in slices, 'first_mbs' holds the first MB of each slice (ascending)
+ *
+ * MBs of different slices are not neighbours: must be called before encode_I_frame.
+ */
+void Frame::set_slices(const std::vector<int>& first_mbs) {
+  // Same slices as the previous frame (the usual case): the table is still valid
+  if (first_mbs.size() <= 1 ? this->slice_first_mbs.empty() : first_mbs == this->slice_first_mbs)
+    return;
+
+  this->slice_map.clear();
+  this->slice_first_mbs.clear();
+  if (first_mbs.size() > 1) {
+    this->slice_first_mbs = first_mbs;
+    this->slice_map.resize(this->mbs.size());
+    int slice = 0;
+    for (int i = 0; i < (int)this->mbs.size(); i++) {
+      while (slice + 1 < (int)first_mbs.size() && i >= first_mbs[slice + 1])
+        slice++;
+      this->slice_map[i] = slice;
+    }
   }
 
-  // If neighbor doesn't exist, return -1
-  if (neighbor_index < 0)
-    neighbor_index = -1;
-  return neighbor_index;
-}
\ No newline at end of file
+  // New slices take the loop filter of the first one
+  const DeblockingParams deblocking = this->slice_deblocking.front();
+  this->slice_deblocking.resize(std::max<std::size_t>(first_mbs.size(), 1), deblocking);
+  build_neighbors();
+}
+
+/* Predicted Intra4x4PredMode of the 4x4 block 'blk' of the MB 'index' (see MacroBlock::convert_table):
+ * min(mode of the left block, mode of the upper block)
+ *
+ * Unavailable neighbour -> DC, neighbour not coded in Intra4x4 -> mode 2 (DC)
+ */
+int Frame::predict_intra4x4_mode(const int index, const int blk) const {
+  const MacroBlock& mb = this->mbs[index];
+  int real_pos = MacroBlock::convert_table[blk];
+
+  int pmA_index, pmA_pos;
+  if (real_pos % 4 == 0) {
+    pmA_index = this->neighbors[index].index[MB_NEIGHBOR_L];
+    pmA_pos = real_pos + 3;
+  } else {
+    pmA_index = index;
+    pmA_pos = real_pos - 1;
+  }
+  pmA_pos = MacroBlock::convert_table[pmA_pos];
+
+  int pmB_index, pmB_pos;
+  if (0 <= real_pos && real_pos <= 3) {
+    pmB_index = this->neighbors[index].index[MB_NEIGHBOR_U];
+    pmB_pos = 12 + real_pos;
+  } else {
+    pmB_index = index;
+    pmB_pos = real_pos - 4;
+  }
+  pmB_pos = MacroBlock::convert_table[pmB_pos];
+
+  int pred_modeA = 2, pred_modeB = 2;
+  if (pmA_index != -1 && pmB_index != -1) {
+    const MacroBlock& mbA = (pmA_index == index) ? mb : this->mbs[pmA_index];
+    const MacroBlock& mbB = (pmB_index == index) ? mb : this->mbs[pmB_index];
+    if (!mbA.is_intra16x16 && !mbA.is_I_PCM)
+      pred_modeA = static_cast<int>(mbA.intra4x4_Y_mode[pmA_pos]);
+    if (!mbB.is_intra16x16 && !mbB.is_I_PCM)
+      pred_modeB = static_cast<int>(mbB.intra4x4_Y_mode[pmB_pos]);
+  }
+
+  return std::min(pred_modeA, pred_modeB);
+}
+
+/* Same loop filter for every slice of the frame (kept for the next frames)
+ */
+void Frame::set_deblocking(const DeblockingParams& params) {
+  std::fill(this->slice_deblocking.begin(), this->slice_deblocking.end(), params);
+}
+
+/* QP'C of the lossy MBs: QPC of qPI = QP_Y + chroma_qp_index_offset (8.5.8), the negative qPI of the
+ * high bit depths are their own QPC. CHROMA_QP at 8 bits and QP_Y 51.
+ */
+int Frame::get_chroma_qp() const {
+  if (this->lossless)
+    return 0;
+  int qpi = clip(get_qp() + CHROMA_QP_INDEX_OFFSET, -get_qp_offset(), 51);
+  return ((qpi < 0) ? qpi : chroma_qp_table[qpi]) + get_qp_offset();
+}
+
+/* Reconstructed luma plane (width x height, padding included)
+ * Empty if the frame was not encoded yet
+ */
+std::vector<std::uint16_t> Frame::get_decoded_Y() const {
+  std::vector<std::uint16_t> plane;
+  if (this->decoded_mbs.size() != this->mbs.size())
+    return plane;
+
+  plane.resize(this->width * this->height);
+  for (const auto& mb : this->decoded_mbs) {
+    for (int i = 0; i < 16; i++)
+      for (int j = 0; j < 16; j++)
+        plane[((mb.mb_row<<4) + i) * this->width + (mb.mb_col<<4) + j] = mb.Y[(i<<4) + j];
+  }
+  return plane;
+}
@@ -1,31 +1,360 @@
 #include "intra.h"
+#include "tr_qt.h"
 
-/* Clip function for 16x16 plane prediction
-* Returns max value between lower and (min(n,upper))
+/* Summation of absolute difference (SAD) between a block and a prediction
+   SAD =  SUM |source_pixel - predicted_pixel|
 */
-template <typename T>
-T clip(const T& n, const T& lower, const T& upper)
+template <std::size_t SIZE>
+int SAD(const std::array<int, SIZE>& block, const std::array<int, SIZE>& pred)
 {
-  return std::max(lower, std::min(n, upper));
+  int sad = 0;
+  for (std::size_t i = 0; i < SIZE; i++)
+    sad += std::abs(block[i] - pred[i]);
+  return sad;
+}
+
+//////////////////////////////////////////////// MODES COMMON TO ALL SIZES ////////////////////////////////////////////////
+
+/*
+Vertical Prediction -> every row is the row above (A,B,C,D for a 4x4 block)
+*/
+template <int N>
+void intra_vertical(PredBlock<N>& pred, const Predictor<N>& predictor) {
+  const typename Predictor<N>::Pels& p = predictor.pred_pel;
+  for (int i = 0; i < N; i++) {
+    std::copy_n(p.begin()+1, N, pred.begin()+i*N);   // first pixel is UL, then the U pixels
+  }
+}
+
+/*
+Horizontal Prediction -> every column is the column at the left (I,J,K,L for a 4x4 block)
+*/
+template <int N>
+void intra_horizontal(PredBlock<N>& pred, const Predictor<N>& predictor) {
+  const typename Predictor<N>::Pels& p = predictor.pred_pel;
+  for (int i = 0; i < N; i++) {
+    std::fill_n(pred.begin()+i*N, N, p[Predictor<N>::LEFT+i]);
+  }
+}
+
+/*
+DC Prediction -> (U+L+N)/2N, 2U or 2L when only one side is available, half the range (128) without neighbours
+                 (4x4: (A+B+C+D+I+J+K+L+4)/8, 16x16: (V+H+16)/32)
+*/
+template <int N>
+void intra_dc(PredBlock<N>& pred, const Predictor<N>& predictor) {
+  const typename Predictor<N>::Pels& p = predictor.pred_pel;
+  const int shift = (N == 4) ? 3 : 5;
+  int s1 = 0, s2 = 0, s = 0;
+
+  for (int i = 0; i < N; i++) {
+    s1 += p[1+i];                       // accumulates upper pixels
+    s2 += p[Predictor<N>::LEFT+i];      // accumulates left pixels
+  }
+
+  if (predictor.up_available && predictor.left_available) {
+    s = s1 + s2;
+  }
+  else if (!predictor.up_available && predictor.left_available) {
+    s = 2 * s2;
+  }
+  else if (predictor.up_available && !predictor.left_available) {
+    s = 2 * s1;
+  }
+
+  s += N;
+  s >>= shift;
+
+  // If predictors are not avaliable (e.g top left block) assumes all predictors=128 (8 bit)
+  if (!predictor.up_available && !predictor.left_available) {
+    s = 1 << (predictor.bit_depth - 1);
+  }
+
+  pred.fill(s);
+}
+
+/*
+Chroma DC Prediction -> one DC per 4x4 quarter of the 8x8 block
+*/
+template <>
+void intra_dc<8>(PredBlock<8>& pred, const Predictor<8>& predictor) {
+  const Predictor8x8::Pels& p = predictor.pred_pel;
+  int s1 = 0, s2 = 0, s3 = 0, s4 = 0;
+  int s_upper_left = 0, s_upper_right = 0, s_down_left = 0, s_down_right = 0;
+  int i, j;
+
+  // summation of predictors
+  // s1: [1..4], s2: [5..8]
+  // s3: [9..12], s4: [13..16]
+  for (i = 0; i < 4; i++) {
+    s1 += p[i+1];
+    s2 += p[i+5];
+    s3 += p[i+9];
+    s4 += p[i+13];
+  }
+
+  if (predictor.up_available && predictor.left_available) {
+    s_upper_left = s1 + s3;
+    s_upper_right = 2 * s2;     // upper right block uses the upper samples only
+    s_down_left = 2 * s4;       // lower left block uses the left samples only
+    s_down_right = s2 + s4;
+  }
+  else if (!predictor.up_available && predictor.left_available) {
+    s_upper_left = s_upper_right = 2 * s3;
+    s_down_left = s_down_right = 2 * s4;
+  }
+  else if (predictor.up_available && !predictor.left_available) {
+    s_upper_left = s_down_left = 2 * s1;
+    s_upper_right = s_down_right = 2 * s2;
+  }
+
+  s_upper_left = (s_upper_left + 4) >> 3;
+  s_upper_right = (s_upper_right + 4) >> 3;
+  s_down_left = (s_down_left + 4) >> 3;
+  s_down_right = (s_down_right + 4) >> 3;
+
+  if (!predictor.up_available && !predictor.left_available) {
+    s_upper_left = s_upper_right = s_down_left = s_down_right  = 1 << (predictor.bit_depth - 1);
+  }
+
+  for (i = 0; i < 4; i++) {
+    for (j = 0; j < 4; j++) {
+      pred[i*8+j] = s_upper_left;
+      pred[i*8+(j+4)] = s_upper_right;
+      pred[(i+4)*8+j] = s_down_left;
+      pred[(i+4)*8+(j+4)] = s_down_right;
+    }
+  }
 }
 
-/* Input iterators; return summation of absolute difference (SAD)
-   SAD =  SUM |source_pixel - predicted_pixel| (for all pixels in MB)
+/* Parameters of the plane prediction (16x16 luma, 8x8 chroma): gradients H and V of the row
+above and of the column at the left, around their centre
+  pred[i][j] = clip((a + b * (j - N/2 + 1) + c * (i - N/2 + 1) + 16) >> 5), to the range of the samples
 */
-template<class InputIt1, class InputIt2, class OutputIt>
-int SAD(InputIt1 first1, InputIt1 last1, InputIt2 first2, OutputIt result) 
+template <int N>
+void plane_parameters(const Predictor<N>& predictor, int& a, int& b, int& c) {
+  const typename Predictor<N>::Pels& p = predictor.pred_pel;
+  const int up = N / 2;                              // centre of the row above
+  const int left = Predictor<N>::LEFT - 1 + N / 2;   // centre of the left column
+  const int scale = (N == 16) ? 5 : 34;              // chroma: (34 * H + 32) >> 6 = (17 * H + 16) >> 5
+  int H = 0, V = 0;
+
+  for (int i = 1; i < N / 2; i++) {
+    H += i * (p[up+i] - p[up-i]);
+    V += i * (p[left+i] - p[left-i]);
+  }
+
+  H += (N / 2) * (p[N] - p[0]);
+  V += (N / 2) * (p[left + N/2] - p[0]);
+
+  a = 16 * (p[N] + p[left + N/2]);
+  b = (scale * H + 32) >> 6;
+  c = (scale * V + 32) >> 6;
+}
+
+// Plane Prediction, each row is a ramp of slope b: incremental adds from its first sample
+template <int N>
+void intra_plane(PredBlock<N>& pred, const Predictor<N>& predictor) {
+  int a, b, c;
+  plane_parameters(predictor, a, b, c);
+  const int max_sample = (1 << predictor.bit_depth) - 1;
+
+  for (int i = 0; i < N; i++) {
+    int value = a - b * (N/2 - 1) + c * (i - (N/2 - 1)) + 16;
+    for (int j = 0; j < N; j++, value += b) {
+      pred[i*N+j] = clip(value >> 5, 0, max_sample);
+    }
+  }
+}
+
+/* SAD of the 4 modes of a 16x16 luma or 8x8 chroma block, in a single pass over the source.
+ * The predictions are not stored: vertical and horizontal compare against the edges, DC
+ * against its (per quarter for chroma) values, plane against its ramp. The modes that are
+ * not available get a cost too (from the half range samples), the caller skips them.
+ */
+template <int N>
+IntraCosts intra_costs(const PredBlock<N>& block, const Predictor<N>& predictor) {
+  const typename Predictor<N>::Pels& p = predictor.pred_pel;
+  PredBlock<N> dc;
+  intra_dc(dc, predictor);
+  int a, b, c;
+  plane_parameters(predictor, a, b, c);
+  const int max_sample = (1 << predictor.bit_depth) - 1;
+
+  IntraCosts costs;
+  for (int y = 0; y < N; y++) {
+    const int* src = &block[y*N];
+    const int* dc_row = &dc[y*N];
+    const int left = p[Predictor<N>::LEFT + y];
+    const int plane = a - b * (N/2 - 1) + c * (y - (N/2 - 1)) + 16;
+    int sad_v = 0, sad_h = 0, sad_dc = 0, sad_plane = 0;
+
+    for (int x = 0; x < N; x++) {
+      sad_v += std::abs(src[x] - p[1+x]);
+      sad_h += std::abs(src[x] - left);
+      sad_dc += std::abs(src[x] - dc_row[x]);
+      sad_plane += std::abs(src[x] - clip((plane + b * x) >> 5, 0, max_sample));
+    }
+
+    costs.vertical += sad_v;
+    costs.horizontal += sad_h;
+    costs.dc += sad_dc;
+    costs.plane += sad_plane;
+  }
+  return costs;
+}
+
+/* Sum of absolute transformed differences of a 4x4 residual (4x4 Hadamard), halved so that
+ * it is on the scale of the SAD
+ */
+static int SATD4x4(const int* diff, const int stride)
 {
-  int sad = 0;
-  int diff;
-  while (first1 != last1)  //goes through all MB pixels
-  {
-    diff = (*first1++ - *first2++); // subtracts source pixel and predicted pixel and increment iterator
-    *result++ = diff;               // MAYBE HERE IS WHERE THE DIFFERENCE IS BEING CALCULATED
-    sad += (diff > 0)? diff: -diff; 
+  int m[4][4];
+  for (int y = 0; y < 4; y++) {
+    const int* d = diff + y*stride;
+    int s01 = d[0] + d[1], d01 = d[0] - d[1], s23 = d[2] + d[3], d23 = d[2] - d[3];
+    m[y][0] = s01 + s23;
+    m[y][1] = s01 - s23;
+    m[y][2] = d01 - d23;
+    m[y][3] = d01 + d23;
+  }
+
+  int satd = 0;
+  for (int x = 0; x < 4; x++) {
+    int s01 = m[0][x] + m[1][x], d01 = m[0][x] - m[1][x], s23 = m[2][x] + m[3][x], d23 = m[2][x] - m[3][x];
+    satd += std::abs(s01 + s23) + std::abs(s01 - s23) + std::abs(d01 - d23) + std::abs(d01 + d23);
+  }
+  return (satd + 1) >> 1;
+}
+
+template <int N>
+int SATD(const PredBlock<N>& block, const PredBlock<N>& pred)
+{
+  PredBlock<N> diff;
+  for (int i = 0; i < N*N; i++)
+    diff[i] = block[i] - pred[i];
+
+  int satd = 0;
+  for (int y = 0; y < N; y += 4)
+    for (int x = 0; x < N; x += 4)
+      satd += SATD4x4(&diff[y*N + x], N);
+  return satd;
+}
+
+/* Forward and inverse QDCT of a residual, as encode_Y_block / encode_CbCr_block and the decoder
+ * do. Returns the estimated size of the quantized coefficients: a level costs about
+ * 3 + 2 * log2|level| bits (coeff_token, sign, level prefix / suffix and run shared out).
+ */
+static int estimate_bits(const int* coeffs, const int size)
+{
+  int bits = 0;
+  for (int i = 0; i < size; i++) {
+    int level = std::abs(coeffs[i]);
+    if (level != 0) {
+      bits += 3;
+      for (; level > 1; level >>= 1)
+        bits += 2;
+    }
+  }
+  return bits;
+}
+
+static int quantize_residual(PredBlock<4>& residual)
+{
+  qdct_luma4x4_intra(Block4x4(residual.data(), 4));
+  int bits = estimate_bits(residual.data(), 16);
+  iqdct_luma4x4_intra(Block4x4(residual.data(), 4), LUMA_QP);
+  return bits;
+}
+
+static int quantize_residual(PredBlock<8>& residual)
+{
+  qdct_chroma8x8_intra(residual);
+  int bits = estimate_bits(residual.data(), 64);
+  iqdct_chroma8x8_intra(residual, CHROMA_QP);
+  return bits;
+}
+
+static int quantize_residual(PredBlock<16>& residual)
+{
+  qdct_luma16x16_intra(residual);
+  int bits = estimate_bits(residual.data(), 256);
+  iqdct_luma16x16_intra(residual, LUMA_QP);
+  return bits;
+}
+
+// Lagrangian multiplier of the SSD cost, 0.85 * 2^((QP-12)/3) (JM high complexity mode decision)
+static int rd_lambda(const int qp)
+{
+  return static_cast<int>(0.85 * std::pow(2.0, (qp - 12) / 3.0) + 0.5);
+}
+
+static const int LUMA_LAMBDA = rd_lambda(LUMA_QP);
+static const int CHROMA_LAMBDA = rd_lambda(CHROMA_QP);
+
+// 4x4 luma / 16x16 luma / 8x8 chroma: QP of the residual
+template <int N>
+int RD(const PredBlock<N>& block, const PredBlock<N>& pred)
+{
+  PredBlock<N> residual;
+  for (int i = 0; i < N*N; i++)
+    residual[i] = block[i] - pred[i];
+  int bits = quantize_residual(residual);
+
+  int ssd = 0;
+  for (int i = 0; i < N*N; i++) {
+    int error = block[i] - clip(pred[i] + residual[i], 0, 255);
+    ssd += error * error;
   }
+  return ssd + ((N == 8) ? CHROMA_LAMBDA : LUMA_LAMBDA) * bits;
+}
+
+// SAD of the residual as coded without transform
+template <int N>
+int bypass_SAD(const PredBlock<N>& block, const PredBlock<N>& pred, const BypassDPCM dpcm)
+{
+  PredBlock<N> residual;
+  for (int i = 0; i < N*N; i++)
+    residual[i] = block[i] - pred[i];
+  if (dpcm != BypassDPCM::NONE)
+    forward_bypass_dpcm(BlockView<N, N>(residual.data(), N), dpcm == BypassDPCM::HORIZONTAL);
+
+  int sad = 0;
+  for (int i = 0; i < N*N; i++)
+    sad += std::abs(residual[i]);
   return sad;
 }
 
+template <int N>
+int intra_cost(const IntraCost cost, const PredBlock<N>& block, const PredBlock<N>& pred, const BypassDPCM dpcm) {
+  switch (cost) {
+    case IntraCost::SATD:
+      return SATD<N>(block, pred);
+    case IntraCost::RD:
+      return RD<N>(block, pred);
+    case IntraCost::BYPASS:
+      return bypass_SAD<N>(block, pred, dpcm);
+    default:
+      return SAD(block, pred);
+  }
+}
+
+template void intra_vertical<4>(PredBlock<4>&, const Predictor<4>&);
+template void intra_vertical<8>(PredBlock<8>&, const Predictor<8>&);
+template void intra_vertical<16>(PredBlock<16>&, const Predictor<16>&);
+template void intra_horizontal<4>(PredBlock<4>&, const Predictor<4>&);
+template void intra_horizontal<8>(PredBlock<8>&, const Predictor<8>&);
+template void intra_horizontal<16>(PredBlock<16>&, const Predictor<16>&);
+template void intra_dc<4>(PredBlock<4>&, const Predictor<4>&);
+template void intra_dc<16>(PredBlock<16>&, const Predictor<16>&);
+template void intra_plane<8>(PredBlock<8>&, const Predictor<8>&);
+template void intra_plane<16>(PredBlock<16>&, const Predictor<16>&);
+template IntraCosts intra_costs<8>(const PredBlock<8>&, const Predictor<8>&);
+template IntraCosts intra_costs<16>(const PredBlock<16>&, const Predictor<16>&);
+template int intra_cost<4>(const IntraCost, const PredBlock<4>&, const PredBlock<4>&, const BypassDPCM);
+template int intra_cost<8>(const IntraCost, const PredBlock<8>&, const PredBlock<8>&, const BypassDPCM);
+template int intra_cost<16>(const IntraCost, const PredBlock<16>&, const PredBlock<16>&, const BypassDPCM);
+
 ////////////////////////////////////////////////////////// 4x4 MODES //////////////////////////////////////////////////////
 
 /* Input 4x4 block and its neighbors
@@ -36,88 +365,203 @@ int SAD(InputIt1 first1, InputIt1 last1, InputIt2 first2, OutputIt result)
  * Consult predicion.png
  */
 
-// Current MB and 4 neighbours
-std::tuple<int, Intra4x4Mode> intra4x4(Block4x4 block, std::experimental::optional<Block4x4> ul, std::experimental::optional<Block4x4> u,
-                                                       std::experimental::optional<Block4x4> ur, std::experimental::optional<Block4x4> l) {
+/* Gradient pre-analysis of a MB
+ * The gradients are computed on the whole MB first (edges replicated), in loops without branches
+ * so that they vectorize. The edges are perpendicular to the gradient: with y pointing up, the
+ * edge makes an angle of atan(|gx| / |gy|) with the horizontal, on the '/' side when gx and gy
+ * have the same sign, '\' otherwise. The angle is binned to the closest 4x4 mode
+ * (H 0, HU 26.6, DDL 45, VL 63.4, V 90, VR 116.6, DDR 135, HD 153.4 degrees) by comparing
+ * 64 |gx| to multiples of |gy| (tangents of the midpoints 13.3, 35.8, 54.2 and 76.7).
+ *
+ * 'directions': number of directional modes kept per 4x4 block, all the modes with 0
+ */
+void analyze_gradients(const Block16x16& source, const int directions, GradientAnalysis& analysis) {
+  // Source with a replicated border of 1 sample
+  std::array<int, 18*18> p;
+  for (int y = 0; y < 18; y++) {
+    const int* row = &source[clip(y - 1, 0, 15) * 16];
+    int* out = &p[y*18];
+    out[0] = row[0];
+    std::copy_n(row, 16, out + 1);
+    out[17] = row[15];
+  }
 
-  ofstream myfile ("txt/4x4_Y_predictors.txt", ios::app);
- 
-  static int predictor_cnt=0;
+  std::array<int, 256> gx, gy;
+  for (int y = 0; y < 16; y++) {
+    const int* up = &p[y*18];
+    const int* mid = up + 18;
+    const int* down = mid + 18;
+    for (int x = 0; x < 16; x++) {
+      gx[y*16 + x] = (up[x+2] + 2*mid[x+2] + down[x+2]) - (up[x] + 2*mid[x] + down[x]);
+      gy[y*16 + x] = (down[x] + 2*down[x+1] + down[x+2]) - (up[x] + 2*up[x+1] + up[x+2]);
+    }
+  }
 
-  // Get predictors
-  Predictor predictor = get_intra4x4_predictor(ul, u, ur, l);
-
-  /*==================================== TESTING =========================================*/
-  // // Print predictors to '16x16predictors.txt'
-  // myfile << "MB " << predictor_cnt/16 << " (" << predictor_cnt%16 << ") ->";
-  // for (int i = 0; i < 13; i++)
-  // {
-  //   myfile << predictor.pred_pel[i] << ' ';
-  // }
-  // myfile << endl;
-  // predictor_cnt++;
-  /*======================================================================================*/
-
-
-  int mode;
-  Intra4x4Mode best_mode;
-  CopyBlock4x4 pred, best_pred, residual, best_residual;
-  int min_sad = (1 << 15), sad;   // worst SAD is 32768 -> 16*16 pixels = 256; worst prediction = 128-0 ; 256*128 = 32768
-
-  // Run all modes to get least residual
-  // Checks if its possible to run prediction mode based on neighbours 
-  for (mode = 0; mode < 9; mode++) {
-
-    if ((!predictor.up_available   && (Intra4x4Mode::VERTICAL   == static_cast<Intra4x4Mode>(mode))) ||
-        (!predictor.left_available && (Intra4x4Mode::HORIZONTAL == static_cast<Intra4x4Mode>(mode))) ||
-        ((!predictor.up_available || !predictor.up_right_available) && (Intra4x4Mode::DOWNLEFT == static_cast<Intra4x4Mode>(mode))) ||
-        ((!predictor.up_available || !predictor.left_available) && (Intra4x4Mode::DOWNRIGHT == static_cast<Intra4x4Mode>(mode))) ||
-        ((!predictor.up_available || !predictor.left_available) && (Intra4x4Mode::VERTICALRIGHT == static_cast<Intra4x4Mode>(mode))) ||
-        ((!predictor.up_available || !predictor.left_available) && (Intra4x4Mode::HORIZONTALDOWN == static_cast<Intra4x4Mode>(mode))) ||
-        ((!predictor.up_available || !predictor.up_right_available) && (Intra4x4Mode::VERTICALLEFT == static_cast<Intra4x4Mode>(mode))) ||
-        (!predictor.left_available && (Intra4x4Mode::HORIZONTALUP == static_cast<Intra4x4Mode>(mode)))) {
-      continue;
+  // Direction of every sample: sector of the angle (0: horizontal .. 4: vertical), + 5 on the '\' side
+  std::array<int, 256> direction;
+  std::array<int, 256> magnitude;
+  for (int i = 0; i < 256; i++) {
+    const int a = std::abs(gx[i]), b = std::abs(gy[i]);
+    const int sector = (64*a >= 15*b) + (64*a >= 46*b) + (64*a >= 89*b) + (64*a >= 271*b);
+    direction[i] = sector + 5 * ((gx[i] > 0) != (gy[i] > 0));
+    magnitude[i] = a + b;
+  }
+
+  static const Intra4x4Mode direction_mode[10] = {
+    Intra4x4Mode::HORIZONTAL, Intra4x4Mode::HORIZONTALUP, Intra4x4Mode::DOWNLEFT, Intra4x4Mode::VERTICALLEFT, Intra4x4Mode::VERTICAL,
+    Intra4x4Mode::HORIZONTAL, Intra4x4Mode::HORIZONTALDOWN, Intra4x4Mode::DOWNRIGHT, Intra4x4Mode::VERTICALRIGHT, Intra4x4Mode::VERTICAL
+  };
+
+  analysis.energy = 0;
+  for (int blk = 0; blk < 16; blk++) {
+    std::array<int, 9> histogram = {{0}};
+    for (int y = (blk / 4) * 4; y < (blk / 4) * 4 + 4; y++) {
+      for (int x = (blk % 4) * 4; x < (blk % 4) * 4 + 4; x++)
+        histogram[static_cast<int>(direction_mode[direction[y*16 + x]])] += magnitude[y*16 + x];
+    }
+    histogram[static_cast<int>(Intra4x4Mode::DC)] = 0;
+    for (int mode = 0; mode < 9; mode++)
+      analysis.energy += histogram[mode];
+
+    // DC, then the strongest directions (with some edges)
+    Intra4x4Modes modes = intra4x4_bit(Intra4x4Mode::DC);
+    for (int i = 0; i < directions; i++) {
+      int strongest = static_cast<int>(Intra4x4Mode::DC);
+      for (int mode = 0; mode < 9; mode++)
+        if (histogram[mode] > histogram[strongest])
+          strongest = mode;
+      if (histogram[strongest] == 0)
+        break;
+      modes |= intra4x4_bit(static_cast<Intra4x4Mode>(strongest));
+      histogram[strongest] = 0;
     }
+    analysis.modes[blk] = (directions > 0) ? modes : ALL_INTRA4X4_MODES;
+  }
+}
 
-    // Aplies prediction
-    get_intra4x4(pred, predictor, static_cast<Intra4x4Mode>(mode));
+// Current MB and 4 neighbours. Of the 6 directional modes, only those of 'modes' are tried
+IntraChoice<Intra4x4Mode> intra4x4(Block4x4 block, const IntraSearch& search, const Intra4x4Modes modes, const std::uint8_t available,
+                                   Block4x4 ul, Block4x4 u, Block4x4 ur, Block4x4 l, const int bit_depth) {
 
-    // Computes SAD and gets best mode
-    sad = SAD(block.begin(), block.end(), pred.begin(), residual.begin());
-    if (sad < min_sad) {
-      min_sad = sad;
-      best_mode = static_cast<Intra4x4Mode>(mode);
-      std::copy(pred.begin(), pred.end(), best_pred.begin());  // save best predicted block
-      std::copy(residual.begin(), residual.end(), best_residual.begin());   // save best residual
+  // Get predictors
+  Predictor4x4 predictor = get_intra4x4_predictor(available, ul, u, ur, l, bit_depth);
+
+  // Source samples, read once for all the modes
+  CopyBlock4x4 src;
+  for (int y = 0; y < 4; y++)
+    std::copy_n(block.row(y), 4, src.begin() + y*4);
+
+  // Checks if its possible to run prediction mode based on neighbours
+  const bool up = predictor.up_available, left = predictor.left_available;
+  std::array<bool, 9> allowed = {{
+    up,                                   // VERTICAL
+    left,                                 // HORIZONTAL
+    true,                                 // DC
+    up && predictor.up_right_available,   // DOWNLEFT
+    up && left,                           // DOWNRIGHT
+    up && left,                           // VERTICALRIGHT
+    up && left,                           // HORIZONTALDOWN
+    up && predictor.up_right_available,   // VERTICALLEFT
+    left                                  // HORIZONTALUP
+  }};
+  for (int mode = 3; mode < 9; mode++)
+    allowed[mode] = allowed[mode] && (modes & (1 << mode));
+
+  // Cost of vertical, horizontal and DC. SAD: against the edges in one pass over the source
+  std::array<int, 9> costs;
+  if (search.cost == IntraCost::SAD) {
+    const Predictor4x4::Pels& p = predictor.pred_pel;
+    CopyBlock4x4 dc;
+    intra_dc(dc, predictor);
+
+    costs[0] = costs[1] = costs[2] = 0;
+    for (int y = 0; y < 4; y++) {
+      for (int x = 0; x < 4; x++) {
+        int sample = src[y*4 + x];
+        costs[0] += std::abs(sample - p[1+x]);
+        costs[1] += std::abs(sample - p[9+y]);
+        costs[2] += std::abs(sample - dc[0]);
+      }
+    }
+  } else {
+    CopyBlock4x4 pred;
+    const BypassDPCM dpcm[3] = {BypassDPCM::VERTICAL, BypassDPCM::HORIZONTAL, BypassDPCM::NONE};
+    for (int mode = 0; mode < 3; mode++) {
+      if (allowed[mode]) {
+        get_intra4x4(pred, predictor, static_cast<Intra4x4Mode>(mode));
+        costs[mode] = intra_cost<4>(search.cost, src, pred, dpcm[mode]);
+      }
     }
   }
 
-  // use operator = instead of std::copy which use *iter to deal with assignment
-  // for (int i = 0; i < 16; i++) {
-  //   block[i] = best_pred[i];             // Overwirte input block with best predicted (TESTING)
-  // }
+  int best_mode = static_cast<int>(Intra4x4Mode::DC);
+  for (int mode = 0; mode < 2; mode++) {
+    if (allowed[mode] && (costs[mode] < costs[best_mode] || (costs[mode] == costs[best_mode] && mode < best_mode)))
+      best_mode = mode;
+  }
 
-  // // use operator = instead of std::copy which use *iter to deal with assignment
-  for (int i = 0; i < 16; i++) {
-    block[i] = best_residual[i];        // Overwirte input block with residual
+  // The directional modes are cheap to generate: all of them, then their costs in one loop. After a
+  // gradient analysis, only the preselected ones. Not tried when the block is already well predicted.
+  if (search.directional4x4 && costs[best_mode] >= search.stop4x4) {
+    if (modes == ALL_INTRA4X4_MODES) {
+      std::array<CopyBlock4x4, 6> preds;
+      intra4x4_downleft(preds[0], predictor);
+      intra4x4_downright(preds[1], predictor);
+      intra4x4_verticalright(preds[2], predictor);
+      intra4x4_horizontaldown(preds[3], predictor);
+      intra4x4_verticalleft(preds[4], predictor);
+      intra4x4_horizontalup(preds[5], predictor);
+      if (search.cost == IntraCost::SAD) {
+        for (int mode = 3; mode < 9; mode++)
+          costs[mode] = SAD(src, preds[mode - 3]);
+      } else {
+        for (int mode = 3; mode < 9; mode++)
+          if (allowed[mode])
+            costs[mode] = intra_cost<4>(search.cost, src, preds[mode - 3]);
+      }
+    } else {
+      CopyBlock4x4 pred;
+      for (int mode = 3; mode < 9; mode++) {
+        if (allowed[mode]) {
+          get_intra4x4(pred, predictor, static_cast<Intra4x4Mode>(mode));
+          costs[mode] = intra_cost<4>(search.cost, src, pred);
+        }
+      }
+    }
+
+    // The first mode with the least cost wins
+    for (int mode = 3; mode < 9; mode++) {
+      if (allowed[mode] && costs[mode] < costs[best_mode])
+        best_mode = mode;
+    }
+  }
+
+  // Overwrite input block with the residual of the best mode only
+  CopyBlock4x4 pred;
+  get_intra4x4(pred, predictor, static_cast<Intra4x4Mode>(best_mode));
+  int sad = 0;
+  for (int y = 0; y < 4; y++) {
+    for (int x = 0; x < 4; x++) {
+      block(y, x) = src[y*4 + x] - pred[y*4 + x];
+      sad += std::abs(block(y, x));
+    }
   }
 
-  // Creates tuple with min SAD and best prediction mode for current MB
-  return std::make_tuple(min_sad, best_mode);
+  return IntraChoice<Intra4x4Mode>{static_cast<Intra4x4Mode>(best_mode), costs[best_mode], sad};
 }
 
 
 //Input 4x4 predictors and mode
-void get_intra4x4(CopyBlock4x4& pred, const Predictor& p, const Intra4x4Mode mode) {
+void get_intra4x4(CopyBlock4x4& pred, const Predictor4x4& p, const Intra4x4Mode mode) {
   switch (mode) {
     case Intra4x4Mode::VERTICAL:
-      intra4x4_vertical(pred, p);
+      intra_vertical(pred, p);
       break;
     case Intra4x4Mode::HORIZONTAL:
-      intra4x4_horizontal(pred, p);
+      intra_horizontal(pred, p);
       break;
     case Intra4x4Mode::DC:
-      intra4x4_dc(pred, p);
+      intra_dc(pred, p);
       break;
     case Intra4x4Mode::DOWNLEFT:
       intra4x4_downleft(pred, p);
@@ -155,85 +599,6 @@ A -> Q are the predictors
 */
 
 
-/* 
-Vertical Prediction -> 0,4,8,12 = A
-                       1,5,9,13 = B  
-                       2,6,10,14 = C 
-                       3,7,11,15 = D
-*/
-void intra4x4_vertical(CopyBlock4x4& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
-  int i;
-  for (i = 0; i < 4; i++) {
-    std::copy_n(p.begin()+1, 4, pred.begin()+i*4);
-  }
-}
-
-
-/*
-Horizontal Prediction -> 0,1,2,3 = I 
-                         4,5,6,7 = J  
-                         8,9,10,11 = K 
-                         12,13,14,15 = L
-*/
-void intra4x4_horizontal(CopyBlock4x4& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
-  int i, j;
-  for (i = 0; i < 4; i++) {
-    for (j = 0; j < 4; j++) {
-      pred[i*4+j] = p[9+i];
-    }
-  }
-}
-
-// DC Prediction -> 0-15 = (A+B+C+D+I+J+K+L+4)/8 
-void intra4x4_dc(CopyBlock4x4& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
-  int s1 = 0, s2 = 0, s = 0;
-  int i;
-
-  // s1 = A+B+C+D
-  for (i = 1; i < 5; i++)
-  {
-    s1 += p[i];
-  }
-
-  // s2 = I+J+K+L
-  for (i = 9; i < 13; i++) 
-  {
-    s2 += p[i];
-  }
-
-  // If top predictor (A,B,C,D) and left predictor (I,J,K,L) are avaliable
-  if (predictor.up_available && predictor.left_available)
-  {
-    s = s1 + s2;
-  }
-  
-  // If top predictor is not avaliable
-  else if (!predictor.up_available && predictor.left_available) 
-  {
-    s = 2 * s2;
-  }
-
-  // If left predictor is not avaliable
-  else if (predictor.up_available && !predictor.left_available) 
-  {
-    s = 2 * s1;
-  }
-
-  // Adds 4 and divides by 8 (shift 3)
-  s += 4;
-  s >>= 3;
-
-  // If predictors are not avaliable (e.g top left 4x4 block) assumes all predictors=128 
-  if (!predictor.up_available && !predictor.left_available) {
-    s = 128;
-  }
-
-  pred.fill(s);
-}
-
 /*
 Down-Left Prediction -> 0 = (A+2B+C+2)/4 
                         1,4 = (B+2C+D+2)/4  
@@ -243,8 +608,8 @@ Down-Left Prediction -> 0 = (A+2B+C+2)/4
                         11,14 = (F+2G+H+2)/4
                         15 = (G+3H+2)/4
 */
-void intra4x4_downleft(CopyBlock4x4& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
+void intra4x4_downleft(CopyBlock4x4& pred, const Predictor4x4& predictor) {
+  const Predictor4x4::Pels& p = predictor.pred_pel;
 
   pred[0]  = ((p[1] + p[3] + (p[2] << 1) + 2) >> 2);
   pred[1]  = pred[4]  = ((p[2] + p[4] + (p[3] << 1) + 2) >> 2);
@@ -264,16 +629,16 @@ Down-Right Prediction -> 0,5,10,15 = (I+2Q+A+2)/4
                          8,13 = (K+2J+I+2)/4
                          12 = (L+2K+J+2)/4
 */
-void intra4x4_downright(CopyBlock4x4& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
+void intra4x4_downright(CopyBlock4x4& pred, const Predictor4x4& predictor) {
+  const Predictor4x4::Pels& p = predictor.pred_pel;
 
   pred[12] = ((p[12] + p[10] + (p[11] << 1) + 2) >> 2);
   pred[8]  = pred[13] = ((p[11] + p[9] + (p[10] << 1) + 2) >> 2);
-  pred[4]  = pred[9]  = pred[14] = ((p[10] + p[1] + (p[9] << 1) + 2) >> 2);
-  pred[0]  = pred[5]  = pred[10] = pred[15] = ((p[0] + p[9] + (p[1] << 1) + 2) >> 2);
+  pred[4]  = pred[9]  = pred[14] = ((p[10] + p[0] + (p[9] << 1) + 2) >> 2);
+  pred[0]  = pred[5]  = pred[10] = pred[15] = ((p[9] + p[1] + (p[0] << 1) + 2) >> 2);
   pred[1]  = pred[6]  = pred[11] = ((p[0] + p[2] + (p[1] << 1) + 2) >> 2);
   pred[2]  = pred[7]  = ((p[1] + p[3] + (p[2] << 1) + 2) >> 2);
-  pred[3]  = ((p[1] + p[3] + (p[2] << 1) + 2) >> 2);
+  pred[3]  = ((p[2] + p[4] + (p[3] << 1) + 2) >> 2);
 }
 
 
@@ -289,8 +654,8 @@ Vertical-Left Prediction -> 0 = (A+B+1)/2
                             11 = (E+F+1)/2
                             15 = (E+2F+G+2)/4
 */
-void intra4x4_verticalleft(CopyBlock4x4& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
+void intra4x4_verticalleft(CopyBlock4x4& pred, const Predictor4x4& predictor) {
+  const Predictor4x4::Pels& p = predictor.pred_pel;
  
   pred[0]  = ((p[1] + p[2] + 1) >> 1);
   pred[1]  = pred[8]  = ((p[2] + p[3] + 1) >> 1);
@@ -317,8 +682,8 @@ Vertical-Right Prediction -> 0,9 = (Q+A+1)/2
                              8 = (Q+2I+J+2)/4
                              12 = (I+2J+K+2)/4
 */
-void intra4x4_verticalright(CopyBlock4x4& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
+void intra4x4_verticalright(CopyBlock4x4& pred, const Predictor4x4& predictor) {
+  const Predictor4x4::Pels& p = predictor.pred_pel;
 
   pred[0]  = pred[9]  = ((p[0] + p[1] + 1) >> 1);
   pred[1]  = pred[10] = ((p[1] + p[2] + 1) >> 1);
@@ -345,15 +710,15 @@ Horizontal-Down Prediction -> 0,6 = (Q+I+1)/2
                               12 = (K+L+1)/2
                               13 = (J+2K+L+2)/4
 */
-void intra4x4_horizontaldown(CopyBlock4x4& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
+void intra4x4_horizontaldown(CopyBlock4x4& pred, const Predictor4x4& predictor) {
+  const Predictor4x4::Pels& p = predictor.pred_pel;
 
   pred[0]  = pred[6]  = ((p[0] + p[9] + 1) >> 1);
   pred[1]  = pred[7]  = ((p[1] + p[9] + (p[0] << 1) + 2) >> 2);
   pred[2]  = ((p[0] + p[2] + (p[1] << 1) + 2) >> 2);
   pred[3]  = ((p[1] + p[3] + (p[2] << 1) + 2) >> 2);
   pred[4]  = pred[10] = ((p[9] + p[10] + 1) >> 1);
-  pred[5]  = pred[11] = ((p[0] + p[11] + (p[10] << 1) + 2) >> 2);
+  pred[5]  = pred[11] = ((p[0] + p[10] + (p[9] << 1) + 2) >> 2);
   pred[8]  = pred[14] = ((p[10] + p[11] + 1) >> 1);
   pred[9]  = pred[15] = ((p[9] + p[11] + (p[10] << 1) + 2) >> 2);
   pred[12] = ((p[11] + p[12] + 1) >> 1);
@@ -370,8 +735,8 @@ Horizontal-Up Prediction -> 0 = (I+J+1)/2
                             7,9 = (K+3L+2)/4
                             10,11,12,13,14,15 = L
 */
-void intra4x4_horizontalup(CopyBlock4x4& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
+void intra4x4_horizontalup(CopyBlock4x4& pred, const Predictor4x4& predictor) {
+  const Predictor4x4::Pels& p = predictor.pred_pel;
 
   pred[0]  = ((p[9] + p[10] + 1) >> 1);
   pred[1]  = ((p[9] + p[11] + (p[10] << 1) + 2) >> 2);
@@ -394,33 +759,33 @@ void intra4x4_horizontalup(CopyBlock4x4& pred, const Predictor& predictor) {
  * 
  */
 
-Predictor get_intra4x4_predictor(std::experimental::optional<Block4x4> ul, std::experimental::optional<Block4x4> u,
-                                 std::experimental::optional<Block4x4> ur, std::experimental::optional<Block4x4> l)
+Predictor4x4 get_intra4x4_predictor(const std::uint8_t available, Block4x4 ul, Block4x4 u, Block4x4 ur, Block4x4 l,
+                                    const int bit_depth)
 {
   // 4x4 block predictor (ul, 4xU, 4xUR, 4xL)
-  Predictor predictor(4);
-  std::vector<int>& p = predictor.pred_pel;
+  Predictor4x4 predictor;
+  Predictor4x4::Pels& p = predictor.pred_pel;
+  const int half = 1 << (bit_depth - 1);   // 128 at 8 bits
+  predictor.bit_depth = bit_depth;
   
   // Check whether neighbors are available, check image get_predictors_neighbours
 
   // If up predictor is avaliable copy bottom row from upper block (b-block) (12-15) to A,B,C,D
-  if (u) 
+  if (available & AVAILABLE_U) 
   {
-    Block4x4& tmp = *u;
-    std::copy_n(tmp.begin()+4*3, 4, p.begin()+1);
+    std::copy_n(u.row(3), 4, p.begin()+1);
     predictor.up_available = true;
   }
   else
   {
-    std::fill_n(p.begin()+1, 4, 128);   // if not avaliable assumes A,B,C,D at 128
+    std::fill_n(p.begin()+1, 4, half);   // if not avaliable assumes A,B,C,D at 128
   }
 
 
   // If up-right predictor is avaliable copy bottom row from upper-right block (c-block) (12-15) to E,F,G,H
-  if (ur) 
+  if (available & AVAILABLE_UR) 
   {
-    Block4x4& tmp = *ur;
-    std::copy_n(tmp.begin()+4*3, 4, p.begin()+5);
+    std::copy_n(ur.row(3), 4, p.begin()+5);
     predictor.up_right_available = true;
   }
   else      // If predictor not avaliable assumes E,F,G,H as D
@@ -429,30 +794,28 @@ Predictor get_intra4x4_predictor(std::experimental::optional<Block4x4> ul, std::
   }
 
   // If left predictor is avaliable copy right row from left block (a-block) (3,7,11,15) to I,J,K,L
-  if (l) 
+  if (available & AVAILABLE_L) 
   {
-    Block4x4& tmp = *l;
     for (int i = 0; i < 4; i++) 
     {
-      p[9+i] = tmp[i*4+3];
+      p[9+i] = l(i, 3);
     }
     predictor.left_available = true;
   }
   else 
   {
-    std::fill_n(p.begin()+9, 4, 128);   // If predictor not avaliable assumes I,J,K,L as 128
+    std::fill_n(p.begin()+9, 4, half);   // If predictor not avaliable assumes I,J,K,L as 128
   }
 
   // If both up and left predictors are avaliable -> up-left predictor is avaliable, copies bit 15 (bottom-right) to Q predictor
-  if (predictor.up_available && predictor.left_available) 
+  if (predictor.up_available && predictor.left_available && (available & AVAILABLE_UL)) 
   {
-    Block4x4& tmp = *ul;
-    p[0] = tmp[15];
+    p[0] = ul(3, 3);
     predictor.all_available = true;
   }
   else 
   {
-    p[0] = 128;  // If predictor not avaliable assumes Q to 128
+    p[0] = half;  // If predictor not avaliable assumes Q to 128
   }
 
   return predictor;
@@ -467,86 +830,63 @@ Predictor get_intra4x4_predictor(std::experimental::optional<Block4x4> ul, std::
  * Return the least cost mode
  */
 
-std::tuple<int, Intra16x16Mode> intra16x16(Block16x16& block, std::experimental::optional<std::reference_wrapper<Block16x16>> ul,
-                                                              std::experimental::optional<std::reference_wrapper<Block16x16>> u,
-                                                              std::experimental::optional<std::reference_wrapper<Block16x16>> l) {
-
-  ofstream myfile ("txt/16x16_Y_predictors.txt", ios::app);
-  static int predictor_cnt=0;
+IntraChoice<Intra16x16Mode> intra16x16(Block16x16& block, const IntraSearch& search, const std::uint8_t available,
+                                       const Block16x16& ul, const Block16x16& u, const Block16x16& l, const int bit_depth) {
 
   // Get predictors
-  Predictor predictor = get_intra16x16_predictor(ul, u, l);
-
-  /*=============================== TESTING ==============================*/
-  // // Print predictors to '16x16predictors.txt'
-  // myfile << "MB " << predictor_cnt << " ->";
-  // if(predictor.up_available)
-  //   myfile << "Up_aval "; 
-  // if (predictor.left_available)
-  //   myfile << "Left_aval ";
-  // if (predictor.up_right_available)
-  //   myfile << "Up_right_aval ";
-  // if (predictor.all_available)
-  //   myfile << "All_aval ";
-  // for (int i = 0; i < 33; i++)
-  // {
-  //   myfile << predictor.pred_pel[i] << ' ';
-  // }
-  // myfile << endl;
-  // predictor_cnt++;
-  /*======================================================================*/
-
-  int mode;
-  Intra16x16Mode best_mode;
-  Block16x16 pred, best_pred, residual, best_residual;
-  int min_sad = (1 << 15), sad;  // worst SAD is 32768 -> 16*16 pixels = 256; worst prediction = 128-0 ; 256*128 = 32768
-
-  // Run all 16x16 pred modes to get least residual
-  for (mode = 0; mode < 4; mode++) {
-
-    // cast is to convert from int to enum
-    // Checks for the predictors needed to perform each prediction mode. Continue jumps iteration
-    if ((!predictor.up_available   && (Intra16x16Mode::VERTICAL   == static_cast<Intra16x16Mode>(mode))) ||
-        (!predictor.left_available && (Intra16x16Mode::HORIZONTAL == static_cast<Intra16x16Mode>(mode))) ||
-        (!predictor.all_available  && (Intra16x16Mode::PLANE      == static_cast<Intra16x16Mode>(mode)))) {
-      continue;
-    }
-
-    // Run prediction, save in pred
-    get_intra16x16(pred, predictor, static_cast<Intra16x16Mode>(mode));
-
-    // Computes SAD, save best prediction and residual
-    sad = SAD(block.begin(), block.end(), pred.begin(), residual.begin());
-    if (sad < min_sad) {
-      min_sad = sad;
-      best_mode = static_cast<Intra16x16Mode>(mode);
-      std::copy(residual.begin(), residual.end(), best_residual.begin());   // save best residual block
-      std::copy(pred.begin(), pred.end(), best_pred.begin());   // save best prediction
+  Predictor16x16 predictor = get_intra16x16_predictor(available, ul, u, l, bit_depth);
+
+  // Cost of the allowed modes, in Intra16x16Mode order. SAD: the 4 modes in one pass
+  const std::array<bool, 4> allowed = {{predictor.up_available, predictor.left_available, true,
+                                        predictor.all_available && search.plane}};
+  std::array<int, 4> costs;
+  if (search.cost == IntraCost::SAD) {
+    IntraCosts sads = intra_costs(block, predictor);
+    costs = {{sads.vertical, sads.horizontal, sads.dc, sads.plane}};
+  } else {
+    const BypassDPCM dpcm[4] = {BypassDPCM::VERTICAL, BypassDPCM::HORIZONTAL, BypassDPCM::NONE, BypassDPCM::NONE};
+    Block16x16 pred;
+    for (int mode = 0; mode < 4; mode++) {
+      if (allowed[mode]) {
+        get_intra16x16(pred, predictor, static_cast<Intra16x16Mode>(mode));
+        costs[mode] = intra_cost<16>(search.cost, block, pred, dpcm[mode]);
+      }
     }
   }
 
-  // std::copy(best_pred.begin(), best_pred.end(), block.begin());   // Overwrite input block with best predicted
-  std::copy(best_residual.begin(), best_residual.end(), block.begin());   // Overwrite input block with best residual
+  int best_mode = static_cast<int>(Intra16x16Mode::DC);
+  for (int mode = 0; mode < 4; mode++) {
+    if (allowed[mode] && (costs[mode] < costs[best_mode] || (costs[mode] == costs[best_mode] && mode < best_mode)))
+      best_mode = mode;
+  }
 
+  // Overwrite input block with the residual of the best mode only
+  Block16x16 pred;
+  get_intra16x16(pred, predictor, static_cast<Intra16x16Mode>(best_mode));
+  int sad = 0;
+  for (int i = 0; i < 256; i++) {
+    block[i] -= pred[i];
+    sad += std::abs(block[i]);
+  }
 
-  return std::make_tuple(min_sad, best_mode);
+  return IntraChoice<Intra16x16Mode>{static_cast<Intra16x16Mode>(best_mode), costs[best_mode], sad};
 }
 
 
 // Input 16x16 predictors and mode 
-void get_intra16x16(Block16x16& pred, const Predictor& p, const Intra16x16Mode mode) {
+void get_intra16x16(Block16x16& pred, const Predictor16x16& p, const Intra16x16Mode mode) {
   switch (mode) {
     case Intra16x16Mode::VERTICAL:
-      intra16x16_vertical(pred, p);
+      intra_vertical(pred, p);
       break;
     case Intra16x16Mode::HORIZONTAL:
-      intra16x16_horizontal(pred, p);
+      intra_horizontal(pred, p);
       break;
     case Intra16x16Mode::DC:
-      intra16x16_dc(pred, p);
+      intra_dc(pred, p);
       break;
     case Intra16x16Mode::PLANE:
-      intra16x16_plane(pred, p);
+      intra_plane(pred, p);
       break;
   }
 }
@@ -562,134 +902,46 @@ H and V rows are the predictors
 */
 
 
-// Vertical prediction -> All pixels are equal to H
-
-void intra16x16_vertical(Block16x16& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel; // predictor elements
-  int i;
-  for (i = 0; i < 16; i++) {
-    // first pixel is UL, then the U pixels
-    std::copy_n(p.begin()+1, 16, pred.begin()+i*16);
-  }
-}
-
-// Horizontal prediction -> All pixels are equal to V
-
-void intra16x16_horizontal(Block16x16& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
-  int i, j;
-  for (i = 0; i < 16; i++) {
-    for (j = 0; j < 16; j++) {
-      pred[i*16+j] = p[17+i];
-    }
-  }
-}
-
-
-// DC prediction -> (V+H+16)/32
-
-void intra16x16_dc(Block16x16& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
-  int s1 = 0, s2 = 0, s = 0;
-  int i;
-
-  for (i = 1; i < 17; i++) {
-    s1 += p[i];   // accumulates upper pixels
-  }
-
-  for (i = 17; i < 33; i++) {
-    s2 += p[i];   // accumulates left pixels
-  }
-
-  // predictor availability should be checked first !!!!
-  if (predictor.up_available && predictor.left_available) {
-    s = s1 + s2;
-  }
-  else if (!predictor.up_available && predictor.left_available) {
-    s = 2 * s2;
-  }
-  else if (predictor.up_available && !predictor.left_available) {
-    s = 2 * s1;
-  }
-
-  s += 16;
-  s >>= 5;
-
-  if (!predictor.up_available && !predictor.left_available) {
-    s = 128;
-  }
-
-  pred.fill(s);
-}
-
-// Plane prediction
-
-void intra16x16_plane(Block16x16& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
-  int H = 0, V = 0;
-  int a, b, c;
-  int i, j;
-
-  for (i = 1; i < 8; i++) {
-    H += i * (p[8+i] - p[8-i]);
-    V += i * (p[24+i] - p[24-i]);
-  }
-
-  H += 8 * (p[16] - p[0]);
-  V += 8 * (p[32] - p[0]);
-
-  a = 16 * (p[16] + p[32]);
-  b = (5 * H + 32) >> 6;
-  c = (5 * V + 32) >> 6;
-
-  for (i = 0; i < 16; i++) {
-    for (j = 0; j < 16; j++) {
-      pred[i*16+j] = clip((a + b * (j-7) + c * (i-7) + 16) >> 5, 0, 255);
-    }
-  }
-}
-
-
 /* Get intra16x16 predictors from neighbors
  * [0]: downmost and rightmost pixel of ul
  * [1..16]: downmost row of u
  * [17..32]: rightmost column of l
  */
-Predictor get_intra16x16_predictor(
-  std::experimental::optional<std::reference_wrapper<Block16x16>> ul,
-  std::experimental::optional<std::reference_wrapper<Block16x16>> u,
-  std::experimental::optional<std::reference_wrapper<Block16x16>> l) {
+Predictor16x16 get_intra16x16_predictor(const std::uint8_t available, const Block16x16& ul, const Block16x16& u, const Block16x16& l,
+                                        const int bit_depth) {
 
-  Predictor predictor(16);
-  std::vector<int>& p = predictor.pred_pel;
+  Predictor16x16 predictor;
+  Predictor16x16::Pels& p = predictor.pred_pel;
+  const int half = 1 << (bit_depth - 1);
+  predictor.bit_depth = bit_depth;
   // Check whether neighbors are available
-  if (u) {
-    Block16x16& tmp = *u;
+  if (available & AVAILABLE_U) {
+    const Block16x16& tmp = u;
     std::copy_n(tmp.begin()+16*15, 16, p.begin()+1);
     predictor.up_available = true;
   }
   else {
-    std::fill_n(p.begin()+1, 16, 128);
+    std::fill_n(p.begin()+1, 16, half);
   }
 
-  if (l) {
-    Block16x16& tmp = *l;
+  if (available & AVAILABLE_L) {
+    const Block16x16& tmp = l;
     for (int i = 0; i < 16; i++) {
       p[17+i] = tmp[i*16+15];
     }
     predictor.left_available = true;
   }
   else {
-    std::fill_n(p.begin()+17, 16, 128);
+    std::fill_n(p.begin()+17, 16, half);
   }
 
-  if (predictor.up_available && predictor.left_available) {
-    Block16x16& tmp = *ul;
+  if (predictor.up_available && predictor.left_available && (available & AVAILABLE_UL)) {
+    const Block16x16& tmp = ul;
     p[0] = tmp.back();
     predictor.all_available = true;
   }
   else {
-    p[0] = 128;
+    p[0] = half;
   }
 
   return predictor;
@@ -707,238 +959,118 @@ Predictor get_intra16x16_predictor(
  * overwrite residual on input block
  * return the least cost mode
  */
-std::tuple<int, IntraChromaMode> intra8x8_chroma(Block8x8& cr_block, std::experimental::optional<std::reference_wrapper<Block8x8>> cr_ul,
-  std::experimental::optional<std::reference_wrapper<Block8x8>> cr_u, std::experimental::optional<std::reference_wrapper<Block8x8>> cr_l,
-  Block8x8& cb_block, std::experimental::optional<std::reference_wrapper<Block8x8>> cb_ul,
-  std::experimental::optional<std::reference_wrapper<Block8x8>> cb_u, std::experimental::optional<std::reference_wrapper<Block8x8>> cb_l) {
-
-  ofstream Cb_pred_file ("txt/8x8_Cb_predictors.txt", ios::app);
-  ofstream Cr_pred_file ("txt/8x8_Cr_predictors.txt", ios::app);
-  static int predictor_cnt=0;
+IntraChoice<IntraChromaMode> intra8x8_chroma(const IntraSearch& search, const std::uint8_t available,
+  Block8x8& cr_block, const Block8x8& cr_ul, const Block8x8& cr_u, const Block8x8& cr_l,
+  Block8x8& cb_block, const Block8x8& cb_ul, const Block8x8& cb_u, const Block8x8& cb_l, const int bit_depth) {
 
   // Get Cr, Cb predictors
-  Predictor cr_predictor = get_intra8x8_chroma_predictor(cr_ul, cr_u, cr_l);
-  Predictor cb_predictor = get_intra8x8_chroma_predictor(cb_ul, cb_u, cb_l);
-
-  /*=============================== TESTING ===================================*/
-  // // Print Cb predictors to '8x8_Cb_predictors.txt'
-  // Cb_pred_file << "MB " << predictor_cnt << " -> ";
-  // for (int i = 0; i < 17; i++)
-  // {
-  //   Cb_pred_file << cb_predictor.pred_pel[i] << ' ';
-  // }
-  // Cb_pred_file << endl;
-
-  // // Print Cr predictors to '8x8_Cr_predictors.txt'
-  // Cr_pred_file << "MB " << predictor_cnt << " -> ";
-  // for (int i = 0; i < 17; i++)
-  // {
-  //   Cr_pred_file << cr_predictor.pred_pel[i] << ' ';
-  // }
-  // Cr_pred_file << endl;
-
-  // predictor_cnt++;
-  /*=======================================================================*/
-
-  int mode;
-  IntraChromaMode best_mode;
-  Block8x8 cr_pred, cb_pred, cr_residual, cb_residual;
-  Block8x8 cr_best_pred, cb_best_pred, cr_best_residual, cb_best_residual;
-  int min_sad = (1 << 15), cr_sad, cb_sad, sad;
-  // Run all modes to get least residual
-  for (mode = 0; mode < 4; mode++) {
-    if ((!cr_predictor.up_available   && (IntraChromaMode::VERTICAL   == static_cast<IntraChromaMode>(mode))) ||
-        (!cr_predictor.left_available && (IntraChromaMode::HORIZONTAL == static_cast<IntraChromaMode>(mode))) ||
-        (!cr_predictor.all_available  && (IntraChromaMode::PLANE      == static_cast<IntraChromaMode>(mode)))) {
-      continue;
+  Predictor8x8 cr_predictor = get_intra8x8_chroma_predictor(available, cr_ul, cr_u, cr_l, bit_depth);
+  Predictor8x8 cb_predictor = get_intra8x8_chroma_predictor(available, cb_ul, cb_u, cb_l, bit_depth);
+
+  // According to the standard, prediction mode must be the same for both Cb and Cr blocks:
+  // cost of the allowed modes on both components, in IntraChromaMode order
+  const std::array<bool, 4> allowed = {{true, cr_predictor.left_available, cr_predictor.up_available,
+                                        cr_predictor.all_available && search.plane}};
+  std::array<int, 4> costs;
+  if (search.cost == IntraCost::SAD) {
+    IntraCosts cr_costs = intra_costs(cr_block, cr_predictor);
+    IntraCosts cb_costs = intra_costs(cb_block, cb_predictor);
+    costs = {{cr_costs.dc + cb_costs.dc, cr_costs.horizontal + cb_costs.horizontal,
+              cr_costs.vertical + cb_costs.vertical, cr_costs.plane + cb_costs.plane}};
+  } else {
+    const BypassDPCM dpcm[4] = {BypassDPCM::NONE, BypassDPCM::HORIZONTAL, BypassDPCM::VERTICAL, BypassDPCM::NONE};
+    Block8x8 cr_pred, cb_pred;
+    for (int mode = 0; mode < 4; mode++) {
+      if (allowed[mode]) {
+        get_intra8x8_chroma(cr_pred, cr_predictor, static_cast<IntraChromaMode>(mode));
+        get_intra8x8_chroma(cb_pred, cb_predictor, static_cast<IntraChromaMode>(mode));
+        costs[mode] = intra_cost<8>(search.cost, cr_block, cr_pred, dpcm[mode]) +
+                      intra_cost<8>(search.cost, cb_block, cb_pred, dpcm[mode]);
+      }
     }
+  }
 
-    get_intra8x8_chroma(cr_pred, cr_predictor, static_cast<IntraChromaMode>(mode));
-    get_intra8x8_chroma(cb_pred, cb_predictor, static_cast<IntraChromaMode>(mode));
-
-    // According to the standard, prediction mode must be the same for both Cb and Cr blocks
-    // NOTE: after testing, performance should be improved copying the residual to the pred block
-    cr_sad = SAD(cr_block.begin(), cr_block.end(), cr_pred.begin(), cr_residual.begin()); // <- //
-    cb_sad = SAD(cb_block.begin(), cb_block.end(), cb_pred.begin(), cb_residual.begin()); // <- //
-    sad = cr_sad + cb_sad;
-    if (sad < min_sad) {
-      min_sad = sad;
-      best_mode = static_cast<IntraChromaMode>(mode);
-      std::copy(cr_pred.begin(), cr_pred.end(), cr_best_pred.begin());  // save best predicted Cr
-      std::copy(cb_pred.begin(), cb_pred.end(), cb_best_pred.begin());  // save best predicted Cb
-      std::copy(cr_residual.begin(), cr_residual.end(), cr_best_residual.begin());    // save best Cr residual
-      std::copy(cb_residual.begin(), cb_residual.end(), cb_best_residual.begin());    // save best Cb residual
-    }
+  int best_mode = static_cast<int>(IntraChromaMode::DC);
+  for (int mode = 1; mode < 4; mode++) {
+    if (allowed[mode] && costs[mode] < costs[best_mode])
+      best_mode = mode;
   }
-  
-  // copy best pred to original block (TESTING !!!)
-  // std::copy(cr_best_pred.begin(), cr_best_pred.end(), cr_block.begin());
-  // std::copy(cb_best_pred.begin(), cb_best_pred.end(), cb_block.begin());
 
-  // copy best residual to original block
-  std::copy(cr_best_residual.begin(), cr_best_residual.end(), cr_block.begin());
-  std::copy(cb_best_residual.begin(), cb_best_residual.end(), cb_block.begin());
+  // Overwrite input blocks with the residual of the best mode only
+  Block8x8 cr_pred, cb_pred;
+  get_intra8x8_chroma(cr_pred, cr_predictor, static_cast<IntraChromaMode>(best_mode));
+  get_intra8x8_chroma(cb_pred, cb_predictor, static_cast<IntraChromaMode>(best_mode));
+  int sad = 0;
+  for (int i = 0; i < 64; i++) {
+    cr_block[i] -= cr_pred[i];
+    cb_block[i] -= cb_pred[i];
+    sad += std::abs(cr_block[i]) + std::abs(cb_block[i]);
+  }
 
-  return std::make_tuple(min_sad, best_mode);
+  return IntraChoice<IntraChromaMode>{static_cast<IntraChromaMode>(best_mode), costs[best_mode], sad};
 }
 
 
 // Input predictors and mode 
-void get_intra8x8_chroma(Block8x8& pred, const Predictor& p, const IntraChromaMode mode) {
+void get_intra8x8_chroma(Block8x8& pred, const Predictor8x8& p, const IntraChromaMode mode) {
   switch (mode) {
     case IntraChromaMode::DC:
-      intra8x8_chroma_dc(pred, p);
+      intra_dc(pred, p);
       break;
     case IntraChromaMode::HORIZONTAL:
-      intra8x8_chroma_horizontal(pred, p);
+      intra_horizontal(pred, p);
       break;
     case IntraChromaMode::VERTICAL:
-      intra8x8_chroma_vertical(pred, p);
+      intra_vertical(pred, p);
       break;
     case IntraChromaMode::PLANE:
-      intra8x8_chroma_plane(pred, p);
+      intra_plane(pred, p);
       break;
   }
 }
 
 
-// DC Prediction
-void intra8x8_chroma_dc(Block8x8& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
-  int s1 = 0, s2 = 0, s3 = 0, s4 = 0;
-  int s_upper_left = 0, s_upper_right = 0, s_down_left = 0, s_down_right = 0;
-  int i, j;
-
-  // summation of predictors
-  // s1: [1..4], s2: [5..8]
-  // s3: [9..12], s4: [13..16]
-  for (i = 0; i < 4; i++) {
-    s1 += p[i+1];
-    s2 += p[i+5];
-    s3 += p[i+9];
-    s4 += p[i+13];
-  }
-
-  if (predictor.up_available && predictor.left_available) {
-    s_upper_left = s1 + s3;
-    s_upper_right = s2 + s3;
-    s_down_left = s1 + s4;
-    s_down_right = s2 + s4;
-  }
-  else if (!predictor.up_available && predictor.left_available) {
-    s_upper_left = s_upper_right = 2 * s3;
-    s_down_left = s_down_right = 2 * s4;
-  }
-  else if (predictor.up_available && !predictor.left_available) {
-    s_upper_left = s_down_left = 2 * s1;
-    s_upper_right = s_down_right = 2 * s2;
-  }
-
-  s_upper_left = (s_upper_left + 4) >> 3;
-  s_upper_right = (s_upper_right + 4) >> 3;
-  s_down_left = (s_down_left + 4) >> 3;
-  s_down_right = (s_down_right + 4) >> 3;
-
-  if (!predictor.up_available && !predictor.left_available) {
-    s_upper_left = s_upper_right = s_down_left = s_down_right  = 128;
-  }
-
-  for (i = 0; i < 4; i++) {
-    for (j = 0; j < 4; j++) {
-      pred[i*8+j] = s_upper_left;
-      pred[i*8+(j+4)] = s_upper_right;
-      pred[(i+4)*8+j] = s_down_left;
-      pred[(i+4)*8+(j+4)] = s_down_right;
-    }
-  }
-}
-
-// Horizontal prediction
-void intra8x8_chroma_horizontal(Block8x8& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
-  int i, j;
-  for (i = 0; i < 8; i++) {
-    for (j = 0; j < 8; j++) {
-      pred[i*8+j] = p[9+i];
-    }
-  }
-}
-
-// Vertical prediction
-void intra8x8_chroma_vertical(Block8x8& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
-  int i;
-  for (i = 0; i < 8; i++) {
-    std::copy_n(p.begin()+1, 8, pred.begin()+i*8);
-  }
-}
-
-// Plane prediciton
-void intra8x8_chroma_plane(Block8x8& pred, const Predictor& predictor) {
-  const std::vector<int>& p = predictor.pred_pel;
-  int H = 0, V = 0;
-  int a, b, c;
-  int i, j;
-
-  for (i = 1; i < 4; i++) {
-    H += i * (p[4+i] - p[4-i]);
-    V += i * (p[12+i] - p[12-i]);
-  }
-
-  H += 4 * (p[8] - p[0]);
-  V += 4 * (p[16] - p[0]);
-
-  a = 16 * (p[8] + p[16]);
-  b = (17 * H + 16) >> 5;
-  c = (17 * V + 16) >> 5;
-
-  for (i = 0; i < 8; i++) {
-    for (j = 0; j < 8; j++) {
-      pred[i*8+j] = clip((a + b * (j-3) + c * (i-3) + 16) >> 5, 0, 255);
-    }
-  }
-}
-
 /* Get intra8x8 chroma predictors from neighbors
  * [0]: downmost and rightmost pixel of ul
  * [1..8]: downmost row of u
  * [9..16]: rightmost column of l
  */
-Predictor get_intra8x8_chroma_predictor(std::experimental::optional<std::reference_wrapper<Block8x8>> ul,
-                                        std::experimental::optional<std::reference_wrapper<Block8x8>> u,
-                                        std::experimental::optional<std::reference_wrapper<Block8x8>> l) {
+Predictor8x8 get_intra8x8_chroma_predictor(const std::uint8_t available, const Block8x8& ul, const Block8x8& u, const Block8x8& l,
+                                           const int bit_depth) {
 
-  Predictor predictor(8);
-  std::vector<int>& p = predictor.pred_pel;
+  Predictor8x8 predictor;
+  Predictor8x8::Pels& p = predictor.pred_pel;
+  const int half = 1 << (bit_depth - 1);   // 128 at 8 bits
+  predictor.bit_depth = bit_depth;
   
   // Check whether neighbors are available
-  if (u) {
-    Block8x8& tmp = *u;
+  if (available & AVAILABLE_U) {
+    const Block8x8& tmp = u;
     std::copy_n(tmp.begin()+8*7, 8, p.begin()+1);
     predictor.up_available = true;
   }
   else {
-    std::fill_n(p.begin()+1, 8, 128);
+    std::fill_n(p.begin()+1, 8, half);
   }
 
-  if (l) {
-    Block8x8& tmp = *l;
+  if (available & AVAILABLE_L) {
+    const Block8x8& tmp = l;
     for (int i = 0; i < 8; i++) {
       p[9+i] = tmp[i*8+7];
     }
     predictor.left_available = true;
   }
   else {
-    std::fill_n(p.begin()+9, 8, 128);
+    std::fill_n(p.begin()+9, 8, half);
   }
 
-  if (predictor.up_available && predictor.left_available) {
-    Block8x8& tmp = *ul;
+  if (predictor.up_available && predictor.left_available && (available & AVAILABLE_UL)) {
+    const Block8x8& tmp = ul;
     p[0] = tmp.back();
     predictor.all_available = true;
   }
   else {
-    p[0] = 128;
+    p[0] = half;
   }
 
   return predictor;
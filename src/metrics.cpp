@@ -0,0 +1,214 @@
+#include "metrics.h"
+
+#include <cmath>
+#include <limits>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+
+namespace {
+
+/* Nearest neighbour of every valid point of 'a' among the valid points of 'b'
+ *
+ * Both clouds come from the same range image grid, so the neighbour is searched in a
+ * (2*radius+1)^2 pixel window around the pixel of the point (projective search).
+ * The loops run over contiguous rows of the SoA buffers for one window offset at a time,
+ * invalid points of 'b' are discarded through an additive penalty: no branches, vectorized.
+ */
+void nearest_neighbours(const PointBuffer& a, const std::vector<float>& a_penalty,
+                        const PointBuffer& b, const std::vector<float>& b_penalty,
+                        const int width, const int height, const int radius,
+                        double& sum_d, double& sum_d2, std::size_t& count) {
+  const float no_neighbour = std::numeric_limits<float>::max();
+  std::vector<float> best(width);
+
+  sum_d = sum_d2 = 0.0;
+  count = 0;
+
+  for (int v = 0; v < height; v++) {
+    std::fill(best.begin(), best.end(), no_neighbour);
+
+    const float* ax = &a.x[v * width];
+    const float* ay = &a.y[v * width];
+    const float* az = &a.z[v * width];
+
+    for (int dv = -radius; dv <= radius; dv++) {
+      int vb = v + dv;
+      if (vb < 0 || vb >= height)
+        continue;
+
+      for (int du = -radius; du <= radius; du++) {
+        int u0 = std::max(0, -du);
+        int u1 = std::min(width, width - du);
+        const float* bx = &b.x[vb * width];
+        const float* by = &b.y[vb * width];
+        const float* bz = &b.z[vb * width];
+        const float* bp = &b_penalty[vb * width];
+
+        for (int u = u0; u < u1; u++) {
+          float dx = ax[u] - bx[u + du];
+          float dy = ay[u] - by[u + du];
+          float dz = az[u] - bz[u + du];
+          float d2 = dx * dx + dy * dy + dz * dz + bp[u + du];
+          best[u] = std::min(best[u], d2);
+        }
+      }
+    }
+
+    const float* ap = &a_penalty[v * width];
+    for (int u = 0; u < width; u++) {
+      if (ap[u] != 0.0f || best[u] >= 1e30f)   // invalid point, or no valid point around
+        continue;
+      sum_d += std::sqrt(best[u]);
+      sum_d2 += best[u];
+      count++;
+    }
+  }
+}
+
+}   // namespace
+
+
+MetricsJob make_metrics_job(const int frame_num, const std::size_t bits, const float* ranges, const int width, const int height,
+                            const cv::Mat& source, const std::uint16_t* decoded_Y, const int stride) {
+  MetricsJob job;
+  job.frame_num = frame_num;
+  job.bits = bits;
+  job.width = width;
+  job.height = height;
+  job.source_ranges.assign(ranges, ranges + width * height);
+  job.source_Y.resize(width * height);
+  job.decoded_Y.resize(width * height);
+
+  for (int i = 0; i < height; i++) {
+    if (source.depth() == CV_16U)
+      std::copy_n(source.ptr<std::uint16_t>(0) + i * stride, width, &job.source_Y[i * width]);
+    else
+      std::copy_n(source.ptr<std::uint8_t>(0) + i * stride, width, &job.source_Y[i * width]);
+    std::copy_n(decoded_Y + i * stride, width, &job.decoded_Y[i * width]);
+  }
+  return job;
+}
+
+FrameMetrics compute_metrics(const MetricsJob& job, const Reprojector& reprojector, const int radius) {
+  const ProjectionConfig& config = reprojector.get_config();
+  const int width = job.width;
+  const int height = job.height;
+  const int nb_pixels = width * height;
+
+  FrameMetrics metrics;
+  metrics.frame_num = job.frame_num;
+  metrics.bits = job.bits;
+
+  // Y PSNR
+  std::int64_t sse = 0;
+  for (int i = 0; i < nb_pixels; i++) {
+    int diff = (int)job.source_Y[i] - (int)job.decoded_Y[i];
+    sse += diff * diff;
+  }
+  const double peak = config.max_sample();
+  metrics.psnr_Y = (sse == 0) ? 100.0 : 10.0 * std::log10(peak * peak * nb_pixels / (double)sse);
+
+  // Range error, in metres
+  std::vector<float> decoded_ranges(nb_pixels);
+  std::vector<float> source_penalty(nb_pixels), decoded_penalty(nb_pixels);
+  double range_se = 0.0;
+  std::size_t nb_valid = 0;
+
+  for (int i = 0; i < nb_pixels; i++) {
+    float source_range = job.source_ranges[i];
+    bool source_valid = std::isfinite(source_range) && source_range > 0.0f;
+    bool decoded_valid = job.decoded_Y[i] != 0;
+
+    decoded_ranges[i] = sample_to_range(job.decoded_Y[i], config);
+    source_penalty[i] = source_valid ? 0.0f : 1e30f;
+    decoded_penalty[i] = decoded_valid ? 0.0f : 1e30f;
+
+    if (source_valid && decoded_valid) {
+      double diff = std::min(source_range, config.max_range) - decoded_ranges[i];
+      range_se += diff * diff;
+      nb_valid++;
+    }
+    metrics.lost_points += (source_valid && !decoded_valid);
+    metrics.fake_points += (!source_valid && decoded_valid);
+  }
+  metrics.range_rmse = nb_valid ? std::sqrt(range_se / nb_valid) : 0.0;
+
+  // Geometry, after reprojection
+  PointBuffer source_points, decoded_points;
+  reprojector.reproject_grid(job.source_ranges.data(), width, width, height, source_points);
+  reprojector.reproject_grid(decoded_ranges.data(), width, width, height, decoded_points);
+
+  double sum_d_ab, sum_d2_ab, sum_d_ba, sum_d2_ba;
+  std::size_t count_ab, count_ba;
+  nearest_neighbours(source_points, source_penalty, decoded_points, decoded_penalty, width, height, radius,
+                     sum_d_ab, sum_d2_ab, count_ab);
+  nearest_neighbours(decoded_points, decoded_penalty, source_points, source_penalty, width, height, radius,
+                     sum_d_ba, sum_d2_ba, count_ba);
+
+  double rmse_ab = count_ab ? std::sqrt(sum_d2_ab / count_ab) : 0.0;
+  double rmse_ba = count_ba ? std::sqrt(sum_d2_ba / count_ba) : 0.0;
+  metrics.p2p_rmse = std::max(rmse_ab, rmse_ba);
+  metrics.chamfer = (count_ab ? sum_d_ab / count_ab : 0.0) + (count_ba ? sum_d_ba / count_ba : 0.0);
+
+  return metrics;
+}
+
+
+MetricsWorker::MetricsWorker(const ProjectionConfig& config, const std::string& filename, const std::size_t _max_pending)
+: reprojector(config), max_pending(_max_pending), dropped(0), stop(false)
+{
+  file.open(filename, std::ios::out);
+  if (!file.is_open()) {
+    std::cerr << "Cannot open " << filename << std::endl;
+    exit(1);
+  }
+  file << "frame bits psnr_Y range_rmse lost fake p2p_rmse chamfer" << std::endl;
+
+  worker = std::thread(&MetricsWorker::run, this);
+}
+
+// Computes the pending jobs before returning
+MetricsWorker::~MetricsWorker() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+  }
+  cv.notify_one();
+  worker.join();
+}
+
+void MetricsWorker::submit(MetricsJob&& job) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (jobs.size() >= max_pending) {
+      jobs.pop_front();
+      dropped++;
+    }
+    jobs.push_back(std::move(job));
+  }
+  cv.notify_one();
+}
+
+std::size_t MetricsWorker::get_dropped() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return dropped;
+}
+
+void MetricsWorker::run() {
+  while (true) {
+    MetricsJob job;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [this] { return stop || !jobs.empty(); });
+      if (jobs.empty())
+        return;
+      job = std::move(jobs.front());
+      jobs.pop_front();
+    }
+
+    FrameMetrics m = compute_metrics(job, reprojector);
+    file << m.frame_num << ' ' << m.bits << ' ' << m.psnr_Y << ' ' << m.range_rmse << ' '
+         << m.lost_points << ' ' << m.fake_points << ' ' << m.p2p_rmse << ' ' << m.chamfer << std::endl;
+  }
+}
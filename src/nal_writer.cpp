@@ -0,0 +1,151 @@
+#include "nal_writer.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <climits>
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+
+NalWriter::NalWriter(const std::string& filename, const FsyncPolicy _fsync_policy, const std::size_t capacity)
+: fsync_policy(_fsync_policy), ring(std::max<std::size_t>(capacity, 1)), head(0), tail(0), stop(false),
+  free_ring(ring.size() + 2), free_head(0), free_tail(free_ring.size()), max_depth(0), full_count(0)
+{
+  iov.reserve(ring.size());
+
+  fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    std::cerr << "Cannot open " << filename << std::endl;
+    exit(1);
+  }
+
+  worker = std::thread(&NalWriter::run, this);
+}
+
+// Writes the pending NAL units before closing the file
+NalWriter::~NalWriter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+  }
+  not_empty.notify_one();
+  worker.join();
+
+  if (fsync_policy != FsyncPolicy::NONE)
+    fsync(fd);
+  close(fd);
+}
+
+/**
+ * @brief Queues a NAL unit, waits only if the ring is full
+ *
+ * @param nal_unit Start code + NAL unit, moved into the ring (no copy)
+ */
+void NalWriter::push(std::vector<std::uint8_t>&& nal_unit) {
+  std::size_t t = tail.load(std::memory_order_relaxed);
+
+  if (t - head.load(std::memory_order_acquire) == ring.size()) {
+    full_count++;
+    std::unique_lock<std::mutex> lock(mutex);
+    not_full.wait(lock, [&] { return t - head.load(std::memory_order_acquire) < ring.size(); });
+  }
+
+  ring[t % ring.size()] = std::move(nal_unit);
+  tail.store(t + 1, std::memory_order_release);
+  max_depth = std::max(max_depth, t + 1 - head.load(std::memory_order_relaxed));
+
+  // Taking the lock orders the notification with the writer's wait predicate
+  { std::lock_guard<std::mutex> lock(mutex); }
+  not_empty.notify_one();
+}
+
+std::size_t NalWriter::get_depth() const {
+  return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+}
+
+void NalWriter::run() {
+  while (true) {
+    std::size_t h = head.load(std::memory_order_relaxed);
+    std::size_t t;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      not_empty.wait(lock, [&] { return tail.load(std::memory_order_acquire) != h || stop; });
+      t = tail.load(std::memory_order_acquire);
+    }
+    if (t == h)   // stopped and drained
+      return;
+
+    write_batch(h, t);
+
+    for (std::size_t i = h; i != t; i++)
+      recycle(ring[i % ring.size()]);
+    head.store(t, std::memory_order_release);
+
+    { std::lock_guard<std::mutex> lock(mutex); }
+    not_full.notify_one();
+  }
+}
+
+std::vector<std::uint8_t> NalWriter::acquire_buffer() {
+  std::vector<std::uint8_t> buffer;
+  std::size_t h = free_head.load(std::memory_order_relaxed);
+  if (h != free_tail.load(std::memory_order_acquire)) {
+    buffer.swap(free_ring[h % free_ring.size()]);
+    free_head.store(h + 1, std::memory_order_release);
+  }
+  return buffer;
+}
+
+void NalWriter::reserve_buffers(const std::size_t bytes) {
+  std::size_t t = free_tail.load(std::memory_order_acquire);
+  for (std::size_t h = free_head.load(std::memory_order_relaxed); h != t; h++)
+    free_ring[h % free_ring.size()].reserve(bytes);
+}
+
+// Hands a written buffer back to acquire_buffer(), or releases it when enough are waiting
+void NalWriter::recycle(std::vector<std::uint8_t>& buffer) {
+  std::size_t t = free_tail.load(std::memory_order_relaxed);
+  if (t - free_head.load(std::memory_order_acquire) < free_ring.size()) {
+    buffer.clear();
+    free_ring[t % free_ring.size()].swap(buffer);
+    free_tail.store(t + 1, std::memory_order_release);
+  }
+  std::vector<std::uint8_t>().swap(buffer);
+}
+
+/**
+ * @brief Writes the slots [first, last) with as few writev calls as possible
+ */
+void NalWriter::write_batch(const std::size_t first, const std::size_t last) {
+  iov.clear();
+  for (std::size_t i = first; i != last; i++) {
+    std::vector<std::uint8_t>& buffer = ring[i % ring.size()];
+    if (!buffer.empty())
+      iov.push_back({buffer.data(), buffer.size()});
+  }
+
+  std::size_t index = 0;
+  while (index < iov.size()) {
+    int count = static_cast<int>(std::min<std::size_t>(iov.size() - index, IOV_MAX));
+    ssize_t written = writev(fd, &iov[index], count);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      std::cerr << "NAL writer: write failed (" << errno << ")" << std::endl;
+      exit(1);
+    }
+
+    // Skip what was written, partial writes resume inside the current buffer
+    std::size_t remaining = written;
+    while (index < iov.size() && remaining >= iov[index].iov_len)
+      remaining -= iov[index++].iov_len;
+    if (index < iov.size()) {
+      iov[index].iov_base = static_cast<std::uint8_t*>(iov[index].iov_base) + remaining;
+      iov[index].iov_len -= remaining;
+    }
+  }
+
+  if (fsync_policy == FsyncPolicy::PER_BATCH)
+    fsync(fd);
+}
@@ -1,14 +1,83 @@
 #include "packager.h"
 
+#include <algorithm>
+#include <iostream>
+
 // Start/stop code prefix to separate NAL Units
 std::uint8_t Packager::start_code[4] = {0x00, 0x00, 0x00, 0x01};
 
-Packager::Packager(std::string filename) {
-  // Open the file stream for output file
-  file.open(filename, std::ios::out | std::ios::binary);
-  if (!file.is_open()) {
-    exit(1);
+/**
+ * @param filename Output H.264 (Annex B) file
+ * @param fsync_policy When the writer thread forces the stream to storage
+ * @param queue_size Number of NAL units that can wait for the writer before write_* blocks
+ * @param _entropy_coding CAVLC (Baseline profile) or CABAC (Main profile, slice data from cabac_frame)
+ * @param _lossless Transform bypass at QP 0 (High 4:4:4 Predictive profile), the frames must be encoded
+ *                  with Frame::lossless
+ * @param _bit_depth Bits per sample, 8 to 14, the frames must be encoded with the same Frame::bit_depth
+ */
+Packager::Packager(std::string _filename, const FsyncPolicy fsync_policy, const std::size_t queue_size,
+                   const EntropyCoding _entropy_coding, const bool _lossless, const int _bit_depth)
+: filename(_filename), writer(_filename, fsync_policy, queue_size), bytes_queued(0), nal_reserve(0), au_offset(-1), au_header_size(0),
+  entropy_coding(_entropy_coding), lossless(_lossless), bit_depth(_bit_depth)
+{
+}
+
+/**
+ * @brief Starts writing '<stream>.idx', must be called before the first NAL unit
+ *
+ * @return false if the index cannot be created (the stream is still written)
+ */
+bool Packager::enable_index() {
+  index_file.open(filename + ".idx", std::ios::out | std::ios::binary);
+  if (!index_file.is_open()) {
+    std::cerr << "Cannot open " << filename << ".idx" << std::endl;
+    return false;
+  }
+  index_file.write(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+  return true;
+}
+
+// Hands a NAL unit to the writer thread, keeping track of the stream offsets for the index
+void Packager::queue(std::vector<std::uint8_t>&& nal_unit, const bool parameter_set) {
+  if (au_offset < 0)
+    au_offset = bytes_queued;
+  if (parameter_set)
+    au_header_size += nal_unit.size();
+
+  bytes_queued += nal_unit.size();
+  writer.push(std::move(nal_unit));
+}
+
+/**
+ * @brief Builds a NAL unit (start code, header, EBSP) in a recycled writer buffer and queues it
+ *
+ * @param access_unit If not null, the NAL unit is also appended to it (for publishing)
+ * @param parameter_set SPS/PPS: also kept for append_parameter_sets
+ * @return Size in bytes, start code included
+ */
+size_t Packager::queue_nal(const NALRefIdc ref_idc, const NALType type, const Bitstream& rbsp,
+                           std::vector<std::uint8_t>* access_unit, const bool parameter_set) {
+  // The writer buffers all grow to the largest NAL unit, not only to the one they held last.
+  // Geometric growth: the slice headers get longer with the frame number (idr_pic_id, POC)
+  std::size_t worst_case = sizeof(start_code) + 1 + rbsp.buffer.size() * 3 / 2;
+  if (worst_case > nal_reserve) {
+    nal_reserve = std::max(worst_case, nal_reserve + nal_reserve / 4);
+    writer.reserve_buffers(nal_reserve);
   }
+  std::vector<std::uint8_t> nal_unit = writer.acquire_buffer();
+  nal_unit.reserve(nal_reserve);
+  nal_unit.assign(start_code, start_code + 4);
+  nal_unit.push_back(make_nal_header(ref_idc, type));
+  rbsp.rbsp_to_ebsp(nal_unit);
+
+  if (access_unit)
+    access_unit->insert(access_unit->end(), nal_unit.begin(), nal_unit.end());
+  if (parameter_set)
+    parameter_sets.insert(parameter_sets.end(), nal_unit.begin(), nal_unit.end());
+
+  size_t size = nal_unit.size();
+  queue(std::move(nal_unit), parameter_set);
+  return size;
 }
 
 /**
@@ -19,43 +88,118 @@ Packager::Packager(std::string filename) {
  * @param num_frames  Number of frames in the stream (PC Range images in this case)
  */
 void Packager::write_SPS(const int width, const int height, const int num_frames) {
-  Bitstream output(start_code, 32);
   Bitstream rbsp = seq_parameter_set_rbsp(width, height, num_frames);   // SPS raw byte sequence payload
-  NALUnit nal_unit(NALRefIdc::HIGHEST, NALType::SPS, rbsp.rbsp_to_ebsp());  // construct SPS NAL Unit
 
-  output += nal_unit.get();
-
-  file.write((char*)&output.buffer[0], output.buffer.size());
-  file.flush();
+  parameter_sets.clear();   // a new SPS starts a new set
+  queue_nal(NALRefIdc::HIGHEST, NALType::SPS, rbsp, nullptr, true);
 }
 
 void Packager::write_PPS() {
-  Bitstream output(start_code, 32);
   Bitstream rbsp = pic_parameter_set_rbsp();
-  NALUnit nal_unit(NALRefIdc::HIGHEST, NALType::PPS, rbsp.rbsp_to_ebsp());
-
-  output += nal_unit.get();
+  queue_nal(NALRefIdc::HIGHEST, NALType::PPS, rbsp, nullptr, true);
+}
 
-  file.write((char*)&output.buffer[0], output.buffer.size());
-  file.flush();
+/**
+ * @brief Writes the projection metadata SEI of the next frame (before its slices)
+ *
+ * @param metadata Projection, quantization, pose and time stamp (see sei.h)
+ * @param access_unit If not null, the NAL unit is also appended to it (for publishing)
+ */
+void Packager::write_SEI(const ProjectionMetadata& metadata, std::vector<std::uint8_t>* access_unit) {
+  Bitstream rbsp = projection_sei_rbsp(metadata);
+  queue_nal(NALRefIdc::DISPOSABLE, NALType::SEI, rbsp, access_unit, false);   // nal_ref_idc is 0 for SEI
 }
 
 /**
- * @brief Writes slice header and data (1 frame per slice)
+ * @brief Writes slice header and data, one NAL unit per slice of the frame (see Frame::set_slices)
  * 
  * @param frame_num Frame number (starting from zero)
  * @param frame The Frame instance (Range image)
+ * @param access_unit If not null, the NAL units are also appended to it (for publishing)
+ * @param stamp Time stamp of the source cloud (ns), written to the index
+ * @return Size of the NAL units in bytes (start codes included), queued for the writer thread
+ */
+size_t Packager::write_slice(const int frame_num, Frame& frame, std::vector<std::uint8_t>* access_unit, const std::uint64_t stamp) {
+  const int nb_mbs = frame.mbs.size();
+  size_t size = 0;
+
+  frame_mb_bits.assign(nb_mbs, 0);   // capacity kept across frames
+
+  int first_mb = 0;
+  while (first_mb < nb_mbs) {
+    int last_mb = first_mb + 1;
+    while (last_mb < nb_mbs && (frame.slice_map.empty() || frame.slice_map[last_mb] == frame.slice_map[first_mb]))
+      last_mb++;
+
+    Bitstream rbsp = slice_layer_without_partitioning_rbsp(frame_num, frame, first_mb, last_mb, frame_mb_bits);
+    size += queue_nal(NALRefIdc::HIGHEST, NALType::IDR, rbsp, access_unit, false);
+
+    first_mb = last_mb;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mb_bits_mutex);
+    mb_bits.swap(frame_mb_bits);
+  }
+
+  if (index_file.is_open()) {
+    IndexEntry entry = IndexEntry();
+    entry.stamp = stamp;
+    entry.offset = au_offset;
+    entry.size = bytes_queued - au_offset;
+    entry.frame_num = frame_num;
+    entry.flags = INDEX_KEYFRAME | (au_header_size ? INDEX_PARAMETER_SETS : 0);
+    entry.header_size = au_header_size;
+    index_file.write((char*)&entry, sizeof(entry));
+  }
+  au_offset = -1;
+  au_header_size = 0;
+
+  return size;
+}
+
+/**
+ * @brief Chooses the slices of the next frame so that each slice NAL unit fits in 'max_bytes'
+ *
+ * The MB sizes of the previous frame are used as estimates (consecutive scans are similar),
+ * a slice that still ends up larger is fragmented by the transport (FU-A).
+ *
+ * @param frame The next frame (only its MB layout is used)
+ * @param max_bytes Maximum NAL unit size, 0 for a single slice
+ * @param first_mbs Output, first MB of each slice for Frame::set_slices (capacity reused)
  */
-void Packager::write_slice(const int frame_num, Frame& frame) {
-  Bitstream output(start_code, 32);
-  Bitstream rbsp = slice_layer_without_partitioning_rbsp(frame_num, frame);
-  rbsp += Bitstream((std::uint8_t)0x80, 8);
+void Packager::plan_slices(const Frame& frame, const size_t max_bytes, std::vector<int>& first_mbs) const {
+  const int nb_mbs = frame.mbs.size();
+  first_mbs.assign(1, 0);
+  if (max_bytes == 0)
+    return;
+
+  std::lock_guard<std::mutex> lock(mb_bits_mutex);
+
+  // No history: one slice per MB row
+  if ((int)mb_bits.size() != nb_mbs) {
+    for (int i = frame.nb_mb_cols; i < nb_mbs; i += frame.nb_mb_cols)
+      first_mbs.push_back(i);
+    return;
+  }
 
-  NALUnit nal_unit(NALRefIdc::HIGHEST, NALType::IDR, rbsp.rbsp_to_ebsp());
+  // 20% margin (MBs cost more at slice borders, emulation prevention), minus start code and headers
+  const size_t header_bits = 16 * 8;
+  size_t budget = max_bytes * 8 * 8 / 10;
+  budget = (budget > 2 * header_bits) ? budget - header_bits : header_bits;
 
-  output += nal_unit.get();
-  file.write((char*)&output.buffer[0], output.buffer.size());
-  file.flush();
+  size_t bits = 0;
+  for (int i = 0; i < nb_mbs; i++) {
+    if (bits + mb_bits[i] > budget && i > first_mbs.back()) {
+      first_mbs.push_back(i);
+      bits = 0;
+    }
+    bits += mb_bits[i];
+  }
+}
+
+void Packager::append_parameter_sets(std::vector<std::uint8_t>& access_unit) const {
+  access_unit.insert(access_unit.end(), parameter_sets.begin(), parameter_sets.end());
 }
 
 /**
@@ -71,7 +215,8 @@ void Packager::write_slice(const int frame_num, Frame& frame) {
  */
 Bitstream Packager::seq_parameter_set_rbsp(const int width, const int height, const int num_frames) {
   Bitstream sodb;
-  std::uint8_t profile_idc = 66;  // u(8)   // baseline profile
+  std::uint8_t profile_idc = (lossless || bit_depth > 10) ? 244 : (bit_depth > 8) ? 110 :
+                             (entropy_coding == EntropyCoding::CABAC) ? 77 : 66;  // u(8)   // high 4:4:4 predictive / high 10 / main / baseline profile
   bool constraint_set0_flag = false;  // u(1)
   bool constraint_set1_flag = false;  // u(1)
   bool constraint_set2_flag = false;  // u(1)
@@ -80,6 +225,14 @@ Bitstream Packager::seq_parameter_set_rbsp(const int width, const int height, co
   std::uint8_t reserved_zero_4bits = 0x00;  // u(4)   <------ MODIFIED
   std::uint8_t level_idc = 10;  // u(8)
   unsigned int seq_parameter_set_id = 0;  // ue(v)
+
+  // if (profile_idc == 110 || profile_idc == 244 ...)
+  unsigned int chroma_format_idc = 1;   // ue(v)   4:2:0
+  unsigned int bit_depth_luma_minus8 = bit_depth - 8;   // ue(v)
+  unsigned int bit_depth_chroma_minus8 = bit_depth - 8;   // ue(v)   same as luma (decoders rarely support a mix)
+  bool qpprime_y_zero_transform_bypass_flag = lossless;   // u(1)   lossless MBs at QP'Y 0
+  bool seq_scaling_matrix_present_flag = false;   // u(1)
+
   unsigned int log2_max_frame_num_minus4 = std::max(0, (int)log2(num_frames) - 4); // ue(v)
   unsigned int pic_order_cnt_type = 0;  // ue(v)
   unsigned int log2_max_pic_order_cnt_lsb_minus4 = log2_max_frame_num_minus4; // ue(v)
@@ -112,6 +265,15 @@ Bitstream Packager::seq_parameter_set_rbsp(const int width, const int height, co
   sodb += Bitstream(reserved_zero_4bits, 4);  // MODIFIED
   sodb += Bitstream(level_idc, 8);
   sodb += uegc(seq_parameter_set_id);
+
+  if (profile_idc == 110 || profile_idc == 244) {
+    sodb += uegc(chroma_format_idc);
+    sodb += uegc(bit_depth_luma_minus8);
+    sodb += uegc(bit_depth_chroma_minus8);
+    sodb += Bitstream(qpprime_y_zero_transform_bypass_flag);
+    sodb += Bitstream(seq_scaling_matrix_present_flag);
+  }
+
   sodb += uegc(log2_max_frame_num_minus4);
   sodb += uegc(pic_order_cnt_type); 
   sodb += uegc(log2_max_pic_order_cnt_lsb_minus4);
@@ -141,27 +303,20 @@ Bitstream Packager::seq_parameter_set_rbsp(const int width, const int height, co
  * @return Bitstream 
  */
 Bitstream Packager::pic_parameter_set_rbsp() {
-  const int QPC2idoffset[] = {
-    0 , 1 , 2 , 3 , 4 , 5 , 6 , 7 , 8 , 9 , 
-    10, 11, 12, 13, 14, 15, 16, 17, 18, 19,
-    20, 21, 22, 23, 24, 25, 26, 27, 28, 30,
-    31, 32, 33, 35, 36, 38, 40, 42, 45, 48
-  };
-
   Bitstream sodb;
 
   unsigned int pic_parameter_set_id = 0;  // ue(v)
   unsigned int seq_parameter_set_id = 0;  // ue(v)
-  bool entropy_coding_mode_flag = false;  // u(1)
+  bool entropy_coding_mode_flag = (entropy_coding == EntropyCoding::CABAC);  // u(1)
   bool pic_order_present_flag = false;  // u(1)
   unsigned int num_slice_groups_minus1 = 0; // ue(v)
   unsigned int num_ref_idx_l0_active_minus1 = 0;  // ue(v)
   unsigned int num_ref_idx_l1_active_minus1 = 0;  // ue(v)
   bool weighted_pred_flag = false;  // u(1)
   unsigned int weighted_bipred_idc = 0; // u(2)
-  int pic_init_qp_minus26 = LUMA_QP - 26; // se(v)
+  int pic_init_qp_minus26 = pic_init_qp() - 26; // se(v)
   int pic_init_qs_minus26 = 0;  // se(v)
-  int chroma_qp_index_offset = QPC2idoffset[CHROMA_QP] - LUMA_QP; // se(v)
+  int chroma_qp_index_offset = CHROMA_QP_INDEX_OFFSET; // se(v)
   bool deblocking_filter_control_present_flag = true; // u(1)
   bool constrained_intra_pred_flag = false; // u(1)
   bool redundant_pic_cnt_present_flag = false;  // u(1)
@@ -185,13 +340,30 @@ Bitstream Packager::pic_parameter_set_rbsp() {
   return sodb.rbsp_trailing_bits();
 }
 
-Bitstream Packager::slice_layer_without_partitioning_rbsp(const int _frame_num, Frame& frame) {
-  Bitstream sodb = slice_header(_frame_num);    // write slice header
-  return write_slice_data(frame, sodb).rbsp_trailing_bits();
+Bitstream Packager::slice_layer_without_partitioning_rbsp(const int _frame_num, Frame& frame, const int first_mb, const int last_mb,
+                                                          std::vector<size_t>& frame_mb_bits) {
+  Bitstream sodb = slice_header(_frame_num, first_mb, frame.get_deblocking(frame.get_slice(first_mb)), frame.get_qp());    // write slice header
+  if (entropy_coding == EntropyCoding::CAVLC)
+    return write_slice_data(frame, sodb, first_mb, last_mb, frame_mb_bits).rbsp_trailing_bits();
+
+  // CABAC: cabac_alignment_one_bit, then the slice data coded by cabac_frame (trailing bits included)
+  while (!sodb.byte_align())
+    sodb += Bitstream(true);
+  const int slice = frame.get_slice(first_mb);
+  const std::size_t start = frame.cabac_slice_offsets[slice], end = frame.cabac_slice_offsets[slice + 1];
+  sodb += Bitstream(frame.cabac_data.data() + start, (end - start) * 8);
+  for (int i = first_mb; i < last_mb; i++)
+    frame_mb_bits[i] = frame.mbs[i].cabac_bits;
+  return sodb;
 }
 
-Bitstream Packager::write_slice_data(Frame& frame, Bitstream& sodb) {
-  for (auto& mb : frame.mbs) {
+// MBs [first_mb, last_mb) of the frame, the size of each MB is kept in 'frame_mb_bits' for plan_slices
+Bitstream Packager::write_slice_data(Frame& frame, Bitstream& sodb, const int first_mb, const int last_mb,
+                                     std::vector<size_t>& frame_mb_bits) {
+  for (int i = first_mb; i < last_mb; i++) {
+    MacroBlock& mb = frame.mbs[i];
+    int start_bits = sodb.nb_bits;
+
     if (mb.is_I_PCM) {    // MB not intra coded
       sodb += uegc(25);
 
@@ -199,14 +371,15 @@ Bitstream Packager::write_slice_data(Frame& frame, Bitstream& sodb) {
         sodb += Bitstream(false);
 
       for (auto& y : mb.Y)
-        sodb += Bitstream(static_cast<std::uint8_t>(y), 8);
+        sodb += Bitstream(static_cast<unsigned int>(y), bit_depth);
 
       for (auto& cb : mb.Cb)
-        sodb += Bitstream(static_cast<std::uint8_t>(cb), 8);
+        sodb += Bitstream(static_cast<unsigned int>(cb), bit_depth);
 
       for (auto& cr : mb.Cr)
-        sodb += Bitstream(static_cast<std::uint8_t>(cr), 8);
+        sodb += Bitstream(static_cast<unsigned int>(cr), bit_depth);
 
+      frame_mb_bits[i] = sodb.nb_bits - start_bits;
       continue;
     }
 
@@ -253,6 +426,8 @@ Bitstream Packager::write_slice_data(Frame& frame, Bitstream& sodb) {
       sodb += segc(0);  // delta_qp
       sodb += mb.bitstream;
     }
+
+    frame_mb_bits[i] = sodb.nb_bits - start_bits;
   }
 
   return sodb;
@@ -270,36 +445,7 @@ Bitstream Packager::mb_pred(MacroBlock& mb, Frame& frame) {
 
   if (!mb.is_intra16x16) {
     for (int cur_pos = 0; cur_pos != 16; cur_pos++) {
-      int real_pos = MacroBlock::convert_table[cur_pos];
-
-      int pmA_index, pmA_pos;
-      if (real_pos % 4 == 0) {
-        pmA_index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_L);
-        pmA_pos = real_pos + 3;
-      } else {
-        pmA_index = mb.mb_index;
-        pmA_pos = real_pos - 1;
-      }
-      pmA_pos = MacroBlock::convert_table[pmA_pos];
-
-      int pmB_index, pmB_pos;
-      if (0 <= real_pos && real_pos <= 3) {
-        pmB_index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_U);
-        pmB_pos = 12 + real_pos;
-      } else {
-        pmB_index = mb.mb_index;
-        pmB_pos = real_pos - 4;
-      }
-      pmB_pos = MacroBlock::convert_table[pmB_pos];
-
-      int pred_modeA = 2, pred_modeB = 2;
-      if (pmA_index != -1 && (!frame.mbs.at(pmA_index).is_intra16x16) && (!frame.mbs.at(pmA_index).is_I_PCM)
-          && pmB_index != -1 && (!frame.mbs.at(pmB_index).is_intra16x16) && (!frame.mbs.at(pmB_index).is_I_PCM)) {
-        pred_modeA = static_cast<int>(frame.mbs.at(pmA_index).intra4x4_Y_mode.at(pmA_pos));
-        pred_modeB = static_cast<int>(frame.mbs.at(pmB_index).intra4x4_Y_mode.at(pmB_pos));
-      }
-
-      int pred_mode = std::min(pred_modeA, pred_modeB);
+      int pred_mode = frame.predict_intra4x4_mode(mb.mb_index, cur_pos);
       int cur_mode = static_cast<int>(mb.intra4x4_Y_mode.at(cur_pos));
       if (pred_mode == cur_mode) {
         sodb += Bitstream(true);
@@ -318,10 +464,11 @@ Bitstream Packager::mb_pred(MacroBlock& mb, Frame& frame) {
   return sodb;
 }
 
-Bitstream Packager::slice_header(const int _frame_num) {
+Bitstream Packager::slice_header(const int _frame_num, const int first_mb, const DeblockingParams& deblocking,
+                                  const int slice_qp) {
   Bitstream sodb;
 
-  unsigned int first_mb_in_slice = 0;  // ue(v)
+  unsigned int first_mb_in_slice = first_mb;  // ue(v)
   unsigned int slice_type = 2; // ue(v)
   unsigned int pic_parameter_set_id = 0; // ue(v)
   unsigned int frame_num = 0;  // u(v)
@@ -329,8 +476,10 @@ Bitstream Packager::slice_header(const int _frame_num) {
   unsigned int pic_order_cnt_lsb = _frame_num;  // u(v)
   bool no_output_of_prior_pics_flag = true; // u(1)
   bool long_term_reference_flag = false; // u(1)
-  int slice_qp_delta = 0;  // se(v)
-  unsigned int disable_deblocking_filter_idc = 1; // ue(v)
+  int slice_qp_delta = slice_qp - pic_init_qp();  // se(v)
+  unsigned int disable_deblocking_filter_idc = deblocking.disable_idc; // ue(v)
+  int slice_alpha_c0_offset_div2 = deblocking.alpha_offset_div2; // se(v)
+  int slice_beta_offset_div2 = deblocking.beta_offset_div2; // se(v)
 
   sodb += uegc(first_mb_in_slice); 
   sodb += uegc(slice_type);
@@ -342,6 +491,10 @@ Bitstream Packager::slice_header(const int _frame_num) {
   sodb += Bitstream(long_term_reference_flag);
   sodb += segc(slice_qp_delta); 
   sodb += uegc(disable_deblocking_filter_idc);
+  if (disable_deblocking_filter_idc != 1) {
+    sodb += segc(slice_alpha_c0_offset_div2);
+    sodb += segc(slice_beta_offset_div2);
+  }
 
   return sodb;
 }
\ No newline at end of file
@@ -1,24 +1,89 @@
 #include "prediction.h"
+#include "arena.h"
 #include <chrono>
 
 using namespace std::chrono;
 ofstream trf_file("txt/trf_time.txt", ios::app);
 
+//////////////////////////////// PRESETS //////////////////////////////
+
+// name, search (cost, plane, directional4x4, stop4x4), intra4x4, skip4x4, directions4x4, flat16x16
+static const EncoderPreset presets[NB_ENCODER_PRESETS] = {
+  {"ultrafast", IntraSearch{IntraCost::SAD,  false, false, 0},  false, 0, 0, 0},
+  {"superfast", IntraSearch{IntraCost::SAD,  true,  false, 0},  false, 0, 0, 0},
+  {"veryfast",  IntraSearch{IntraCost::SAD,  true,  false, 0},  true,  512, 0, 1024},
+  {"faster",    IntraSearch{IntraCost::SAD,  true,  true,  16}, true,  256, 0, 1024},
+  {"fast",      IntraSearch{IntraCost::SATD, true,  true,  16}, true,  256, 3, 1024},
+  {"medium",    IntraSearch{IntraCost::SATD, true,  true,  0},  true,  0, 0, 0},
+  {"slow",      IntraSearch{IntraCost::RD,   true,  true,  0},  true,  0, 0, 0}
+};
+
+const EncoderPreset& get_encoder_preset(const int level) {
+  return presets[clip(level, 0, NB_ENCODER_PRESETS - 1)];
+}
+
+int find_encoder_preset(const std::string& name) {
+  for (int level = 0; level < NB_ENCODER_PRESETS; level++) {
+    if (presets[level].name == name)
+      return level;
+  }
+  return -1;
+}
+
 ////////////////////////////// FRAME ////////////////////////////////
 
 
+/*
+*   Estimated size of the residual of a transform bypass MB: about the length of a signed
+*   Exp-Golomb code per non zero sample (the zero samples are mostly in runs)
+*/
+static int lossless_bits(const MacroBlock& mb) {
+  auto bits = [](const int* samples, const int size) {
+    int total = 0;
+    for (int i = 0; i < size; i++) {
+      int level = std::abs(samples[i]);
+      if (level != 0) {
+        total += 3;
+        for (; level > 1; level >>= 1)
+          total += 2;
+      }
+    }
+    return total;
+  };
+  return bits(mb.Y.data(), 256) + bits(mb.Cb.data(), 64) + bits(mb.Cr.data(), 64);
+}
+
 /*
 *   Function to encode all frame (composed by Y, Cr and Cb)
 *
 */
 
-void encode_I_frame(Frame& frame) {
+void encode_I_frame(Frame& frame, const EncoderPreset& frame_preset) {
+
+  // Transform bypass: the residual is coded as is, the SAD of its coded form is the closest estimate
+  // of its size (SATD and RD model the transform and the quantization at LUMA_QP)
+  EncoderPreset preset = frame_preset;
+  if (frame.lossless)
+    preset.search.cost = IntraCost::BYPASS;
+
+  // Above 8 bits the luma costs grow with the sample range: the thresholds of the preset are
+  // scaled along, and RD (8 bit QP and lambda) falls back to SATD
+  const int range_shift = frame.bit_depth - 8;
+  if (range_shift > 0) {
+    if (preset.search.cost == IntraCost::RD)
+      preset.search.cost = IntraCost::SATD;
+    preset.search.stop4x4 <<= range_shift;
+    preset.skip4x4 <<= range_shift;
+    preset.flat16x16 <<= range_shift;
+  }
 
   //int cnt16x16 = 0, cnt4x4 = 0;
   // decoded Y blocks for intra prediction
 
  
-  std::vector<MacroBlock> decoded_blocks;
+  // Reconstruction, built in the frame (a recycled frame keeps the capacity)
+  std::vector<MacroBlock>& decoded_blocks = frame.decoded_mbs;
+  decoded_blocks.clear();
   decoded_blocks.reserve(frame.mbs.size());
 
   /////////////////////////////// TESTS /////////////////////////////////
@@ -33,14 +98,21 @@ void encode_I_frame(Frame& frame) {
   // cout << "Number of Macroblocks:" << frame.mbs.size() << endl;
   ///////////////////////////////////////////////////////////////////////
 
+  // Gradient pre-analysis of the source MBs: the 4x4 search only tries the likely directions,
+  // flat MBs are coded 16x16 without trying 4x4
+  std::vector<GradientAnalysis, ArenaAllocator<GradientAnalysis>> gradients;
+  if (preset.intra4x4 && (preset.directions4x4 > 0 || preset.flat16x16 > 0)) {
+    gradients.resize(frame.mbs.size());
+    for (std::size_t i = 0; i < frame.mbs.size(); i++)
+      analyze_gradients(frame.mbs[i].Y, preset.directions4x4, gradients[i]);
+  }
+
   // Loops through all MB
   for (auto& mb : frame.mbs) {
 
     MacroBlock origin_block = mb;
 
     decoded_blocks.push_back(mb);   // vector to reconstruct macroblocks
-    if(mb.mb_index < ((int)frame.mbs.size() - 1))
-      decoded_blocks.push_back(*(&mb + 1));   // next mb to predict UR (except for the last one)
 
   /////////////////////////////// TESTS /////////////////////////////////
     // Print all 703 Macroblock Y (16x16) component to 'mb_Y_input.txt' 
@@ -57,11 +129,7 @@ void encode_I_frame(Frame& frame) {
   /////////////////////////////////////////////////////////////////////
 
     // Encode Luma component, output is in 'mb.Y vector'
-    int error_luma = encode_Y_block(mb, decoded_blocks, frame);
-
-    // Pop aditional mb
-    if(mb.mb_index < ((int)frame.mbs.size() - 1))
-      decoded_blocks.pop_back();
+    int error_luma = encode_Y_block(mb, decoded_blocks, frame, preset, gradients.empty() ? nullptr : &gradients[mb.mb_index]);
 
     //////////////////////////////// TESTS /////////////////////////////////
     // Print all Macroblock Y (16x16) component after prediction, transform and quantization to 'mb_Y_output.txt' 
@@ -113,7 +181,7 @@ void encode_I_frame(Frame& frame) {
     ////////////////////////////////////////////////////////////////////////
 
     // Encoding Chroma component function
-    int error_chroma = encode_CbCr_block(mb, decoded_blocks, frame);
+    int error_chroma = encode_CbCr_block(mb, decoded_blocks, frame, preset.search);
 
     //////////////////////////////// TESTS /////////////////////////////////
     // Print all 703 Macroblock Cb (8x8) component after prediction, transform and quantization to 'mb_Cb_output.txt' 
@@ -152,8 +220,11 @@ void encode_I_frame(Frame& frame) {
     // error_file << "CbCr = " << error_chroma << endl;
     ////////////////////////////////////////////////////////////////////////
 
-    // Defined threshold for bad predictions, if SAD is greater MB remains the same
-    if (error_luma > 2000 || error_chroma > 1000) {
+    // Defined threshold for bad predictions, if SAD is greater MB remains the same. Lossless: the
+    // large residuals of the range edges are still cheaper than the samples, only their size decides
+    bool pcm = frame.lossless ? (lossless_bits(mb) > 384 * frame.bit_depth)
+                              : ((error_luma >> range_shift) > 2000 || (error_chroma >> range_shift) > 1000);
+    if (pcm) {
       mb = origin_block;
       decoded_blocks.back() = origin_block;
       mb.is_I_PCM = true;   // not predicted
@@ -165,30 +236,45 @@ void encode_I_frame(Frame& frame) {
   // std::cout << "Total MBs 16x16: " << cnt16x16 << endl;
   // std::cout << "Total MBs 4x4: " << cnt4x4 << endl;
 
-  // in-loop deblocking filter                         ====== NECESSARY ??? =====
-  // deblocking_filter(decoded_blocks, frame);
+  // In-loop deblocking filter: the decoder outputs the filtered picture, the intra prediction
+  // above works on the unfiltered samples
+  deblocking_filter(decoded_blocks, frame);
 }
 
 /*
-*   Function to encode 16x16 Y block, comparing 4x4 and 16x16 prediction errors
+*   Function to encode 16x16 Y block, comparing 4x4 and 16x16 prediction costs (when the
+*   preset evaluates 4x4). Returns the SAD of the chosen prediction
+*   'gradients': pre-analysis of the MB, nullptr to try all the 4x4 modes
 *
 */
-int encode_Y_block(MacroBlock& mb, std::vector<MacroBlock>& decoded_blocks, Frame& frame) {
+int encode_Y_block(MacroBlock& mb, std::vector<MacroBlock>& decoded_blocks, Frame& frame, const EncoderPreset& preset,
+                   const GradientAnalysis* gradients) {
+
+  if (!preset.intra4x4 || (gradients && gradients->energy < preset.flat16x16))
+    return encode_Y_intra16x16_block(mb, decoded_blocks, frame, preset.search).sad;
 
   // Temp marcoblock for choosing two predicitons
   MacroBlock temp_block = mb;
   MacroBlock temp_decoded_block = mb;
 
   // Perform intra16x16 prediction
-  int error_intra16x16 = encode_Y_intra16x16_block(mb, decoded_blocks, frame);
-
-  // Perform intra4x4 prediction
-  int error_intra4x4 = 0;
-  for (int i = 0; i < 16; i++)
-    error_intra4x4 += encode_Y_intra4x4_block(i, temp_block, temp_decoded_block, decoded_blocks, frame);
+  IntraChoice<Intra16x16Mode> intra16x16 = encode_Y_intra16x16_block(mb, decoded_blocks, frame, preset.search);
+
+  // Flat MB, 4x4 is not worth trying
+  if (intra16x16.cost < preset.skip4x4)
+    return intra16x16.sad;
+
+  // Perform intra4x4 prediction, abandoned as soon as it costs more than 16x16
+  int cost_intra4x4 = 0, error_intra4x4 = 0;
+  for (int i = 0; i < 16 && cost_intra4x4 < intra16x16.cost; i++) {
+    Intra4x4Modes modes = gradients ? gradients->modes[MacroBlock::convert_table[i]] : ALL_INTRA4X4_MODES;
+    IntraChoice<Intra4x4Mode> intra4x4 = encode_Y_intra4x4_block(i, temp_block, temp_decoded_block, decoded_blocks, frame, preset.search, modes);
+    cost_intra4x4 += intra4x4.cost;
+    error_intra4x4 += intra4x4.sad;
+  }
 
-  // compare the error of two predictions
-  if (false && error_intra4x4 < error_intra16x16){
+  // compare the cost of two predictions
+  if (cost_intra4x4 < intra16x16.cost){
     mb = temp_block;
     decoded_blocks.at(mb.mb_index) = temp_decoded_block;
 
@@ -196,7 +282,7 @@ int encode_Y_block(MacroBlock& mb, std::vector<MacroBlock>& decoded_blocks, Fram
   }
   else 
   {
-    return error_intra16x16;
+    return intra16x16.sad;
   }
 }
 
@@ -207,35 +293,34 @@ int encode_Y_block(MacroBlock& mb, std::vector<MacroBlock>& decoded_blocks, Fram
 *   Function to apply 16x16 prediction and get the error
 *
 */
-int encode_Y_intra16x16_block(MacroBlock& mb, std::vector<MacroBlock>& decoded_blocks, Frame& frame) {
+IntraChoice<Intra16x16Mode> encode_Y_intra16x16_block(MacroBlock& mb, std::vector<MacroBlock>& decoded_blocks, Frame& frame, const IntraSearch& search) {
 /*============================================== TESTING ============================================*/
   // ofstream pred_file ("txt/16x16_Y_pred_mode.txt", ios::app);
   // ofstream residual_16x16_file ("txt/16x16_Y_residual.txt", ios::app);
 /*===================================================================================================*/
 
-  // Get neighbours MBs pointers (ul, u, l)
-  auto get_decoded_Y_block = [&](int direction) {
-    int index = frame.get_neighbor_index(mb.mb_index, direction);   // works well
-    if (index == -1)
-      return std::experimental::optional<std::reference_wrapper<Block16x16>>(); // If there is no neighbours it doesnt return initialized mb
-    else
-      return std::experimental::optional<std::reference_wrapper<Block16x16>>(decoded_blocks.at(index).Y);
+  // Decoded neighbour MBs (ul, u, l), the current MB stands in for the unavailable ones (not read)
+  const MBNeighbors& neighbors = frame.get_neighbors(mb.mb_index);
+  auto get_decoded_Y_block = [&](int direction) -> const Block16x16& {
+    int index = neighbors.index[direction];
+    return (index == -1) ? mb.Y : decoded_blocks.at(index).Y;
   };
 
-  // Apply intra prediction
-  int error;
-  Intra16x16Mode mode;
+  // Source samples, the prediction is source - residual
+  Block16x16 pred = mb.Y;
 
+  // Apply intra prediction
   //Inputs Y mb and neighbours obtained from above function
-  std::tie(error, mode) = intra16x16(mb.Y, get_decoded_Y_block(MB_NEIGHBOR_UL),
-                                           get_decoded_Y_block(MB_NEIGHBOR_U),
-                                           get_decoded_Y_block(MB_NEIGHBOR_L));
+  IntraChoice<Intra16x16Mode> choice = intra16x16(mb.Y, search, neighbors.available,
+                                                  get_decoded_Y_block(MB_NEIGHBOR_UL),
+                                                  get_decoded_Y_block(MB_NEIGHBOR_U),
+                                                  get_decoded_Y_block(MB_NEIGHBOR_L), frame.bit_depth);
 
   // Sets 16x16 prediction flag
   mb.is_intra16x16 = true;
 
   // Sets 16x16 mode
-  mb.intra16x16_Y_mode = mode;
+  mb.intra16x16_Y_mode = choice.mode;
 
 /*============================================== TESTING ============================================*/
   // Print prediction mode to 'pred_mode.txt'
@@ -259,13 +344,31 @@ int encode_Y_intra16x16_block(MacroBlock& mb, std::vector<MacroBlock>& decoded_b
 
   
   auto start_0 = high_resolution_clock::now(); 
-  qdct_luma16x16_intra(mb.Y);
+  for (int i = 0; i < 256; i++)
+    pred[i] -= mb.Y[i];
+  if (!frame.lossless)
+    qdct_luma16x16_intra(mb.Y, frame.get_luma_qp());
   auto stop_0 = high_resolution_clock::now();
   auto duration_0 = duration_cast<microseconds>(stop_0 - start_0);
   trf_file << duration_0.count() << endl;  
   
+  // Reconstruct as the decoder does, neighbours are predicted from the decoded samples
+  Block16x16& decoded = decoded_blocks.at(mb.mb_index).Y;
+  if (frame.lossless) {
+    // Transform bypass: the reconstruction is the source, the residual is coded as is
+    for (int i = 0; i < 256; i++)
+      decoded[i] = pred[i] + mb.Y[i];
+    if (choice.mode == Intra16x16Mode::VERTICAL || choice.mode == Intra16x16Mode::HORIZONTAL)
+      forward_bypass_dpcm(BlockView<16, 16>(mb.Y.data(), 16), choice.mode == Intra16x16Mode::HORIZONTAL);
+    return choice;
+  }
+  const int max_sample = (1 << frame.bit_depth) - 1;
+  decoded = mb.Y;
+  iqdct_luma16x16_intra(decoded, frame.get_luma_qp());
+  for (int i = 0; i < 256; i++)
+    decoded[i] = clip(pred[i] + decoded[i], 0, max_sample);
 
-  return error;
+  return choice;
 }
 
 
@@ -274,7 +377,8 @@ int encode_Y_intra16x16_block(MacroBlock& mb, std::vector<MacroBlock>& decoded_b
 *   Function to apply 4x4 prediction and get the error
 *
 */
-int encode_Y_intra4x4_block(int cur_pos, MacroBlock& mb, MacroBlock& decoded_block, std::vector<MacroBlock>& decoded_blocks, Frame& frame) {
+IntraChoice<Intra4x4Mode> encode_Y_intra4x4_block(int cur_pos, MacroBlock& mb, MacroBlock& decoded_block, std::vector<MacroBlock>& decoded_blocks,
+                                                  Frame& frame, const IntraSearch& search, const Intra4x4Modes modes) {
 /*============================================== TESTING ============================================*/
   // ofstream pred_file ("txt/4x4_Y_pred_mode.txt", ios::app);
   // ofstream residual_4x4_file ("txt/4x4_Y_residual.txt", ios::app);
@@ -283,109 +387,109 @@ int encode_Y_intra4x4_block(int cur_pos, MacroBlock& mb, MacroBlock& decoded_blo
   // Convert input position (see macroblock.cpp)
   int temp_pos = MacroBlock::convert_table[cur_pos];    // is this necessary? Two times?
 
+  const MBNeighbors& neighbors = frame.get_neighbors(mb.mb_index);
+  std::uint8_t available = 0;   // AVAILABLE_* bits of the neighbouring 4x4 blocks
+
+  // Source samples of the current block are still in 'decoded_block'
+  Block4x4 decoded = decoded_block.get_Y_4x4_block(cur_pos);
+  Block4x4 residual = mb.get_Y_4x4_block(cur_pos);
+
   /**
-   * Returns the 4x4 Block of the MB referred by 'index', at the position referred by 'pos'
+   * Returns the 4x4 Block of the MB referred by 'index', at the position referred by 'pos', and
+   * sets 'bit' in 'available'. The current block stands in for an unavailable one (not read).
    */
-  auto get_4x4_block = [&](int index, int pos) {
+  auto get_4x4_block = [&](int index, int pos, std::uint8_t bit) {
     if (index == -1)
-      return std::experimental::optional<Block4x4>();
-    else if (index == mb.mb_index)
-      return std::experimental::optional<Block4x4>(decoded_block.get_Y_4x4_block(pos));
-    else{
-      return std::experimental::optional<Block4x4>(decoded_blocks.at(index).get_Y_4x4_block(pos));
-      // return std::experimental::optional<Block4x4>(frame.mbs.at(index).get_Y_4x4_block(pos));
-    }
+      return decoded;
+    available |= bit;
+    if (index == mb.mb_index)
+      return decoded_block.get_Y_4x4_block(pos);
+    return decoded_blocks.at(index).get_Y_4x4_block(pos);
   };
 
   // Gets upper left 4x4 block
   auto get_UL_4x4_block = [&]() {
     int index, pos;
     if (temp_pos == 0) {    // temp_pos or cur_pos?
-      index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_UL);  // get external UL MB index
+      index = neighbors.index[MB_NEIGHBOR_UL];  // get external UL MB index
       pos = 15;
     } else if (1 <= temp_pos && temp_pos <= 3) {
-      index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_U);   // get external U MB index
+      index = neighbors.index[MB_NEIGHBOR_U];   // get external U MB index
       pos = 11 + temp_pos;
     } else if (temp_pos % 4 == 0) {
-      index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_L);   // get external L MB index
+      index = neighbors.index[MB_NEIGHBOR_L];   // get external L MB index
       pos = temp_pos - 1;
     } else {
       index = mb.mb_index;
       pos = temp_pos - 5;
     }
 
-    return get_4x4_block(index, MacroBlock::convert_table[pos]);
+    return get_4x4_block(index, MacroBlock::convert_table[pos], AVAILABLE_UL);
   };
 
   // Gets upper 4x4 block
   auto get_U_4x4_block = [&]() {
     int index, pos;
     if (0 <= temp_pos && temp_pos <= 3) {   // upper 4 pixels
-      index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_U);
+      index = neighbors.index[MB_NEIGHBOR_U];
       pos = 12 + temp_pos;
     } else {
       index = mb.mb_index;
       pos = temp_pos - 4;
     }
 
-    return get_4x4_block(index, MacroBlock::convert_table[pos]);
+    return get_4x4_block(index, MacroBlock::convert_table[pos], AVAILABLE_U);
   };
 
-  // Gets upper right 4x4 block (SOMETHING IS NOT CORRECT HERE)
+  // Gets upper right 4x4 block, unavailable when it is decoded after the current one
+  // (right column and positions 5, 13 of the MB, see standard 6.4.11.4)
   auto get_UR_4x4_block = [&]() {
     int index, pos;
     if (temp_pos == 3) {
-      index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_UR);
+      index = neighbors.index[MB_NEIGHBOR_UR];
       pos = 12;
     } 
-    // else if (temp_pos == 5 || temp_pos == 13) {    MODIFIED
-    //   index = -1;
-    //   pos = 0;
-    // } 
     else if (0 <= temp_pos && temp_pos <= 2) {
-      index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_U);
-      // pos = 1 + temp_pos;    MODIFIED
+      index = neighbors.index[MB_NEIGHBOR_U];
       pos = 13 + temp_pos;
-    } else if ((temp_pos + 1) % 4 == 0) {
-      // index = -1;    MODIFIED
-      // pos = 0;
-      index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_R);
-      pos = temp_pos - 7;
+    } else if ((temp_pos + 1) % 4 == 0 || MacroBlock::convert_table[temp_pos - 3] > cur_pos) {
+      index = -1;
+      pos = 0;
     } else {
       index = mb.mb_index;
       pos = temp_pos - 3;
     }
 
-    return get_4x4_block(index, MacroBlock::convert_table[pos]);
+    return get_4x4_block(index, MacroBlock::convert_table[pos], AVAILABLE_UR);
   };
 
   // Gets left 4x4 block
   auto get_L_4x4_block = [&]() {
     int index, pos;
     if (temp_pos % 4 == 0) {    // first column at the left
-      index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_L);
+      index = neighbors.index[MB_NEIGHBOR_L];
       pos = temp_pos + 3;
     } else {
       index = mb.mb_index;
       pos = temp_pos - 1;
     }
 
-    return get_4x4_block(index, MacroBlock::convert_table[pos]);
+    return get_4x4_block(index, MacroBlock::convert_table[pos], AVAILABLE_L);
   };
 
-  int error = 0;
-  Intra4x4Mode mode;
-  std::tie(error, mode) = intra4x4(mb.get_Y_4x4_block(cur_pos),
-                                   get_UL_4x4_block(),
-                                   get_U_4x4_block(),
-                                   get_UR_4x4_block(),
-                                   get_L_4x4_block());
+  Block4x4 ul = get_UL_4x4_block();
+  Block4x4 u = get_U_4x4_block();
+  Block4x4 ur = get_UR_4x4_block();
+  Block4x4 l = get_L_4x4_block();
+
+  IntraChoice<Intra4x4Mode> choice = intra4x4(mb.get_Y_4x4_block(cur_pos), search, modes, available, ul, u, ur, l,
+                                              frame.bit_depth);
 
   // Print prediction mode to 'pred_mode.txt'
   //pred_file << "MB " << mb.mb_index << " (" << cur_pos << ") ->" << (int)mode << endl;
 
   mb.is_intra16x16 = false;
-  mb.intra4x4_Y_mode.at(cur_pos) = mode;
+  mb.intra4x4_Y_mode.at(cur_pos) = choice.mode;
 
 /*============================================== TESTING ============================================*/
   // Print residual 4x4 to "4x4_Y_residual.txt"  -> Tests
@@ -406,15 +510,33 @@ int encode_Y_intra4x4_block(int cur_pos, MacroBlock& mb, MacroBlock& decoded_blo
   // Perform QDCT
   
   auto start_1 = high_resolution_clock::now(); 
-  qdct_luma4x4_intra(mb.get_Y_4x4_block(cur_pos));
+  CopyBlock4x4 pred;
+  for (int y = 0; y < 4; y++)
+    for (int x = 0; x < 4; x++)
+      pred[y*4 + x] = decoded(y, x) - residual(y, x);
+  if (!frame.lossless)
+    qdct_luma4x4_intra(residual, frame.get_luma_qp());
   auto stop_1 = high_resolution_clock::now();
   auto duration_1 = duration_cast<microseconds>(stop_1 - start_1);
   trf_file << duration_1.count() << endl;  
   
+  // Transform bypass: 'decoded' keeps the source samples
+  if (frame.lossless) {
+    if (choice.mode == Intra4x4Mode::VERTICAL || choice.mode == Intra4x4Mode::HORIZONTAL)
+      forward_bypass_dpcm(residual, choice.mode == Intra4x4Mode::HORIZONTAL);
+    return choice;
+  }
 
-  // Reconstruct for later prediction     NECESSARY ???
+  // Reconstruct for later prediction (next 4x4 blocks and MBs)
+  const int max_sample = (1 << frame.bit_depth) - 1;
+  for (int y = 0; y < 4; y++)
+    std::copy_n(residual.row(y), 4, decoded.row(y));
+  iqdct_luma4x4_intra(decoded, frame.get_luma_qp());
+  for (int y = 0; y < 4; y++)
+    for (int x = 0; x < 4; x++)
+      decoded(y, x) = clip(pred[y*4 + x] + decoded(y, x), 0, max_sample);
 
-  return error;
+  return choice;
 }
 
 //////////////////////////////////////////////// 8X8 ////////////////////////////////////////////////7
@@ -423,9 +545,9 @@ int encode_Y_intra4x4_block(int cur_pos, MacroBlock& mb, MacroBlock& decoded_blo
 *   Function to encode 8x8 Cr and Cb blocks
 *
 */
-int encode_CbCr_block(MacroBlock& mb, std::vector<MacroBlock>& decoded_blocks, Frame& frame) {
+int encode_CbCr_block(MacroBlock& mb, std::vector<MacroBlock>& decoded_blocks, Frame& frame, const IntraSearch& search) {
   
-  int error_intra8x8 = encode_CbCr_intra8x8_block(mb, decoded_blocks, frame);
+  int error_intra8x8 = encode_CbCr_intra8x8_block(mb, decoded_blocks, frame, search);
  
   return error_intra8x8;
 }
@@ -434,39 +556,38 @@ int encode_CbCr_block(MacroBlock& mb, std::vector<MacroBlock>& decoded_blocks, F
 *   Function to apply 8x8 prediction and get the error
 *
 */
-int encode_CbCr_intra8x8_block(MacroBlock& mb, std::vector<MacroBlock>& decoded_blocks, Frame& frame) {
+int encode_CbCr_intra8x8_block(MacroBlock& mb, std::vector<MacroBlock>& decoded_blocks, Frame& frame, const IntraSearch& search) {
 /*============================================== TESTING ============================================*/
   // ofstream pred_file ("txt/8x8_CbCr_pred_mode.txt", ios::app);
   // ofstream residual_Cb_file ("txt/Cb_residual.txt", ios::app);
   // ofstream residual_Cr_file ("txt/Cr_residual.txt", ios::app);
 /*===================================================================================================*/
 
-  auto get_decoded_Cr_block = [&](int direction) {
-    int index = frame.get_neighbor_index(mb.mb_index, direction);
-    if (index == -1)
-      return std::experimental::optional<std::reference_wrapper<Block8x8>>();
-    else
-      return std::experimental::optional<std::reference_wrapper<Block8x8>>(decoded_blocks.at(index).Cr);
+  // Decoded neighbour MBs, the current MB stands in for the unavailable ones (not read)
+  const MBNeighbors& neighbors = frame.get_neighbors(mb.mb_index);
+  auto get_decoded_Cr_block = [&](int direction) -> const Block8x8& {
+    int index = neighbors.index[direction];
+    return (index == -1) ? mb.Cr : decoded_blocks.at(index).Cr;
   };
 
-  auto get_decoded_Cb_block = [&](int direction) {
-    int index = frame.get_neighbor_index(mb.mb_index, direction);
-    if (index == -1)
-      return std::experimental::optional<std::reference_wrapper<Block8x8>>();
-    else
-      return std::experimental::optional<std::reference_wrapper<Block8x8>>(decoded_blocks.at(index).Cb);
+  auto get_decoded_Cb_block = [&](int direction) -> const Block8x8& {
+    int index = neighbors.index[direction];
+    return (index == -1) ? mb.Cb : decoded_blocks.at(index).Cb;
   };
 
-  int error;
-  IntraChromaMode mode;
-  std::tie(error, mode) = intra8x8_chroma(mb.Cr, get_decoded_Cr_block(MB_NEIGHBOR_UL),
-                                                 get_decoded_Cr_block(MB_NEIGHBOR_U),
-                                                 get_decoded_Cr_block(MB_NEIGHBOR_L),
-                                          mb.Cb, get_decoded_Cb_block(MB_NEIGHBOR_UL),
-                                                 get_decoded_Cb_block(MB_NEIGHBOR_U),
-                                                 get_decoded_Cb_block(MB_NEIGHBOR_L));
+  // Source samples, the prediction is source - residual
+  Block8x8 pred_Cr = mb.Cr;
+  Block8x8 pred_Cb = mb.Cb;
+
+  IntraChoice<IntraChromaMode> choice = intra8x8_chroma(search, neighbors.available,
+                                                        mb.Cr, get_decoded_Cr_block(MB_NEIGHBOR_UL),
+                                                               get_decoded_Cr_block(MB_NEIGHBOR_U),
+                                                               get_decoded_Cr_block(MB_NEIGHBOR_L),
+                                                        mb.Cb, get_decoded_Cb_block(MB_NEIGHBOR_UL),
+                                                               get_decoded_Cb_block(MB_NEIGHBOR_U),
+                                                               get_decoded_Cb_block(MB_NEIGHBOR_L), frame.bit_depth);
 
-  mb.intra_Cr_Cb_mode = mode;
+  mb.intra_Cr_Cb_mode = choice.mode;
 
 /*============================================== TESTING ============================================*/
   // Print selected mode to '8x8_CbCr_pred_mode.txt' (must be the same for both)
@@ -502,14 +623,99 @@ int encode_CbCr_intra8x8_block(MacroBlock& mb, std::vector<MacroBlock>& decoded_
   // Perform QDCT (Cr and Cb components)
  
   auto start_2 = high_resolution_clock::now(); 
-  qdct_chroma8x8_intra(mb.Cr);
-  qdct_chroma8x8_intra(mb.Cb);
+  for (int i = 0; i < 64; i++) {
+    pred_Cr[i] -= mb.Cr[i];
+    pred_Cb[i] -= mb.Cb[i];
+  }
+  if (!frame.lossless) {
+    qdct_chroma8x8_intra(mb.Cr, frame.get_chroma_qp());
+    qdct_chroma8x8_intra(mb.Cb, frame.get_chroma_qp());
+  }
   auto stop_2 = high_resolution_clock::now();
   auto duration_2 = duration_cast<microseconds>(stop_2 - start_2);
   trf_file << duration_2.count() << endl;  
  
+  // Reconstruct for later prediction
+  MacroBlock& decoded = decoded_blocks.at(mb.mb_index);
+  if (frame.lossless) {
+    // Transform bypass: the reconstruction is the source, the residual is coded as is
+    for (int i = 0; i < 64; i++) {
+      decoded.Cr[i] = pred_Cr[i] + mb.Cr[i];
+      decoded.Cb[i] = pred_Cb[i] + mb.Cb[i];
+    }
+    if (choice.mode == IntraChromaMode::VERTICAL || choice.mode == IntraChromaMode::HORIZONTAL) {
+      forward_bypass_dpcm(BlockView<8, 8>(mb.Cr.data(), 8), choice.mode == IntraChromaMode::HORIZONTAL);
+      forward_bypass_dpcm(BlockView<8, 8>(mb.Cb.data(), 8), choice.mode == IntraChromaMode::HORIZONTAL);
+    }
+    return choice.sad;
+  }
+  decoded.Cr = mb.Cr;
+  decoded.Cb = mb.Cb;
+  iqdct_chroma8x8_intra(decoded.Cr, frame.get_chroma_qp());
+  iqdct_chroma8x8_intra(decoded.Cb, frame.get_chroma_qp());
+  const int max_sample = (1 << frame.bit_depth) - 1;
+  for (int i = 0; i < 64; i++) {
+    decoded.Cr[i] = clip(pred_Cr[i] + decoded.Cr[i], 0, max_sample);
+    decoded.Cb[i] = clip(pred_Cb[i] + decoded.Cb[i], 0, max_sample);
+  }
   
 
-  return error;
+  return choice.sad;
 }
 
+//////////////////////////////////////////// DEBLOCKING //////////////////////////////////////////////
+
+/*
+*   Function to apply the loop filter of the slice headers to the reconstructed MBs
+*
+*   The MBs are copied to planes for the filter (see deblocking.h), then back. The planes are
+*   16 bit, for every bit depth.
+*/
+void deblocking_filter(std::vector<MacroBlock>& decoded_blocks, const Frame& frame) {
+  bool enabled = false;
+  for (int slice = 0; slice < frame.get_nb_slices(); slice++)
+    enabled |= (frame.get_deblocking(slice).disable_idc != 1);
+  if (!enabled || decoded_blocks.size() != frame.mbs.size())
+    return;
+
+  const int luma_stride = frame.nb_mb_cols * 16;
+  const int chroma_stride = frame.nb_mb_cols * 8;
+  std::vector<std::uint16_t, ArenaAllocator<std::uint16_t>> Y(luma_stride * frame.nb_mb_rows * 16);
+  std::vector<std::uint16_t, ArenaAllocator<std::uint16_t>> Cb(Y.size() / 4), Cr(Y.size() / 4);
+  std::vector<int, ArenaAllocator<int>> qp(decoded_blocks.size());
+
+  for (const auto& mb : decoded_blocks) {
+    // I_PCM: QP'Y 0, as the reference decoder filters it (QP_Y 0 in the text of 8.7.2.2, the same at 8 bits)
+    qp[mb.mb_index] = frame.mbs[mb.mb_index].is_I_PCM ? -frame.get_qp_offset() : frame.get_qp();
+    std::uint16_t* y = &Y[mb.mb_row * 16 * luma_stride + mb.mb_col * 16];
+    for (int i = 0; i < 16; i++)
+      for (int j = 0; j < 16; j++)
+        y[i * luma_stride + j] = mb.Y[(i<<4) + j];
+
+    int offset = mb.mb_row * 8 * chroma_stride + mb.mb_col * 8;
+    for (int i = 0; i < 8; i++)
+      for (int j = 0; j < 8; j++) {
+        Cb[offset + i * chroma_stride + j] = mb.Cb[(i<<3) + j];
+        Cr[offset + i * chroma_stride + j] = mb.Cr[(i<<3) + j];
+      }
+  }
+
+  DeblockingPicture picture = {nullptr, nullptr, nullptr, Y.data(), Cb.data(), Cr.data(), frame.bit_depth,
+                               frame.nb_mb_cols, frame.nb_mb_rows, qp.data(),
+                               frame.slice_map.empty() ? nullptr : frame.slice_map.data()};
+  deblock_picture(picture, frame.slice_deblocking, CHROMA_QP_INDEX_OFFSET);
+
+  for (auto& mb : decoded_blocks) {
+    const std::uint16_t* y = &Y[mb.mb_row * 16 * luma_stride + mb.mb_col * 16];
+    for (int i = 0; i < 16; i++)
+      for (int j = 0; j < 16; j++)
+        mb.Y[(i<<4) + j] = y[i * luma_stride + j];
+
+    int offset = mb.mb_row * 8 * chroma_stride + mb.mb_col * 8;
+    for (int i = 0; i < 8; i++)
+      for (int j = 0; j < 8; j++) {
+        mb.Cb[(i<<3) + j] = Cb[offset + i * chroma_stride + j];
+        mb.Cr[(i<<3) + j] = Cr[offset + i * chroma_stride + j];
+      }
+  }
+}
@@ -0,0 +1,438 @@
+#include "projection.h"
+
+#include <cstring>
+#include <limits>
+
+bool ProjectionConfig::operator==(const ProjectionConfig& other) const {
+  return angular_resolution_x == other.angular_resolution_x && angular_resolution_y == other.angular_resolution_y &&
+         max_angle_width == other.max_angle_width && max_angle_height == other.max_angle_height &&
+         min_range == other.min_range && max_range == other.max_range && bit_depth == other.bit_depth;
+}
+
+namespace {
+
+/* Padding of the luma plane (BORDER_REPLICATE) and constant chroma (no colour information, half the
+ * range) of the encoder input, the samples are 8 bit at 8 bits and 16 bit above
+ */
+template <typename Sample>
+void pad_I420(Sample* Y, const int width, const int height, const int padded_width, const int padded_height,
+              const int bit_depth) {
+  for (int i = 0; i < height; i++) {
+    Sample* dst = Y + i * padded_width;
+    std::fill_n(dst + width, padded_width - width, dst[width-1]);
+  }
+  for (int i = height; i < padded_height; i++)
+    std::copy_n(Y + (height-1) * padded_width, padded_width, Y + i * padded_width);
+  std::fill_n(Y + padded_width * padded_height, padded_width * padded_height / 2, Sample(1 << (bit_depth - 1)));
+}
+
+template <typename Sample>
+void quantize_ranges(const float* ranges, const int width, const int height, const ProjectionConfig& config, cv::Mat& yuv) {
+  const int padded_width = yuv.cols;
+  Sample* Y = reinterpret_cast<Sample*>(yuv.data);
+
+  for (int i = 0; i < height; i++) {
+    const float* src = ranges + i * width;
+    Sample* dst = Y + i * padded_width;
+    for (int j = 0; j < width; j++)
+      dst[j] = range_to_sample(src[j], config);
+  }
+  pad_I420(Y, width, height, padded_width, yuv.rows * 2 / 3, config.bit_depth);
+}
+
+}   // namespace
+
+cv::Mat range_image_to_I420(const float* ranges, const int width, const int height, const ProjectionConfig& config) {
+  int padded_width = (width + 15) & ~15;
+  int padded_height = (height + 15) & ~15;
+
+  cv::Mat yuv(padded_height * 3 / 2, padded_width, (config.bit_depth > 8) ? CV_16UC1 : CV_8UC1);
+  if (config.bit_depth > 8)
+    quantize_ranges<std::uint16_t>(ranges, width, height, config, yuv);
+  else
+    quantize_ranges<std::uint8_t>(ranges, width, height, config, yuv);
+
+  return yuv;
+}
+
+/* Inverse of Reprojector::build_tables: LASER_FRAME maps (x, y, z) to (-y, -z, x) in the range
+ * image system, then
+ *   angle_x = atan2(-y, x), angle_y = asin(-z / range)
+ *   u = (angle_x * cos(angle_y) + pi) / res_x - offset_x
+ *   v = (angle_y + pi/2) / res_y - offset_y
+ * rounded to the nearest pixel, the nearest return wins (z-buffer).
+ */
+size_t project_points(const std::uint8_t* data, const std::uint32_t width, const std::uint32_t height,
+                      const std::uint32_t row_step, const CloudLayout& layout, const ProjectionConfig& config, float* ranges) {
+  int image_width = config.width();
+  int image_height = config.height();
+  int full_width = static_cast<int>(std::lrint(std::floor(2.0f * M_PI / config.angular_resolution_x)));
+  int full_height = static_cast<int>(std::lrint(std::floor(M_PI / config.angular_resolution_y)));
+  float offset_x = (full_width - image_width) / 2;
+  float offset_y = (full_height - image_height) / 2;
+  float scale_x = 1.0f / config.angular_resolution_x;
+  float scale_y = 1.0f / config.angular_resolution_y;
+
+  std::fill(ranges, ranges + image_width * image_height, -std::numeric_limits<float>::infinity());
+  std::size_t n = 0;
+
+  for (std::uint32_t row = 0; row < height; row++) {
+    const std::uint8_t* point = data + row * row_step;
+
+    for (std::uint32_t i = 0; i < width; i++, point += layout.point_step) {
+      float x = layout.x(point), y = layout.y(point), z = layout.z(point);
+      float range = std::sqrt(x*x + y*y + z*z);
+      if (!std::isfinite(range) || range < config.min_range || range == 0.0f)
+        continue;
+
+      float angle_x = std::atan2(-y, x);
+      float angle_y = std::asin(-z / range);
+      int u = static_cast<int>(std::lrint((angle_x * std::cos(angle_y) + M_PI) * scale_x - offset_x));
+      int v = static_cast<int>(std::lrint((angle_y + 0.5f * M_PI) * scale_y - offset_y));
+      if (u < 0 || u >= image_width || v < 0 || v >= image_height)
+        continue;
+
+      float& pixel = ranges[v * image_width + u];
+      if (pixel < 0.0f || range < pixel)    // -inf (no return yet) or farther
+        pixel = range;
+      n++;
+    }
+  }
+
+  return n;
+}
+
+
+namespace {
+
+/* atan2 approximation (minimax polynomial on [0, 1]), |error| < 2e-6 rad, the pixels are 3.5e-3 rad wide
+ * Selects instead of branches, so that the loop calling it vectorizes.
+ */
+inline float fast_atan2(const float y, const float x) {
+  float ax = std::fabs(x), ay = std::fabs(y);
+  float a = std::min(ax, ay) / std::max(std::max(ax, ay), 1e-30f);
+  float s = a * a;
+  float r = a * (0.99997726f + s * (-0.33262347f + s * (0.19354346f + s * (-0.11643287f + s * (0.05265332f + s * -0.01172120f)))));
+  r = (ay > ax) ? float(0.5 * M_PI) - r : r;
+  r = (x < 0.0f) ? float(M_PI) - r : r;
+  return (y < 0.0f) ? -r : r;
+}
+
+
+/* Pixel (position in the luma plane, -1 if none) and sample of every point, see project_points
+ * Separate function: the compiler only trusts __restrict__ on parameters. No control flow in
+ * the loop (& instead of &&, clamping before the conversions, NaN included), so it vectorizes.
+ */
+void bin_points(const float* __restrict__ px, const float* __restrict__ py, const float* __restrict__ pz,
+                const std::size_t nb_points, const int w, const int h, const int padded_width,
+                const float scale_x, const float scale_y, const float centre_x, const float centre_y,
+                const float min_range, const float max_range, const int max_sample,
+                float* __restrict__ pr, std::int32_t* __restrict__ pp, std::uint16_t* __restrict__ ps) {
+  const float inv_step = float(max_sample - 1) / (max_range - min_range);
+
+  for (std::size_t i = 0; i < nb_points; i++) {
+    float horizontal = std::sqrt(px[i] * px[i] + py[i] * py[i]);
+    float r = std::sqrt(horizontal * horizontal + pz[i] * pz[i]);
+    float angle_x = fast_atan2(-py[i], px[i]);
+    float angle_y = fast_atan2(-pz[i], horizontal);
+    float u = angle_x * (horizontal / r) * scale_x + centre_x;   // + 0.5: truncation rounds
+    float v = angle_y * scale_y + centre_y;
+
+    bool valid = (r >= min_range) & (r > 0.0f) & (u >= 0.0f) & (u < w) & (v >= 0.0f) & (v < h);
+    std::int32_t column = static_cast<std::int32_t>(std::min(std::max(0.0f, u), float(w - 1)));
+    std::int32_t line = static_cast<std::int32_t>(std::min(std::max(0.0f, v), float(h - 1)));
+    float level = std::min(std::max(0.0f, r - min_range), max_range - min_range) * inv_step;
+    pr[i] = r;
+    pp[i] = valid ? line * padded_width + column : -1;
+    ps[i] = static_cast<std::uint16_t>(1.5f + level);   // range_to_sample
+  }
+}
+
+/* Z-buffer on the samples: the quantization is monotonic, nearest return = smallest sample > 0.
+ * The image is 8 bit at 8 bits and 16 bit above (see range_image_to_I420).
+ */
+template <typename Sample>
+std::size_t zbuffer(const std::int32_t* pp, const std::uint16_t* ps, const std::size_t nb_points,
+                    const int w, const int h, const int padded_width, const int padded_height, const int bit_depth,
+                    cv::Mat& yuv) {
+  Sample* Y = reinterpret_cast<Sample*>(yuv.data);
+  for (int v = 0; v < h; v++)
+    std::fill_n(Y + v * padded_width, w, Sample(0));
+
+  std::size_t n = 0;
+  for (std::size_t i = 0; i < nb_points; i++) {
+    if (pp[i] < 0)
+      continue;
+    Sample& dst = Y[pp[i]];
+    const Sample sample = static_cast<Sample>(ps[i]);
+    dst = (dst == 0) ? sample : std::min(dst, sample);
+    n++;
+  }
+
+  pad_I420(Y, w, h, padded_width, padded_height, bit_depth);
+  return n;
+}
+
+}   // namespace
+
+SphericalProjector::SphericalProjector(const ProjectionConfig& _config)
+: config(_config)
+{
+  build_constants();
+}
+
+void SphericalProjector::set_config(const ProjectionConfig& _config) {
+  if (_config == config)
+    return;
+  config = _config;
+  build_constants();
+}
+
+// Image position of (angle_x, angle_y), see project_points: u = angle_x * cos(angle_y) * scale_x + centre_x
+void SphericalProjector::build_constants() {
+  image_width = config.width();
+  image_height = config.height();
+
+  int full_width = static_cast<int>(std::lrint(std::floor(2.0f * M_PI / config.angular_resolution_x)));
+  int full_height = static_cast<int>(std::lrint(std::floor(M_PI / config.angular_resolution_y)));
+  scale_x = 1.0f / config.angular_resolution_x;
+  scale_y = 1.0f / config.angular_resolution_y;
+  centre_x = M_PI * scale_x - (full_width - image_width) / 2 + 0.5f;
+  centre_y = 0.5f * M_PI * scale_y - (full_height - image_height) / 2 + 0.5f;
+}
+
+size_t SphericalProjector::project(const std::uint8_t* data, const std::uint32_t width, const std::uint32_t height,
+                                   const std::uint32_t row_step, const CloudLayout& layout, cv::Mat& yuv, float* ranges) {
+  std::size_t nb_points = std::size_t(width) * height;
+  if (x.size() < nb_points) {
+    x.resize(nb_points);
+    y.resize(nb_points);
+    z.resize(nb_points);
+    range.resize(nb_points);
+    pixel.resize(nb_points);
+    sample.resize(nb_points);
+  }
+
+  // 1. Structure of arrays (the fields are interleaved in the message)
+  for (std::uint32_t row = 0, i = 0; row < height; row++) {
+    const std::uint8_t* point = data + row * row_step;
+    for (std::uint32_t col = 0; col < width; col++, i++, point += layout.point_step) {
+      x[i] = layout.x(point);
+      y[i] = layout.y(point);
+      z[i] = layout.z(point);
+    }
+  }
+
+  // 2. Pixel and sample of every point (vectorized)
+  const int w = image_width, h = image_height;
+  const int padded_width = (w + 15) & ~15;
+  const int padded_height = (h + 15) & ~15;
+  bin_points(x.data(), y.data(), z.data(), nb_points, w, h, padded_width, scale_x, scale_y, centre_x, centre_y,
+             config.min_range, config.max_range, config.max_sample(), range.data(), pixel.data(), sample.data());
+
+  // 3. Z-buffer in the luma plane, padding (BORDER_REPLICATE) and constant chroma, as range_image_to_I420
+  const bool wide = config.bit_depth > 8;
+  yuv.create(padded_height * 3 / 2, padded_width, wide ? CV_16UC1 : CV_8UC1);
+  const std::int32_t* pp = pixel.data();
+  const float* pr = range.data();
+  std::size_t n = wide ? zbuffer<std::uint16_t>(pp, sample.data(), nb_points, w, h, padded_width, padded_height, config.bit_depth, yuv)
+                       : zbuffer<std::uint8_t>(pp, sample.data(), nb_points, w, h, padded_width, padded_height, 8, yuv);
+
+  if (ranges) {
+    std::fill(ranges, ranges + w * h, -std::numeric_limits<float>::infinity());
+    for (std::size_t i = 0; i < nb_points; i++) {
+      if (pp[i] < 0)
+        continue;
+      float& dst = ranges[(pp[i] / padded_width) * w + pp[i] % padded_width];
+      if (dst < 0.0f || pr[i] < dst)
+        dst = pr[i];
+    }
+  }
+
+  return n;
+}
+
+
+Reprojector::Reprojector(const ProjectionConfig& _config)
+: config(_config)
+{
+  build_tables();
+}
+
+void Reprojector::set_config(const ProjectionConfig& _config) {
+  if (_config == config && !dir_x.empty())
+    return;
+  config = _config;
+  build_tables();
+}
+
+/* Unit direction of each pixel, same as pcl::RangeImage::calculate3DPoint with range 1
+ *
+ * The range image is centred in the full sphere:
+ *   angle_y = (v + offset_y) * res_y - pi/2
+ *   angle_x = ((u + offset_x) * res_x - pi) / cos(angle_y)
+ * and LASER_FRAME maps the range image system (x right, y down, z forward) to (z, -x, -y).
+ */
+void Reprojector::build_tables() {
+  table_width = config.width();
+  table_height = config.height();
+
+  int full_width = static_cast<int>(std::lrint(std::floor(2.0f * M_PI / config.angular_resolution_x)));
+  int full_height = static_cast<int>(std::lrint(std::floor(M_PI / config.angular_resolution_y)));
+  int offset_x = (full_width - table_width) / 2;
+  int offset_y = (full_height - table_height) / 2;
+
+  dir_x.resize(table_width * table_height);
+  dir_y.resize(table_width * table_height);
+  dir_z.resize(table_width * table_height);
+
+  for (int v = 0; v < table_height; v++) {
+    float angle_y = (v + offset_y) * config.angular_resolution_y - 0.5f * M_PI;
+    float cos_y = std::cos(angle_y);
+    float sin_y = std::sin(angle_y);
+
+    for (int u = 0; u < table_width; u++) {
+      float angle_x = (cos_y == 0.0f) ? 0.0f : ((u + offset_x) * config.angular_resolution_x - M_PI) / cos_y;
+      int index = v * table_width + u;
+      dir_x[index] = std::cos(angle_x) * cos_y;
+      dir_y[index] = -std::sin(angle_x) * cos_y;
+      dir_z[index] = -sin_y;
+    }
+  }
+
+  range_lut.resize(config.max_sample() + 1);
+  for (int sample = 0; sample <= config.max_sample(); sample++)
+    range_lut[sample] = sample_to_range(sample, config);
+}
+
+/**
+ * @brief Reprojects a decoded range plane to 3D points, skipping invalid (0) samples
+ *
+ * The inner loop has no branches (points are always written, the output index only
+ * advances for valid samples) so the compiler vectorizes it (NEON on the ZYBO, SSE on x86).
+ *
+ * @param plane Range samples (decoded luma, 16 bit above 8 bits)
+ * @param stride Distance between rows of 'plane'
+ * @param width, height Size of the window to reproject
+ * @param points Output, resized to fit width * height points
+ * @param offset_x, offset_y Position of the window in the range image
+ *
+ * @return Number of valid points
+ */
+template <typename Sample>
+size_t Reprojector::reproject_points(const Sample* plane, const int stride, const int width, const int height,
+                                     PointBuffer& points, const int offset_x, const int offset_y) const {
+  int w = std::min(width, table_width - offset_x);
+  int h = std::min(height, table_height - offset_y);
+
+  std::size_t capacity = std::max(w, 0) * std::max(h, 0);
+  if (points.x.size() < capacity) {
+    points.x.resize(capacity);
+    points.y.resize(capacity);
+    points.z.resize(capacity);
+  }
+
+  float* __restrict__ x = points.x.data();
+  float* __restrict__ y = points.y.data();
+  float* __restrict__ z = points.z.data();
+  std::size_t n = 0;
+
+  const float* lut = range_lut.data();
+  for (int v = 0; v < h; v++) {
+    const Sample* row = plane + v * stride;
+    int index = (v + offset_y) * table_width + offset_x;
+    const float* dx = &dir_x[index];
+    const float* dy = &dir_y[index];
+    const float* dz = &dir_z[index];
+
+    for (int u = 0; u < w; u++) {
+      float range = lut[row[u]];
+      x[n] = range * dx[u];
+      y[n] = range * dy[u];
+      z[n] = range * dz[u];
+      n += (row[u] != 0);
+    }
+  }
+
+  points.size = n;
+  return n;
+}
+
+template <typename Sample>
+size_t Reprojector::reproject_cloud(const Sample* plane, const int stride, const int width, const int height,
+                                    pcl::PointCloud<pcl::PointXYZ>& cloud, const int offset_x, const int offset_y) const {
+  int w = std::min(width, table_width - offset_x);
+  int h = std::min(height, table_height - offset_y);
+
+  cloud.points.resize(std::max(w, 0) * std::max(h, 0));
+  std::size_t n = 0;
+
+  for (int v = 0; v < h; v++) {
+    const Sample* row = plane + v * stride;
+    int index = (v + offset_y) * table_width + offset_x;
+
+    for (int u = 0; u < w; u++) {
+      float range = range_lut[row[u]];
+      pcl::PointXYZ& point = cloud.points[n];
+      point.x = range * dir_x[index + u];
+      point.y = range * dir_y[index + u];
+      point.z = range * dir_z[index + u];
+      n += (row[u] != 0);
+    }
+  }
+
+  cloud.points.resize(n);
+  cloud.width = n;
+  cloud.height = 1;
+  cloud.is_dense = true;
+  return n;
+}
+
+size_t Reprojector::reproject(const std::uint8_t* plane, const int stride, const int width, const int height,
+                              PointBuffer& points, const int offset_x, const int offset_y) const {
+  return reproject_points(plane, stride, width, height, points, offset_x, offset_y);
+}
+
+size_t Reprojector::reproject(const std::uint16_t* plane, const int stride, const int width, const int height,
+                              PointBuffer& points, const int offset_x, const int offset_y) const {
+  return reproject_points(plane, stride, width, height, points, offset_x, offset_y);
+}
+
+size_t Reprojector::reproject(const std::uint8_t* plane, const int stride, const int width, const int height,
+                              pcl::PointCloud<pcl::PointXYZ>& cloud, const int offset_x, const int offset_y) const {
+  return reproject_cloud(plane, stride, width, height, cloud, offset_x, offset_y);
+}
+
+size_t Reprojector::reproject(const std::uint16_t* plane, const int stride, const int width, const int height,
+                              pcl::PointCloud<pcl::PointXYZ>& cloud, const int offset_x, const int offset_y) const {
+  return reproject_cloud(plane, stride, width, height, cloud, offset_x, offset_y);
+}
+
+/**
+ * @brief Reprojects float ranges keeping the image layout: point i is pixel i of the window
+ *
+ * @param ranges Ranges in metres, non finite or negative values are invalid
+ * @param stride Distance between rows of 'ranges'
+ */
+void Reprojector::reproject_grid(const float* ranges, const int stride, const int width, const int height,
+                                 PointBuffer& points, const int offset_x, const int offset_y) const {
+  int w = std::max(0, std::min(width, table_width - offset_x));
+  int h = std::max(0, std::min(height, table_height - offset_y));
+
+  points.x.assign(width * height, 0.0f);
+  points.y.assign(width * height, 0.0f);
+  points.z.assign(width * height, 0.0f);
+  points.size = width * height;
+
+  for (int v = 0; v < h; v++) {
+    const float* row = ranges + v * stride;
+    int index = (v + offset_y) * table_width + offset_x;
+
+    for (int u = 0; u < w; u++) {
+      float range = (std::isfinite(row[u]) && row[u] > 0.0f) ? row[u] : 0.0f;
+      points.x[v * width + u] = range * dir_x[index + u];
+      points.y[v * width + u] = range * dir_y[index + u];
+      points.z[v * width + u] = range * dir_z[index + u];
+    }
+  }
+}
@@ -0,0 +1,143 @@
+#include "recording.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+const char INDEX_MAGIC[8] = {'H', '2', '6', '4', 'I', 'D', 'X', '1'};
+
+RecordingReader::RecordingReader()
+: fd(-1)
+{
+}
+
+RecordingReader::~RecordingReader() {
+  if (fd >= 0)
+    close(fd);
+}
+
+/**
+ * @brief Opens a recorded stream and loads its index
+ *
+ * @param filename H.264 stream written by Packager (the index is 'filename'.idx)
+ * @return false if either file is missing or the index is malformed
+ */
+bool RecordingReader::open(const std::string& filename) {
+  std::ifstream index(filename + ".idx", std::ios::in | std::ios::binary);
+  if (!index.is_open()) {
+    std::cerr << "Cannot open " << filename << ".idx" << std::endl;
+    return false;
+  }
+
+  char magic[8];
+  index.read(magic, sizeof(magic));
+  if (!index || std::memcmp(magic, INDEX_MAGIC, sizeof(magic)) != 0) {
+    std::cerr << "Not an index file: " << filename << ".idx" << std::endl;
+    return false;
+  }
+
+  entries.clear();
+  IndexEntry entry;
+  while (index.read((char*)&entry, sizeof(entry)))   // a truncated last record is ignored
+    entries.push_back(entry);
+
+  parameter_sets.resize(entries.size());
+  long last = -1;
+  for (std::size_t i = 0; i < entries.size(); i++) {
+    if (entries[i].flags & INDEX_PARAMETER_SETS)
+      last = i;
+    parameter_sets[i] = last;
+  }
+
+  if (fd >= 0)
+    close(fd);
+  fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "Cannot open " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
+
+long RecordingReader::find_frame(const std::uint32_t frame_num) const {
+  auto it = std::lower_bound(entries.begin(), entries.end(), frame_num,
+                             [](const IndexEntry& e, const std::uint32_t n) { return e.frame_num < n; });
+  if (it == entries.end() || it->frame_num != frame_num)
+    return -1;
+  return it - entries.begin();
+}
+
+long RecordingReader::find_stamp(const std::uint64_t stamp) const {
+  auto it = std::upper_bound(entries.begin(), entries.end(), stamp,
+                             [](const std::uint64_t t, const IndexEntry& e) { return t < e.stamp; });
+  return (it - entries.begin()) - 1;
+}
+
+// pread() keeps no file position: safe from several threads
+bool RecordingReader::read_at(std::uint8_t* data, const std::size_t size, const std::uint64_t offset) const {
+  std::size_t done = 0;
+  while (done < size) {
+    ssize_t n = pread(fd, data + done, size - done, offset + done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    done += n;
+  }
+  return true;
+}
+
+/**
+ * @brief Reads the access units [first, last) as one Annex B stream
+ *
+ * The parameter sets in force at 'first' are prepended when the first access unit
+ * does not carry them. Empty on error.
+ */
+std::vector<std::uint8_t> RecordingReader::extract(const std::size_t first, const std::size_t last) const {
+  std::vector<std::uint8_t> stream;
+  if (first >= last || last > entries.size() || fd < 0)
+    return stream;
+
+  long ps = parameter_sets[first];
+  std::size_t header_size = (ps >= 0 && ps != (long)first) ? entries[ps].header_size : 0;
+  std::uint64_t begin = entries[first].offset;
+  std::uint64_t end = entries[last-1].offset + entries[last-1].size;
+
+  stream.resize(header_size + (end - begin));
+  if ((header_size && !read_at(stream.data(), header_size, entries[ps].offset)) ||
+      !read_at(stream.data() + header_size, end - begin, begin))
+    stream.clear();
+  return stream;
+}
+
+/**
+ * @brief Reads the access units [first, last) split in 'nb_threads' decodable chunks
+ *
+ * @return One Annex B stream per chunk, in order
+ */
+std::vector<std::vector<std::uint8_t>> RecordingReader::extract_parallel(const std::size_t first, const std::size_t last,
+                                                                         const int nb_threads) const {
+  std::vector<std::vector<std::uint8_t>> chunks;
+  if (first >= last || last > entries.size())
+    return chunks;
+
+  std::size_t count = last - first;
+  std::size_t nb_chunks = std::min<std::size_t>(std::max(nb_threads, 1), count);
+  chunks.resize(nb_chunks);
+
+  std::vector<std::thread> threads;
+  for (std::size_t c = 0; c < nb_chunks; c++) {
+    std::size_t begin = first + count * c / nb_chunks;
+    std::size_t end = first + count * (c + 1) / nb_chunks;
+    threads.emplace_back([this, &chunks, c, begin, end] { chunks[c] = extract(begin, end); });
+  }
+  for (auto& thread : threads)
+    thread.join();
+
+  return chunks;
+}
@@ -0,0 +1,262 @@
+#include "rtp.h"
+
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+
+namespace {
+
+const std::uint8_t STAP_A = 24;
+const std::uint8_t FU_A = 28;
+const std::size_t RTP_HEADER_SIZE = 12;
+
+// Splits an Annex B byte stream in NAL units (start codes and trailing zeros removed)
+std::vector<std::pair<const std::uint8_t*, std::size_t>> split_nal_units(const std::uint8_t* data, const std::size_t size) {
+  std::vector<std::pair<const std::uint8_t*, std::size_t>> nal_units;
+
+  std::size_t pos = 0;
+  while (pos + 3 <= size && !(data[pos] == 0 && data[pos+1] == 0 && data[pos+2] == 1))
+    pos++;
+
+  while (pos + 3 <= size) {
+    std::size_t begin = pos + 3;
+    std::size_t end = begin;
+    while (end + 3 <= size && !(data[end] == 0 && data[end+1] == 0 && data[end+2] == 1))
+      end++;
+    if (end + 3 > size)
+      end = size;
+    pos = end;
+
+    while (end > begin && data[end-1] == 0)
+      end--;
+    if (end > begin)
+      nal_units.push_back({data + begin, end - begin});
+  }
+
+  return nal_units;
+}
+
+}   // namespace
+
+
+/**
+ * @param ssrc Synchronization source identifier of the stream
+ * @param payload_type Dynamic RTP payload type
+ * @param max_payload Maximum RTP payload in bytes (1400 fits a 1500 bytes MTU)
+ */
+RtpPacketizer::RtpPacketizer(const std::uint32_t _ssrc, const std::uint8_t _payload_type, const std::size_t _max_payload)
+: ssrc(_ssrc), payload_type(_payload_type), max_payload(std::max<std::size_t>(_max_payload, 16)), sequence_number(0)
+{
+}
+
+// RTP header: V=2, no padding/extension/CSRC, marker cleared
+std::vector<std::uint8_t> RtpPacketizer::new_packet(const std::uint32_t timestamp) {
+  std::vector<std::uint8_t> packet;
+  packet.reserve(RTP_HEADER_SIZE + max_payload);
+  packet.push_back(0x80);
+  packet.push_back(payload_type & 0x7f);
+  packet.push_back(sequence_number >> 8);
+  packet.push_back(sequence_number & 0xff);
+  for (int shift = 24; shift >= 0; shift -= 8)
+    packet.push_back((timestamp >> shift) & 0xff);
+  for (int shift = 24; shift >= 0; shift -= 8)
+    packet.push_back((ssrc >> shift) & 0xff);
+  sequence_number++;
+  return packet;
+}
+
+/**
+ * @brief Packetizes one access unit
+ *
+ * @param access_unit Annex B NAL units of one frame (SPS, PPS, slices)
+ * @param size Size in bytes
+ * @param timestamp RTP timestamp (90 kHz clock), the same for every packet of the access unit
+ *
+ * @return RTP packets, in sending order
+ */
+std::vector<std::vector<std::uint8_t>> RtpPacketizer::packetize(const std::uint8_t* access_unit, const std::size_t size,
+                                                                const std::uint32_t timestamp) {
+  std::vector<std::vector<std::uint8_t>> packets;
+  auto nal_units = split_nal_units(access_unit, size);
+
+  std::size_t i = 0;
+  while (i < nal_units.size()) {
+    const std::uint8_t* nal = nal_units[i].first;
+    std::size_t nal_size = nal_units[i].second;
+
+    // STAP-A: as many following NAL units as fit (1 byte STAP-A header, 2 bytes size per NAL unit)
+    std::size_t j = i;
+    std::size_t stap_size = 1;
+    while (j < nal_units.size() && stap_size + 2 + nal_units[j].second <= max_payload) {
+      stap_size += 2 + nal_units[j].second;
+      j++;
+    }
+    if (j - i >= 2) {
+      std::vector<std::uint8_t> packet = new_packet(timestamp);
+      std::uint8_t nri = 0;
+      for (std::size_t k = i; k < j; k++)
+        nri = std::max<std::uint8_t>(nri, nal_units[k].first[0] & 0x60);
+      packet.push_back(nri | STAP_A);
+      for (std::size_t k = i; k < j; k++) {
+        packet.push_back(nal_units[k].second >> 8);
+        packet.push_back(nal_units[k].second & 0xff);
+        packet.insert(packet.end(), nal_units[k].first, nal_units[k].first + nal_units[k].second);
+      }
+      packets.push_back(std::move(packet));
+      i = j;
+      continue;
+    }
+
+    if (nal_size <= max_payload) {    // single NAL unit packet
+      std::vector<std::uint8_t> packet = new_packet(timestamp);
+      packet.insert(packet.end(), nal, nal + nal_size);
+      packets.push_back(std::move(packet));
+    } else {                          // FU-A, the NAL header is rebuilt from the FU indicator and header
+      std::uint8_t fu_indicator = (nal[0] & 0xe0) | FU_A;
+      std::uint8_t nal_type = nal[0] & 0x1f;
+      std::size_t chunk = max_payload - 2;
+
+      for (std::size_t pos = 1; pos < nal_size; pos += chunk) {
+        std::size_t length = std::min(chunk, nal_size - pos);
+        std::uint8_t fu_header = nal_type;
+        if (pos == 1)
+          fu_header |= 0x80;    // start
+        if (pos + length == nal_size)
+          fu_header |= 0x40;    // end
+
+        std::vector<std::uint8_t> packet = new_packet(timestamp);
+        packet.push_back(fu_indicator);
+        packet.push_back(fu_header);
+        packet.insert(packet.end(), nal + pos, nal + pos + length);
+        packets.push_back(std::move(packet));
+      }
+    }
+    i++;
+  }
+
+  if (!packets.empty())
+    packets.back()[1] |= 0x80;    // marker: last packet of the access unit
+
+  return packets;
+}
+
+
+RtpDepacketizer::RtpDepacketizer()
+: in_fragment(false), has_sequence(false), next_sequence(0), lost(0)
+{
+}
+
+void RtpDepacketizer::append_nal(const std::uint8_t* nal, const std::size_t size) {
+  static const std::uint8_t start_code[4] = {0x00, 0x00, 0x00, 0x01};
+  current.insert(current.end(), start_code, start_code + 4);
+  current.insert(current.end(), nal, nal + size);
+}
+
+/**
+ * @brief Adds one RTP packet
+ *
+ * @param packet RTP packet, header included
+ * @param size Size in bytes
+ *
+ * @return true if the access unit is complete, available through access_unit()
+ */
+bool RtpDepacketizer::push(const std::uint8_t* packet, const std::size_t size) {
+  if (size <= RTP_HEADER_SIZE || (packet[0] >> 6) != 2)
+    return false;
+
+  std::size_t header_size = RTP_HEADER_SIZE + 4 * (packet[0] & 0x0f);
+  if (packet[0] & 0x10) {   // header extension
+    if (size < header_size + 4)
+      return false;
+    header_size += 4 + 4 * ((packet[header_size + 2] << 8) | packet[header_size + 3]);
+  }
+  std::size_t end = size;
+  if (packet[0] & 0x20)     // padding
+    end -= std::min<std::size_t>(packet[size - 1], size);
+  if (end <= header_size)
+    return false;
+
+  bool marker = packet[1] & 0x80;
+  std::uint16_t sequence = (packet[2] << 8) | packet[3];
+  if (has_sequence && sequence != next_sequence) {
+    lost += static_cast<std::uint16_t>(sequence - next_sequence);
+    in_fragment = false;    // the fragmented NAL unit is incomplete
+  }
+  has_sequence = true;
+  next_sequence = sequence + 1;
+
+  const std::uint8_t* payload = packet + header_size;
+  std::size_t payload_size = end - header_size;
+  std::uint8_t type = payload[0] & 0x1f;
+
+  if (type == STAP_A) {
+    std::size_t pos = 1;
+    while (pos + 2 <= payload_size) {
+      std::size_t nal_size = (payload[pos] << 8) | payload[pos + 1];
+      pos += 2;
+      if (nal_size == 0 || pos + nal_size > payload_size)
+        break;
+      append_nal(payload + pos, nal_size);
+      pos += nal_size;
+    }
+  } else if (type == FU_A) {
+    if (payload_size < 2)
+      return false;
+    bool start = payload[1] & 0x80;
+    bool stop = payload[1] & 0x40;
+    if (start) {
+      fragment.assign(1, (payload[0] & 0xe0) | (payload[1] & 0x1f));
+      in_fragment = true;
+    }
+    if (in_fragment) {
+      fragment.insert(fragment.end(), payload + 2, payload + payload_size);
+      if (stop) {
+        append_nal(fragment.data(), fragment.size());
+        in_fragment = false;
+      }
+    }
+  } else if (type >= 1 && type <= 23) {
+    append_nal(payload, payload_size);
+  }
+
+  if (marker) {
+    std::swap(completed, current);
+    current.clear();
+    in_fragment = false;
+    return !completed.empty();
+  }
+  return false;
+}
+
+
+/**
+ * @param host IPv4 address of the receiver
+ * @param port UDP port of the receiver
+ */
+RtpSender::RtpSender(const std::string& host, const int port) {
+  fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0) {
+    std::cerr << "Cannot create the RTP socket" << std::endl;
+    exit(1);
+  }
+
+  destination = sockaddr_in();
+  destination.sin_family = AF_INET;
+  destination.sin_port = htons(port);
+  if (inet_pton(AF_INET, host.c_str(), &destination.sin_addr) != 1) {
+    std::cerr << "Invalid RTP destination " << host << std::endl;
+    exit(1);
+  }
+}
+
+RtpSender::~RtpSender() {
+  close(fd);
+}
+
+void RtpSender::send(const std::vector<std::vector<std::uint8_t>>& packets) {
+  for (auto& packet : packets)
+    sendto(fd, packet.data(), packet.size(), 0, (const struct sockaddr*)&destination, sizeof(destination));
+}
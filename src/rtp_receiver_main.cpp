@@ -0,0 +1,71 @@
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "rtp.h"
+#include "decoder.h"
+
+using namespace std;
+
+/*
+*   Receives the RTP stream sent by pointcloud_h264_node (~rtp_host, ~rtp_port), writes the
+*   rebuilt H.264 stream and decodes it on the fly to check every access unit
+*
+*   usage: pointcloud_h264_rtp_receiver <port> <output.h264> [<nb_frames>]
+*/
+int main(int argc, char** argv)
+{
+    if (argc < 3) {
+        cerr << "usage: " << argv[0] << " <port> <output.h264> [<nb_frames>]" << endl;
+        return 1;
+    }
+    int nb_frames = (argc > 3) ? atoi(argv[3]) : 0;   // 0: until interrupted
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in address = sockaddr_in();
+    address.sin_family = AF_INET;
+    address.sin_port = htons(atoi(argv[1]));
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (fd < 0 || bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        cerr << "Cannot listen on port " << argv[1] << endl;
+        return 1;
+    }
+
+    int buffer_size = 8 << 20;    // a whole frame arrives in one burst
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+
+    ofstream output(argv[2], ios::out | ios::binary);
+    if (!output.is_open()) {
+        cerr << "Cannot open " << argv[2] << endl;
+        return 1;
+    }
+
+    RtpDepacketizer depacketizer;
+    Decoder decoder;
+    vector<uint8_t> packet(65536);
+    int frames = 0;
+
+    while (nb_frames == 0 || frames < nb_frames) {
+        ssize_t size = recv(fd, packet.data(), packet.size(), 0);
+        if (size <= 0)
+            break;
+        if (!depacketizer.push(packet.data(), size))
+            continue;
+
+        const vector<uint8_t>& access_unit = depacketizer.access_unit();
+        output.write((char*)access_unit.data(), access_unit.size());
+
+        vector<DecodedPicture> pictures = decoder.decode(access_unit.data(), access_unit.size());
+        cout << "Access unit " << frames << ": " << access_unit.size() << " bytes, "
+             << pictures.size() << " picture(s), " << depacketizer.get_lost() << " packets lost" << endl;
+        frames++;
+    }
+
+    close(fd);
+    return 0;
+}
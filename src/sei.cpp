@@ -0,0 +1,130 @@
+#include "sei.h"
+
+#include <vector>
+#include <cstring>
+
+// Identifies the projection metadata among user_data_unregistered messages
+const std::uint8_t PROJECTION_SEI_UUID[16] = {
+  0x5c, 0x1d, 0x9a, 0x4e, 0x27, 0x83, 0x4f, 0x0b,
+  0xa6, 0x31, 0xe8, 0x72, 0x0d, 0xc4, 0x59, 0x16
+};
+
+namespace {
+
+const std::uint8_t USER_DATA_UNREGISTERED = 5;
+const std::uint8_t METADATA_VERSION = 1;
+const std::size_t METADATA_SIZE = 16 + 3 + 13 * 4 + 8 + 4;
+
+void put_u32(std::vector<std::uint8_t>& bytes, const std::uint32_t value) {
+  for (int shift = 24; shift >= 0; shift -= 8)
+    bytes.push_back((value >> shift) & 0xff);
+}
+
+void put_float(std::vector<std::uint8_t>& bytes, const float value) {
+  std::uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  put_u32(bytes, bits);
+}
+
+std::uint32_t get_u32(const std::uint8_t* data) {
+  return (std::uint32_t(data[0]) << 24) | (std::uint32_t(data[1]) << 16) | (std::uint32_t(data[2]) << 8) | data[3];
+}
+
+float get_float(const std::uint8_t* data) {
+  std::uint32_t bits = get_u32(data);
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+}   // namespace
+
+
+/**
+ * @brief Generates the SEI RBSP of the projection metadata
+ *
+ * @param metadata Projection, quantization, pose and time stamp of the frame
+ * @return sei_rbsp(): one sei_message (user_data_unregistered) + rbsp_trailing_bits
+ */
+Bitstream projection_sei_rbsp(const ProjectionMetadata& metadata) {
+  std::vector<std::uint8_t> bytes;
+  bytes.reserve(2 + METADATA_SIZE);
+
+  bytes.push_back(USER_DATA_UNREGISTERED);    // last_payload_type_byte
+  bytes.push_back(METADATA_SIZE);             // last_payload_size_byte (< 255)
+
+  bytes.insert(bytes.end(), PROJECTION_SEI_UUID, PROJECTION_SEI_UUID + 16);
+  bytes.push_back(METADATA_VERSION);
+  bytes.push_back(metadata.config.bit_depth);
+  bytes.push_back(0);   // linear quantization between min_range and max_range
+
+  put_float(bytes, metadata.config.angular_resolution_x);
+  put_float(bytes, metadata.config.angular_resolution_y);
+  put_float(bytes, metadata.config.max_angle_width);
+  put_float(bytes, metadata.config.max_angle_height);
+  put_float(bytes, metadata.config.min_range);
+  put_float(bytes, metadata.config.max_range);
+  for (int i = 0; i < 7; i++)
+    put_float(bytes, metadata.sensor_pose[i]);
+
+  put_u32(bytes, metadata.stamp >> 32);
+  put_u32(bytes, metadata.stamp & 0xffffffff);
+  put_u32(bytes, metadata.frame_num);
+
+  Bitstream sodb(bytes.data(), bytes.size() * 8);
+  return sodb.rbsp_trailing_bits();
+}
+
+/**
+ * @param rbsp SEI RBSP (NAL header and emulation prevention bytes removed)
+ * @param size Size in bytes
+ * @param metadata Output
+ */
+bool parse_projection_sei(const std::uint8_t* rbsp, const std::size_t size, ProjectionMetadata& metadata) {
+  std::size_t pos = 0;
+
+  // sei_message() loop, stops at the rbsp_trailing_bits
+  while (pos < size && rbsp[pos] != 0x80) {
+    std::size_t payload_type = 0, payload_size = 0;
+    while (pos < size && rbsp[pos] == 0xff)
+      payload_type += rbsp[pos++];
+    if (pos >= size)
+      return false;
+    payload_type += rbsp[pos++];
+    while (pos < size && rbsp[pos] == 0xff)
+      payload_size += rbsp[pos++];
+    if (pos >= size)
+      return false;
+    payload_size += rbsp[pos++];
+    if (pos + payload_size > size)
+      return false;
+
+    const std::uint8_t* payload = rbsp + pos;
+    pos += payload_size;
+
+    if (payload_type != USER_DATA_UNREGISTERED || payload_size < METADATA_SIZE ||
+        std::memcmp(payload, PROJECTION_SEI_UUID, 16) != 0 || payload[16] != METADATA_VERSION || payload[18] != 0 ||
+        payload[17] < 8 || payload[17] > 14)
+      continue;
+
+    ProjectionMetadata m;
+    const std::uint8_t* p = payload + 19;
+    m.config.bit_depth = payload[17];
+    m.config.angular_resolution_x = get_float(p);
+    m.config.angular_resolution_y = get_float(p + 4);
+    m.config.max_angle_width = get_float(p + 8);
+    m.config.max_angle_height = get_float(p + 12);
+    m.config.min_range = get_float(p + 16);
+    m.config.max_range = get_float(p + 20);
+    for (int i = 0; i < 7; i++)
+      m.sensor_pose[i] = get_float(p + 24 + 4 * i);
+    p += 13 * 4;
+    m.stamp = (std::uint64_t(get_u32(p)) << 32) | get_u32(p + 4);
+    m.frame_num = get_u32(p + 8);
+
+    metadata = m;
+    return true;
+  }
+
+  return false;
+}
@@ -8,11 +8,15 @@ void vlc_frame(Frame& frame) {
 
   // vector of nMB arrays of 16 ints for Luma, 4 for Chroma
   // each macroblock has an array of 16 ints (each 4x4 T. block needs to count non-zero coeffs)
-  std::vector<std::array<int, 16>> nc_Y_table;
+  // Kept across frames (one set per encoding thread): no allocation once the size is reached
+  static thread_local std::vector<std::array<int, 16>> nc_Y_table;
+  nc_Y_table.clear();
   nc_Y_table.reserve(frame.mbs.size());           
-  std::vector<std::array<int, 4>> nc_Cb_table;
+  static thread_local std::vector<std::array<int, 4>> nc_Cb_table;
+  nc_Cb_table.clear();
   nc_Cb_table.reserve(frame.mbs.size());
-  std::vector<std::array<int, 4>> nc_Cr_table;
+  static thread_local std::vector<std::array<int, 4>> nc_Cr_table;
+  nc_Cr_table.clear();
   nc_Cr_table.reserve(frame.mbs.size());
 
   for (auto& mb : frame.mbs) {
@@ -89,8 +93,8 @@ void vlc_frame(Frame& frame) {
  * @return Coded bitstream of the 4x4 Luma DC coeffs block
  */
 Bitstream vlc_Y_DC(MacroBlock& mb, std::vector<std::array<int, 16>>& nc_Y_table, Frame& frame) {
-  int nA_index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_L);  // get left MB index
-  int nB_index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_U);  // get upper MB index
+  int nA_index = frame.get_neighbors(mb.mb_index).index[MB_NEIGHBOR_L];  // get left MB index
+  int nB_index = frame.get_neighbors(mb.mb_index).index[MB_NEIGHBOR_U];  // get upper MB index
 
   // WHICH ARE THE NEIGHBOUR BLOCKS OF THE DC BLOCK ???
   int nC;
@@ -125,7 +129,7 @@ Bitstream vlc_Y(int cur_pos, MacroBlock& mb, std::vector<std::array<int, 16>>& n
 
   int nA_index, nA_pos;
   if (real_pos % 4 == 0) {  // left 4x4 block in the left MB
-    nA_index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_L);
+    nA_index = frame.get_neighbors(mb.mb_index).index[MB_NEIGHBOR_L];
     nA_pos = real_pos + 3;
   } else {                  // left 4x4 block in the same MB
     nA_index = mb.mb_index;
@@ -135,7 +139,7 @@ Bitstream vlc_Y(int cur_pos, MacroBlock& mb, std::vector<std::array<int, 16>>& n
 
   int nB_index, nB_pos;
   if (0 <= real_pos && real_pos <= 3) {   // upper 4x4 block in the upper MB
-    nB_index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_U);
+    nB_index = frame.get_neighbors(mb.mb_index).index[MB_NEIGHBOR_U];
     nB_pos = 12 + real_pos;
   } else {                                // upper 4x4 block in the same MB
     nB_index = mb.mb_index;
@@ -156,7 +160,7 @@ Bitstream vlc_Y(int cur_pos, MacroBlock& mb, std::vector<std::array<int, 16>>& n
   Bitstream bitstream;
   int non_zero;
   if (mb.is_intra16x16)   // if intra 16x16 coded, a DC 4x4 transform was applied to all 16 DC coeffs
-    std::tie(bitstream, non_zero) = cavlc_block4x4(mb.get_Y_AC_block(cur_pos), nC, 15);
+    std::tie(bitstream, non_zero) = cavlc_block4x4(mb.get_Y_4x4_block(cur_pos), nC, 15, true);
   else                    // if not, only default 4x4 transform was applied
     std::tie(bitstream, non_zero) = cavlc_block4x4(mb.get_Y_4x4_block(cur_pos), nC, 16);
 
@@ -235,7 +239,7 @@ Bitstream vlc_Cb_AC(int cur_pos, MacroBlock& mb, std::vector<std::array<int, 4>>
 
   // Same as Luma for left block, but with 4 4x4 blocks
   if (cur_pos % 2 == 0) {
-    nA_index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_L);
+    nA_index = frame.get_neighbors(mb.mb_index).index[MB_NEIGHBOR_L];
     nA_pos = cur_pos + 1;
   } else {
     nA_index = mb.mb_index;
@@ -245,7 +249,7 @@ Bitstream vlc_Cb_AC(int cur_pos, MacroBlock& mb, std::vector<std::array<int, 4>>
   // Same as Luma for upper block, but with 4 4x4 blocks
   int nB_index, nB_pos;
   if (0 <= cur_pos && cur_pos <= 1) {
-    nB_index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_U);
+    nB_index = frame.get_neighbors(mb.mb_index).index[MB_NEIGHBOR_U];
     nB_pos = cur_pos + 2;
   } else {
     nB_index = mb.mb_index;
@@ -264,7 +268,7 @@ Bitstream vlc_Cb_AC(int cur_pos, MacroBlock& mb, std::vector<std::array<int, 4>>
 
   Bitstream bitstream;
   int non_zero;
-  std::tie(bitstream, non_zero) = cavlc_block4x4(mb.get_Cb_AC_block(cur_pos), nC, 15);
+  std::tie(bitstream, non_zero) = cavlc_block4x4(mb.get_Cb_4x4_block(cur_pos), nC, 15, true);
   // Save number of non-zero coeffs for further nC choices
   nc_Cb_table.at(mb.mb_index)[cur_pos] = non_zero;
 
@@ -287,7 +291,7 @@ Bitstream vlc_Cb_AC(int cur_pos, MacroBlock& mb, std::vector<std::array<int, 4>>
 Bitstream vlc_Cr_AC(int cur_pos, MacroBlock& mb, std::vector<std::array<int, 4>>& nc_Cr_table, Frame& frame) {
   int nA_index, nA_pos;
   if (cur_pos % 2 == 0) {
-    nA_index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_L);
+    nA_index = frame.get_neighbors(mb.mb_index).index[MB_NEIGHBOR_L];
     nA_pos = cur_pos + 1;
   } else {
     nA_index = mb.mb_index;
@@ -296,7 +300,7 @@ Bitstream vlc_Cr_AC(int cur_pos, MacroBlock& mb, std::vector<std::array<int, 4>>
 
   int nB_index, nB_pos;
   if (0 <= cur_pos && cur_pos <= 1) {
-    nB_index = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_U);
+    nB_index = frame.get_neighbors(mb.mb_index).index[MB_NEIGHBOR_U];
     nB_pos = cur_pos + 2;
   } else {
     nB_index = mb.mb_index;
@@ -315,7 +319,7 @@ Bitstream vlc_Cr_AC(int cur_pos, MacroBlock& mb, std::vector<std::array<int, 4>>
 
   Bitstream bitstream;
   int non_zero;
-  std::tie(bitstream, non_zero) = cavlc_block4x4(mb.get_Cr_AC_block(cur_pos), nC, 15);
+  std::tie(bitstream, non_zero) = cavlc_block4x4(mb.get_Cr_4x4_block(cur_pos), nC, 15, true);
   nc_Cr_table.at(mb.mb_index)[cur_pos] = non_zero;
 
   if (non_zero != 0)
@@ -323,3 +327,359 @@ Bitstream vlc_Cr_AC(int cur_pos, MacroBlock& mb, std::vector<std::array<int, 4>>
 
   return bitstream;
 }
+
+
+
+/////////////////////////////////////////////////// CABAC ///////////////////////////////////////////////////
+
+
+namespace {
+
+/* What the contexts of the next MBs need from a coded MB (9.3.3.1.1)
+ * An I_PCM MB is recorded as fully coded (cbp 15 / 2, every coded_block_flag set) with the chroma mode 0
+ */
+struct CabacMBInfo {
+  bool is_I_NxN;                      // Intra4x4
+  int chroma_mode;                    // intra_chroma_pred_mode
+  int cbp_luma;                       // CodedBlockPatternLuma, one bit per 8x8 block
+  int cbp_chroma;                     // CodedBlockPatternChroma
+  bool cbf_Y_DC;                      // coded_block_flag of each block (false when not coded)
+  std::array<bool, 16> cbf_Y;         // indexed by 4x4 block position (see MacroBlock)
+  std::array<bool, 2> cbf_C_DC;       // Cb, Cr
+  std::array<std::array<bool, 4>, 2> cbf_C_AC;
+};
+
+// condTermFlagN of coded_block_flag: the current MB is intra, an unavailable neighbour (-1) counts as coded
+inline int cbf_cond(const int index, const bool cbf) {
+  return (index == -1) ? 1 : cbf;
+}
+
+/**
+ * @brief Codes a block of coefficients (residual_block_cabac)
+ *
+ * @param coeff Coefficients in scan order
+ * @param nb_coeff maxNumCoeff
+ * @param cat ctxBlockCat
+ * @param cbf_inc ctxIdxInc of coded_block_flag
+ * @return coded_block_flag
+ */
+bool cabac_residual_block(CabacEncoder& cabac, const int coeff[], const int nb_coeff, const BlockCat cat, const int cbf_inc) {
+  const int c = static_cast<int>(cat);
+
+  int last = nb_coeff - 1;
+  while (last >= 0 && coeff[last] == 0)
+    last--;
+
+  cabac.encode_decision(CTX_CODED_BLOCK_FLAG + cbf_cat_offset[c] + cbf_inc, last >= 0);
+  if (last < 0)
+    return false;
+
+  // Significance map (for chroma DC, Min(numDecodAbsLevel / NumC8x8, 2) is the index itself in 4:2:0)
+  const int significant = CTX_SIGNIFICANT_COEFF + significant_cat_offset[c];
+  const int last_significant = CTX_LAST_SIGNIFICANT_COEFF + significant_cat_offset[c];
+  for (int i = 0; i < nb_coeff - 1; i++) {
+    cabac.encode_decision(significant + i, coeff[i] != 0);
+    if (coeff[i] != 0) {
+      cabac.encode_decision(last_significant + i, i == last);
+      if (i == last)
+        break;
+    }
+  }
+
+  // Levels in reverse scan order: coeff_abs_level_minus1 (TU prefix, cMax 14, then UEG0 suffix) and sign
+  const int abs_level = CTX_COEFF_ABS_LEVEL + abs_level_cat_offset[c];
+  const int max_gt1_inc = (cat == BlockCat::CHROMA_DC) ? 3 : 4;
+  int nb_eq1 = 0, nb_gt1 = 0;
+  for (int i = last; i >= 0; i--) {
+    if (coeff[i] == 0)
+      continue;
+
+    int level = std::abs(coeff[i]) - 1;
+    cabac.encode_decision(abs_level + (nb_gt1 ? 0 : std::min(4, 1 + nb_eq1)), level > 0);
+    if (level > 0) {
+      int ctx = abs_level + 5 + std::min(max_gt1_inc, nb_gt1);
+      int prefix = std::min(level, 14);
+      for (int k = 1; k < prefix; k++)
+        cabac.encode_decision(ctx, 1);
+      if (level < 14) {
+        cabac.encode_decision(ctx, 0);
+      } else {
+        int suffix = level - 14;
+        int k = 0;
+        while (suffix >= (1 << k)) {
+          cabac.encode_bypass(1);
+          suffix -= 1 << k;
+          k++;
+        }
+        cabac.encode_bypass(0);
+        while (k--)
+          cabac.encode_bypass((suffix >> k) & 1);
+      }
+      nb_gt1++;
+    } else {
+      nb_eq1++;
+    }
+    cabac.encode_bypass(coeff[i] < 0);
+  }
+
+  return true;
+}
+
+// Coefficients of a 4x4 block in scan order, from 'first' (1 to skip the DC coefficient)
+template <int STEP>
+inline void scan_block(BlockView<4, 4, int, STEP> block, int coeff[], const int first) {
+  for (int k = first; k < 16; k++)
+    coeff[k - first] = block[zigzag_scan4x4[k]];
+}
+
+inline bool any_coeff(const int coeff[], const int nb_coeff) {
+  return std::any_of(coeff, coeff + nb_coeff, [](const int x) { return x != 0; });
+}
+
+/**
+ * @brief Coded block flags and coded block pattern of a MB (set in the MB too, as vlc_frame does)
+ */
+void cabac_mb_info(MacroBlock& mb, CabacMBInfo& cur) {
+  cur.is_I_NxN = !mb.is_I_PCM && !mb.is_intra16x16;
+  if (mb.is_I_PCM) {
+    cur.chroma_mode = 0;
+    cur.cbp_luma = 15;
+    cur.cbp_chroma = 2;
+    cur.cbf_Y_DC = true;
+    cur.cbf_Y.fill(true);
+    cur.cbf_C_DC.fill(true);
+    cur.cbf_C_AC[0].fill(true);
+    cur.cbf_C_AC[1].fill(true);
+    return;
+  }
+
+  cur.chroma_mode = static_cast<int>(mb.intra_Cr_Cb_mode);
+  cur.cbp_luma = 0;
+
+  int coeff[16];
+  scan_block(mb.get_Y_DC_block(), coeff, 0);
+  cur.cbf_Y_DC = mb.is_intra16x16 && any_coeff(coeff, 16);
+
+  const int first = mb.is_intra16x16 ? 1 : 0;
+  for (int cur_pos = 0; cur_pos != 16; cur_pos++) {
+    scan_block(mb.get_Y_4x4_block(cur_pos), coeff, first);
+    cur.cbf_Y[cur_pos] = any_coeff(coeff, 16 - first);
+    if (cur.cbf_Y[cur_pos])
+      cur.cbp_luma |= 1 << (cur_pos / 4);
+  }
+  if (mb.is_intra16x16 && cur.cbp_luma)   // all the AC blocks or none
+    cur.cbp_luma = 15;
+
+  bool chroma_DC = false, chroma_AC = false;
+  for (int c = 0; c < 2; c++) {
+    Block8x8& block = (c == 0) ? mb.Cb : mb.Cr;
+    cur.cbf_C_DC[c] = block[0] || block[4] || block[32] || block[36];
+    chroma_DC |= cur.cbf_C_DC[c];
+
+    for (int cur_pos = 0; cur_pos != 4; cur_pos++) {
+      scan_block((c == 0) ? mb.get_Cb_4x4_block(cur_pos) : mb.get_Cr_4x4_block(cur_pos), coeff, 1);
+      cur.cbf_C_AC[c][cur_pos] = any_coeff(coeff, 15);
+      chroma_AC |= cur.cbf_C_AC[c][cur_pos];
+    }
+  }
+  cur.cbp_chroma = chroma_AC ? 2 : (chroma_DC ? 1 : 0);
+
+  mb.coded_block_pattern_luma = cur.cbp_luma != 0;
+  for (int i = 0; i != 4; i++)
+    mb.coded_block_pattern_luma_4x4[i] = (cur.cbp_luma >> i) & 1;
+  mb.coded_block_pattern_chroma_DC = chroma_DC;
+  mb.coded_block_pattern_chroma_AC = chroma_AC;
+}
+
+/**
+ * @brief Luma and chroma residual of a MB (residual( ) of 7.3.5.3), blocks of the coded block pattern only
+ */
+void cabac_residual(CabacEncoder& cabac, MacroBlock& mb, const Frame& frame, const std::vector<CabacMBInfo>& info) {
+  const CabacMBInfo& cur = info[mb.mb_index];
+  const int index_A = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_L);
+  const int index_B = frame.get_neighbor_index(mb.mb_index, MB_NEIGHBOR_U);
+  int coeff[16];
+
+  // Intra16x16 luma DC: the neighbour block is the DC of an Intra16x16 MB
+  if (mb.is_intra16x16) {
+    int inc = cbf_cond(index_A, index_A != -1 && info[index_A].cbf_Y_DC) +
+              2 * cbf_cond(index_B, index_B != -1 && info[index_B].cbf_Y_DC);
+    scan_block(mb.get_Y_DC_block(), coeff, 0);
+    cabac_residual_block(cabac, coeff, 16, BlockCat::LUMA_DC, inc);
+  }
+
+  // Luma 4x4 blocks (AC only for Intra16x16), neighbours as in vlc_Y
+  const int first = mb.is_intra16x16 ? 1 : 0;
+  for (int cur_pos = 0; cur_pos != 16; cur_pos++) {
+    if (!(cur.cbp_luma & (1 << (cur_pos / 4))))
+      continue;
+
+    int real_pos = MacroBlock::convert_table[cur_pos];
+    int nA_index = (real_pos % 4 == 0) ? index_A : mb.mb_index;
+    int nA_pos = MacroBlock::convert_table[(real_pos % 4 == 0) ? real_pos + 3 : real_pos - 1];
+    int nB_index = (real_pos < 4) ? index_B : mb.mb_index;
+    int nB_pos = MacroBlock::convert_table[(real_pos < 4) ? real_pos + 12 : real_pos - 4];
+    int inc = cbf_cond(nA_index, nA_index != -1 && info[nA_index].cbf_Y[nA_pos]) +
+              2 * cbf_cond(nB_index, nB_index != -1 && info[nB_index].cbf_Y[nB_pos]);
+
+    scan_block(mb.get_Y_4x4_block(cur_pos), coeff, first);
+    cabac_residual_block(cabac, coeff, 16 - first, mb.is_intra16x16 ? BlockCat::LUMA_AC : BlockCat::LUMA_4x4, inc);
+  }
+
+  // Chroma DC (2x2, raster order) of Cb and Cr, then the AC blocks of Cb and Cr
+  if (cur.cbp_chroma == 0)
+    return;
+
+  for (int c = 0; c < 2; c++) {
+    Block2x2 dc = (c == 0) ? mb.get_Cb_DC_block() : mb.get_Cr_DC_block();
+    for (int i = 0; i < 4; i++)
+      coeff[i] = dc[i];
+    int inc = cbf_cond(index_A, index_A != -1 && info[index_A].cbf_C_DC[c]) +
+              2 * cbf_cond(index_B, index_B != -1 && info[index_B].cbf_C_DC[c]);
+    cabac_residual_block(cabac, coeff, 4, BlockCat::CHROMA_DC, inc);
+  }
+
+  if (cur.cbp_chroma != 2)
+    return;
+
+  for (int c = 0; c < 2; c++) {
+    for (int cur_pos = 0; cur_pos != 4; cur_pos++) {
+      // Neighbours as in vlc_Cb_AC
+      int nA_index = (cur_pos % 2 == 0) ? index_A : mb.mb_index;
+      int nA_pos = (cur_pos % 2 == 0) ? cur_pos + 1 : cur_pos - 1;
+      int nB_index = (cur_pos < 2) ? index_B : mb.mb_index;
+      int nB_pos = (cur_pos < 2) ? cur_pos + 2 : cur_pos - 2;
+      int inc = cbf_cond(nA_index, nA_index != -1 && info[nA_index].cbf_C_AC[c][nA_pos]) +
+                2 * cbf_cond(nB_index, nB_index != -1 && info[nB_index].cbf_C_AC[c][nB_pos]);
+
+      scan_block((c == 0) ? mb.get_Cb_4x4_block(cur_pos) : mb.get_Cr_4x4_block(cur_pos), coeff, 1);
+      cabac_residual_block(cabac, coeff, 15, BlockCat::CHROMA_AC, inc);
+    }
+  }
+}
+
+}   // namespace
+
+/**
+ * @brief CABAC counterpart of vlc_frame and Packager::write_slice_data: codes the slice_data( ) of
+ * each slice of the frame into frame.cabac_data (see cabac_slice_offsets), the packager only adds the slice headers
+ *
+ * @param frame The frame, after prediction
+ */
+void cabac_frame(Frame& frame) {
+  const int nb_mbs = frame.mbs.size();
+  static thread_local std::vector<CabacMBInfo> info;   // kept across frames, as the nC tables of vlc_frame
+  info.resize(nb_mbs);
+  frame.cabac_data.clear();    // reserved by Frame::load for the worst case
+  frame.cabac_slice_offsets.assign(1, 0);
+
+  int first_mb = 0;
+  while (first_mb < nb_mbs) {
+    int last_mb = first_mb + 1;
+    while (last_mb < nb_mbs && frame.get_slice(last_mb) == frame.get_slice(first_mb))
+      last_mb++;
+
+    std::vector<std::uint8_t>& bytes = frame.cabac_data;   // the carry never reaches the previous slice
+    CabacEncoder cabac(bytes);
+    init_cabac_contexts(cabac.contexts, frame.get_qp());   // SliceQPY
+
+    for (int i = first_mb; i < last_mb; i++) {
+      MacroBlock& mb = frame.mbs[i];
+      CabacMBInfo& cur = info[i];
+      cabac_mb_info(mb, cur);
+      std::size_t start_bits = cabac.bits_written();
+
+      const int index_A = frame.get_neighbor_index(i, MB_NEIGHBOR_L);
+      const int index_B = frame.get_neighbor_index(i, MB_NEIGHBOR_U);
+
+      // mb_type, bin 0 (I_NxN or not) depends on the neighbours
+      int inc = (index_A != -1 && !info[index_A].is_I_NxN) + (index_B != -1 && !info[index_B].is_I_NxN);
+      cabac.encode_decision(CTX_MB_TYPE_I + inc, !cur.is_I_NxN);
+
+      if (mb.is_I_PCM) {
+        // The arithmetic coder is flushed before the samples (pcm_alignment_zero_bit included) and restarted after them
+        cabac.encode_terminate(1);
+        cabac.flush();
+        std::uint32_t pcm_bits = 0;   // bit_depth bits per sample, whole bytes per MB (384 samples)
+        int nb_pcm_bits = 0;
+        auto put_samples = [&](const int* samples, const int count) {
+          for (int k = 0; k < count; k++) {
+            pcm_bits = (pcm_bits << frame.bit_depth) | samples[k];
+            for (nb_pcm_bits += frame.bit_depth; nb_pcm_bits >= 8; nb_pcm_bits -= 8)
+              bytes.push_back(static_cast<std::uint8_t>(pcm_bits >> (nb_pcm_bits - 8)));
+          }
+        };
+        put_samples(mb.Y.data(), 256);
+        put_samples(mb.Cb.data(), 64);
+        put_samples(mb.Cr.data(), 64);
+        cabac.start();
+      } else if (mb.is_intra16x16) {
+        // Intra16x16: cbp and prediction mode in the remaining bins of mb_type
+        cabac.encode_terminate(0);
+        cabac.encode_decision(CTX_MB_TYPE_I + 3, cur.cbp_luma != 0);
+        cabac.encode_decision(CTX_MB_TYPE_I + 4, cur.cbp_chroma != 0);
+        if (cur.cbp_chroma != 0)
+          cabac.encode_decision(CTX_MB_TYPE_I + 5, cur.cbp_chroma == 2);
+        int mode = static_cast<int>(mb.intra16x16_Y_mode);
+        cabac.encode_decision(CTX_MB_TYPE_I + 6, mode >> 1);
+        cabac.encode_decision(CTX_MB_TYPE_I + 7, mode & 1);
+      } else {
+        // prev_intra4x4_pred_mode_flag, rem_intra4x4_pred_mode (3 bins, LSB first)
+        for (int cur_pos = 0; cur_pos != 16; cur_pos++) {
+          int pred_mode = frame.predict_intra4x4_mode(i, cur_pos);
+          int cur_mode = static_cast<int>(mb.intra4x4_Y_mode.at(cur_pos));
+          cabac.encode_decision(CTX_PREV_INTRA4X4_PRED_MODE, pred_mode == cur_mode);
+          if (pred_mode != cur_mode) {
+            int rem = (cur_mode < pred_mode) ? cur_mode : cur_mode - 1;
+            for (int k = 0; k < 3; k++)
+              cabac.encode_decision(CTX_REM_INTRA4X4_PRED_MODE, (rem >> k) & 1);
+          }
+        }
+      }
+
+      if (!mb.is_I_PCM) {
+        // intra_chroma_pred_mode, TU with cMax 3
+        int mode = cur.chroma_mode;
+        inc = (index_A != -1 && info[index_A].chroma_mode != 0) + (index_B != -1 && info[index_B].chroma_mode != 0);
+        cabac.encode_decision(CTX_INTRA_CHROMA_PRED_MODE + inc, mode != 0);
+        for (int k = 1; k <= std::min(mode, 2); k++)
+          cabac.encode_decision(CTX_INTRA_CHROMA_PRED_MODE + 3, k < mode);
+
+        // coded_block_pattern: prefix (one bin per 8x8 luma block), suffix (chroma, TU with cMax 2)
+        if (!mb.is_intra16x16) {
+          for (int b8 = 0; b8 < 4; b8++) {
+            // condTermFlagN: the neighbour 8x8 block is available and has no coefficient
+            int cond_A = (b8 % 2 == 0) ? (index_A != -1 && !((info[index_A].cbp_luma >> (b8 + 1)) & 1))
+                                       : !((cur.cbp_luma >> (b8 - 1)) & 1);
+            int cond_B = (b8 < 2) ? (index_B != -1 && !((info[index_B].cbp_luma >> (b8 + 2)) & 1))
+                                  : !((cur.cbp_luma >> (b8 - 2)) & 1);
+            cabac.encode_decision(CTX_CBP_LUMA + cond_A + 2 * cond_B, (cur.cbp_luma >> b8) & 1);
+          }
+
+          inc = (index_A != -1 && info[index_A].cbp_chroma != 0) + 2 * (index_B != -1 && info[index_B].cbp_chroma != 0);
+          cabac.encode_decision(CTX_CBP_CHROMA + inc, cur.cbp_chroma != 0);
+          if (cur.cbp_chroma != 0) {
+            inc = (index_A != -1 && info[index_A].cbp_chroma == 2) + 2 * (index_B != -1 && info[index_B].cbp_chroma == 2);
+            cabac.encode_decision(CTX_CBP_CHROMA + 4 + inc, cur.cbp_chroma == 2);
+          }
+        }
+
+        // mb_qp_delta is always 0 (constant QP), so is the one of the previous MB
+        if (cur.cbp_luma || cur.cbp_chroma || mb.is_intra16x16) {
+          cabac.encode_decision(CTX_MB_QP_DELTA, 0);
+          cabac_residual(cabac, mb, frame, info);
+        }
+      }
+
+      // end_of_slice_flag, the last one also writes rbsp_stop_one_bit and the alignment bits
+      cabac.encode_terminate(i == last_mb - 1);
+      if (i == last_mb - 1)
+        cabac.flush();
+
+      mb.cabac_bits = cabac.bits_written() - start_bits;
+    }
+
+    frame.cabac_slice_offsets.push_back(bytes.size());
+    first_mb = last_mb;
+  }
+}
@@ -152,7 +152,7 @@ inline void forward_qdct4x4(Block4x4 block, const int QP){
   // Copy into 4x4 matrix
   for (int y = 0; y < 4; y++) {
     for (int x = 0; x < 4; x++)
-      mat_x[y][x] = block[y*4+x];
+      mat_x[y][x] = block(y, x);
   }
 
   // Apply 4x4 core transform
@@ -164,7 +164,7 @@ inline void forward_qdct4x4(Block4x4 block, const int QP){
   // Write back from 4x4 matrix
   for (int y = 0; y < 4; y++) {
     for (int x = 0; x < 4; x++)
-      block[y*4+x] = mat_x[y][x];
+      block(y, x) = mat_x[y][x];
   }
 }
 
@@ -276,20 +276,20 @@ void forward_hadamard2x2(const int mat_x[][2], int mat_z[][2]) {
 // QDCT -> Quantized Discrete Cosine Transform
 
 // Performs 16x16 Luma QDCT 
-void qdct_luma16x16_intra(Block16x16& block){
-  forward_qdct(block, 16, LUMA_QP);
+void qdct_luma16x16_intra(Block16x16& block, const int QP){
+  forward_qdct(block, 16, QP);
 }
 
 
 // Performs 8x8 Chroma QDCT
-void qdct_chroma8x8_intra(Block8x8& block){
-  forward_qdct(block, 8, CHROMA_QP);
+void qdct_chroma8x8_intra(Block8x8& block, const int QP){
+  forward_qdct(block, 8, QP);
 }
 
 
 // Performs 4x4 Luma QDCT -> não passa o bloco por referência?
-void qdct_luma4x4_intra(Block4x4 block){
-  forward_qdct4x4(block, LUMA_QP);
+void qdct_luma4x4_intra(Block4x4 block, const int QP){
+  forward_qdct4x4(block, QP);
 }
 
 
@@ -301,6 +301,9 @@ void qdct_luma4x4_intra(Block4x4 block){
  *   (0, 0),(2, 0),(0, 2),(2, 2): mf = mat_MF[QP % 6][0]
  *   (1, 1),(3, 1),(1, 3),(3, 3): mf = mat_MF[QP % 6][1]
  *   other positions:             mf = mat_MF[QP % 6][2]
+ *
+ * The products are 64 bit: above 8 bits the coefficients (up to 2^(bit depth + 9) for the
+ * 16x16 DC) times mf overflow an int.
  */
 void forward_quantize4x4(const int mat_x[][4], int mat_z[][4], const int QP){
   int qbits = 15 + floor(QP / 6);
@@ -315,7 +318,7 @@ void forward_quantize4x4(const int mat_x[][4], int mat_z[][4], const int QP){
       else
         k = 2;
 
-      mat_z[i][j] = (abs(mat_x[i][j]) * mat_MF[QP % 6][k] + f) >> qbits;
+      mat_z[i][j] = (std::abs(static_cast<std::int64_t>(mat_x[i][j])) * mat_MF[QP % 6][k] + f) >> qbits;
       if (mat_x[i][j] < 0)
         mat_z[i][j] = -mat_z[i][j];
     }
@@ -329,7 +332,7 @@ void forward_DC_quantize4x4(const int mat_x[][4], int mat_z[][4], const int QP){
   int f = (int)(pow(2.0, qbits) / 3.0);
   for (int i = 0; i < 4; i++) {
     for (int j = 0; j < 4; j++) {
-      mat_z[i][j] = (abs(mat_x[i][j]) * mat_MF[QP % 6][0] + 2 * f) >> (qbits + 1);
+      mat_z[i][j] = (std::abs(static_cast<std::int64_t>(mat_x[i][j])) * mat_MF[QP % 6][0] + 2 * f) >> (qbits + 1);
       if (mat_x[i][j] < 0)
         mat_z[i][j] = -mat_z[i][j];
     }
@@ -342,9 +345,255 @@ void forward_quantize2x2(const int mat_x[][2], int mat_z[][2], const int QP) {
   int f = (int)(pow(2.0, qbits) / 3.0);
   for (int i = 0; i < 2; i++) {
     for (int j = 0; j < 2; j++) {
-      mat_z[i][j] = (abs(mat_x[i][j]) * mat_MF[QP % 6][0] + 2 * f) >> (qbits + 1);
+      mat_z[i][j] = (std::abs(static_cast<std::int64_t>(mat_x[i][j])) * mat_MF[QP % 6][0] + 2 * f) >> (qbits + 1);
       if (mat_x[i][j] < 0)
         mat_z[i][j] = -mat_z[i][j];
     }
   }
-}
\ No newline at end of file
+}
+
+/////////////////////////// INVERSE TRANSFORM FUNCTIONS ///////////////////////////////////////
+
+
+/* Inverse of forward_qdct (for 16x16 and 8x8 blocks)
+ *
+ * Rescales the DC coefficients (4x4 or 2x2 Hadamard) and the AC coefficients of each 4x4 block,
+ * then applies the inverse core transform. The block holds the residual on return.
+*/
+template <typename T>
+inline void inverse_qdct(T& block, const int BLOCK_SIZE, const int QP) {
+
+  int mat_x[4][4], mat_z[4][4];
+  int dc[4][4];
+
+  if (BLOCK_SIZE == 16) {
+    // Same DC positions as in forward_qdct
+    for (int i = 0; i < 4; i++) {
+      for (int j = 0; j < 4; j++) {
+        mat_x[i][j] = block[i*4*BLOCK_SIZE + j*4];
+      }
+    }
+
+    inverse_hadamard4x4(mat_x, mat_z);
+    inverse_DC_quantize4x4(mat_z, dc, QP);
+  }
+  else {
+    int mat8[2][2], mat_p[2][2];
+
+    for (int i = 0; i < 2; i++) {
+      for (int j = 0; j < 2; j++) {
+        mat8[i][j] = block[i*4*BLOCK_SIZE + j*4];
+      }
+    }
+
+    inverse_hadamard2x2(mat8, mat_p);
+    inverse_quantize2x2(mat_p, mat8, QP);
+
+    for (int i = 0; i < 2; i++) {
+      for (int j = 0; j < 2; j++)
+        dc[i][j] = mat8[i][j];
+    }
+  }
+
+  for (int i = 0; i < BLOCK_SIZE*BLOCK_SIZE; i += BLOCK_SIZE*4) {
+    for (int j = 0; j < BLOCK_SIZE; j += 4) {
+      for (int y = 0; y < 4; y++) {
+        for (int x = 0; x < 4; x++)
+          mat_x[y][x] = block[i+j+y*BLOCK_SIZE+x];
+      }
+
+      // Rescale AC coefficients, DC comes from the second stage transform
+      inverse_quantize4x4(mat_x, mat_z, QP);
+      mat_z[0][0] = dc[i / (BLOCK_SIZE*4)][j / 4];
+
+      inverse_dct4x4(mat_z, mat_x);
+
+      for (int y = 0; y < 4; y++) {
+        for (int x = 0; x < 4; x++)
+          block[i+j+y*BLOCK_SIZE+x] = mat_x[y][x];
+      }
+    }
+  }
+}
+
+
+/* Inverse of forward_qdct4x4
+ */
+inline void inverse_qdct4x4(Block4x4 block, const int QP) {
+
+  int mat_x[4][4], mat_z[4][4];
+
+  for (int y = 0; y < 4; y++) {
+    for (int x = 0; x < 4; x++)
+      mat_x[y][x] = block(y, x);
+  }
+
+  inverse_quantize4x4(mat_x, mat_z, QP);
+  inverse_dct4x4(mat_z, mat_x);
+
+  for (int y = 0; y < 4; y++) {
+    for (int x = 0; x < 4; x++)
+      block(y, x) = mat_x[y][x];
+  }
+}
+
+
+/* Inverse core transformation (4x4)
+ *
+ * given the rescaled coefficients: W, the residual: R, is
+ *   R = (Ci^T x W x Ci + 32) >> 6
+ */
+void inverse_dct4x4(const int mat_x[][4], int mat_z[][4]) {
+  int mat_temp[4][4];
+  int p0, p1, p2, p3, t0, t1, t2, t3;
+
+  // Horizontal
+  for (int i = 0; i < 4; i++) {
+    p0 = mat_x[i][0];
+    p1 = mat_x[i][1];
+    p2 = mat_x[i][2];
+    p3 = mat_x[i][3];
+
+    t0 = p0 + p2;
+    t1 = p0 - p2;
+    t2 = (p1 >> 1) - p3;
+    t3 = p1 + (p3 >> 1);
+
+    mat_temp[i][0] = t0 + t3;
+    mat_temp[i][1] = t1 + t2;
+    mat_temp[i][2] = t1 - t2;
+    mat_temp[i][3] = t0 - t3;
+  }
+
+  // Vertical
+  for (int i = 0; i < 4; i++) {
+    p0 = mat_temp[0][i];
+    p1 = mat_temp[1][i];
+    p2 = mat_temp[2][i];
+    p3 = mat_temp[3][i];
+
+    t0 = p0 + p2;
+    t1 = p0 - p2;
+    t2 = (p1 >> 1) - p3;
+    t3 = p1 + (p3 >> 1);
+
+    mat_z[0][i] = (t0 + t3 + 32) >> 6;
+    mat_z[1][i] = (t1 + t2 + 32) >> 6;
+    mat_z[2][i] = (t1 - t2 + 32) >> 6;
+    mat_z[3][i] = (t0 - t3 + 32) >> 6;
+  }
+}
+
+// Inverse Hadamard transformation on 4x4 block (no normalization, see inverse_DC_quantize4x4)
+void inverse_hadamard4x4(const int mat_x[][4], int mat_z[][4]) {
+  int mat_temp[4][4];
+  int p0, p1, p2, p3, t0, t1, t2, t3;
+
+  // Horizontal
+  for (int i = 0; i < 4; i++) {
+    p0 = mat_x[i][0];
+    p1 = mat_x[i][1];
+    p2 = mat_x[i][2];
+    p3 = mat_x[i][3];
+
+    t0 = p0 + p3;
+    t1 = p1 + p2;
+    t2 = p1 - p2;
+    t3 = p0 - p3;
+
+    mat_temp[i][0] = t0 + t1;
+    mat_temp[i][1] = t3 + t2;
+    mat_temp[i][2] = t0 - t1;
+    mat_temp[i][3] = t3 - t2;
+  }
+
+  // Vertical
+  for (int i = 0; i < 4; i++) {
+    p0 = mat_temp[0][i];
+    p1 = mat_temp[1][i];
+    p2 = mat_temp[2][i];
+    p3 = mat_temp[3][i];
+
+    t0 = p0 + p3;
+    t1 = p1 + p2;
+    t2 = p1 - p2;
+    t3 = p0 - p3;
+
+    mat_z[0][i] = t0 + t1;
+    mat_z[1][i] = t3 + t2;
+    mat_z[2][i] = t0 - t1;
+    mat_z[3][i] = t3 - t2;
+  }
+}
+
+// Inverse Hadamard transformation on 2x2 block (the 2x2 Hadamard is its own inverse)
+void inverse_hadamard2x2(const int mat_x[][2], int mat_z[][2]) {
+  forward_hadamard2x2(mat_x, mat_z);
+}
+
+
+// IQDCT -> Inverse Quantized Discrete Cosine Transform
+
+// Performs 16x16 Luma IQDCT
+void iqdct_luma16x16_intra(Block16x16& block, const int QP) {
+  inverse_qdct(block, 16, QP);
+}
+
+// Performs 8x8 Chroma IQDCT
+void iqdct_chroma8x8_intra(Block8x8& block, const int QP) {
+  inverse_qdct(block, 8, QP);
+}
+
+// Performs 4x4 Luma IQDCT
+void iqdct_luma4x4_intra(Block4x4 block, const int QP) {
+  inverse_qdct4x4(block, QP);
+}
+
+
+//////////////////////////////// DEQUANTIZATION FUNCTIONS ////////////////////////////////
+
+/* Rescaling (flat scaling matrices)
+ *
+ * By formula:
+ *   (0, 0),(2, 0),(0, 2),(2, 2): v = mat_V[QP % 6][0]
+ *   (1, 1),(3, 1),(1, 3),(3, 3): v = mat_V[QP % 6][1]
+ *   other positions:             v = mat_V[QP % 6][2]
+ */
+void inverse_quantize4x4(const int mat_x[][4], int mat_z[][4], const int QP) {
+  int qbits = QP / 6;
+  int k;
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 4; j++) {
+      if ((i == 0 || i == 2) && (j == 0 || j == 2))
+        k = 0;
+      else if ((i == 1 || i == 3) && (j == 1 || j == 3))
+        k = 1;
+      else
+        k = 2;
+
+      mat_z[i][j] = (mat_x[i][j] * mat_V[QP % 6][k]) << qbits;
+    }
+  }
+}
+
+// DC 4x4 Rescaling (Intra 16x16 luma DC), applied after the inverse Hadamard
+void inverse_DC_quantize4x4(const int mat_x[][4], int mat_z[][4], const int QP) {
+  int scale = 16 * mat_V[QP % 6][0];
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 4; j++) {
+      if (QP >= 36)
+        mat_z[i][j] = (mat_x[i][j] * scale) << (QP / 6 - 6);
+      else
+        mat_z[i][j] = (mat_x[i][j] * scale + (1 << (5 - QP / 6))) >> (6 - QP / 6);
+    }
+  }
+}
+
+// 2x2 Rescaling (Chroma DC), applied after the inverse Hadamard
+void inverse_quantize2x2(const int mat_x[][2], int mat_z[][2], const int QP) {
+  int scale = 16 * mat_V[QP % 6][0];
+  for (int i = 0; i < 2; i++) {
+    for (int j = 0; j < 2; j++)
+      mat_z[i][j] = ((mat_x[i][j] * scale) << (QP / 6)) >> 5;
+  }
+}
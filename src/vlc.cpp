@@ -18,6 +18,57 @@ const int suffix_len_thld[6] = {
   0, 3, 6, 12, 24, 48
 };
 
+namespace {
+
+// Bits of a bitset as '0' / '1' characters, in the frame arena
+template <std::size_t N>
+ArenaString to_arena_string(const std::bitset<N>& bits) {
+  return bits.template to_string<char, std::char_traits<char>, ArenaAllocator<char>>();
+}
+
+// Appends a code word of the tables below (built once, on the heap) to a string of the frame arena
+void append_code(ArenaString& str, const std::string& code) {
+  str.append(code.data(), code.size());
+}
+
+/* Appends level_prefix and level_suffix of a levelCode (standard page 218 2.-6.), computed directly:
+ * the levels of the lossless residuals are large. The escape (prefix >= 15) has a suffix of
+ * prefix - 3 bits, prefixes above 15 extend it by 4096 - (1 << (prefix - 3)).
+ */
+void append_level_code(ArenaString& str, const int level_code, const int suffix_len) {
+  int level_prefix, level_suffix_len, level_suffix;
+  if (suffix_len == 0 && level_code < 14) {
+    level_prefix = level_code;
+    level_suffix_len = 0;
+    level_suffix = 0;
+  }
+  else if (suffix_len == 0 && level_code < 30) {
+    level_prefix = 14;
+    level_suffix_len = 4;
+    level_suffix = level_code - 14;
+  }
+  else if (suffix_len > 0 && level_code < (15 << suffix_len)) {
+    level_prefix = level_code >> suffix_len;
+    level_suffix_len = suffix_len;
+    level_suffix = level_code & ((1 << suffix_len) - 1);
+  }
+  else {
+    int escape = level_code - (15 << suffix_len) - (suffix_len == 0 ? 15 : 0) + 4096;
+    level_prefix = 15;
+    while (escape >= (1 << (level_prefix - 2)))
+      level_prefix++;
+    level_suffix_len = level_prefix - 3;
+    level_suffix = escape - (1 << level_suffix_len);
+  }
+
+  str.append(level_prefix, '0');
+  str += '1';
+  for (int bit = level_suffix_len - 1; bit >= 0; bit--)
+    str += ((level_suffix >> bit) & 1) ? '1' : '0';
+}
+
+}   // namespace
+
 /* Num-VLC table
  *
  * look-up table for "coeff_token" encoding
@@ -204,21 +255,20 @@ level_VLC_encoder level_VLC_table[7] = {level_VLC_0, level_VLC_1, level_VLC_2,
 /*
   1, 01, 001, 0001, 00001, ...  
 */                                      
-std::string level_VLC_0(int level_code)
+ArenaString level_VLC_0(int level_code)
 {
-  std::string VLC_str = "";
+  ArenaString VLC_str = "";
 
   int num_zeros = (level_code > 0) ? (level_code-1) << 1 : ((0-level_code) << 1) - 1;
-  std::bitset<1024> zeros;
-  VLC_str = zeros.to_string().substr(1024-num_zeros-1, num_zeros) + "1";
+  VLC_str = ArenaString(num_zeros, '0') + "1";
 
   return VLC_str;
 }
 
-std::string level_VLC_1(int level_code)
+ArenaString level_VLC_1(int level_code)
 {
-  std::string VLC_str = "";
-  std::string suffix = "";
+  ArenaString VLC_str = "";
+  ArenaString suffix = "";
 
   if(level_code < 0)  // negative level
   {
@@ -229,128 +279,122 @@ std::string level_VLC_1(int level_code)
     suffix = "10";
 
   int num_zeros = level_code - 1;
-  std::bitset<1024> zeros;
-  VLC_str = zeros.to_string().substr(1024-num_zeros-1, num_zeros) + suffix;
+  VLC_str = ArenaString(num_zeros, '0') + suffix;
 
   return VLC_str;
 }
 
-std::string level_VLC_2(int level_code)
+ArenaString level_VLC_2(int level_code)
 {
-  std::string VLC_str = "";
-  std::string suffix = "";
+  ArenaString VLC_str = "";
+  ArenaString suffix = "";
 
   if(level_code < 0)  // negative level
   {
     level_code = 0 - level_code;
     std::bitset<2> var_suffix((level_code << 1) - 1); // selects only the 2 LSb
-    suffix = "1" + var_suffix.to_string();
+    suffix = "1" + to_arena_string(var_suffix);
   }
   else                // positive level
   {
     std::bitset<2> var_suffix((level_code - 1) << 1); // selects only the 2 LSb
-    suffix = "1" + var_suffix.to_string();
+    suffix = "1" + to_arena_string(var_suffix);
   }
 
   int num_zeros = (level_code - 1) >> 1;  // (level_code-1)/2
-  std::bitset<512> zeros;
-  VLC_str = zeros.to_string().substr(512-num_zeros-1, num_zeros) + suffix;
+  VLC_str = ArenaString(num_zeros, '0') + suffix;
 
   return VLC_str;
 }
 
-std::string level_VLC_3(int level_code)
+ArenaString level_VLC_3(int level_code)
 {
-  std::string VLC_str = "";
-  std::string suffix = "";
+  ArenaString VLC_str = "";
+  ArenaString suffix = "";
 
   if(level_code < 0)  // negative level
   {
     level_code = 0 - level_code;
     std::bitset<3> var_suffix((level_code << 1) - 1); // selects only the 3 LSb
-    suffix = "1" + var_suffix.to_string();
+    suffix = "1" + to_arena_string(var_suffix);
   }
   else                // positive level
   {
     std::bitset<3> var_suffix((level_code - 1) << 1); // selects only the 3 LSb
-    suffix = "1" + var_suffix.to_string();
+    suffix = "1" + to_arena_string(var_suffix);
   }
 
   int num_zeros = (level_code - 1) >> 2;  // (level_code-1)/4
-  std::bitset<512> zeros;
-  VLC_str = zeros.to_string().substr(512-num_zeros-1, num_zeros) + suffix;
+  VLC_str = ArenaString(num_zeros, '0') + suffix;
 
   return VLC_str;
 }
 
-std::string level_VLC_4(int level_code)
+ArenaString level_VLC_4(int level_code)
 {
-  std::string VLC_str = "";
-  std::string suffix = "";
+  ArenaString VLC_str = "";
+  ArenaString suffix = "";
 
   if(level_code < 0)  // negative level
   {
     level_code = 0 - level_code;
     std::bitset<4> var_suffix((level_code << 1) - 1); // selects only the 4 LSb
-    suffix = "1" + var_suffix.to_string();
+    suffix = "1" + to_arena_string(var_suffix);
   }
   else                // positive level
   {
     std::bitset<4> var_suffix((level_code - 1) << 1); // selects only the 4 LSb
-    suffix = "1" + var_suffix.to_string();
+    suffix = "1" + to_arena_string(var_suffix);
   }
 
   int num_zeros = (level_code - 1) >> 3;  // (level_code-1)/8
-  std::bitset<512> zeros;
-  VLC_str = zeros.to_string().substr(512-num_zeros-1, num_zeros) + suffix;
+  VLC_str = ArenaString(num_zeros, '0') + suffix;
 
   return VLC_str;
 }
 
-std::string level_VLC_5(int level_code)
+ArenaString level_VLC_5(int level_code)
 {
-  std::string VLC_str = "";
-  std::string suffix = "";
+  ArenaString VLC_str = "";
+  ArenaString suffix = "";
 
   if(level_code < 0)  // negative level
   {
     level_code = 0 - level_code;
     std::bitset<5> var_suffix((level_code << 1) - 1); // selects only the 5 LSb
-    suffix = "1" + var_suffix.to_string();
+    suffix = "1" + to_arena_string(var_suffix);
   }
   else                // positive level
   {
     std::bitset<5> var_suffix((level_code - 1) << 1); // selects only the 5 LSb
-    suffix = "1" + var_suffix.to_string();
+    suffix = "1" + to_arena_string(var_suffix);
   }
 
   int num_zeros = (level_code - 1) >> 4;  // (level_code-1)/16
-  std::bitset<512> zeros;
-  VLC_str = zeros.to_string().substr(512-num_zeros-1, num_zeros) + suffix;
+  VLC_str = ArenaString(num_zeros, '0') + suffix;
 
   return VLC_str;
 }
 
-std::string level_VLC_6(int level_code)
+ArenaString level_VLC_6(int level_code)
 {
-  std::string VLC_str = "";
-  std::string suffix = "";
+  ArenaString VLC_str = "";
+  ArenaString suffix = "";
 
   if(level_code < 0)  // negative level
   {
     level_code = 0 - level_code;
     std::bitset<6> var_suffix((level_code << 1) - 1); // selects only the 6 LSb
-    suffix = "1" + var_suffix.to_string();
+    suffix = "1" + to_arena_string(var_suffix);
   }
   else                // positive level
   {
     std::bitset<6> var_suffix((level_code - 1) << 1); // selects only the 6 LSb
-    suffix = "1" + var_suffix.to_string();
+    suffix = "1" + to_arena_string(var_suffix);
   }
 
   int num_zeros = (level_code - 1) >> 5;  // (level_code-1)/32
-  std::bitset<512> zeros;
-  VLC_str = zeros.to_string().substr(512-num_zeros-1, num_zeros) + suffix;
+  VLC_str = ArenaString(num_zeros, '0') + suffix;
 
   return VLC_str;
 }
@@ -367,9 +411,14 @@ Bitstream uegc(const unsigned int codenum) {
     leading_zeros = static_cast<int> (log2(x));   // N of bits of X, minus 1
     nb_bits = (leading_zeros << 1) + 1;   // codeword size 
 
-    std::string codeword = std::bitset<64>(x).to_string();
-    codeword = codeword.substr(64-nb_bits, nb_bits);
-    return Bitstream(codeword);
+    // codeword: x on nb_bits bits (leading_zeros zeros, then x), written MSb first
+    Bitstream codeword;
+    codeword.nb_bits = nb_bits;
+    codeword.buffer.reserve((nb_bits + 7) / 8);
+    std::uint64_t word = static_cast<std::uint64_t>(x) << (64 - nb_bits);
+    for (int i = 0; i < nb_bits; i += 8)
+      codeword.buffer.push_back(static_cast<std::uint8_t>(word >> (56 - i)));
+    return codeword;
 }
 
 /**
@@ -384,13 +433,15 @@ Bitstream segc(const int codenum) {
 }
 
 /**
- * @brief   Scans a zigzag ordered 4x4 block
+ * @brief   Scans a zigzag ordered 4x4 block (coefficients or DC coefficients of a MB)
  * 
  * @return  Sequentially ordered 4x4 block as an int array
  */
-void scan_zigzag(Block4x4 block, int tblock[]) {
-    for (int i = 0; i < 16; i++)
-        tblock[mat_zigzag4x4[i]] = block[i];
+template <int STEP>
+void scan_zigzag(BlockView<4, 4, int, STEP> block, int tblock[]) {
+  for (int y = 0; y < 4; y++)
+    for (int x = 0; x < 4; x++)
+      tblock[mat_zigzag4x4[y * 4 + x]] = block(y, x);
 }
 
 /**
@@ -408,15 +459,13 @@ void scan_zigzag(Block2x2 block, int tblock[]) {
 /**
  * @brief       Performs 4x4 CAVLC encoding
  * 
- * @param block Transform coefficients 4x4 input block
+ * @param mat_x Transform coefficients of the 4x4 block, in scan order
  * @param nC    Number of non-zero coefficients in neighbouring blocks
  * @param maxNumCoeff Related with whether the DC transform was performed or not
  * 
  * @return  Bitstream object initialized with the final string, and total number of non-zero coeffs
  */
-std::pair<Bitstream, int> cavlc_block4x4(Block4x4 block, const int nC, const int maxNumCoeff) {
-  int mat_x[16];  // input coefficients block
-  scan_zigzag(block, mat_x);
+static std::pair<Bitstream, int> cavlc_scanned4x4(const int mat_x[], const int nC, const int maxNumCoeff) {
 
   int total_coeff = 0;    // total number of non-zero coefficients
   int total_zeros = 0;    // sum of all zeros preceding the highest non-zero coeff
@@ -456,7 +505,7 @@ std::pair<Bitstream, int> cavlc_block4x4(Block4x4 block, const int nC, const int
       total_zeros--;
 
   // (#2) Count trailing ones, store up to 3
-  std::string ones_str;
+  ArenaString ones_str;
   int resume_idx = highest_idx;
   for (int i = highest_idx; i >= 0; i--) {  // start from the highest frequency coeff
     if (mat_x[i] != 0) 
@@ -485,7 +534,7 @@ std::pair<Bitstream, int> cavlc_block4x4(Block4x4 block, const int nC, const int
   }
 
   // (#3) Level encoding (Remaining coeffs after trailing ones in reverse order)
-  std::string level_vlc_str = "";
+  ArenaString level_vlc_str = "";
   int lastCoeff = total_coeff - trail_ones;
   if (lastCoeff > 0)  // if there are more coeffs to encode...
   {
@@ -500,7 +549,6 @@ std::pair<Bitstream, int> cavlc_block4x4(Block4x4 block, const int nC, const int
     {
       if (mat_x[i] != 0) // coeff is non-zero
       {
-        lastCoeff--;
         int level_code = mat_x[i];
 
         /*
@@ -534,74 +582,19 @@ std::pair<Bitstream, int> cavlc_block4x4(Block4x4 block, const int nC, const int
         else
             level_code = 0 - (level_code + 1);
 
-        // Initialize level prefix
-        int level_prefix = 0;
-        std::string level_prefix_str = "";
-        bool solution_found = false;
+        append_level_code(level_vlc_str, level_code, suffix_len);
 
-        while (!solution_found)
-        {
-            int level_suffix_len = 0;
-            if (level_prefix == 14 && suffix_len == 0)  // Standard page 218 2.
-                level_suffix_len = 4;
-            else 
-            {
-                if (level_prefix >= 15)
-                level_suffix_len = level_prefix - 3;    // Standard page 218 2.
-                else
-                level_suffix_len = suffix_len;          // Standard page 218 2.
-            }
-
-            if (level_prefix >= 16)
-                level_code -= (1 << (level_prefix - 3)) - 4096;     // Standard page 218 6.
-
-            if (level_prefix >= 15 && suffix_len == 0)
-                level_code -= 15;                       // Standard page 218 5.
-
-            // int level_code_prefix = std::min(15, level_prefix) * pow(2.0, suffix_len);
-            int level_code_prefix = std::min(15, level_prefix) << suffix_len;   // Standard page 218 4.
-            int level_suffix = level_code - level_code_prefix;
-            int level_max = pow(2.0, level_suffix_len) - 1;
-
-            if (level_suffix <= level_max) 
-            {
-                solution_found = true;
-                level_vlc_str += level_prefix_str + "1";
-                if (level_suffix_len != 0)      // Standard page 218 3.
-                {
-                    std::string encoded_str;
-                    if (level_suffix != 0)
-                    {
-                        std::bitset<64> bits(level_suffix);
-                        encoded_str = bits.to_string();
-                        int first_one_pos = encoded_str.find_first_of("1");
-                        encoded_str = encoded_str.substr(first_one_pos, 64 - first_one_pos);
-                    }
-                    else
-                        encoded_str = "0";
-                    while (encoded_str.length() < (unsigned int)level_suffix_len)   // Standard page 218 3. (uint)
-                        encoded_str = "0" + encoded_str;
-                    level_vlc_str += encoded_str;
-                }
-
-                // Standard page 218 10.
-                if (std::abs(mat_x[i]) > (3 << (suffix_len - 1)) && suffix_len < 6)
-                suffix_len++;
-                if (lastCoeff == total_coeff - 1 - trail_ones && std::abs(mat_x[i]) > 3)
-                suffix_len = 2;
-            }
-            else 
-            {
-                level_prefix++;
-                level_prefix_str += "0";
-            }
-        }
+        // Standard page 218 10.
+        if (suffix_len == 0)
+          suffix_len = 1;
+        if (std::abs(mat_x[i]) > (3 << (suffix_len - 1)) && suffix_len < 6)
+          suffix_len++;
       }
     }
   }
 
   // (#4) Calculate run-before
-  std::string run_vlc_str = "";
+  ArenaString run_vlc_str = "";
   int last_zeros = total_zeros; // zeros left in the block
   // int coeff_cnt = total_coeff - 1;
 
@@ -624,15 +617,11 @@ std::pair<Bitstream, int> cavlc_block4x4(Block4x4 block, const int nC, const int
 
       if(j != -1)   // all iterations except the last coeff (does not need coding)
       {
-        std::string run_str = "";
-        if (last_zeros <= 6)
-          run_str = run_vlc_table[zero_cnt][last_zeros];
-        else
-          run_str = run_vlc_table[zero_cnt][7];
+        const std::string& run_str = (last_zeros <= 6) ? run_vlc_table[zero_cnt][last_zeros] : run_vlc_table[zero_cnt][7];
 
         last_zeros -= zero_cnt;
         // coeff_cnt--;
-        run_vlc_str += run_str;
+        append_code(run_vlc_str, run_str);
       }
     }
 
@@ -642,9 +631,12 @@ std::pair<Bitstream, int> cavlc_block4x4(Block4x4 block, const int nC, const int
   }
 
   // (#5) Final vlc string
-  std::string final_str = num_vlc_table[coeff_table_idx][total_coeff][trail_ones] + ones_str + level_vlc_str;
+  ArenaString final_str;
+  append_code(final_str, num_vlc_table[coeff_table_idx][total_coeff][trail_ones]);
+  final_str += ones_str;
+  final_str += level_vlc_str;
   if (total_coeff < maxNumCoeff)
-    final_str += zero_vlc_table[total_zeros][total_coeff];
+    append_code(final_str, zero_vlc_table[total_zeros][total_coeff]);
   final_str += run_vlc_str;
 
 
@@ -662,6 +654,20 @@ std::pair<Bitstream, int> cavlc_block4x4(Block4x4 block, const int nC, const int
 }
 
 
+std::pair<Bitstream, int> cavlc_block4x4(Block4x4 block, const int nC, const int maxNumCoeff, const bool skip_dc) {
+  int mat_x[16];  // input coefficients block
+  scan_zigzag(block, mat_x);
+  if (skip_dc)    // coded separately (Intra16x16 and chroma AC blocks)
+    mat_x[0] = 0;
+  return cavlc_scanned4x4(mat_x, nC, maxNumCoeff);
+}
+
+std::pair<Bitstream, int> cavlc_block4x4(DCBlock4x4 block, const int nC, const int maxNumCoeff) {
+  int mat_x[16];
+  scan_zigzag(block, mat_x);
+  return cavlc_scanned4x4(mat_x, nC, maxNumCoeff);
+}
+
 /**
  * @brief       Performs 2x2 CAVLC encoding
  * 
@@ -714,7 +720,7 @@ std::pair<Bitstream, int> cavlc_block2x2(Block2x2 block, const int nC, const int
   total_zeros = highest_idx - total_coeff + 1;
 
   // (#2) Count trailing ones, store up to 3
-  std::string ones_str;
+  ArenaString ones_str;
   int resume_idx = highest_idx;
   for (int i = highest_idx; i >= 0; i--) {
     if (mat_x[i] != 0) {
@@ -739,7 +745,7 @@ std::pair<Bitstream, int> cavlc_block2x2(Block2x2 block, const int nC, const int
   }
  
   // Level encoding
-  std::string level_vlc_str = "";
+  ArenaString level_vlc_str = "";
   int lastCoeff = total_coeff - trail_ones;
   if (lastCoeff > 0) 
   {
@@ -750,7 +756,6 @@ std::pair<Bitstream, int> cavlc_block2x2(Block2x2 block, const int nC, const int
     {
       if (mat_x[i] != 0) 
       {
-        lastCoeff--;
         int level_code = mat_x[i];
 
         if (pad_this) {
@@ -778,66 +783,18 @@ std::pair<Bitstream, int> cavlc_block2x2(Block2x2 block, const int nC, const int
         else
           level_code = 0 - (level_code + 1);
 
-        int level_prefix = 0;
-        std::string level_prefix_str = "";
-        bool solution_found = false;
-
-        while (!solution_found) {
-          int level_suffix_len = 0;
-          if (level_prefix == 14 && suffix_len == 0)
-            level_suffix_len = 4;
-          else {
-            if (level_prefix >= 15)
-              level_suffix_len = level_prefix - 3;
-            else
-              level_suffix_len = suffix_len;
-          }
-
-          if (level_prefix >= 16)
-            level_code -= (1 << (level_prefix - 3)) - 4096;
-
-          if (level_prefix >= 15 && suffix_len == 0)
-            level_code -= 15;
-
-          // int level_code_prefix = std::min(15, level_prefix) * pow(2.0, suffix_len);
-          int level_code_prefix = std::min(15, level_prefix) << suffix_len;
-          int level_suffix = level_code - level_code_prefix;
-          int level_max = pow(2.0, level_suffix_len) - 1;
-
-          if (level_suffix <= level_max) {
-            solution_found = true;
-            level_vlc_str += level_prefix_str + "1";
-            if (level_suffix_len != 0) {
-              std::string encoded_str;
-              if (level_suffix != 0) {
-                std::bitset<64> bits(level_suffix);
-                encoded_str = bits.to_string();
-                int first_one_pos = encoded_str.find_first_of("1");
-                encoded_str = encoded_str.substr(first_one_pos, 64 - first_one_pos);
-              }
-              else
-                encoded_str = "0";
-              while (encoded_str.length() < (unsigned int)level_suffix_len)
-                encoded_str = "0" + encoded_str;
-              level_vlc_str += encoded_str;
-            }
-
-            if (std::abs(mat_x[i]) > (3 << (suffix_len - 1)) && suffix_len < 6)
-              suffix_len++;
-            if (lastCoeff == total_coeff - 1 - trail_ones && std::abs(mat_x[i]) > 3)
-              suffix_len = 2;
-          }
-          else {
-            level_prefix++;
-            level_prefix_str += "0";
-          }
-        }
+        append_level_code(level_vlc_str, level_code, suffix_len);
+
+        if (suffix_len == 0)
+          suffix_len = 1;
+        if (std::abs(mat_x[i]) > (3 << (suffix_len - 1)) && suffix_len < 6)
+          suffix_len++;
       }
     }
   }
 
   // Calculate run-before
-  std::string run_vlc_str = "";
+  ArenaString run_vlc_str = "";
   int last_zeros = total_zeros;
   // int coeff_cnt = total_coeff - 1;
 
@@ -856,14 +813,10 @@ std::pair<Bitstream, int> cavlc_block2x2(Block2x2 block, const int nC, const int
       }
 
       if (j != -1) {
-        std::string run_str = "";
-        if (last_zeros <= 6)
-          run_str = run_vlc_table[zero_cnt][last_zeros];
-        else
-          run_str = run_vlc_table[zero_cnt][7];
+        const std::string& run_str = (last_zeros <= 6) ? run_vlc_table[zero_cnt][last_zeros] : run_vlc_table[zero_cnt][7];
         last_zeros -= zero_cnt;
         // coeff_cnt--;
-        run_vlc_str += run_str;
+        append_code(run_vlc_str, run_str);
       }
     }
 
@@ -872,9 +825,12 @@ std::pair<Bitstream, int> cavlc_block2x2(Block2x2 block, const int nC, const int
   }
 
   // (#5) Final vlc string
-  std::string final_str = num_vlc_table[coeff_table_idx][total_coeff][trail_ones] + ones_str + level_vlc_str;
+  ArenaString final_str;
+  append_code(final_str, num_vlc_table[coeff_table_idx][total_coeff][trail_ones]);
+  final_str += ones_str;
+  final_str += level_vlc_str;
   if (total_coeff < maxNumCoeff)
-    final_str += zero_vlc_table2x2[total_zeros][total_coeff];
+    append_code(final_str, zero_vlc_table2x2[total_zeros][total_coeff]);
   final_str += run_vlc_str;
 
   // if (total_coeff > 0) {